@@ -119,7 +119,8 @@ void DHCPClientController::option_internal(struct option_cache *oc,
 	   oc->option->code == DHCPV6_IA_ADDRESS ||
 	   oc->option->code == DHCPV6_AUTHENTICATION ||
 	   oc->option->code == DHCPV6_VENDOR_SPECIFIC_INFORMATION ||
-	   oc->option->code == DHCPV6_IA_PD))
+	   oc->option->code == DHCPV6_IA_PD ||
+	   oc->option->code == DHCPV6_IA_PREFIX))
 	return;
 
       if (option_name_clean(name, sizeof name, oc->option))
@@ -253,6 +254,8 @@ void DHCPClientController::send_ia_addr(const char *type,
 
   add_item("valid", "%ld", (unsigned long)address->valid);
   add_item("preferred", "%ld", (unsigned long)address->preferred);
+  if (address->prefixlen)
+    add_item("prefix-length", "%u", address->prefixlen);
 	
   /* Now emit the options attached to this address, if it's
    * valid.
@@ -109,8 +109,39 @@ struct option_state *new_option_state()
   return nv;
 }
 
+/* Make an empty option_state whose lookups fall through to parent. */
+struct option_state *new_layered_option_state(struct option_state *parent)
+{
+  struct option_state *nv = new_option_state();
+
+  nv->parent = parent;
+  nv->site_option_space = parent->site_option_space;
+  nv->site_code_min = parent->site_code_min;
+  return nv;
+}
+
+/* Free an option state and the options in it.   Nothing counts the
+ * references to an option cache, so this is only for a state whose
+ * options nobody else points to, like the one parse_options() makes for
+ * a received packet.
+ */
+void option_state_dereference(struct option_state **ptr)
+{
+  struct option_state *options = *ptr;
+  unsigned i;
+
+  if (!options)
+    return;
+  for (i = 0; i < options->option_space_count; i++)
+    if (option_spaces[i] && option_spaces[i]->option_state_dereference)
+      (*option_spaces[i]->option_state_dereference)(option_spaces[i],
+						    options);
+  free(options);
+  *ptr = 0;
+}
+
 struct option_cache *make_const_option_cache(struct buffer **buffer,
-					     u_int8_t *data,
+					     const u_int8_t *data,
 					     unsigned len,
 					     struct option *option)
 {
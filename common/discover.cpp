@@ -49,13 +49,27 @@ static char copyright[] __attribute__((unused)) =
 #include <ifaddrs.h>
 #endif
 
+typedef struct hash_table interface_hash_t;
+HASH_FUNCTIONS_DECL(interface, const u_int8_t *,
+		    struct interface_info, interface_hash_t)
+HASH_FUNCTIONS(interface, const u_int8_t *,
+	       struct interface_info, interface_hash_t)
+
 struct interface_info *interfaces, *dummy_interfaces, *fallback_interface;
-int interfaces_invalidated;
+int interfaces_invalidated = 1;	/* The indexes below need rebuilding. */
 int quiet_interface_discovery;
 u_int16_t local_port;
 u_int16_t remote_port;
 u_int16_t listen_port;
 int (*dhcp_interface_setup_hook) (struct interface_info *, struct iaddr *);
+
+/* Interfaces by IPv4 address and by circuit ID, so that a relay with
+ * thousands of interfaces doesn't have to look through all of them for
+ * every packet.   They're rebuilt the first time they're used after
+ * anything sets interfaces_invalidated.
+ */
+static interface_hash_t *interfaces_by_address;
+static interface_hash_t *interfaces_by_circuit_id;
 int (*dhcp_interface_discovery_hook) (struct interface_info *);
 isc_result_t (*dhcp_interface_startup_hook) (struct interface_info *);
 int (*dhcp_interface_shutdown_hook) (struct interface_info *);
@@ -256,6 +270,7 @@ void discover_interfaces()
     }
 
   freeifaddrs(ifaddrs);
+  interfaces_invalidated = 1;
 }
 
 void interface_snorf (struct interface_info *tmp)
@@ -266,6 +281,66 @@ void interface_snorf (struct interface_info *tmp)
   tmp->remote_id_len = 0;
   tmp->next = interfaces;
   interfaces = tmp;
+  interfaces_invalidated = 1;
+}
+
+/* Where an address or circuit ID belongs to more than one interface,
+ * the first one on the list gets it, as it would with a linear search.
+ */
+static void interface_indexes_rebuild()
+{
+  struct interface_info *ip, *tmp;
+  int i;
+
+  if (interfaces_by_address)
+    free_hash_table(&interfaces_by_address);
+  if (interfaces_by_circuit_id)
+    free_hash_table(&interfaces_by_circuit_id);
+  interface_new_hash(&interfaces_by_address, 0);
+  interface_new_hash(&interfaces_by_circuit_id, 0);
+
+  for (ip = interfaces; ip; ip = ip->next)
+    {
+      for (i = 0; i < ip->ipv4_addr_count; i++)
+	if (!interface_hash_lookup(&tmp, interfaces_by_address,
+				   (u_int8_t *)&ip->ipv4s[i], 4))
+	  interface_hash_add(interfaces_by_address,
+			     (u_int8_t *)&ip->ipv4s[i], 4, ip);
+      if (ip->circuit_id && ip->circuit_id_len &&
+	  !interface_hash_lookup(&tmp, interfaces_by_circuit_id,
+				 ip->circuit_id, ip->circuit_id_len))
+	interface_hash_add(interfaces_by_circuit_id,
+			   ip->circuit_id, ip->circuit_id_len, ip);
+    }
+  interfaces_invalidated = 0;
+}
+
+/* Find the interface with an IPv4 address. */
+struct interface_info *interface_find_address(struct in_addr addr)
+{
+  struct interface_info *ip;
+
+  if (interfaces_invalidated)
+    interface_indexes_rebuild();
+  if (!interface_hash_lookup(&ip, interfaces_by_address,
+			     (u_int8_t *)&addr, 4))
+    return 0;
+  return ip;
+}
+
+/* Find the interface with a relay agent circuit ID. */
+struct interface_info *interface_find_circuit_id(const u_int8_t *id,
+						 unsigned len)
+{
+  struct interface_info *ip;
+
+  if (!len)
+    return 0;
+  if (interfaces_invalidated)
+    interface_indexes_rebuild();
+  if (!interface_hash_lookup(&ip, interfaces_by_circuit_id, id, len))
+    return 0;
+  return ip;
 }
 
 /* Local Variables:  */
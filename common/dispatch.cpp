@@ -60,7 +60,11 @@ typedef struct io_object
 
 static io_object_t *io_objects;
 
-unsigned long long cur_time;
+/* Each thread keeps its own clock: the relay's worker threads read the
+ * time as they pick up packets, and mustn't move it under dispatch(),
+ * which works out how long to wait from cur_time.
+ */
+__thread unsigned long long cur_time;
 
 /* Advance the clock (this has historically been used in simulation, and
  * probably isn't used at all in the current code).
@@ -142,13 +146,16 @@ isc_result_t dispatch(void)
   struct timeval to;
   fd_set r, w, x;
 
-  FD_ZERO(&r);
-  FD_ZERO(&w);
-  FD_ZERO(&x);
-
   to.tv_sec = 60 * 60 * 24;
   to.tv_usec = 0;
+
+  /* We have no descriptors of our own, so the masks dispatch_select()
+   * hands back are cleared before they're passed in again.
+   */
   do {
+    FD_ZERO(&r);
+    FD_ZERO(&w);
+    FD_ZERO(&x);
     rv = dispatch_select(&r, &w, &x, 0, &to, 0);
   } while (rv == ISC_R_SUCCESS);
   return rv;
@@ -213,7 +220,7 @@ isc_result_t dispatch_select(fd_set *ord,
       }
 	
     to.tv_sec = SECONDS(when);
-    to.tv_usec = MICROSECONDS(when);
+    to.tv_usec = MICROSECONDS(when % NANO_SECONDS(1));
 
     /* It is possible for the timeout to get set larger than
      * the largest time select() is willing to accept.
@@ -276,6 +283,12 @@ isc_result_t dispatch_select(fd_set *ord,
     /* Get the current time... */
     fetch_time();
 
+    /* A signal arrived; whatever its handler wrote to a pipe will be
+     * there next time.
+     */
+    if (count < 0 && errno == EINTR)
+      goto again;
+
     /* We probably have a bad file descriptor.   Figure out which one.
      * When we find it, call the reaper function on it, which will
      * maybe make it go away, and then try again.
@@ -336,6 +349,7 @@ isc_result_t dispatch_select(fd_set *ord,
 		if (count < 0)
 		  goto bogon;
 	      }
+	    io = io->next;
 	  }
 
 	/* If we didn't get a bogon, it means that one of the descriptors
@@ -370,7 +384,7 @@ isc_result_t dispatch_select(fd_set *ord,
 	      status = (io->writer)(io->thunk);
 	    /* XXX what to do with status? */
 	    --count;
-	    FD_CLR(desc, &r);
+	    FD_CLR(desc, &w);
 	  }
       }
   } while (count > 0 && cur_time < expiry);
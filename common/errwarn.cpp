@@ -55,9 +55,10 @@ int log_syslog = 1;
 int log_priority;
 void (*log_cleanup) (void);
 
+/* Each thread formats its messages in its own buffers. */
 #define CVT_BUF_MAX 1023
-static char mbuf [CVT_BUF_MAX + 1];
-static char fbuf [CVT_BUF_MAX + 1];
+static __thread char mbuf [CVT_BUF_MAX + 1];
+static __thread char fbuf [CVT_BUF_MAX + 1];
 
 /* Log an error message, then exit... */
 
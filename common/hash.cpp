@@ -46,6 +46,7 @@ static char copyright[] __attribute__((unused)) =
 
 static int do_hash (const unsigned char *, unsigned, unsigned);
 static int do_case_hash (const unsigned char *, unsigned, unsigned);
+static int do_wide_hash (const unsigned char *, unsigned, unsigned);
 
 int new_hash_table (struct hash_table **tp, int count)
 {
@@ -62,6 +63,23 @@ int new_hash_table (struct hash_table **tp, int count)
   return 1;
 }
 
+/* Free a table and its buckets, but not the objects in it. */
+void free_hash_table (struct hash_table **tp)
+{
+  struct hash_table *table = *tp;
+  struct hash_bucket *bp, *next;
+  unsigned i;
+
+  for (i = 0; i < table->hash_count; i++)
+    for (bp = table->buckets[i]; bp; bp = next)
+      {
+	next = bp->next;
+	free_hash_bucket(bp);
+      }
+  free(table);
+  *tp = (struct hash_table *)0;
+}
+
 struct hash_bucket *free_hash_buckets;
 
 struct hash_bucket *new_hash_bucket()
@@ -110,6 +128,23 @@ int new_hash (struct hash_table **rp,
   return 1;
 }
 
+/* Make a table with a given number of buckets, for one that's going to
+ * hold far more names than DEFAULT_HASH_SIZE.   Names are compared
+ * exactly, and hashed with do_wide_hash(), since do_hash() never comes
+ * up with more than 65536 different values.
+ */
+int new_hash_sized (struct hash_table **rp, unsigned count)
+{
+  if (count < DEFAULT_HASH_SIZE)
+    count = DEFAULT_HASH_SIZE;
+  if (!new_hash_table (rp, count))
+    return 0;
+  memset (&(*rp)->buckets [0], 0, count * sizeof (struct hash_bucket *));
+  (*rp)->cmp = (hash_comparator_t)memcmp;
+  (*rp)->do_hash = do_wide_hash;
+  return 1;
+}
+
 static int do_case_hash (const unsigned char *name,
 			 unsigned len,
 			 unsigned size)
@@ -160,6 +195,21 @@ static int do_hash (const unsigned char *name,
   return accum % size;
 }
 
+/* FNV-1a, which spreads short names like hardware addresses over all
+ * 32 bits.
+ */
+static int do_wide_hash (const unsigned char *name,
+			 unsigned len,
+			 unsigned size)
+{
+  u_int32_t accum = 2166136261U;
+  unsigned i;
+
+  for (i = 0; i < len; i++)
+    accum = (accum ^ name [i]) * 16777619U;
+  return accum % size;
+}
+
 void add_hash (struct hash_table *table, 
 	       const unsigned char *name,
 	       unsigned len,
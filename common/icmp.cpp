@@ -78,6 +78,10 @@ void icmp_startup (int routep,
 		log_error ("Can't set close-on-exec on icmp: %m");
 #endif
 
+	/* Callers send probes from the dispatcher, which mustn't block. */
+	if (fcntl (icmp_state -> socket, F_SETFL, O_NONBLOCK) < 0)
+		log_error ("Can't make icmp socket non-blocking: %m");
+
 	/* Make sure it does routing... */
 	state = 0;
 	if (setsockopt (icmp_state -> socket, SOL_SOCKET, SO_DONTROUTE,
@@ -97,7 +101,10 @@ int icmp_readsocket(void *v)
 	return state->socket;
 }
 
-int icmp_echorequest(struct iaddr *addr)
+/* Send an echo request to addr.   The caller chooses the identifier and
+ * sequence number, so that it can match up the reply.
+ */
+int icmp_echorequest(struct iaddr *addr, u_int16_t id, u_int16_t seq)
 {
 	struct sockaddr_in to;
 	struct icmp icmp;
@@ -119,13 +126,8 @@ int icmp_echorequest(struct iaddr *addr)
 	icmp.icmp_type = ICMP_ECHO;
 	icmp.icmp_code = 0;
 	icmp.icmp_cksum = 0;
-	icmp.icmp_seq = 0;
-#ifdef PTRSIZE_64BIT
-	icmp.icmp_id = (((u_int32_t)(u_int64_t)addr) ^
-  			(u_int32_t)(((u_int64_t)addr) >> 32));
-#else
-	icmp.icmp_id = (u_int32_t)addr;
-#endif
+	icmp.icmp_id = htons (id);
+	icmp.icmp_seq = htons (seq);
 	memset (&icmp.icmp_dun, 0, sizeof icmp.icmp_dun);
 
 	icmp.icmp_cksum = wrapsum (checksum ((unsigned char *)&icmp,
@@ -180,12 +182,13 @@ isc_result_t icmp_echoreply (void *v)
 		return ISC_R_SUCCESS;
 	}
 
-	/* If we were given a second-stage handler, call it. */
+	/* If we were given a second-stage handler, call it with the
+	   ICMP message, not the IP header. */
 	if (state -> icmp_handler) {
 		memcpy (ia.iabuf, &from.sin_addr, sizeof from.sin_addr);
 		ia.len = sizeof from.sin_addr;
 
-		(*state -> icmp_handler) (ia, icbuf, len);
+		(*state -> icmp_handler) (ia, (u_int8_t *)icfrom, len);
 	}
 	return ISC_R_SUCCESS;
 }
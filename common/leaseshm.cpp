@@ -0,0 +1,525 @@
+/* leaseshm.cpp
+ *
+ * A table of the server's bindings in shared memory, which other programs
+ * can look up without the server knowing they're there.
+ */
+
+/* Copyright (c) 2009 Nominum, Inc.   All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Nominum nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NOMINUM AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL NOMINUM OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef lint
+static char ocopyright[] __attribute__((unused)) =
+  "$Id: leaseshm.cpp,v 1.1 2009/10/23 15:02:37 mellon Exp $ Copyright (c) 2009 Nominum, Inc.  All rights reserved.\n";
+#endif /* not lint */
+
+#include "dhcpd.h"
+#include <sys/mman.h>
+#include <sched.h>
+
+/* The server owns the table and is the only writer.   Each change is
+ * bracketed by incrementing the header's sequence number, so that it's
+ * odd while the change is being made.   A reader notes the sequence
+ * number, copies out what it's looking for, and then checks that the
+ * sequence number hasn't changed; if it has, what it copied may be torn,
+ * and it looks again.   The server never waits for a reader, and a reader
+ * never writes to the file, so the server can't tell it's being read.
+ *
+ * Because a reader can see a chain in the middle of being changed, every
+ * record number it follows is checked against the size of the table, and
+ * a chain is never followed for more steps than there are records.
+ *
+ * A server that takes over from another (see server/handoff.h) fills in
+ * a new file with the leases it's handed and renames it into place,
+ * after setting the superseded flag in the old one; readers that see the
+ * flag map the new file.
+ */
+
+/* How many times a reader looks before giving up on a server that seems
+ * to have stopped in the middle of a change.
+ */
+#define LEASE_SHM_TRIES		100000
+
+enum lease_shm_index { BY_ADDRESS, BY_ID, BY_HW };
+
+/* The table this process publishes its bindings in, if any. */
+struct lease_shm *lease_shm;
+
+static u_int32_t lease_shm_hash(const u_int8_t *key, unsigned len)
+{
+  u_int32_t hash = 2166136261U;
+  unsigned i;
+
+  for (i = 0; i < len; i++)
+    hash = (hash ^ key[i]) * 16777619U;
+  return hash;
+}
+
+static u_int32_t *lease_shm_head(struct lease_shm *shm, int index,
+				 const u_int8_t *key, unsigned len)
+{
+  u_int32_t *heads = (index == BY_ADDRESS ? shm->addr_heads :
+		      index == BY_ID ? shm->id_heads : shm->hw_heads);
+
+  return &heads[lease_shm_hash(key, len) & (shm->buckets - 1)];
+}
+
+static u_int32_t *lease_shm_next(struct lease_shm_record *rec, int index)
+{
+  return (index == BY_ADDRESS ? &rec->addr_next :
+	  index == BY_ID ? &rec->id_next : &rec->hw_next);
+}
+
+static unsigned lease_shm_address_len(int kind)
+{
+  return kind == LEASE_SHM_V4 ? 4 : 16;
+}
+
+/* Point the handle at the parts of a mapped file, after checking that
+ * they fit in it.
+ */
+static isc_result_t lease_shm_layout(struct lease_shm *shm, void *map,
+				     size_t size)
+{
+  struct lease_shm_header *header = (struct lease_shm_header *)map;
+  u_int64_t need;
+
+  if (size < sizeof *header || header->magic != LEASE_SHM_MAGIC ||
+      header->size != size || !header->buckets ||
+      (header->buckets & (header->buckets - 1)))
+    return ISC_R_FORMERR;
+  need = (sizeof *header + 3 * sizeof (u_int32_t) * (u_int64_t)header->buckets
+	  + sizeof (struct lease_shm_record) *
+	  ((u_int64_t)header->capacity + 1));
+  if (need > size)
+    return ISC_R_FORMERR;
+
+  shm->size = size;
+  shm->header = header;
+  shm->capacity = header->capacity;
+  shm->buckets = header->buckets;
+  shm->addr_heads = (u_int32_t *)(header + 1);
+  shm->id_heads = shm->addr_heads + shm->buckets;
+  shm->hw_heads = shm->id_heads + shm->buckets;
+  shm->records = (struct lease_shm_record *)(shm->hw_heads + shm->buckets);
+  return ISC_R_SUCCESS;
+}
+
+/* Tell readers of the file that's at path now, if there is one, to look
+ * at the one that's about to replace it.
+ */
+static void lease_shm_supersede(const char *path)
+{
+  struct lease_shm_header *header;
+  void *map;
+  int fd;
+
+  if ((fd = open(path, O_RDWR)) < 0)
+    return;
+  map = mmap(0, sizeof *header, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return;
+  header = (struct lease_shm_header *)map;
+  if (header->magic == LEASE_SHM_MAGIC)
+    header->superseded = 1;
+  munmap(map, sizeof *header);
+}
+
+/* Make a table with room for capacity bindings, to replace whatever is
+ * at path when lease_shm_install() is called.
+ */
+isc_result_t lease_shm_create(struct lease_shm **result, const char *path,
+			      u_int32_t capacity)
+{
+  struct lease_shm *shm;
+  struct lease_shm_header *header;
+  u_int32_t buckets;
+  u_int64_t size;
+  char tmp[1024];
+  void *map;
+  int fd;
+
+  if (!capacity || capacity > 0x1000000)
+    return ISC_R_INVALIDARG;
+  for (buckets = 1; buckets < capacity; buckets <<= 1)
+    ;
+  size = (sizeof *header + 3 * sizeof (u_int32_t) * (u_int64_t)buckets +
+	  sizeof (struct lease_shm_record) * ((u_int64_t)capacity + 1));
+
+  /* A new file is made, to be renamed into place once it's filled in,
+   * so that the server we might be taking over from can go on writing to
+   * the old one until then.
+   */
+  snprintf(tmp, sizeof tmp, "%s.new", path);
+  fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    {
+      log_error("Can't create %s: %m", tmp);
+      return ISC_R_NOPERM;
+    }
+  if (ftruncate(fd, size) < 0)
+    {
+      log_error("Can't size %s: %m", tmp);
+      close(fd);
+      unlink(tmp);
+      return ISC_R_NOSPACE;
+    }
+  map = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    {
+      log_error("Can't map %s: %m", tmp);
+      unlink(tmp);
+      return ISC_R_NOMEMORY;
+    }
+
+  /* The file starts out full of zeroes, which is an empty table. */
+  header = (struct lease_shm_header *)map;
+  header->magic = LEASE_SHM_MAGIC;
+  header->pid = getpid();
+  header->size = size;
+  header->capacity = capacity;
+  header->buckets = buckets;
+
+  shm = (struct lease_shm *)safemalloc(sizeof *shm);
+  shm->path = strdup(path);
+  lease_shm_layout(shm, map, size);
+  *result = shm;
+  return ISC_R_SUCCESS;
+}
+
+/* Put a new table where readers will find it. */
+isc_result_t lease_shm_install(struct lease_shm *shm)
+{
+  char tmp[1024];
+
+  snprintf(tmp, sizeof tmp, "%s.new", shm->path);
+  lease_shm_supersede(shm->path);
+  if (rename(tmp, shm->path) < 0)
+    {
+      log_error("Can't rename %s to %s: %m", tmp, shm->path);
+      return ISC_R_NOPERM;
+    }
+  return ISC_R_SUCCESS;
+}
+
+/* The writer's side of the sequence lock. */
+static void lease_shm_begin(struct lease_shm *shm)
+{
+  shm->header->seq++;
+  __sync_synchronize();
+}
+
+static void lease_shm_end(struct lease_shm *shm)
+{
+  __sync_synchronize();
+  shm->header->seq++;
+}
+
+static void lease_shm_link(struct lease_shm *shm, u_int32_t n, int index,
+			   const u_int8_t *key, unsigned len)
+{
+  u_int32_t *head = lease_shm_head(shm, index, key, len);
+
+  *lease_shm_next(&shm->records[n], index) = *head;
+  *head = n;
+}
+
+static void lease_shm_unlink(struct lease_shm *shm, u_int32_t n, int index,
+			     const u_int8_t *key, unsigned len)
+{
+  u_int32_t *np = lease_shm_head(shm, index, key, len);
+
+  while (*np && *np != n)
+    np = lease_shm_next(&shm->records[*np], index);
+  if (*np)
+    *np = *lease_shm_next(&shm->records[n], index);
+}
+
+/* Find the record for a binding, from the server's side. */
+static u_int32_t lease_shm_lookup(struct lease_shm *shm, int kind,
+				  const u_int8_t *addr)
+{
+  unsigned len = lease_shm_address_len(kind);
+  struct lease_shm_record *rec;
+  u_int32_t n;
+
+  for (n = *lease_shm_head(shm, BY_ADDRESS, addr, len); n;
+       n = rec->addr_next)
+    {
+      rec = &shm->records[n];
+      if (rec->kind == kind && !memcmp(rec->address, addr, len))
+	return n;
+    }
+  return 0;
+}
+
+/* Take a record off the table.   Must be called between
+ * lease_shm_begin() and lease_shm_end().
+ */
+static void lease_shm_drop(struct lease_shm *shm, u_int32_t n)
+{
+  struct lease_shm_record *rec = &shm->records[n];
+
+  lease_shm_unlink(shm, n, BY_ADDRESS, rec->address,
+		   lease_shm_address_len(rec->kind));
+  lease_shm_unlink(shm, n, BY_ID, rec->id, rec->id_len);
+  if (rec->has_hw)
+    lease_shm_unlink(shm, n, BY_HW, rec->hw, sizeof rec->hw);
+  rec->kind = LEASE_SHM_NONE;
+  rec->addr_next = shm->header->free;
+  shm->header->free = n;
+  shm->header->count--;
+}
+
+/* Publish a binding, or bring the published one up to date. */
+void lease_shm_put(struct lease_shm *shm, const struct lease_shm_record *rec)
+{
+  struct lease_shm_header *header = shm->header;
+  struct lease_shm_record *nr;
+  u_int32_t n;
+
+  lease_shm_begin(shm);
+  if ((n = lease_shm_lookup(shm, rec->kind, rec->address)))
+    lease_shm_drop(shm, n);
+
+  if (header->free)
+    {
+      n = header->free;
+      header->free = shm->records[n].addr_next;
+    }
+  else if (header->used < shm->capacity)
+    n = ++header->used;
+  else
+    {
+      header->overflow++;
+      lease_shm_end(shm);
+      return;
+    }
+
+  nr = &shm->records[n];
+  memcpy(nr, rec, sizeof *nr);
+  if (nr->id_len > sizeof nr->id)
+    nr->id_len = sizeof nr->id;
+  lease_shm_link(shm, n, BY_ADDRESS, nr->address,
+		 lease_shm_address_len(nr->kind));
+  lease_shm_link(shm, n, BY_ID, nr->id, nr->id_len);
+  if (nr->has_hw)
+    lease_shm_link(shm, n, BY_HW, nr->hw, sizeof nr->hw);
+  header->count++;
+  lease_shm_end(shm);
+}
+
+/* Withdraw a binding, if it was published. */
+void lease_shm_remove(struct lease_shm *shm, int kind, const u_int8_t *addr)
+{
+  u_int32_t n;
+
+  if (!(n = lease_shm_lookup(shm, kind, addr)))
+    return;
+  lease_shm_begin(shm);
+  lease_shm_drop(shm, n);
+  lease_shm_end(shm);
+}
+
+/* The Ethernet address in a DUID-LLT or DUID-LL, if it has one. */
+int lease_shm_duid_hw(u_int8_t *hw, const u_int8_t *duid, unsigned len)
+{
+  if (len == 14 && getUShort(duid) == DUID_LLT && getUShort(duid + 2) == 1)
+    {
+      memcpy(hw, duid + 8, 6);
+      return 1;
+    }
+  if (len == 10 && getUShort(duid) == DUID_LL && getUShort(duid + 2) == 1)
+    {
+      memcpy(hw, duid + 4, 6);
+      return 1;
+    }
+  return 0;
+}
+
+/* Map the table at path for reading. */
+isc_result_t lease_shm_open(struct lease_shm **result, const char *path)
+{
+  struct lease_shm *shm;
+  struct stat st;
+  isc_result_t status;
+  void *map;
+  int fd;
+
+  if ((fd = open(path, O_RDONLY)) < 0)
+    return errno == ENOENT ? ISC_R_NOTFOUND : ISC_R_NOPERM;
+  if (fstat(fd, &st) < 0)
+    {
+      close(fd);
+      return ISC_R_UNEXPECTED;
+    }
+  map = st.st_size ? mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0) : 0;
+  close(fd);
+  if (!map || map == MAP_FAILED)
+    return ISC_R_FORMERR;
+
+  shm = (struct lease_shm *)safemalloc(sizeof *shm);
+  if ((status = lease_shm_layout(shm, map, st.st_size)) != ISC_R_SUCCESS)
+    {
+      munmap(map, st.st_size);
+      free(shm);
+      return status;
+    }
+  madvise(map, st.st_size, MADV_RANDOM);
+  shm->path = strdup(path);
+  *result = shm;
+  return ISC_R_SUCCESS;
+}
+
+void lease_shm_close(struct lease_shm *shm)
+{
+  munmap(shm->header, shm->size);
+  free(shm->path);
+  free(shm);
+}
+
+/* Follow a reader to the file that has replaced the one it has. */
+static isc_result_t lease_shm_reopen(struct lease_shm *shm)
+{
+  struct lease_shm *nshm;
+  isc_result_t status;
+
+  if ((status = lease_shm_open(&nshm, shm->path)) != ISC_R_SUCCESS)
+    return status;
+  munmap(shm->header, shm->size);
+  free(shm->path);
+  memcpy(shm, nshm, sizeof *shm);
+  free(nshm);
+  return ISC_R_SUCCESS;
+}
+
+static int lease_shm_match(const struct lease_shm_record *rec, int index,
+			   const u_int8_t *key, unsigned len)
+{
+  switch (index)
+    {
+    case BY_ADDRESS:
+      return (rec->kind != LEASE_SHM_NONE &&
+	      lease_shm_address_len(rec->kind) == len &&
+	      !memcmp(rec->address, key, len));
+    case BY_ID:
+      return (rec->kind != LEASE_SHM_NONE && rec->id_len == len &&
+	      len <= sizeof rec->id && !memcmp(rec->id, key, len));
+    default:
+      return (rec->kind != LEASE_SHM_NONE && rec->has_hw &&
+	      !memcmp(rec->hw, key, sizeof rec->hw));
+    }
+}
+
+/* Copy out up to max records that match a key in an index. */
+static isc_result_t lease_shm_find(struct lease_shm *shm, int index,
+				   const u_int8_t *key, unsigned len,
+				   struct lease_shm_record *out,
+				   unsigned max, unsigned *count)
+{
+  struct lease_shm_record rec;
+  isc_result_t status;
+  u_int32_t seq, n, steps;
+  unsigned found;
+  int tries;
+
+  /* Identifiers are published cut short, so look them up that way. */
+  if (index == BY_ID && len > LEASE_SHM_ID_MAX)
+    len = LEASE_SHM_ID_MAX;
+
+  for (tries = 0; tries < LEASE_SHM_TRIES; tries++)
+    {
+      if (shm->header->superseded &&
+	  (status = lease_shm_reopen(shm)) != ISC_R_SUCCESS)
+	return status;
+
+      seq = shm->header->seq;
+      if (seq & 1)
+	{
+	  sched_yield();
+	  continue;
+	}
+      __sync_synchronize();
+
+      found = 0;
+      n = *lease_shm_head(shm, index, key, len);
+      for (steps = 0; n && n <= shm->capacity && steps < shm->capacity;
+	   steps++)
+	{
+	  memcpy(&rec, &shm->records[n], sizeof rec);
+	  if (found < max && lease_shm_match(&rec, index, key, len))
+	    out[found++] = rec;
+	  n = *lease_shm_next(&rec, index);
+	}
+
+      __sync_synchronize();
+      if (shm->header->seq == seq)
+	{
+	  *count = found;
+	  return ISC_R_SUCCESS;
+	}
+    }
+  return ISC_R_TIMEDOUT;
+}
+
+/* Find the binding on an address (4 bytes) or the address binding and
+ * the delegation at an IPv6 address (16 bytes).
+ */
+isc_result_t lease_shm_find_address(struct lease_shm *shm,
+				    const u_int8_t *addr, unsigned len,
+				    struct lease_shm_record *out,
+				    unsigned max, unsigned *count)
+{
+  if (len != 4 && len != 16)
+    return ISC_R_INVALIDARG;
+  return lease_shm_find(shm, BY_ADDRESS, addr, len, out, max, count);
+}
+
+/* Find the bindings of a DHCPv4 client identifier or a DHCPv6 DUID. */
+isc_result_t lease_shm_find_id(struct lease_shm *shm,
+			       const u_int8_t *id, unsigned len,
+			       struct lease_shm_record *out,
+			       unsigned max, unsigned *count)
+{
+  return lease_shm_find(shm, BY_ID, id, len, out, max, count);
+}
+
+/* Find the bindings of an Ethernet address. */
+isc_result_t lease_shm_find_hw(struct lease_shm *shm, const u_int8_t *hw,
+			       struct lease_shm_record *out,
+			       unsigned max, unsigned *count)
+{
+  return lease_shm_find(shm, BY_HW, hw, 6, out, max, count);
+}
+
+/* Local Variables:  */
+/* mode:C++ */
+/* c-file-style:"gnu" */
+/* end: */
@@ -50,6 +50,7 @@ static char copyright[] __attribute__((unused)) =
 #if defined(NEED_LPF)
 #include <sys/ioctl.h>
 #include <sys/uio.h>
+#include <sys/mman.h>
 
 #include <asm/types.h>
 #include <linux/filter.h>
@@ -128,74 +129,163 @@ lpf_gen_filter_setup(int rfdesc)
     }
 }
 
+/* Frames are normally read from a TPACKET_V3 receive ring that the
+ * kernel fills a block at a time; the interface's read buffer fields
+ * describe it.   rbuf is the mapped ring, rbuf_max its size and
+ * rbuf_offset the offset of the next block to look at.   A block is
+ * handed to us when it's full or when LPF_RING_TIMEOUT ms have passed
+ * since its first frame came in.   If the kernel can't do that, rbuf
+ * is null and frames are read one at a time.
+ */
+
+#define LPF_RING_BLOCK_SIZE	(1 << 16)
+#define LPF_RING_BLOCKS		32
+#define LPF_RING_FRAME_SIZE	2048
+#define LPF_RING_TIMEOUT	1
+
+/* Decode a frame where it lies and hand its payload to the interface's
+ * listener.   The listener must be done with the payload when it returns,
+ * and mustn't write past its end: in the ring, the next frame follows it.
+ */
 static isc_result_t
-receive_packet_worker(struct interface_info *ifp)
+lpf_got_frame(struct interface_info *ifp, unsigned char *frame,
+	      unsigned length)
 {
-  int length = 0;
-  int offset = 0;
-  unsigned char ibuf[4096];
-  union {
-    unsigned char packbuf[4096];
-    u_int64_t aligneything;
-  } u;
+  ssize_t offset;
   unsigned bufix = 0;
   unsigned paylen;
   struct sockaddr_in from;
   struct hardware hfrom;
   char buf[100];
 
-  printf("in lpf receive_packet_worker...\n");
-  length = read(ifp->pf_sock, ibuf, sizeof ibuf);
-  if (length < 0)
-    return uerr2isc(errno);
-
-  bufix = 0;
   /* Decode the physical header... */
-  offset = decode_ethernet_header(ifp, ibuf, bufix, &hfrom);
+  offset = decode_ethernet_header(ifp, frame, bufix, &hfrom);
 
   /* If a physical layer checksum failed (dunno of any physical layer
    * that supports this, but WTH), skip this packet.
    */
-  if (offset < 0)
-    {
-      printf("dropping out because link layer decode failed.\n");
-      return ISC_R_SUCCESS;
-    }
+  if (offset < 0 || (unsigned)offset > length)
+    return ISC_R_SUCCESS;
 
   bufix += offset;
   length -= offset;
 
   /* Decode the IP and UDP headers... */
-  offset = decode_udp_ip_header(ifp, ibuf, bufix, &from,
-				(unsigned)length, &paylen);
+  offset = decode_udp_ip_header(ifp, frame, bufix, &from, length, &paylen);
 
   /* If the IP or UDP checksum was bad, skip the packet... */
   if (offset < 0)
-    {
-      printf("dropping out because ip/udp layer decode failed.\n");
-      return ISC_R_SUCCESS;
-    }
+    return ISC_R_SUCCESS;
 
   bufix += offset;
-  length -= offset;
-
-  /* Copy out the data in the packet... */
-  memcpy(u.packbuf, &ibuf[bufix], paylen);
 
   if (ifp->v4listener)
+    return ifp->v4listener->got_packet(ifp, &from, &frame[bufix], paylen);
+
+  inet_ntop(from.sin_family, (void *)&from.sin_addr, buf, sizeof buf);
+  log_error("Dropping packet from %s on %s - no listener object",
+	    buf, ifp->name);
+  return ISC_R_SUCCESS;
+}
+
+/* Handle every frame in every block the kernel has finished with, giving
+ * each block back as soon as we're done with it.
+ */
+static isc_result_t
+receive_packet_worker(struct interface_info *ifp)
+{
+  struct tpacket_block_desc *block;
+  struct tpacket3_hdr *hdr;
+  struct sockaddr_ll *sll;
+  unsigned i;
+
+  if (!ifp->rbuf)
     {
-      printf("passing it to the listener.\n");
-      return ifp->v4listener->got_packet(ifp, &from, u.packbuf, paylen);
+      union {
+	unsigned char frame[4096];
+	u_int64_t aligneything;
+      } u;
+      ssize_t length;
+
+      length = read(ifp->pf_sock, u.frame, sizeof u.frame);
+      if (length < 0)
+	return uerr2isc(errno);
+      return lpf_got_frame(ifp, u.frame, length);
     }
-  else
+
+  for (;;)
     {
-      inet_ntop(from.sin_family, (void *)&from.sin_addr, buf, sizeof buf);
-      log_error("Dropping packet from %s on %s - no listener object",
-		buf, ifp->name);
+      block = (struct tpacket_block_desc *)&ifp->rbuf[ifp->rbuf_offset];
+      if (!(block->hdr.bh1.block_status & TP_STATUS_USER))
+	break;
+      __sync_synchronize();
+
+      hdr = (struct tpacket3_hdr *)((unsigned char *)block +
+				    block->hdr.bh1.offset_to_first_pkt);
+      for (i = 0; i < block->hdr.bh1.num_pkts; i++)
+	{
+	  /* Frames we sent ourselves come back to us too. */
+	  sll = (struct sockaddr_ll *)((unsigned char *)hdr +
+				       TPACKET_ALIGN(sizeof *hdr));
+	  if (sll->sll_pkttype != PACKET_OUTGOING)
+	    lpf_got_frame(ifp, (unsigned char *)hdr + hdr->tp_mac,
+			  hdr->tp_snaplen);
+	  hdr = (struct tpacket3_hdr *)((unsigned char *)hdr +
+					hdr->tp_next_offset);
+	}
+
+      __sync_synchronize();
+      block->hdr.bh1.block_status = TP_STATUS_KERNEL;
+      ifp->rbuf_offset += LPF_RING_BLOCK_SIZE;
+      if (ifp->rbuf_offset >= ifp->rbuf_max)
+	ifp->rbuf_offset = 0;
     }
   return ISC_R_SUCCESS;
 }
 
+/* Set up the receive ring on a packet socket.   Returns 0 if the kernel
+ * can't do it, in which case frames are read one at a time.
+ */
+static int
+lpf_ring_setup(struct interface_info *info, int sock)
+{
+  struct tpacket_req3 req;
+  int version = TPACKET_V3;
+  void *ring;
+
+  if (setsockopt(sock, SOL_PACKET, PACKET_VERSION,
+		 &version, sizeof version) < 0)
+    {
+      log_error("Can't use a TPACKET_V3 ring on %s: %m", info->name);
+      return 0;
+    }
+
+  memset(&req, 0, sizeof req);
+  req.tp_block_size = LPF_RING_BLOCK_SIZE;
+  req.tp_block_nr = LPF_RING_BLOCKS;
+  req.tp_frame_size = LPF_RING_FRAME_SIZE;
+  req.tp_frame_nr = (LPF_RING_BLOCK_SIZE / LPF_RING_FRAME_SIZE *
+		     LPF_RING_BLOCKS);
+  req.tp_retire_blk_tov = LPF_RING_TIMEOUT;
+  if (setsockopt(sock, SOL_PACKET, PACKET_RX_RING, &req, sizeof req) < 0)
+    {
+      log_error("Can't set up a receive ring on %s: %m", info->name);
+      version = TPACKET_V1;
+      setsockopt(sock, SOL_PACKET, PACKET_VERSION, &version, sizeof version);
+      return 0;
+    }
+
+  ring = mmap(0, LPF_RING_BLOCK_SIZE * LPF_RING_BLOCKS,
+	      PROT_READ | PROT_WRITE, MAP_SHARED, sock, 0);
+  if (ring == MAP_FAILED)
+    log_fatal("Can't map the receive ring on %s: %m", info->name);
+
+  info->rbuf = (unsigned char *)ring;
+  info->rbuf_max = LPF_RING_BLOCK_SIZE * LPF_RING_BLOCKS;
+  info->rbuf_offset = 0;
+  return 1;
+}
+
 /* Called by io handler code in dispatch.cpp to get the socket file descriptor
  * so that it can be used in select().
  */
@@ -226,11 +316,12 @@ void
 lpf_setup(struct interface_info *info)
 {
   int sock;
-  struct sockaddr sa;
+  struct sockaddr_ll sll;
 
-  /* Make an LPF socket. */
-  if ((sock = socket(PF_PACKET, SOCK_PACKET,
-		     htons((short)ETH_P_ALL))) < 0)
+  /* Make an LPF socket.   It gets no frames until it's bound, by which
+   * time the filter and the ring are in place.
+   */
+  if ((sock = socket(PF_PACKET, SOCK_RAW, 0)) < 0)
     {
       if (errno == ENOPROTOOPT || errno == EPROTONOSUPPORT ||
 	  errno == ESOCKTNOSUPPORT || errno == EPFNOSUPPORT ||
@@ -246,11 +337,15 @@ lpf_setup(struct interface_info *info)
       log_fatal("Open a socket for LPF: %m");
     }
 
-  /* Bind to the interface name */
-  memset(&sa, 0, sizeof sa);
-  sa.sa_family = AF_PACKET;
-  strncpy(sa.sa_data, (const char *)info->name, sizeof sa.sa_data);
-  if (bind(sock, &sa, sizeof sa))
+  lpf_gen_filter_setup(sock);
+  lpf_ring_setup(info, sock);
+
+  /* Bind to the interface */
+  memset(&sll, 0, sizeof sll);
+  sll.sll_family = AF_PACKET;
+  sll.sll_protocol = htons(ETH_P_ALL);
+  sll.sll_ifindex = info->index;
+  if (bind(sock, (struct sockaddr *)&sll, sizeof sll))
     {
       if (errno == ENOPROTOOPT || errno == EPROTONOSUPPORT ||
 	  errno == ESOCKTNOSUPPORT || errno == EPFNOSUPPORT ||
@@ -266,11 +361,254 @@ lpf_setup(struct interface_info *info)
       log_fatal("Bind socket to interface: %m");
     }
 
-  lpf_gen_filter_setup(sock);
-
   info->pf_sock = sock;
   register_io_object(info, if_readsocket, 0, receive_packet, 0, 0);
 }
+
+/* Packet socket that frames are sent on, for every interface. */
+static int lpf_send_sock = -1;
+
+/* Send a DHCPv4 packet as an Ethernet frame to the hardware address in
+ * hto, without going through the kernel's routing and ARP.   This is how
+ * a reply reaches a client that has no IP address yet without being
+ * broadcast.
+ */
+
+ssize_t
+lpf_send_packet(struct interface_info *interface,
+		void *packet, size_t len, struct sockaddr_in *to,
+		struct hardware *hto)
+{
+  unsigned hbufp = 0, ibufp = 0;
+  double hw[4];
+  double ip[32];
+  struct iovec iov[3];
+  struct sockaddr_ll sll;
+  struct msghdr mh;
+  u_int32_t from;
+  ssize_t result;
+
+  if (interface->lladdr.hbuf[0] != HTYPE_ETHER ||
+      interface->lladdr.hlen != 7 || hto->hlen != 7)
+    {
+      errno = EAFNOSUPPORT;
+      return -1;
+    }
+
+  /* Make sure there's a socket.   It's never bound, so nothing is ever
+   * queued on it to be read.   More than one thread may get here first.
+   */
+  if (lpf_send_sock < 0)
+    {
+      int sock = socket(PF_PACKET, SOCK_RAW, 0);
+
+      if (sock < 0)
+	{
+	  log_error("Can't open a packet socket to send on: %m");
+	  return -1;
+	}
+      if (!__sync_bool_compare_and_swap(&lpf_send_sock, -1, sock))
+	close(sock);
+    }
+
+  if (interface->ipv4_addr_count)
+    from = interface->ipv4s[0].s_addr;
+  else
+    from = INADDR_ANY;
+
+  /* Assemble the headers... */
+  assemble_ethernet_header(interface, (unsigned char *)hw, &hbufp, hto);
+  assemble_udp_ip_header(interface,
+			 (unsigned char *)ip, &ibufp, from,
+			 to->sin_addr.s_addr, to->sin_port,
+			 (unsigned char *)packet, len);
+
+  memset(&sll, 0, sizeof sll);
+  sll.sll_family = AF_PACKET;
+  sll.sll_protocol = htons(ETH_P_IP);
+  sll.sll_ifindex = interface->index;
+  sll.sll_halen = ETH_ALEN;
+  memcpy(sll.sll_addr, &hto->hbuf[1], ETH_ALEN);
+
+  /* Fire it off */
+  iov[0].iov_base = ((char *)hw);
+  iov[0].iov_len = hbufp;
+  iov[1].iov_base = ((char *)ip);
+  iov[1].iov_len = ibufp;
+  iov[2].iov_base = (char *)packet;
+  iov[2].iov_len = len;
+
+  memset(&mh, 0, sizeof mh);
+  mh.msg_name = &sll;
+  mh.msg_namelen = sizeof sll;
+  mh.msg_iov = iov;
+  mh.msg_iovlen = 3;
+
+  result = sendmsg(lpf_send_sock, &mh, 0);
+  if (result < 0)
+    log_error("lpf_send_packet: %m");
+  return result;
+}
+
+/* Filters for the DHCP UDP sockets, so that the kernel drops packets the
+ * program would only read to throw away.   On a UDP socket the filter
+ * sees the packet from the UDP header on; the IP header is reached
+ * through SKF_NET_OFF.   The programs are put together here from the
+ * role's settings, and end with an instruction that accepts the packet
+ * and one that drops it, which checks jump to with LPF_ACCEPT and
+ * LPF_DROP.
+ */
+
+#define LPF_UDP_MAX_INSNS	64
+#define LPF_ACCEPT		0xfe
+#define LPF_DROP		0xff
+
+#define LPF_UDP(off)		(sizeof (struct udphdr) + (off))
+#define LPF_BOOTP_OP		LPF_UDP(0)
+#define LPF_BOOTP_HLEN		LPF_UDP(2)
+#define LPF_BOOTP_HOPS		LPF_UDP(3)
+#define LPF_BOOTP_CHADDR	LPF_UDP(28)
+#define LPF_BOOTP_COOKIE	LPF_UDP(DHCP_FIXED_NON_UDP)
+#define LPF_DHCPV6_TYPE		LPF_UDP(0)
+#define LPF_DHCPV6_HOPS		LPF_UDP(1)
+
+struct lpf_udp_program {
+  struct sock_filter insns[LPF_UDP_MAX_INSNS];
+  unsigned len;
+};
+
+static void
+lpf_emit(struct lpf_udp_program *prog, u_int16_t code, u_int32_t k,
+	 u_int8_t jt, u_int8_t jf)
+{
+  struct sock_filter *insn = &prog->insns[prog->len++];
+
+  insn->code = code;
+  insn->jt = jt;
+  insn->jf = jf;
+  insn->k = k;
+}
+
+/* Finish a program off, fill in the jumps to its end and attach it to a
+ * socket, replacing any filter it already has.
+ */
+static int
+lpf_udp_filter_attach(int fd, struct lpf_udp_program *prog, int family)
+{
+  struct sock_fprog p;
+  unsigned i;
+
+  lpf_emit(prog, BPF_RET + BPF_K, (u_int)-1, 0, 0);
+  lpf_emit(prog, BPF_RET + BPF_K, 0, 0, 0);
+  for (i = 0; i < prog->len; i++)
+    {
+      struct sock_filter *insn = &prog->insns[i];
+
+      if (BPF_CLASS(insn->code) != BPF_JMP || BPF_OP(insn->code) == BPF_JA)
+	continue;
+      if (insn->jt == LPF_ACCEPT || insn->jt == LPF_DROP)
+	insn->jt = prog->len - (insn->jt == LPF_DROP ? 1 : 2) - (i + 1);
+      if (insn->jf == LPF_ACCEPT || insn->jf == LPF_DROP)
+	insn->jf = prog->len - (insn->jf == LPF_DROP ? 1 : 2) - (i + 1);
+    }
+
+  p.len = prog->len;
+  p.filter = prog->insns;
+  if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &p, sizeof p) < 0)
+    {
+      log_error("Can't install a filter on the DHCPv%d socket: %m",
+		family == AF_INET6 ? 6 : 4);
+      return -1;
+    }
+  return 0;
+}
+
+/* Attach a filter to a DHCPv4 socket.   With shards, the hash of a
+ * broadcast BOOTREQUEST's client is FNV-1a over the first six bytes of
+ * chaddr, folded once: h ^ (h >> 16).   Returns -1 if the kernel won't
+ * take the filter, in which case every packet still gets through.
+ */
+int
+lpf_udp_filter_v4(int fd, const struct dhcpv4_udp_filter *filter)
+{
+  struct lpf_udp_program prog;
+  unsigned i;
+
+  prog.len = 0;
+  lpf_emit(&prog, BPF_LD + BPF_W + BPF_LEN, 0, 0, 0);
+  lpf_emit(&prog, BPF_JMP + BPF_JGE + BPF_K,
+	   LPF_UDP(filter->min_length), 0, LPF_DROP);
+  lpf_emit(&prog, BPF_LD + BPF_B + BPF_ABS, LPF_BOOTP_HLEN, 0, 0);
+  lpf_emit(&prog, BPF_JMP + BPF_JGT + BPF_K,
+	   sizeof ((struct dhcp_packet *)0)->chaddr, LPF_DROP, 0);
+  if (filter->dhcp_only)
+    {
+      lpf_emit(&prog, BPF_LD + BPF_W + BPF_ABS, LPF_BOOTP_COOKIE, 0, 0);
+      lpf_emit(&prog, BPF_JMP + BPF_JEQ + BPF_K, 0x63825363, 0, LPF_DROP);
+    }
+
+  lpf_emit(&prog, BPF_LD + BPF_B + BPF_ABS, LPF_BOOTP_OP, 0, 0);
+  if (!filter->requests_only)
+    lpf_emit(&prog, BPF_JMP + BPF_JEQ + BPF_K, BOOTREPLY, LPF_ACCEPT, 0);
+  lpf_emit(&prog, BPF_JMP + BPF_JEQ + BPF_K, BOOTREQUEST, 0, LPF_DROP);
+  lpf_emit(&prog, BPF_LD + BPF_B + BPF_ABS, LPF_BOOTP_HOPS, 0, 0);
+  lpf_emit(&prog, BPF_JMP + BPF_JGE + BPF_K, filter->max_hops, LPF_DROP, 0);
+
+  if (filter->shards > 1)
+    {
+      lpf_emit(&prog, BPF_LD + BPF_W + BPF_ABS, SKF_NET_OFF + 16, 0, 0);
+      lpf_emit(&prog, BPF_JMP + BPF_JEQ + BPF_K, INADDR_BROADCAST,
+	       0, LPF_ACCEPT);
+
+      /* The hash is kept in X. */
+      lpf_emit(&prog, BPF_LDX + BPF_W + BPF_IMM, 2166136261U, 0, 0);
+      for (i = 0; i < 6; i++)
+	{
+	  lpf_emit(&prog, BPF_LD + BPF_B + BPF_ABS, LPF_BOOTP_CHADDR + i, 0, 0);
+	  lpf_emit(&prog, BPF_ALU + BPF_XOR + BPF_X, 0, 0, 0);
+	  lpf_emit(&prog, BPF_ALU + BPF_MUL + BPF_K, 16777619U, 0, 0);
+	  lpf_emit(&prog, BPF_MISC + BPF_TAX, 0, 0, 0);
+	}
+      lpf_emit(&prog, BPF_ALU + BPF_RSH + BPF_K, 16, 0, 0);
+      lpf_emit(&prog, BPF_ALU + BPF_XOR + BPF_X, 0, 0, 0);
+      lpf_emit(&prog, BPF_ALU + BPF_MOD + BPF_K, filter->shards, 0, 0);
+      lpf_emit(&prog, BPF_JMP + BPF_JEQ + BPF_K, filter->shard,
+	       LPF_ACCEPT, LPF_DROP);
+    }
+  return lpf_udp_filter_attach(fd, &prog, AF_INET);
+}
+
+/* Attach a filter to a DHCPv6 socket. */
+int
+lpf_udp_filter_v6(int fd, const struct dhcpv6_udp_filter *filter)
+{
+  struct lpf_udp_program prog;
+
+  prog.len = 0;
+  lpf_emit(&prog, BPF_LD + BPF_W + BPF_LEN, 0, 0, 0);
+  lpf_emit(&prog, BPF_JMP + BPF_JGE + BPF_K, LPF_UDP(4), 0, LPF_DROP);
+
+  /* Only the message types asked for. */
+  lpf_emit(&prog, BPF_LD + BPF_B + BPF_ABS, LPF_DHCPV6_TYPE, 0, 0);
+  lpf_emit(&prog, BPF_JMP + BPF_JGT + BPF_K, 31, LPF_DROP, 0);
+  lpf_emit(&prog, BPF_MISC + BPF_TAX, 0, 0, 0);
+  lpf_emit(&prog, BPF_LD + BPF_W + BPF_IMM, 1, 0, 0);
+  lpf_emit(&prog, BPF_ALU + BPF_LSH + BPF_X, 0, 0, 0);
+  lpf_emit(&prog, BPF_JMP + BPF_JSET + BPF_K, filter->types, 0, LPF_DROP);
+
+  /* Relay messages have a longer header, and Relay-Forwards a hop
+     count. */
+  lpf_emit(&prog, BPF_MISC + BPF_TXA, 0, 0, 0);
+  lpf_emit(&prog, BPF_JMP + BPF_JEQ + BPF_K, DHCPV6_RELAY_REPLY, 3, 0);
+  lpf_emit(&prog, BPF_JMP + BPF_JEQ + BPF_K, DHCPV6_RELAY_FORWARD,
+	   0, LPF_ACCEPT);
+  lpf_emit(&prog, BPF_LD + BPF_B + BPF_ABS, LPF_DHCPV6_HOPS, 0, 0);
+  lpf_emit(&prog, BPF_JMP + BPF_JGE + BPF_K, filter->max_hops, LPF_DROP, 0);
+  lpf_emit(&prog, BPF_LD + BPF_W + BPF_LEN, 0, 0, 0);
+  lpf_emit(&prog, BPF_JMP + BPF_JGE + BPF_K, LPF_UDP(34),
+	   LPF_ACCEPT, LPF_DROP);
+  return lpf_udp_filter_attach(fd, &prog, AF_INET6);
+}
 #endif
 
 /* Local Variables:  */
@@ -47,6 +47,50 @@ static char copyright[] __attribute__((unused)) =
 
 struct option *vendor_cfg_option;
 
+/* An option_cache whose data points here masks the option of the same code
+ * in the parents of a layered option_state; see delete_option().
+ */
+static unsigned char masked_option_data [1];
+#define OPTION_MASKED(oc) ((oc)->data.data == masked_option_data)
+
+#define PRIORITY_COUNT 300
+
+/* Used by cons_options() to add options that are present to the priority
+ * list.   Options with codes outside of [min, limit) are skipped.
+ */
+struct priority_fill {
+  unsigned *priority_list;
+  unsigned *priority_len;
+  unsigned min, limit;
+};
+
+static void add_priority (struct option_cache *oc,
+			  struct option_state *options,
+			  struct option_space *u, void *stuff)
+{
+  struct priority_fill *pf = (struct priority_fill *)stuff;
+
+  if (oc->option->code >= pf->min && oc->option->code < pf->limit &&
+      *pf->priority_len < PRIORITY_COUNT &&
+      oc->option->code != DHO_DHCP_AGENT_OPTIONS)
+    pf->priority_list [(*pf->priority_len)++] = oc->option->code;
+}
+
+/* Returns nonzero if there are any options in the specified option space
+ * in options or any of its parents.
+ */
+static int option_space_present (struct option_state *options,
+				 unsigned index)
+{
+  for (; options; options = options->parent)
+    {
+      if (index < options->option_space_count &&
+	  options->option_spaces [index])
+	return 1;
+    }
+  return 0;
+}
+
 /* Parse all available options out of the specified packet. */
 
 int parse_options (struct packet *packet)
@@ -112,6 +156,7 @@ int parse_option_buffer (struct option_state *options,
   struct option_cache *op = (struct option_cache *)0;
   struct buffer *bp = (struct buffer *)0;
   struct option *opt = (struct option *)0;
+  int saved = 0;
 
   bp = buffer_allocate(length);
   memcpy (bp->data, buffer, length);
@@ -144,6 +189,8 @@ int parse_option_buffer (struct option_state *options,
 	  log_error ("parse_option_buffer: option %s.%s (%d) "
 		     "larger than buffer.",
 		     option_space->name, opt->name, len);
+	  if (!saved)
+	    free(bp);
 	  return 0;
 	}
 
@@ -178,10 +225,13 @@ int parse_option_buffer (struct option_state *options,
 	    {
 	      save_option_buffer (option_space, options, bp,
 				  &bp->data [offset + 2], len, opt, 1);
+	      saved = 1;
 	    }
 	}
       offset += len + 2;
     }
+  if (!saved)
+    free(bp);
   return 1;
 }
 
@@ -558,7 +608,6 @@ int cons_options (struct dhcp_packet *outpacket,
 		  struct data_string *prl,
 		  const char *vuname)
 {
-#define PRIORITY_COUNT 300
   unsigned priority_list [PRIORITY_COUNT];
   unsigned priority_len;
   unsigned char buffer [4096];	/* Really big buffer... */
@@ -569,7 +618,7 @@ int cons_options (struct dhcp_packet *outpacket,
   unsigned i;
   struct option_cache *op;
   struct data_string ds;
-  pair pp, *hash;
+  struct priority_fill pf;
   int need_endopt = 0;
   int ocount = 0;
   unsigned ofbuf1, ofbuf2;
@@ -649,48 +698,24 @@ int cons_options (struct dhcp_packet *outpacket,
 	 space, and the first for loop is skipped, because
 	 it's slightly more general to do it this way,
 	 taking the 1Q99 DHCP futures work into account. */
+      pf.priority_list = priority_list;
+      pf.priority_len = &priority_len;
       if (options->site_code_min)
 	{
-	  for (i = 0; i < OPTION_HASH_SIZE; i++)
-	    {
-	      hash = (pair *)(options->option_spaces[dhcp_option_space.index]);
-	      if (hash)
-		{
-		  for (pp = hash [i]; pp; pp = pp->cdr)
-		    {
-		      op = (struct option_cache *)(pp->car);
-		      if (op->option->code < options->site_code_min &&
-			  priority_len < PRIORITY_COUNT &&
-			  (op->option->code != DHO_DHCP_AGENT_OPTIONS))
-			priority_list [priority_len++] =
-			  op->option->code;
-		    }
-		}
-	    }
+	  pf.min = 0;
+	  pf.limit = options->site_code_min;
+	  option_space_foreach (options, &dhcp_option_space, &pf,
+				add_priority);
 	}
 
       /* Now cycle through the site option space, or if there
 	 is no site option space, we'll be cycling through the
 	 dhcp option space. */
-      for (i = 0; i < OPTION_HASH_SIZE; i++)
-	{
-	  hash = (pair *)(options->option_spaces
-			  [options->site_option_space]);
-	  if (hash)
-	    {
-	      for (pp = hash [i]; pp; pp = pp->cdr)
-		{
-		  op = (struct option_cache *)(pp->car);
-		  if (op->option->code >=
-		      options->site_code_min &&
-		      priority_len < PRIORITY_COUNT &&
-		      (op->option->code !=
-		       DHO_DHCP_AGENT_OPTIONS))
-		    priority_list [priority_len++] =
-		      op->option->code;
-		}
-	    }
-	}
+      pf.min = options->site_code_min;
+      pf.limit = UINT_MAX;
+      option_space_foreach (options,
+			    option_spaces [options->site_option_space],
+			    &pf, add_priority);
 
       /* Now go through all the option spaces for which options
 	 were set and see if there are encapsulations for
@@ -698,7 +723,7 @@ int cons_options (struct dhcp_packet *outpacket,
 	 on the priority list as well. */
       for (i = 0; i < options->option_space_count; i++)
 	{
-	  if (options->option_spaces [i] &&
+	  if (option_space_present (options, i) &&
 	      option_spaces[i]->enc_opt &&
 	      priority_len < PRIORITY_COUNT &&
 	      (option_spaces[i]->enc_opt->option_space == &dhcp_option_space))
@@ -1457,25 +1482,36 @@ int get_option (struct data_string *result,
 
   if (!option_space->lookup_func)
     return 0;
-  oc = ((*option_space->lookup_func) (option_space, options, code));
+  oc = lookup_option (option_space, options, code);
   if (!oc)
     return 0;
   data_string_copy(result, &oc->data);
   return 1;
 }
 
+/* Look the option up in each layer of options in turn; the first one that
+ * has it wins.
+ */
 struct option_cache *lookup_option (struct option_space *option_space,
 				    struct option_state *options,
 				    unsigned code)
 {
+  struct option_cache *oc;
+
   if (!options)
     return (struct option_cache *)0;
-  if (option_space->lookup_func)
-    return (*option_space->lookup_func)(option_space,
-					options, code);
-  else
-    log_error ("can't look up options in %s space.",
-	       option_space->name);
+  if (!option_space->lookup_func)
+    {
+      log_error ("can't look up options in %s space.",
+		 option_space->name);
+      return (struct option_cache *)0;
+    }
+  for (; options; options = options->parent)
+    {
+      oc = (*option_space->lookup_func)(option_space, options, code);
+      if (oc)
+	return OPTION_MASKED (oc) ? (struct option_cache *)0 : oc;
+    }
   return (struct option_cache *)0;
 }
 
@@ -1554,11 +1590,23 @@ save_option_buffer (struct option_space *option_space,
 void save_option (struct option_space *option_space,
 		  struct option_state *options, struct option_cache *oc)
 {
-  if (option_space->save_func)
-    (*option_space->save_func) (option_space, options, oc);
-  else
-    log_error ("can't store options in %s space.",
-	       option_space->name);
+  struct option_cache *cur;
+
+  if (!option_space->save_func)
+    {
+      log_error ("can't store options in %s space.",
+		 option_space->name);
+      return;
+    }
+
+  /* Don't append to the mask if this option was deleted earlier. */
+  if (options->parent && option_space->lookup_func &&
+      option_space->delete_func &&
+      (cur = (*option_space->lookup_func) (option_space, options,
+					   oc->option->code)) &&
+      OPTION_MASKED (cur))
+    (*option_space->delete_func) (option_space, options, oc->option->code);
+  (*option_space->save_func) (option_space, options, oc);
 }
 
 void save_hashed_option (struct option_space *option_space,
@@ -1633,11 +1681,26 @@ void delete_option (struct option_space *option_space,
 		    struct option_state *options,
 		    unsigned code)
 {
-  if (option_space->delete_func)
-    (*option_space->delete_func) (option_space, options, code);
-  else
-    log_error ("can't delete options from %s space.",
-	       option_space->name);
+  struct option_cache *oc;
+
+  if (!option_space->delete_func)
+    {
+      log_error ("can't delete options from %s space.",
+		 option_space->name);
+      return;
+    }
+  (*option_space->delete_func) (option_space, options, code);
+
+  /* A layer can't change its parents, so if one of them has the option,
+   * hide it instead.
+   */
+  if (options->parent && lookup_option (option_space, options->parent, code))
+    {
+      oc = (struct option_cache *)safemalloc(sizeof *oc);
+      oc->option = find_option(option_space, code);
+      oc->data.data = masked_option_data;
+      (*option_space->save_func) (option_space, options, oc);
+    }
 }
 
 void delete_hashed_option (struct option_space *option_space,
@@ -1670,6 +1733,56 @@ void delete_hashed_option (struct option_space *option_space,
     }
 }
 
+/* Buffers aren't reference counted outside of this: a state's options
+ * share the buffer they were parsed from, so count the state's own
+ * references in refcnt first, and free each buffer with the last option
+ * cache that points into it.
+ */
+static void option_cache_hold(struct option_cache *oc)
+{
+  for (; oc; oc = oc->next)
+    if (oc->data.buffer)
+      oc->data.buffer->refcnt++;
+}
+
+static void option_cache_release(struct option_cache *oc)
+{
+  struct option_cache *next;
+
+  for (; oc; oc = next)
+    {
+      next = oc->next;
+      if (oc->data.buffer && !--oc->data.buffer->refcnt)
+	free(oc->data.buffer);
+      free(oc);
+    }
+}
+
+void hashed_option_state_dereference(struct option_space *option_space,
+				     struct option_state *options)
+{
+  pair *hash, bptr, next;
+  int i;
+
+  if (option_space->index >= options->option_space_count)
+    return;
+  hash = (pair *)options->option_spaces[option_space->index];
+  if (!hash)
+    return;
+  for (i = 0; i < OPTION_HASH_SIZE; i++)
+    for (bptr = hash[i]; bptr; bptr = bptr->cdr)
+      option_cache_hold((struct option_cache *)bptr->car);
+  for (i = 0; i < OPTION_HASH_SIZE; i++)
+    for (bptr = hash[i]; bptr; bptr = next)
+      {
+	next = bptr->cdr;
+	option_cache_release((struct option_cache *)bptr->car);
+	free(bptr);
+      }
+  free(hash);
+  options->option_spaces[option_space->index] = 0;
+}
+
 void data_string_need(struct data_string *result, int need)
 {
   int total_need = result->len + need;
@@ -1781,47 +1894,40 @@ int option_space_encapsulate (struct data_string *result,
   return 0;
 }
 
+struct encapsulation_state {
+  struct data_string *result;
+  int status;
+};
+
+static void encapsulate_option (struct option_cache *oc,
+				struct option_state *options,
+				struct option_space *u, void *stuff)
+{
+  struct encapsulation_state *es = (struct encapsulation_state *)stuff;
+
+  store_option (es->result, u, oc);
+  es->status = 1;
+}
+
 int hashed_option_space_encapsulate (struct data_string *result,
 				     struct option_state *options,
 				     struct option_space *option_space)
 {
-  pair p, *hash;
-  int status;
-  int i;
-
-  if (option_space->index >= options->option_space_count)
-    return 0;
+  struct encapsulation_state es;
 
-  hash = (pair *)options->option_spaces [option_space->index];
-  if (!hash)
-    return 0;
-
-  status = 0;
-  for (i = 0; i < OPTION_HASH_SIZE; i++)
-    {
-      for (p = hash [i]; p; p = p->cdr)
-	{
-	  store_option (result, option_space,
-			(struct option_cache *)p->car);
-	  status = 1;
-	}
-    }
-  return status;
+  es.result = result;
+  es.status = 0;
+  option_space_foreach (options, option_space, &es, encapsulate_option);
+  return es.status;
 }
 
 int nwip_option_space_encapsulate (struct data_string *result,
 				   struct option_state *options,
 				   struct option_space *option_space)
 {
-  pair ocp;
-  int status;
-  struct option_chain_head *head;
+  struct encapsulation_state es;
 
-  if (option_space->index >= options->option_space_count)
-    return 0;
-  head = ((struct option_chain_head *)
-	  options->option_spaces [nwip_option_space.index]);
-  if (!head || !head->first)
+  if (!option_space_present (options, nwip_option_space.index))
     return 0;
 
   /* Preallocate space at the beginning of the buffer for the stupid
@@ -1831,21 +1937,16 @@ int nwip_option_space_encapsulate (struct data_string *result,
   result->len = 2;
   result->data = &result->buffer->data[0];
 
-  status = 0;
-  for (ocp = head->first; ocp; ocp = ocp->cdr)
-    {
-      store_option (result, option_space,
-		    (struct option_cache *)ocp->car);
-      status = 1;
-    }
+  es.result = result;
+  es.status = 0;
+  option_space_foreach (options, option_space, &es, encapsulate_option);
 
   /* If there's no data, the nwip suboption is supposed to contain
      a suboption saying there's no data. */
-  if (!status)
+  if (!es.status)
     {
       result->buffer->data[0] = 1;
       result->buffer->data[1] = 0;
-      status = 1;
     }
   else
     {
@@ -1853,37 +1954,35 @@ int nwip_option_space_encapsulate (struct data_string *result,
       result->buffer->data[1] = 0;
     }
 
-  return status;
+  return 1;
+}
+
+static void fqdn_suboption (struct option_cache *oc,
+			    struct option_state *options,
+			    struct option_space *u, void *stuff)
+{
+  struct data_string **results = (struct data_string **)stuff;
+
+  if (oc->option->code <= FQDN_SUBOPTION_COUNT)
+    results[oc->option->code] = &oc->data;
 }
 
 int fqdn_option_space_encapsulate (struct data_string *result,
 				   struct option_state *options,
 				   struct option_space *option_space)
 {
-  pair ocp;
   struct data_string *results[FQDN_SUBOPTION_COUNT + 1];
   unsigned len;
   struct buffer *bp = (struct buffer *)0;
-  struct option_chain_head *head;
 
   /* If there's no FQDN option_space, don't encapsulate. */
-  if (fqdn_option_space.index >= options->option_space_count)
-    return 0;
-  head = ((struct option_chain_head *)
-	  options->option_spaces [fqdn_option_space.index]);
-  if (!head || !head->first)
+  if (!option_space_present (options, fqdn_option_space.index))
     return 0;
 
   /* Figure out the values of all the suboptions. */
   memset (results, 0, sizeof results);
-  for (ocp = head->first; ocp; ocp = ocp->cdr)
-    {
-      struct option_cache *oc = (struct option_cache *)(ocp->car);
-      if (oc->option->code > FQDN_SUBOPTION_COUNT)
-	continue;
-      results[oc->option->code] = &oc->data;
-    }
-  len = 4 + results [FQDN_FQDN]->len;
+  option_space_foreach (options, &fqdn_option_space, results, fqdn_suboption);
+  len = 4 + (results [FQDN_FQDN] ? results [FQDN_FQDN]->len : 0);
   /* Save the contents of the option in a buffer. */
   bp = buffer_allocate(len);
   result->buffer = bp;
@@ -1954,14 +2053,56 @@ int dns_fqdn_to_wire (unsigned char *in,
   return out - in;
 }
 
+struct layered_foreach {
+  struct option_state *top;
+  struct option_state *layer;
+  void *stuff;
+  void (*func) (struct option_cache *, struct option_state *,
+		struct option_space *, void *);
+};
+
+/* Pass an option from one layer of a layered option_state on to the
+ * caller's function, unless a layer above it has an option with the same
+ * code, or it's a mask.
+ */
+static void layered_foreach_func (struct option_cache *oc,
+				  struct option_state *options,
+				  struct option_space *u, void *stuff)
+{
+  struct layered_foreach *lf = (struct layered_foreach *)stuff;
+  struct option_state *up;
+
+  if (OPTION_MASKED (oc))
+    return;
+  for (up = lf->top; up != lf->layer; up = up->parent)
+    {
+      if ((*u->lookup_func) (u, up, oc->option->code))
+	return;
+    }
+  (*lf->func) (oc, lf->top, u, lf->stuff);
+}
+
 void option_space_foreach (struct option_state *options,
 			   struct option_space *u, void *stuff,
 			   void (*func) (struct option_cache *,
 					 struct option_state *,
 					 struct option_space *, void *))
 {
-  if (u->foreach)
-    (*u->foreach) (options, u, stuff, func);
+  struct layered_foreach lf;
+
+  if (!u->foreach)
+    return;
+  if (!options->parent || !u->lookup_func)
+    {
+      (*u->foreach) (options, u, stuff, func);
+      return;
+    }
+
+  lf.top = options;
+  lf.stuff = stuff;
+  lf.func = func;
+  for (lf.layer = options; lf.layer; lf.layer = lf.layer->parent)
+    (*u->foreach) (lf.layer, u, &lf, layered_foreach_func);
 }
 
 void suboption_foreach (struct option_state *options,
@@ -1974,8 +2115,7 @@ void suboption_foreach (struct option_state *options,
 {
   struct option_space *option_space =
     find_option_option_space (oc->option, vsname);
-  if (option_space->foreach)
-    (*option_space->foreach) (options, option_space, stuff, func);
+  option_space_foreach (options, option_space, stuff, func);
 }
 
 void hashed_option_space_foreach (struct option_state *options,
@@ -2042,25 +2182,12 @@ int linked_option_space_encapsulate (struct data_string *result,
 				     struct option_state *options,
 				     struct option_space *option_space)
 {
-  int status;
-  pair oc;
-  struct option_chain_head *head;
-
-  if (option_space->index >= options->option_space_count)
-    return 0;
-  head = ((struct option_chain_head *)
-	  options->option_spaces [option_space->index]);
-  if (!head)
-    return 0;
+  struct encapsulation_state es;
 
-  status = 0;
-  for (oc = head->first; oc; oc = oc->cdr)
-    {
-      store_option (result, option_space,
-		    (struct option_cache *)(oc->car));
-      status = 1;
-    }
-  return status;
+  es.result = result;
+  es.status = 0;
+  option_space_foreach (options, option_space, &es, encapsulate_option);
+  return es.status;
 }
 
 void delete_linked_option (struct option_space *option_space,
@@ -2088,6 +2215,30 @@ void delete_linked_option (struct option_space *option_space,
     }
 }
 
+void linked_option_state_dereference(struct option_space *option_space,
+				     struct option_state *options)
+{
+  struct option_chain_head *head;
+  pair car, next;
+
+  if (option_space->index >= options->option_space_count)
+    return;
+  head = ((struct option_chain_head *)
+	  options->option_spaces [option_space->index]);
+  if (!head)
+    return;
+  for (car = head->first; car; car = car->cdr)
+    option_cache_hold((struct option_cache *)car->car);
+  for (car = head->first; car; car = next)
+    {
+      next = car->cdr;
+      option_cache_release((struct option_cache *)car->car);
+      free(car);
+    }
+  free(head);
+  options->option_spaces[option_space->index] = 0;
+}
+
 struct option_cache *lookup_linked_option (struct option_space *option_space,
 					   struct option_state *options,
 					   unsigned code)
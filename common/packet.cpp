@@ -148,6 +148,7 @@ void assemble_udp_ip_header(struct interface_info *interface,
   struct udphdr udp;
 
   /* Fill out the IP header */
+  memset(&ip, 0, sizeof ip);
   IP_V_SET(&ip, 4);
   IP_HL_SET(&ip, 20);
   ip.ip_tos = IPTOS_LOWDELAY;
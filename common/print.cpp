@@ -183,7 +183,7 @@ char *print_hw_addr (int htype,
 		     int hlen,
 		     unsigned char *data)
 {
-  static char habuf [49];
+  static __thread char habuf [49];
   char *s;
   int i;
 
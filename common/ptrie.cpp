@@ -0,0 +1,267 @@
+/* ptrie.cpp
+ *
+ * Path-compressed binary trie for longest-prefix matching of IPv4 and
+ * IPv6 addresses.
+ */
+
+/* Copyright (c) 2009 Nominum, Inc.   All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Nominum nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NOMINUM AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL NOMINUM OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef lint
+static char ocopyright[] __attribute__((unused)) =
+  "$Id: ptrie.cpp,v 1.1 2009/10/09 17:40:12 mellon Exp $ Copyright (c) 2009 Nominum, Inc.  All rights reserved.\n";
+#endif /* not lint */
+
+#include "dhcpd.h"
+
+/* Each node holds a prefix and the bit position at which its children
+ * diverge; nodes with no value are glue nodes created where two prefixes
+ * part ways.   Because single-child chains are never created, the depth of
+ * the trie is bounded by the number of distinct prefixes along a path rather
+ * than by the address length.
+ */
+
+#define PTRIE_BIT(key, bit) (((key)[(bit) >> 3] >> (7 - ((bit) & 7))) & 1)
+
+static struct ptrie_node *ptrie_node_create(const unsigned char *key,
+					    unsigned bitlen, void *value)
+{
+  struct ptrie_node *node;
+
+  node = (struct ptrie_node *)safemalloc(sizeof *node);
+  memset(node, 0, sizeof *node);
+  memcpy(node->key, key, (bitlen + 7) / 8);
+  node->bitlen = bitlen;
+  node->value = value;
+  return node;
+}
+
+/* Return nonzero if the first bitlen bits of a and b are the same. */
+static int ptrie_prefix_match(const unsigned char *a, const unsigned char *b,
+			      unsigned bitlen)
+{
+  unsigned bytes = bitlen >> 3;
+  unsigned mask;
+
+  if (bytes && memcmp(a, b, bytes))
+    return 0;
+  if (!(bitlen & 7))
+    return 1;
+  mask = (0xff00 >> (bitlen & 7)) & 0xff;
+  return !((a[bytes] ^ b[bytes]) & mask);
+}
+
+/* Find the first bit at which a and b differ, looking no further than
+ * maxbit.
+ */
+static unsigned ptrie_differ_bit(const unsigned char *a, const unsigned char *b,
+				 unsigned maxbit)
+{
+  unsigned i, bit;
+  unsigned char r;
+
+  for (i = 0; i * 8 < maxbit; i++)
+    {
+      r = a[i] ^ b[i];
+      if (!r)
+	continue;
+      for (bit = i * 8; !(r & 0x80); r <<= 1)
+	bit++;
+      return bit < maxbit ? bit : maxbit;
+    }
+  return maxbit;
+}
+
+struct ptrie *ptrie_create(unsigned maxbits)
+{
+  struct ptrie *trie;
+
+  trie = (struct ptrie *)safemalloc(sizeof *trie);
+  memset(trie, 0, sizeof *trie);
+  trie->maxbits = maxbits;
+  return trie;
+}
+
+/* Replace node with nouveau in node's parent (or at the root). */
+static void ptrie_replace(struct ptrie *trie, struct ptrie_node *node,
+			  struct ptrie_node *nouveau)
+{
+  struct ptrie_node *parent = node->parent;
+
+  nouveau->parent = parent;
+  if (!parent)
+    trie->root = nouveau;
+  else if (parent->child[1] == node)
+    parent->child[1] = nouveau;
+  else
+    parent->child[0] = nouveau;
+  node->parent = nouveau;
+}
+
+/* Add a prefix to the trie.   Returns ISC_R_EXISTS if the same prefix is
+ * already there.
+ */
+isc_result_t ptrie_insert(struct ptrie *trie, const unsigned char *key,
+			  unsigned bitlen, void *value)
+{
+  struct ptrie_node *node, *nouveau, *glue;
+  unsigned differ, check;
+
+  if (bitlen > trie->maxbits || !value)
+    return ISC_R_INVALIDARG;
+
+  if (!trie->root)
+    {
+      trie->root = ptrie_node_create(key, bitlen, value);
+      trie->count++;
+      return ISC_R_SUCCESS;
+    }
+
+  /* Walk down as far as the key will take us. */
+  node = trie->root;
+  while (node->bitlen < bitlen)
+    {
+      struct ptrie_node *next = node->child[PTRIE_BIT(key, node->bitlen)];
+      if (!next)
+	break;
+      node = next;
+    }
+
+  /* Figure out where the key parts ways with what we found, and back up
+   * to the node above that point.
+   */
+  check = node->bitlen < bitlen ? node->bitlen : bitlen;
+  differ = ptrie_differ_bit(key, node->key, check);
+  while (node->parent && node->parent->bitlen >= differ)
+    node = node->parent;
+
+  if (differ == bitlen && node->bitlen == bitlen)
+    {
+      if (node->value)
+	return ISC_R_EXISTS;
+      node->value = value;
+      trie->count++;
+      return ISC_R_SUCCESS;
+    }
+
+  nouveau = ptrie_node_create(key, bitlen, value);
+  trie->count++;
+
+  /* The new prefix goes below the node we found. */
+  if (node->bitlen == differ)
+    {
+      nouveau->parent = node;
+      node->child[PTRIE_BIT(key, node->bitlen)] = nouveau;
+      return ISC_R_SUCCESS;
+    }
+
+  /* The new prefix covers the node we found. */
+  if (bitlen == differ)
+    {
+      ptrie_replace(trie, node, nouveau);
+      nouveau->child[PTRIE_BIT(node->key, bitlen)] = node;
+      return ISC_R_SUCCESS;
+    }
+
+  /* The two diverge somewhere in between, so we need a glue node. */
+  glue = ptrie_node_create(key, differ, (void *)0);
+  ptrie_replace(trie, node, glue);
+  glue->child[PTRIE_BIT(key, differ)] = nouveau;
+  glue->child[!PTRIE_BIT(key, differ)] = node;
+  nouveau->parent = glue;
+  return ISC_R_SUCCESS;
+}
+
+/* Find the value of the longest prefix that covers a full-length key. */
+void *ptrie_lookup(struct ptrie *trie, const unsigned char *key)
+{
+  struct ptrie_node *node, *best = 0;
+
+  if (!trie)
+    return 0;
+  for (node = trie->root; node; )
+    {
+      if (!ptrie_prefix_match(node->key, key, node->bitlen))
+	break;
+      if (node->value)
+	best = node;
+      if (node->bitlen >= trie->maxbits)
+	break;
+      node = node->child[PTRIE_BIT(key, node->bitlen)];
+    }
+  return best ? best->value : 0;
+}
+
+/* Find the value stored for exactly this prefix, if any. */
+void *ptrie_find_exact(struct ptrie *trie, const unsigned char *key,
+		       unsigned bitlen)
+{
+  struct ptrie_node *node;
+
+  if (!trie)
+    return 0;
+  for (node = trie->root; node && node->bitlen < bitlen; )
+    node = node->child[PTRIE_BIT(key, node->bitlen)];
+  if (node && node->bitlen == bitlen &&
+      ptrie_prefix_match(node->key, key, bitlen))
+    return node->value;
+  return 0;
+}
+
+static void ptrie_free_nodes(struct ptrie_node *node)
+{
+  if (!node)
+    return;
+  ptrie_free_nodes(node->child[0]);
+  ptrie_free_nodes(node->child[1]);
+  free(node);
+}
+
+void ptrie_free(struct ptrie *trie)
+{
+  if (!trie)
+    return;
+  ptrie_free_nodes(trie->root);
+  free(trie);
+}
+
+/* Make a newly built trie visible to readers in place of the old one, and
+ * return the old one.   The barrier ensures that a reader that sees the new
+ * pointer also sees the nodes it points to.   The caller may only free the
+ * old trie once no reader can still be looking at it.
+ */
+struct ptrie *ptrie_publish(struct ptrie **where, struct ptrie *trie)
+{
+  __sync_synchronize();
+  return __sync_lock_test_and_set(where, trie);
+}
+
+/* Local Variables:  */
+/* mode:C++ */
+/* c-file-style:"gnu" */
+/* end: */
@@ -46,19 +46,41 @@ static char copyright[] __attribute__((unused)) =
 #include "dhc++/v6listener.h"
 
 static isc_result_t receive_packet_worker(int sock);
-static int sockfd;
-static int sock4fd;
+static int sockfd = -1;
+static int sock4fd = -1;
+
+/* While the sockets are being handed to another process, nothing is read
+ * from them here; see dhcp_sockets_pause().
+ */
+static int sockets_paused;
+
+/* If set, DHCPv4 sockets are opened with SO_REUSEPORT, so that more than
+ * one can listen on the port, each getting a share of the packets.
+ */
+int dhcpv4_socket_reuseport;
+
+/* The address the DHCPv4 packet this thread is handling was sent to, or
+ * INADDR_ANY if that isn't known.
+ */
+__thread struct in_addr dhcpv4_packet_dest;
+
+/* If set, DHCPv6 packets are handed to this as they are, instead of being
+ * decoded for the interface's listeners.
+ */
+isc_result_t (*dhcpv6_packet_hook)(struct interface_info *,
+				   struct sockaddr_in6 *,
+				   unsigned char *, ssize_t);
 
 static int
 if_readsocket (void *v)
 {
-  return sockfd;
+  return sockets_paused ? -1 : sockfd;
 }
 
 static int
 if_read4socket(void *v)
 {
-  return sock4fd;
+  return sockets_paused ? -1 : sock4fd;
 }
 
 static isc_result_t
@@ -67,13 +89,14 @@ receive_ipv4_packet(void *v)
   return receive_packet_worker(sock4fd);
 }
 
-/* Registration routine for V4-only socket, if needed. */
+/* Open a V4-only socket on the DHCPv4 port, without registering it. */
 
-void
-dhcpv4_socket_setup(void)
+int
+dhcpv4_socket_open(void)
 {
   struct sockaddr_in name;
   int flag;
+  int fd;
 
   /* Set up the address we're going to bind to. */
   memset(&name, 0, sizeof name);
@@ -83,24 +106,31 @@ dhcpv4_socket_setup(void)
   name.sin_family = AF_INET;
   name.sin_port = listen_port;
 
-  if ((sock4fd = socket(PF_INET, SOCK_DGRAM, 0)) < 0)
+  if ((fd = socket(PF_INET, SOCK_DGRAM, 0)) < 0)
     {
       log_fatal("Cannot create DHCPv4 socket: %m");
     }
 
   flag = 1;
-  if (setsockopt(sock4fd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof flag) < 0)
+  if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof flag) < 0)
     {
       log_fatal("Unable to set SO_REUSEADDR sockopt: %m");
     }
-  if (bind(sock4fd, (struct sockaddr *)&name, sizeof name) < 0)
+#ifdef SO_REUSEPORT
+  if (dhcpv4_socket_reuseport &&
+      setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &flag, sizeof flag) < 0)
+    {
+      log_fatal("Unable to set SO_REUSEPORT sockopt: %m");
+    }
+#endif
+  if (bind(fd, (struct sockaddr *)&name, sizeof name) < 0)
     {
       log_fatal("Cannot bind to DHCPv4 address %s/%d: %m",
 		inet_ntoa(name.sin_addr), ntohs(name.sin_port));
     }
 
   flag = 1;
-  if (setsockopt(sock4fd, SOL_SOCKET, SO_BROADCAST, &flag, sizeof flag) < 0)
+  if (setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &flag, sizeof flag) < 0)
     {
       log_fatal("Unable to set SO_BROADCAST sockopt: %m");
     }
@@ -112,28 +142,46 @@ dhcpv4_socket_setup(void)
 #ifdef IP_PKTINFO
   /* Request the ip_pktinfo socket data. */
   flag = 1;
-  if (setsockopt(sock4fd, IPPROTO_IP, IP_PKTINFO, &flag, sizeof flag) < 0)
+  if (setsockopt(fd, IPPROTO_IP, IP_PKTINFO, &flag, sizeof flag) < 0)
     {
       log_fatal("Unable to set IP_PKTINFO sockopt: %m");
     }
 #else
   /* Request the ip_recvif socket data. */
   flag = 1;
-  if (setsockopt(sock4fd, IPPROTO_IP, IP_RECVIF, &flag, sizeof flag) < 0)
+  if (setsockopt(fd, IPPROTO_IP, IP_RECVIF, &flag, sizeof flag) < 0)
     {
       log_fatal("Unable to set IP_RECVIF sockopt: %m");
     }
 
   /* Request the ip_recvif socket data. */
   flag = 1;
-  if (setsockopt(sock4fd, IPPROTO_IP, IP_RECVDSTADDR, &flag, sizeof flag) < 0)
+  if (setsockopt(fd, IPPROTO_IP, IP_RECVDSTADDR, &flag, sizeof flag) < 0)
     {
       log_fatal("Unable to set IP_RECVIF sockopt: %m");
     }
 #endif
 
+  return fd;
+}
+
+/* Registration routine for V4-only socket, if needed. */
+
+void
+dhcpv4_socket_setup(void)
+{
+  sock4fd = dhcpv4_socket_open();
   register_io_object(NULL, if_read4socket, 0, receive_ipv4_packet, 0, 0);
-  return;
+}
+
+/* Read and handle a packet from a DHCPv4 socket that dispatch() doesn't
+ * read, e.g., one of several sharing the port.
+ */
+
+isc_result_t
+dhcpv4_socket_receive(int fd)
+{
+  return receive_packet_worker(fd);
 }
 
 static isc_result_t
@@ -207,6 +255,95 @@ dhcpv6_socket_setup(void)
   register_io_object(0, if_readsocket, 0, receive_packet, 0, 0);
 }
 
+/* Use sockets that some other process set up and passed to us, instead
+ * of making new ones.   They're already bound, and the DHCPv6 socket is
+ * already in whatever multicast groups it needs to be in.
+ */
+void
+dhcpv4_socket_adopt(int fd)
+{
+  sock4fd = fd;
+  register_io_object(NULL, if_read4socket, 0, receive_ipv4_packet, 0, 0);
+}
+
+void
+dhcpv6_socket_adopt(int fd)
+{
+  sockfd = fd;
+  register_io_object(0, if_readsocket, 0, receive_packet, 0, 0);
+}
+
+/* The descriptors of the sockets, or -1 if they haven't been set up. */
+int
+dhcpv4_socket_fd(void)
+{
+  return sock4fd;
+}
+
+int
+dhcpv6_socket_fd(void)
+{
+  return sockfd;
+}
+
+/* Stop or start reading packets.   Packets that come in while reading is
+ * stopped wait in the socket buffers for whoever reads next; replies can
+ * still be sent.
+ */
+void
+dhcp_sockets_pause(int pause)
+{
+  sockets_paused = pause;
+}
+
+/* Make a nonblocking socket listening for TCP connections on a port, on
+ * any address of the given family.   Returns -1, with errno set, if that
+ * can't be done, e.g., if another process is still listening there.
+ */
+int
+tcp_listener_setup(int family, u_int16_t port)
+{
+  struct sockaddr_storage name;
+  struct sockaddr_in *sin = (struct sockaddr_in *)&name;
+  struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&name;
+  socklen_t len;
+  int fd, flag = 1, err;
+
+  memset(&name, 0, sizeof name);
+  if (family == AF_INET6)
+    {
+#if defined(HAVE_SA_LEN)
+      sin6->sin6_len = sizeof *sin6;
+#endif
+      sin6->sin6_family = AF_INET6;
+      sin6->sin6_port = port;
+      len = sizeof *sin6;
+    }
+  else
+    {
+#if defined(HAVE_SA_LEN)
+      sin->sin_len = sizeof *sin;
+#endif
+      sin->sin_family = AF_INET;
+      sin->sin_port = port;
+      len = sizeof *sin;
+    }
+
+  if ((fd = socket(family, SOCK_STREAM, 0)) < 0)
+    return -1;
+  if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof flag) < 0 ||
+      bind(fd, (struct sockaddr *)&name, len) < 0 ||
+      listen(fd, 16) < 0 ||
+      fcntl(fd, F_SETFL, O_NONBLOCK) < 0 || fcntl(fd, F_SETFD, 1) < 0)
+    {
+      err = errno;
+      close(fd);
+      errno = err;
+      return -1;
+    }
+  return fd;
+}
+
 void
 dhcpv6_multicast_relay_join(struct interface_info *info)
 {
@@ -264,10 +401,22 @@ if_statusprint(struct interface_info *info, const char *status)
 
 ssize_t send_packet(struct interface_info *interface,
 		    void *packet, size_t len, struct sockaddr *to)
+{
+  struct iovec iov;
+
+  iov.iov_base = (caddr_t)packet;
+  iov.iov_len = len;
+  return send_packetv(interface, &iov, 1, to);
+}
+
+/* Send a packet that's in pieces, e.g., a header we made and a message
+ * we're passing along, without copying them together first.
+ */
+ssize_t send_packetv(struct interface_info *interface,
+		     struct iovec *iov, int iovcnt, struct sockaddr *to)
 {
   int sent;
   char buf[128];
-  struct iovec iov;
   struct msghdr mh;
   struct cmsghdr *cmh;
   unsigned char cmsg_buf[1024];
@@ -277,11 +426,10 @@ ssize_t send_packet(struct interface_info *interface,
   int need_sendif = 0;
 
   /* Set up msgbuf. */
-  memset(&iov, 0, sizeof iov);
   memset(&mh, 0, sizeof mh);
 	
 #if defined(DEBUG_PACKET)
-  dump_raw((unsigned char *)packet, len);
+  dump_raw((unsigned char *)iov[0].iov_base, iov[0].iov_len);
 #endif
 
   /* Set up mh.msg_name: the equivalent of the to address in sendto(). */
@@ -299,10 +447,8 @@ ssize_t send_packet(struct interface_info *interface,
     mh.msg_namelen = sizeof (struct sockaddr_in6);
 	
   /* This is equivalent to the buf argument in recvfrom. */
-  mh.msg_iov = &iov;
-  mh.msg_iovlen = 1;
-  iov.iov_base = (caddr_t)packet;
-  iov.iov_len = len;
+  mh.msg_iov = iov;
+  mh.msg_iovlen = iovcnt;
 
   /* If we are sending to an IPv6 link-local address, we need to specify
    * the interface on which to send.
@@ -342,7 +488,9 @@ ssize_t send_packet(struct interface_info *interface,
       mh.msg_controllen = CMSG_SPACE(sizeof *pktin);
 #else
 # if defined(NEED_BPF)
-      bpf_send_packet(interface, packet, len, (struct sockaddr_in *)to);
+      /* DHCPv4 packets are only ever sent in one piece. */
+      bpf_send_packet(interface, iov[0].iov_base, iov[0].iov_len,
+		      (struct sockaddr_in *)to);
 # else
       log_info("need to set send interface, but can't.");
 # endif
@@ -377,11 +525,11 @@ ssize_t send_packet(struct interface_info *interface,
       /* Assemble everything into a single buffer. */
       mh.msg_control = cmsg_buf;
       mh.msg_controllen = CMSG_SPACE(sizeof *pktin6);
-      log_info("Specifying outgoing interface: %d",
+      log_debug("Specifying outgoing interface: %d",
 	       interface->index);
     }
 
-  log_info("Sending to %s/%d%s%s",
+  log_debug("Sending to %s/%d%s%s",
 	   inet_ntop(to->sa_family,
 		     (to->sa_family == AF_INET
 		      ? (char *)&((struct sockaddr_in *)to)->sin_addr
@@ -474,6 +622,8 @@ receive_packet_worker(int sock)
       goto again;
     }
 
+  dhcpv4_packet_dest.s_addr = INADDR_ANY;
+
   /* Loop through the control message headers looking for
    * the IPV6_PKTINFO or IP_PKTINFO data.
    */
@@ -499,6 +649,7 @@ receive_packet_worker(int sock)
 	  memcpy(&pktinfo, CMSG_DATA(cmh), sizeof pktinfo);
 	  ifindex = pktinfo.ipi_ifindex;
 	  got_ifindex = 1;
+	  dhcpv4_packet_dest = pktinfo.ipi_addr;
 #endif
 #ifdef IP_RECVIF
 	}
@@ -532,7 +683,9 @@ receive_packet_worker(int sock)
   return ISC_R_SUCCESS;
 
  out:
-  if (from.sa.sa_family == AF_INET6)
+  if (from.sa.sa_family == AF_INET6 && dhcpv6_packet_hook)
+    return (*dhcpv6_packet_hook)(iface, &from.in6, u.packbuf, result);
+  else if (from.sa.sa_family == AF_INET6)
     {
       if (iface->num_v6listeners > 0)
 	{
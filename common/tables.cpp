@@ -222,6 +222,7 @@ struct const_option predef_options[] = {
   { "server-update", "f",			&fqdn_option_space, 2 },
   { "no-client-update", "f",			&fqdn_option_space, 1 },
 
+  { "relay-id", "X",				&dhcpv6_option_space, 53 },
   { "fqdn", "Bd",				&dhcpv6_option_space, 39 },
   { "information-refresh_time", "x",		&dhcpv6_option_space, 32 },
   { "nis+-domain", "d",				&dhcpv6_option_space, 30 },
@@ -533,6 +534,8 @@ void initialize_common_option_spaces()
   dhcp_option_space.lookup_func = lookup_hashed_option;
   dhcp_option_space.save_func = save_hashed_option;
   dhcp_option_space.delete_func = delete_hashed_option;
+  dhcp_option_space.option_state_dereference =
+    hashed_option_state_dereference;
   dhcp_option_space.encapsulate = hashed_option_space_encapsulate;
   dhcp_option_space.foreach = hashed_option_space_foreach;
   dhcp_option_space.decode = parse_option_buffer;
@@ -549,6 +552,8 @@ void initialize_common_option_spaces()
   dhcpv6_option_space.lookup_func = lookup_hashed_option;
   dhcpv6_option_space.save_func = save_hashed_option;
   dhcpv6_option_space.delete_func = delete_hashed_option;
+  dhcpv6_option_space.option_state_dereference =
+    hashed_option_state_dereference;
   dhcpv6_option_space.encapsulate = hashed_option_space_encapsulate;
   dhcpv6_option_space.foreach = hashed_option_space_foreach;
   dhcpv6_option_space.decode = parse_twobyte_option_buffer;
@@ -565,6 +570,8 @@ void initialize_common_option_spaces()
   nwip_option_space.lookup_func = lookup_linked_option;
   nwip_option_space.save_func = save_linked_option;
   nwip_option_space.delete_func = delete_linked_option;
+  nwip_option_space.option_state_dereference =
+    linked_option_state_dereference;
   nwip_option_space.encapsulate = nwip_option_space_encapsulate;
   nwip_option_space.foreach = linked_option_space_foreach;
   nwip_option_space.decode = parse_option_buffer;
@@ -583,6 +590,8 @@ void initialize_common_option_spaces()
   fqdn_option_space.lookup_func = lookup_linked_option;
   fqdn_option_space.save_func = save_linked_option;
   fqdn_option_space.delete_func = delete_linked_option;
+  fqdn_option_space.option_state_dereference =
+    linked_option_state_dereference;
   fqdn_option_space.encapsulate = fqdn_option_space_encapsulate;
   fqdn_option_space.foreach = linked_option_space_foreach;
   fqdn_option_space.decode = fqdn_option_space_decode;
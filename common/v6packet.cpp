@@ -54,6 +54,9 @@ void make_ia_option(struct data_string *output, struct ia *ia, int clientp)
   struct ia_addr *addr;
   struct option_cache *addropts = 0;
   struct option_cache *oc;
+  int pd = ia->type == DHCPV6_IA_PD;
+  unsigned code = pd ? DHCPV6_IA_PREFIX : DHCPV6_IA_ADDRESS;
+  unsigned len = pd ? 25 : 24;
 
   output->buffer = buffer_allocate(40);
 	
@@ -64,7 +67,7 @@ void make_ia_option(struct data_string *output, struct ia *ia, int clientp)
   output->len = 12;
 
   /* Make a space in the ia->send_options structure for the IA_ADDRESS
-   * options, but only if there are IA_ADDRESS options.
+   * (or, in an IA_PD, IA_PREFIX) options, but only if there are any.
    */
   if (ia->addresses)
     {
@@ -75,8 +78,7 @@ void make_ia_option(struct data_string *output, struct ia *ia, int clientp)
 	  /* Delete any stale IA_ADDRESS options from the options
 	   * for this IA.
 	   */
-	  delete_option(&dhcpv6_option_space,
-			ia->send_options, DHCPV6_IA_ADDRESS);
+	  delete_option(&dhcpv6_option_space, ia->send_options, code);
 	}
     }
 
@@ -88,25 +90,44 @@ void make_ia_option(struct data_string *output, struct ia *ia, int clientp)
       /* Make an option cache for this IA_ADDRESS option. */
       oc = (struct option_cache *)safemalloc(sizeof *oc);
       memset(oc, 0, sizeof *oc);
-      oc->data.buffer = buffer_allocate(24);
+      oc->data.buffer = buffer_allocate(len);
       oc->data.data = oc->data.buffer->data;
 
-      /* Stash the IA_ADDRESS address. */
-      memcpy(oc->data.buffer->data, addr->address.iabuf, 16);
-
-      /* Client always sets preferred and valid lifetimes to zero. */
-      if (clientp)
+      /* An IA_PREFIX has the lifetimes first, preferred then valid
+       * (RFC3633 section 10), then the prefix length and prefix.
+       */
+      if (pd)
 	{
-	  memset(&oc->data.buffer->data[16], 0, 8);
+	  if (clientp)
+	    memset(oc->data.buffer->data, 0, 8);
+	  else
+	    {
+	      putULong(&oc->data.buffer->data[0],
+		       addr->preferred - cur_time);
+	      putULong(&oc->data.buffer->data[4], addr->valid - cur_time);
+	    }
+	  oc->data.buffer->data[8] = addr->prefixlen;
+	  memcpy(&oc->data.buffer->data[9], addr->address.iabuf, 16);
 	}
       else
 	{
-	  putULong(&oc->data.buffer->data[16],
-		   addr->valid - cur_time);
-	  putULong(&oc->data.buffer->data[20],
-		   addr->preferred - cur_time);
+	  /* Stash the IA_ADDRESS address. */
+	  memcpy(oc->data.buffer->data, addr->address.iabuf, 16);
+
+	  /* Client always sets preferred and valid lifetimes to zero. */
+	  if (clientp)
+	    {
+	      memset(&oc->data.buffer->data[16], 0, 8);
+	    }
+	  else
+	    {
+	      putULong(&oc->data.buffer->data[16],
+		       addr->valid - cur_time);
+	      putULong(&oc->data.buffer->data[20],
+		       addr->preferred - cur_time);
+	    }
 	}
-      oc->data.len = 24;
+      oc->data.len = len;
 
       /* If this IA_ADDRESS has options, encapsulate them. */
       if (addr->send_options &&
@@ -116,7 +137,7 @@ void make_ia_option(struct data_string *output, struct ia *ia, int clientp)
 	  log_fatal ("Couldn't encapsulate IA_ADDRESS");
 	}
 
-      oc->option = find_option(&dhcpv6_option_space, DHCPV6_IA_ADDRESS);
+      oc->option = find_option(&dhcpv6_option_space, code);
 
       /* Make a linked list of the IA_ADDRESS options.   When we
        * get to the end, stash it in ia->send_options.
@@ -318,12 +339,19 @@ decode_dhcpv6_packet(const unsigned char *packet, unsigned len, struct dhcpv6_re
 	  log_info("Dropping %s: malformed IA_NA option.", response->name);
 	  return 0;
 	}
+      if (!extract_ias(response, DHCPV6_IA_PD))
+	{
+	  log_info("Dropping %s: malformed IA_PD option.", response->name);
+	  return 0;
+	}
     }
   else
     {
 
-      /* XXX extract the link address, peer address and hop count. */
       response->xid = 0;
+      response->hop_count = packet[1];
+      memcpy(&response->link_address, &packet[2], 16);
+      memcpy(&response->peer_address, &packet[18], 16);
 
       /* Find the encapsulated message. */
       struct option_cache *oc =
@@ -340,8 +368,9 @@ decode_dhcpv6_packet(const unsigned char *packet, unsigned len, struct dhcpv6_re
   return response;
 }
 
-/* Given an option_state structure, find all the IA_NA options.   Create
- * ia structures from them, and parse out any IA_ADDRESS suboptions.
+/* Given an option_state structure, find all the IA_NA (or IA_PD) options.
+ * Create ia structures from them, and parse out any IA_ADDRESS (or
+ * IA_PREFIX) suboptions.
  */
 
 int
@@ -368,6 +397,7 @@ extract_ias(struct dhcpv6_response *response, int code)
       memset(nouveau, 0, sizeof nouveau);
 
       /* Decode IA_ID. */
+      nouveau->type = code;
       nouveau->id = getULong(optr->data.data);
       nouveau->t1 = getULong(optr->data.data + 4);
       nouveau->t2 = getULong(optr->data.data + 8);
@@ -400,12 +430,54 @@ extract_ias(struct dhcpv6_response *response, int code)
   return 1;
 }
 
+/* Given an IA_PD, extract any IA_PREFIX suboptions into the IA's address
+ * list.
+ */
+static int
+extract_ia_prefixes(struct ia *ia)
+{
+  struct option_cache *optr;
+  struct ia_addr *nouveau;
+
+  for (optr = lookup_option(&dhcpv6_option_space,
+			    ia->recv_options, DHCPV6_IA_PREFIX);
+       optr; optr = optr->next)
+    {
+      /* Lifetimes, prefix length and prefix. */
+      if (optr->data.len < 25 || optr->data.data[8] > 128)
+	return 0;
+
+      nouveau = (struct ia_addr *)safemalloc(sizeof *nouveau);
+      nouveau->preferred = getULong(&optr->data.data[0]);
+      nouveau->valid = getULong(&optr->data.data[4]);
+      nouveau->prefixlen = optr->data.data[8];
+      memcpy(&nouveau->address.iabuf, &optr->data.data[9], 16);
+      nouveau->address.len = 16;
+
+      if (optr->data.len > 25)
+	{
+	  nouveau->recv_options = new_option_state();
+	  if (!decode_option_space(nouveau->recv_options, optr->data.data + 25,
+				   optr->data.len - 25, &dhcpv6_option_space))
+	    return 0;
+	}
+
+      nouveau->ia = ia;
+      nouveau->next = ia->addresses;
+      ia->addresses = nouveau;
+    }
+  return 1;
+}
+
 /* Given an IA, extract any IA_ADDRESS suboptions. */
 int
 extract_ia_addrs(struct ia *ia)
 {
   struct option_cache *option, *optr;
 
+  if (ia->type == DHCPV6_IA_PD)
+    return extract_ia_prefixes(ia);
+
   /* Look for IA_ADDRESS options and de-encapsulate them: */
   option = lookup_option(&dhcpv6_option_space,
 			 ia->recv_options, DHCPV6_IA_ADDRESS);
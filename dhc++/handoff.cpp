@@ -0,0 +1,535 @@
+/* handoff.cpp
+ *
+ * Passing a running process's sockets and state to its replacement.
+ */
+
+/* Copyright (c) 2009 Nominum, Inc.   All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Nominum nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NOMINUM AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL NOMINUM OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef lint
+static char ocopyright[] __attribute__((unused)) =
+  "$Id: handoff.cpp,v 1.1 2009/10/23 18:42:10 mellon Exp $ Copyright (c) 2009 Nominum, Inc.  All rights reserved.\n";
+#endif /* not lint */
+
+#include "dhcpd.h"
+#include <sys/un.h>
+#include "dhc++/handoff.h"
+
+/* The first thing sent is a header, which carries the sockets: a magic
+ * number, which sockets there are, and the length of the state that
+ * follows.
+ */
+#define HANDOFF_MAGIC	0x44484f31			      /* "DHO1" */
+#define HANDOFF_V4	1
+#define HANDOFF_V6	2
+#define HANDOFF_HEADER_LEN	12
+
+/* What the new process sends once it has everything, and what the old
+ * one answers once it has let go of the sockets.
+ */
+#define HANDOFF_READY	'R'
+#define HANDOFF_GO	'G'
+
+/* Timeout selectors. */
+#define HANDOFF_EXIT		0
+#define HANDOFF_ACK_WAIT	1
+
+void handoff_put(struct handoff_buffer *buf, const void *data, unsigned len)
+{
+  u_int8_t *nd;
+
+  if (buf->len + len > buf->size)
+    {
+      buf->size = (buf->size ? buf->size * 2 : 4096);
+      if (buf->size < buf->len + len)
+	buf->size = buf->len + len;
+      nd = (u_int8_t *)safemalloc(buf->size);
+      if (buf->len)
+	memcpy(nd, buf->data, buf->len);
+      free(buf->data);
+      buf->data = nd;
+    }
+  memcpy(&buf->data[buf->len], data, len);
+  buf->len += len;
+}
+
+void handoff_put_uchar(struct handoff_buffer *buf, u_int8_t val)
+{
+  handoff_put(buf, &val, 1);
+}
+
+void handoff_put_ulong(struct handoff_buffer *buf, u_int32_t val)
+{
+  u_int8_t b[4];
+
+  putULong(b, val);
+  handoff_put(buf, b, sizeof b);
+}
+
+void handoff_put_time(struct handoff_buffer *buf, u_int64_t val)
+{
+  handoff_put_ulong(buf, (u_int32_t)(val >> 32));
+  handoff_put_ulong(buf, (u_int32_t)val);
+}
+
+void handoff_get(struct handoff_buffer *buf, void *data, unsigned len)
+{
+  if (buf->error || len > buf->len - buf->offset)
+    {
+      buf->error = 1;
+      memset(data, 0, len);
+      return;
+    }
+  memcpy(data, &buf->data[buf->offset], len);
+  buf->offset += len;
+}
+
+u_int8_t handoff_get_uchar(struct handoff_buffer *buf)
+{
+  u_int8_t val;
+
+  handoff_get(buf, &val, 1);
+  return val;
+}
+
+u_int32_t handoff_get_ulong(struct handoff_buffer *buf)
+{
+  u_int8_t b[4];
+
+  handoff_get(buf, b, sizeof b);
+  return getULong(b);
+}
+
+u_int64_t handoff_get_time(struct handoff_buffer *buf)
+{
+  u_int64_t val = handoff_get_ulong(buf);
+
+  return val << 32 | handoff_get_ulong(buf);
+}
+
+Handoff::Handoff(const char *file)
+{
+  path = file;
+  listener = -1;
+  successor = -1;
+}
+
+Handoff::~Handoff()
+{
+}
+
+static int handoff_address(const char *path, struct sockaddr_un *sun)
+{
+  memset(sun, 0, sizeof *sun);
+  sun->sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof sun->sun_path)
+    {
+      log_error("Handoff socket path %s is too long.", path);
+      return 0;
+    }
+  strcpy(sun->sun_path, path);
+  return 1;
+}
+
+/* Don't let a read or write on the handoff connection wait more than
+ * the given number of seconds; zero means wait as long as it takes.
+ */
+static void handoff_timeout(int fd, int seconds)
+{
+  struct timeval tv;
+
+  tv.tv_sec = seconds;
+  tv.tv_usec = 0;
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv);
+}
+
+/* Make room in a DHCP socket for the packets that arrive while nobody is
+ * reading it: during the handoff itself, and while the new process is
+ * starting up and competing with this one for the CPU.   Beyond
+ * net.core.rmem_max, only root can do that.
+ */
+static void handoff_socket_buffer(int fd)
+{
+  int size = HANDOFF_SOCKET_BUFFER;
+
+#if defined (SO_RCVBUFFORCE)
+  if (!setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof size))
+    return;
+#endif
+  setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof size);
+}
+
+/* Read exactly len bytes, or fail. */
+static int handoff_read(int fd, u_int8_t *data, unsigned len)
+{
+  ssize_t n;
+
+  while (len)
+    {
+      n = read(fd, data, len);
+      if (n < 0 && errno == EINTR)
+	continue;
+      if (n <= 0)
+	return 0;
+      data += n;
+      len -= n;
+    }
+  return 1;
+}
+
+static int handoff_write(int fd, const u_int8_t *data, unsigned len)
+{
+  ssize_t n;
+
+  while (len)
+    {
+      n = send(fd, data, len, MSG_NOSIGNAL);
+      if (n < 0 && errno == EINTR)
+	continue;
+      if (n <= 0)
+	return 0;
+      data += n;
+      len -= n;
+    }
+  return 1;
+}
+
+/* Take over from a process listening on the handoff path, if there is
+ * one.   Returns ISC_R_NOTFOUND if there isn't, in which case the caller
+ * sets up its sockets as usual.   Otherwise, the sockets the other
+ * process was using are returned, or -1 for any it didn't have, and the
+ * caller must use them rather than making its own.
+ */
+isc_result_t Handoff::takeover(int *v4fd, int *v6fd)
+{
+  struct sockaddr_un sun;
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  union {
+    struct cmsghdr hdr;
+    u_int8_t buf[CMSG_SPACE(2 * sizeof (int))];
+  } control;
+  u_int8_t header[HANDOFF_HEADER_LEN];
+  struct handoff_buffer buf;
+  int fds[2], nfds = 0, sock, which;
+  isc_result_t status;
+  u_int8_t ready = HANDOFF_READY, go = 0;
+  ssize_t n;
+
+  *v4fd = *v6fd = -1;
+  if (!handoff_address(path, &sun))
+    return ISC_R_INVALIDARG;
+  if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    {
+      log_error("Can't create handoff socket: %m");
+      return ISC_R_UNEXPECTED;
+    }
+  if (connect(sock, (struct sockaddr *)&sun, sizeof sun) < 0)
+    {
+      close(sock);
+
+      /* A socket left behind by a process that's gone is refused. */
+      if (errno == ENOENT || errno == ECONNREFUSED)
+	return ISC_R_NOTFOUND;
+      log_error("Can't connect to %s: %m", path);
+      return ISC_R_UNEXPECTED;
+    }
+  handoff_timeout(sock, HANDOFF_TIMEOUT);
+
+  memset(&msg, 0, sizeof msg);
+  iov.iov_base = header;
+  iov.iov_len = sizeof header;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof control.buf;
+  do
+    n = recvmsg(sock, &msg, 0);
+  while (n < 0 && errno == EINTR);
+
+  if (n > 0)
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+      if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+	{
+	  nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof (int);
+	  if (nfds > 2)
+	    nfds = 2;
+	  memcpy(fds, CMSG_DATA(cmsg), nfds * sizeof (int));
+	}
+
+  which = getULong(&header[4]);
+  if (n != sizeof header || getULong(header) != HANDOFF_MAGIC ||
+      nfds != !!(which & HANDOFF_V4) + !!(which & HANDOFF_V6))
+    {
+      log_error("Bad handoff header from %s.", path);
+      status = ISC_R_FORMERR;
+      goto out;
+    }
+
+  memset(&buf, 0, sizeof buf);
+  buf.len = buf.size = getULong(&header[8]);
+  if (buf.len)
+    buf.data = (u_int8_t *)safemalloc(buf.len);
+  if (!handoff_read(sock, buf.data, buf.len))
+    {
+      log_error("Short read of handoff state from %s.", path);
+      free(buf.data);
+      status = ISC_R_UNEXPECTEDEND;
+      goto out;
+    }
+  status = restore(&buf);
+  free(buf.data);
+  if (status != ISC_R_SUCCESS)
+    goto out;
+
+  /* Until the old process hears from us, it can still change its mind,
+   * so the sockets aren't ours until it says so.   It answers as soon as
+   * it sees we're ready, or hangs up if it has given up on us, so there's
+   * no need to time out the wait.
+   */
+  if (!handoff_write(sock, &ready, 1))
+    {
+      log_error("Can't tell %s we're ready: %m", path);
+      status = ISC_R_UNEXPECTED;
+      goto out;
+    }
+  handoff_timeout(sock, 0);
+  if (!handoff_read(sock, &go, 1) || go != HANDOFF_GO)
+    {
+      log_error("The process at %s didn't let go of its sockets.", path);
+      status = ISC_R_UNEXPECTED;
+      goto out;
+    }
+  close(sock);
+
+  nfds = 0;
+  if (which & HANDOFF_V4)
+    *v4fd = fds[nfds++];
+  if (which & HANDOFF_V6)
+    *v6fd = fds[nfds++];
+  log_info("Took over %s%s%s from the process at %s.",
+	   *v4fd >= 0 ? "the DHCPv4 socket" : "",
+	   *v4fd >= 0 && *v6fd >= 0 ? " and " : "",
+	   *v6fd >= 0 ? "the DHCPv6 socket" : "no sockets", path);
+  return ISC_R_SUCCESS;
+
+ out:
+  while (nfds)
+    close(fds[--nfds]);
+  close(sock);
+  return status;
+}
+
+/* Listen for a process that wants to take over from this one.   Whatever
+ * is at the path now is either the process we took over from, which
+ * doesn't need it any more, or was left behind.
+ */
+void Handoff::listen()
+{
+  struct sockaddr_un sun;
+
+  if (!handoff_address(path, &sun))
+    return;
+  if (dhcpv4_socket_fd() >= 0)
+    handoff_socket_buffer(dhcpv4_socket_fd());
+  if (dhcpv6_socket_fd() >= 0)
+    handoff_socket_buffer(dhcpv6_socket_fd());
+  unlink(path);
+  if ((listener = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    log_fatal("Can't create handoff socket: %m");
+  if (bind(listener, (struct sockaddr *)&sun, sizeof sun) < 0)
+    log_fatal("Can't bind handoff socket to %s: %m", path);
+  if (::listen(listener, 1) < 0)
+    log_fatal("Can't listen on %s: %m", path);
+  if (fcntl(listener, F_SETFL, O_NONBLOCK) < 0 ||
+      fcntl(listener, F_SETFD, 1) < 0)
+    log_fatal("Can't set up the handoff socket: %m");
+  register_io_object(this, listenfd, 0, incoming, 0, 0);
+  register_io_object(this, successorfd, 0, acknowledged, 0, 0);
+}
+
+int Handoff::listenfd(void *v)
+{
+  Handoff *h = (Handoff *)v;
+
+  return h->successor < 0 ? h->listener : -1;
+}
+
+isc_result_t Handoff::incoming(void *v)
+{
+  Handoff *h = (Handoff *)v;
+  int fd;
+
+  if (h->listener < 0 || (fd = accept(h->listener, 0, 0)) < 0)
+    return ISC_R_SUCCESS;
+  fcntl(fd, F_SETFD, 1);
+  handoff_timeout(fd, HANDOFF_TIMEOUT);
+  h->handoff(fd);
+  return ISC_R_SUCCESS;
+}
+
+/* Stop reading packets, and send our sockets and state to the process
+ * that just connected.   The state is saved after reading stops, so
+ * nothing it covers changes once it's been sent.   The writes block,
+ * but for no more than HANDOFF_TIMEOUT seconds each.
+ */
+void Handoff::handoff(int fd)
+{
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  union {
+    struct cmsghdr hdr;
+    u_int8_t buf[CMSG_SPACE(2 * sizeof (int))];
+  } control;
+  u_int8_t header[HANDOFF_HEADER_LEN];
+  struct handoff_buffer buf;
+  int fds[2], nfds = 0, which = 0;
+  ssize_t n;
+
+  if ((fds[nfds] = dhcpv4_socket_fd()) >= 0)
+    {
+      which |= HANDOFF_V4;
+      nfds++;
+    }
+  if ((fds[nfds] = dhcpv6_socket_fd()) >= 0)
+    {
+      which |= HANDOFF_V6;
+      nfds++;
+    }
+
+  dhcp_sockets_pause(1);
+  memset(&buf, 0, sizeof buf);
+  save(&buf);
+
+  putULong(header, HANDOFF_MAGIC);
+  putULong(&header[4], which);
+  putULong(&header[8], buf.len);
+  memset(&msg, 0, sizeof msg);
+  iov.iov_base = header;
+  iov.iov_len = sizeof header;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  if (nfds)
+    {
+      msg.msg_control = control.buf;
+      msg.msg_controllen = CMSG_SPACE(nfds * sizeof (int));
+      cmsg = CMSG_FIRSTHDR(&msg);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type = SCM_RIGHTS;
+      cmsg->cmsg_len = CMSG_LEN(nfds * sizeof (int));
+      memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof (int));
+    }
+  do
+    n = sendmsg(fd, &msg, 0);
+  while (n < 0 && errno == EINTR);
+
+  if (n != sizeof header || !handoff_write(fd, buf.data, buf.len))
+    {
+      log_error("Can't hand off to the process on %s: %m", path);
+      free(buf.data);
+      close(fd);
+      dhcp_sockets_pause(0);
+      return;
+    }
+  log_info("Handed off sockets and %u bytes of state on %s.",
+	   buf.len, path);
+  free(buf.data);
+  successor = fd;
+  addTimeout(cur_time + NANO_SECONDS(HANDOFF_TIMEOUT), HANDOFF_ACK_WAIT);
+}
+
+int Handoff::successorfd(void *v)
+{
+  return ((Handoff *)v)->successor;
+}
+
+/* The new process either says it's ready, in which case we tell it to go
+ * ahead, drain and exit, or goes away, in which case we start reading
+ * packets again.   Once we've told it to go ahead, the sockets are its.
+ */
+isc_result_t Handoff::acknowledged(void *v)
+{
+  Handoff *h = (Handoff *)v;
+  u_int8_t c = 0, go = HANDOFF_GO;
+  ssize_t n;
+
+  do
+    n = read(h->successor, &c, 1);
+  while (n < 0 && errno == EINTR);
+  if (n == 1 && c == HANDOFF_READY && !handoff_write(h->successor, &go, 1))
+    n = -1;
+  close(h->successor);
+  h->successor = -1;
+  h->clearTimeouts();
+
+  if (n != 1 || c != HANDOFF_READY)
+    {
+      log_error("The new process didn't take over; carrying on.");
+      dhcp_sockets_pause(0);
+      return ISC_R_SUCCESS;
+    }
+
+  log_info("The new process has taken over; exiting in %d seconds.",
+	   HANDOFF_DRAIN_TIME);
+  close(h->listener);
+  h->listener = -1;
+  h->handed_off();
+  h->addTimeout(cur_time + NANO_SECONDS(HANDOFF_DRAIN_TIME), HANDOFF_EXIT);
+  return ISC_R_SUCCESS;
+}
+
+void Handoff::handed_off()
+{
+}
+
+void Handoff::event(const char *evname, int selector, int status)
+{
+  /* Closing the connection without telling the new process to go ahead
+   * makes it give up too, even if it has already said it's ready.
+   */
+  if (selector == HANDOFF_ACK_WAIT)
+    {
+      log_error("The new process didn't take over within %d seconds; "
+		"carrying on.", HANDOFF_TIMEOUT);
+      close(successor);
+      successor = -1;
+      dhcp_sockets_pause(0);
+      return;
+    }
+  log_info("Handoff complete.");
+  exit(0);
+}
+
+/* Local Variables:  */
+/* mode:C++ */
+/* c-file-style:"gnu" */
+/* end: */
@@ -0,0 +1,130 @@
+/* handoff.h
+ *
+ * Definitions for the Handoff class.
+ */
+
+/* Copyright (c) 2009 Nominum, Inc.   All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Nominum nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NOMINUM AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL NOMINUM OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef DHCPP_LIB_HANDOFF_H
+#define DHCPP_LIB_HANDOFF_H
+
+#include "dhc++/timeout.h"
+
+/* How long a process keeps running after it has handed its sockets to a
+ * new one, in seconds, so that work it already started (offers waiting
+ * on a ping check, say) is finished rather than dropped.
+ */
+#define HANDOFF_DRAIN_TIME	10
+
+/* How long, in seconds, either process waits for the other at each step
+ * of a handoff before giving up.   The old process then carries on with
+ * its sockets, so a new one that hangs can't stop it answering.
+ */
+#define HANDOFF_TIMEOUT		5
+
+/* While the state is being sent and restored, neither process reads the
+ * sockets, so packets wait in their receive buffers, which are made this
+ * big as soon as there's a handoff socket, so that they don't overflow.
+ */
+#define HANDOFF_SOCKET_BUFFER	(4 << 20)
+
+/* State being handed off is put into one of these, in network byte
+ * order.   A get past the end returns zeros and sets error, so a restore
+ * routine can read a whole record and then check once.
+ */
+struct handoff_buffer {
+  u_int8_t *data;
+  unsigned len;					  /* Bytes in use. */
+  unsigned size;				/* Bytes allocated. */
+  unsigned offset;			/* Where the next get starts. */
+  int error;
+};
+
+void handoff_put(struct handoff_buffer *buf, const void *data, unsigned len);
+void handoff_put_uchar(struct handoff_buffer *buf, u_int8_t val);
+void handoff_put_ulong(struct handoff_buffer *buf, u_int32_t val);
+void handoff_put_time(struct handoff_buffer *buf, u_int64_t val);
+void handoff_get(struct handoff_buffer *buf, void *data, unsigned len);
+u_int8_t handoff_get_uchar(struct handoff_buffer *buf);
+u_int32_t handoff_get_ulong(struct handoff_buffer *buf);
+u_int64_t handoff_get_time(struct handoff_buffer *buf);
+
+/* Lets a new copy of a program take over from a running one without
+ * dropping packets, e.g., to upgrade it.   The running process listens
+ * on a unix socket; the new one connects to it and is passed the bound
+ * DHCP sockets with SCM_RIGHTS, followed by whatever state the subclass
+ * saves.   The old process stops reading from the sockets before it
+ * sends them, so a packet that comes in during the handoff waits in the
+ * socket buffer for the new process rather than being lost.   Once the
+ * new process has restored the state it says so, and the old one tells
+ * it to go ahead, stops listening, calls handed_off() so that the
+ * subclass can let go of anything else the new process will want, and
+ * exits HANDOFF_DRAIN_TIME seconds later.   The new process doesn't use
+ * the sockets until it's told to go ahead.   If it goes away without
+ * saying it's ready, or takes more than HANDOFF_TIMEOUT seconds over any
+ * step, the old one hangs up and carries on as before.
+ *
+ * Packets aren't answered from when the old process stops reading until
+ * the new one has restored the state, so the stall grows with the size
+ * of the state.
+ */
+class Handoff: public Timeout
+{
+public:
+  Handoff(const char *path);
+  ~Handoff();
+
+  isc_result_t takeover(int *v4fd, int *v6fd);
+  void listen(void);
+  void event(const char *evname, int selector, int status);
+
+protected:
+  virtual void save(struct handoff_buffer *buf) = 0;
+  virtual isc_result_t restore(struct handoff_buffer *buf) = 0;
+  virtual void handed_off(void);
+
+private:
+  static int listenfd(void *v);
+  static isc_result_t incoming(void *v);
+  static int successorfd(void *v);
+  static isc_result_t acknowledged(void *v);
+  void handoff(int fd);
+
+  const char *path;
+  int listener;
+  int successor;		/* Process we've handed off to, if any. */
+};
+
+#endif
+
+/* Local Variables:  */
+/* mode:c++ */
+/* c-file-style:"gnu" */
+/* end: */
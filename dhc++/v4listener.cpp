@@ -73,6 +73,7 @@ isc_result_t DHCPv4Listener::got_packet(struct interface_info *interface,
   if (packet->hlen > sizeof packet->chaddr)
     {
       log_info ("Discarding packet with bogus hlen.");
+      free(decoded_packet);
       return ISC_R_FORMERR;
     }
 
@@ -81,6 +82,8 @@ isc_result_t DHCPv4Listener::got_packet(struct interface_info *interface,
     {
       if (!parse_options(decoded_packet))
 	{
+	  option_state_dereference(&decoded_packet->options);
+	  free(decoded_packet);
 	  return ISC_R_FORMERR;
 	}
 
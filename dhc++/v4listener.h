@@ -38,10 +38,10 @@ class DHCPv4Listener
 {
 public:
   virtual ~DHCPv4Listener();
-  isc_result_t got_packet(struct interface_info *interface,
-			  struct sockaddr_in *from,
-			  unsigned char *contents,
-			  ssize_t length);
+  virtual isc_result_t got_packet(struct interface_info *interface,
+				  struct sockaddr_in *from,
+				  unsigned char *contents,
+				  ssize_t length);
 
 protected:
   virtual void dhcp(struct packet *packet);
@@ -84,7 +84,9 @@ typedef u_int32_t u32;
 # include <linux/time.h>		/* also necessary */
 #else
 # include <net/if_arp.h>
-# include <netpacket/packet.h>
+/* The kernel's version of <netpacket/packet.h>, which also describes
+   the packet socket receive ring. */
+# include <linux/if_packet.h>
 #endif
 
 #include <sys/time.h>		/* gettimeofday()*/
@@ -125,6 +127,7 @@ typedef u_int32_t u32;
 
 #define NEED_V4ONLY_SOCKET
 #define NEED_LPF
+#define NEED_PACKET_ASSEMBLY
 #define NEED_PACKET_DECODING
 #define NEED_USERLAND_FILTER
 /* At the time of this writing, the Linux headers do not follow RFC3542. */
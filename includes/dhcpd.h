@@ -267,11 +267,21 @@ struct option_cache {
  * structure, use delete_option().   Use option_space_encapsulate() to convert
  * an option_state structure into a buffer containing wire-format options. 
  * To go the other way, use decode_option_space().
+ *
+ * An option_state made with new_layered_option_state() starts out empty
+ * and refers to a parent, which it treats as read-only.   Lookups, foreach
+ * and encapsulation see the options in the new state and any in the parent
+ * chain that it doesn't replace; saving an option stores it in the new
+ * state, hiding the parent's option of the same code, and deleting one
+ * masks the parent's copy.   This lets a reply be built as a small layer on
+ * top of configuration scopes without copying them.   The parent must not
+ * be changed or freed while layers refer to it.
  */
 struct option_state {
 	unsigned option_space_count;
 	int site_option_space;
 	unsigned site_code_min;
+	struct option_state *parent;	/* Next scope out, or null. */
 	VOIDPTR option_spaces [1];
 };
 
@@ -295,9 +305,8 @@ struct option_space {
 				   struct option_space *, void *));
 	void (*delete_func) (struct option_space *option_space,
 			     struct option_state *, unsigned);
-	int (*option_state_dereference) (struct option_space *,
-					 struct option_state *,
-					 const char *, int);
+	void (*option_state_dereference) (struct option_space *,
+					  struct option_state *);
 	int (*decode) (struct option_state *,
 		       const unsigned char *, unsigned, struct option_space *);
 	int (*encapsulate) (struct data_string *,
@@ -467,9 +476,23 @@ struct client_config {
 };
 
 /* Relay agent server list. */
+/* How a relay server is doing.   There's one of these for each server
+   address, however many lists the server is on. */
+struct server_health {
+	struct in_addr addr;
+	u_int32_t requests;		/* Requests forwarded to it. */
+	u_int32_t replies;		/* Replies seen from it. */
+	u_int32_t unanswered;		/* Requests since its last reply. */
+	u_int64_t unanswered_since;	/* When the first of those went, ns. */
+	u_int64_t probe;		/* When a server that's down next
+					   gets a request anyway, ns. */
+	int down;			/* Nonzero if it seems to be down. */
+};
+
 struct server_list {
 	struct server_list *next;
 	struct sockaddr_in to;
+	struct server_health *health;
 };
 
 /* DHCPv6 Identity Association address (can be more than one per). */
@@ -477,6 +500,7 @@ struct ia_addr {
 	struct ia_addr *next;		        /* If there's more than one. */
 	struct iaddr address;			     /* Actual IPv6 address. */
 	u_int64_t valid, preferred;	   /* Valid and preferred lifetimes. */
+	unsigned prefixlen;		/* For a prefix in an IA_PD. */
 	struct ia *ia;			      /* IA containing this address. */
 
 	/* Options to send to the server in this IA_ADDR. */
@@ -489,7 +513,8 @@ struct ia_addr {
 /* DHCPv6 Identity Association... */
 struct ia {
 	struct ia *next;    /* If there's more then one IA for an interface. */
-	struct ia_addr *addresses;		    /* Addresses in this IA. */
+	struct ia_addr *addresses;   /* Addresses (or prefixes) in this IA. */
+	int type;		  /* DHCPV6_IA_PD, or IA_NA if zero. */
 	u_int64_t expiry;	   /* Expiry of the earliest preferred time. */
 
 	/* IA Identifier. */
@@ -518,6 +543,9 @@ struct dhcpv6_response {
   u_int8_t message_type;
   const char *name;
   struct dhcpv6_response *outer;
+  u_int8_t hop_count;			/* The rest are only set for */
+  struct in6_addr link_address;		/* relay messages. */
+  struct in6_addr peer_address;
 };
 
 struct dhcpv6_client_context {
@@ -525,6 +553,73 @@ struct dhcpv6_client_context {
 	struct data_string duid;
 };
 
+/* Path-compressed binary trie, keyed on IPv4 or IPv6 prefixes. */
+struct ptrie_node {
+	struct ptrie_node *parent;
+	struct ptrie_node *child [2];
+	unsigned bitlen;		/* Length of the prefix in key. */
+	unsigned char key [16];
+	void *value;			/* Null for glue nodes. */
+};
+
+struct ptrie {
+	struct ptrie_node *root;
+	unsigned maxbits;		/* 32 for IPv4, 128 for IPv6. */
+	unsigned count;
+};
+
+/* The server's bindings, published in a file mapped into memory for
+ * other programs to look up without asking it; see common/leaseshm.cpp.
+ * The file is a header, three arrays of chain heads (by address, by
+ * client identifier and by hardware address), and the records.
+ */
+#define LEASE_SHM_MAGIC		0x444c5331		/* "DLS1" */
+#define LEASE_SHM_ID_MAX	128	     /* Longer identifiers are cut. */
+
+enum lease_shm_kind {
+	LEASE_SHM_NONE,
+	LEASE_SHM_V4,
+	LEASE_SHM_V6,
+	LEASE_SHM_PD
+};
+
+struct lease_shm_header {
+	u_int32_t magic;
+	u_int32_t pid;			/* Of the server. */
+	u_int64_t size;			/* Of the file. */
+	u_int32_t capacity;		/* Records. */
+	u_int32_t buckets;		/* Per index; a power of two. */
+	u_int32_t used;			/* Records ever taken. */
+	volatile u_int32_t seq;		/* Odd while the server writes. */
+	volatile u_int32_t superseded;	/* A newer file has replaced it. */
+	u_int32_t count;		/* Bindings published. */
+	u_int32_t overflow;		/* Bindings left out for want of room. */
+	u_int32_t free;			/* First free record, or 0. */
+};
+
+/* Record numbers start at 1; 0 ends a chain. */
+struct lease_shm_record {
+	u_int32_t addr_next, id_next, hw_next;
+	u_int8_t kind;			/* enum lease_shm_kind. */
+	u_int8_t prefixlen;		/* 32 or 128, or of a delegation. */
+	u_int8_t id_len;
+	u_int8_t has_hw;
+	u_int32_t iaid;
+	u_int64_t expiry;		/* Seconds since the epoch. */
+	u_int8_t address [16];		/* An IPv4 address is the first 4. */
+	u_int8_t hw [6];		/* Ethernet address, if has_hw. */
+	u_int8_t id [LEASE_SHM_ID_MAX];	/* Client identifier, or DUID. */
+};
+
+struct lease_shm {
+	char *path;
+	size_t size;
+	struct lease_shm_header *header;
+	u_int32_t capacity, buckets;
+	u_int32_t *addr_heads, *id_heads, *hw_heads;
+	struct lease_shm_record *records;	/* records [0] is unused. */
+};
+
 /* Information about each network interface. */
 
 struct interface_info {
@@ -647,6 +742,14 @@ typedef unsigned char option_mask [16];
 #define _PATH_DHCRELAY_PID	"/var/run/dhcrelay.pid"
 #endif
 
+#ifndef _PATH_DHCP_SERVER_CONF
+#define _PATH_DHCP_SERVER_CONF	"/etc/dhcp-server.conf"
+#endif
+
+#ifndef _PATH_DHCP_LEASE_TABLE
+#define _PATH_DHCP_LEASE_TABLE	"/var/run/dhcp-server.leases"
+#endif
+
 #ifndef DHCPD_LOG_FACILITY
 #define DHCPD_LOG_FACILITY	LOG_DAEMON
 #endif
@@ -704,6 +807,8 @@ void save_hashed_option(struct option_space *,
 void delete_option(struct option_space *, struct option_state *, unsigned);
 void delete_hashed_option(struct option_space *,
 			  struct option_state *, unsigned);
+void hashed_option_state_dereference(struct option_space *,
+				     struct option_state *);
 void data_string_need(struct data_string *result, int need);
 void data_string_putc(struct data_string *dest, int c);
 void data_string_strcat(struct data_string *dest, const char *s);
@@ -754,6 +859,8 @@ int linked_option_space_encapsulate (struct data_string *,
 				     struct option_space *);
 void delete_linked_option (struct option_space *,
 			   struct option_state *, unsigned);
+void linked_option_state_dereference(struct option_space *,
+				     struct option_state *);
 struct option_cache *lookup_linked_option (struct option_space *,
 					   struct option_state *, unsigned);
 void do_packet(struct interface_info *,
@@ -776,9 +883,11 @@ void data_string_forget (struct data_string *data);
 void data_string_truncate (struct data_string *dp, unsigned len);
 struct dns_host_entry *dns_host_entry_allocate (const char *hostname);
 struct option_state *new_option_state(void);
+struct option_state *new_layered_option_state(struct option_state *);
+void option_state_dereference(struct option_state **);
 pair cons(caddr_t, pair);
 struct option_cache *make_const_option_cache(struct buffer **,
-					     u_int8_t *, unsigned,
+					     const u_int8_t *, unsigned,
 					     struct option *);
 
 /* print.c */
@@ -807,15 +916,57 @@ int token_print_indent (FILE *, int, int,
 void indent_spaces (FILE *, int);
 
 /* socket.c */
+extern isc_result_t (*dhcpv6_packet_hook)(struct interface_info *,
+					  struct sockaddr_in6 *,
+					  unsigned char *, ssize_t);
+extern int dhcpv4_socket_reuseport;
+extern __thread struct in_addr dhcpv4_packet_dest;
 ssize_t send_packet(struct interface_info *, void *, size_t, struct sockaddr *);
+ssize_t send_packetv(struct interface_info *, struct iovec *, int,
+		     struct sockaddr *);
+int dhcpv4_socket_open(void);
 void dhcpv4_socket_setup(void);
+isc_result_t dhcpv4_socket_receive(int fd);
 void dhcpv6_socket_setup(void);
+void dhcpv4_socket_adopt(int fd);
+void dhcpv6_socket_adopt(int fd);
+int dhcpv4_socket_fd(void);
+int dhcpv6_socket_fd(void);
+void dhcp_sockets_pause(int pause);
+int tcp_listener_setup(int family, u_int16_t port);
 void if_statusprint(struct interface_info *info, const char *status);
 void dhcpv6_multicast_relay_join(struct interface_info *info);
 void dhcpv6_multicast_server_join(struct interface_info *info);
 
 /* lpf.cpp */
 void lpf_setup(struct interface_info *info);
+ssize_t lpf_send_packet(struct interface_info *interface,
+			void *packet, size_t len, struct sockaddr_in *to,
+			struct hardware *hto);
+
+/* What the kernel lets through to a DHCP socket; everything else is
+ * dropped before it's read.
+ */
+struct dhcpv4_udp_filter {
+  int requests_only;		/* Drop BOOTREPLYs. */
+  int dhcp_only;		/* Drop packets without the options cookie. */
+  unsigned min_length;		/* Drop shorter messages. */
+  unsigned max_hops;		/* Drop BOOTREQUESTs with this many hops;
+				   256 for no limit. */
+  unsigned shards;		/* If more than one, drop broadcast
+				   BOOTREQUESTs whose client hashes to a
+				   shard other than this one. */
+  unsigned shard;
+};
+
+struct dhcpv6_udp_filter {
+  u_int32_t types;		/* Bit n set: let message type n through. */
+  unsigned max_hops;		/* Drop Relay-Forwards with this many hops;
+				   256 for no limit. */
+};
+
+int lpf_udp_filter_v4(int fd, const struct dhcpv4_udp_filter *filter);
+int lpf_udp_filter_v6(int fd, const struct dhcpv6_udp_filter *filter);
 
 /* bpf.cpp */
 ssize_t bpf_send_packet(struct interface_info *interface,
@@ -826,6 +977,7 @@ extern struct interface_info *interfaces,
 	*dummy_interfaces, *fallback_interface;
 extern struct protocol *protocols;
 extern int quiet_interface_discovery;
+extern int interfaces_invalidated;
 
 extern struct in_addr limited_broadcast;
 extern struct in_addr local_address;
@@ -844,6 +996,9 @@ extern int interface_count;
 extern int interface_max;
 isc_result_t interface_initialize (struct interface_info *);
 void discover_interfaces(void);
+struct interface_info *interface_find_address(struct in_addr addr);
+struct interface_info *interface_find_circuit_id(const u_int8_t *id,
+						 unsigned len);
 isc_result_t got_v4_packet (struct interface_info *ip,
 			    struct sockaddr_in *from,
 			    char *buf, ssize_t length);
@@ -860,7 +1015,7 @@ void interface_snorf (struct interface_info *tmp);
 #define SECONDS(nano)	((nano) / 1000000000ULL)
 #define MICROSECONDS(nano) ((nano) / 1000ULL)
 
-extern unsigned long long cur_time;
+extern __thread unsigned long long cur_time;
 void set_time(unsigned long long time);
 void fetch_time(void);
 isc_result_t dispatch(void);
@@ -929,6 +1084,38 @@ struct dhcpv6_response *decode_dhcpv6_packet(const unsigned char *packet, unsign
 int extract_ias(struct dhcpv6_response *response, int code);
 int extract_ia_addrs(struct ia *ia);
 
+/* common/ptrie.c */
+struct ptrie *ptrie_create(unsigned maxbits);
+isc_result_t ptrie_insert(struct ptrie *trie, const unsigned char *key,
+			  unsigned bitlen, void *value);
+void *ptrie_lookup(struct ptrie *trie, const unsigned char *key);
+void *ptrie_find_exact(struct ptrie *trie, const unsigned char *key,
+		       unsigned bitlen);
+void ptrie_free(struct ptrie *trie);
+struct ptrie *ptrie_publish(struct ptrie **where, struct ptrie *trie);
+
+/* common/leaseshm.c */
+extern struct lease_shm *lease_shm;
+isc_result_t lease_shm_create(struct lease_shm **result, const char *path,
+			      u_int32_t capacity);
+isc_result_t lease_shm_install(struct lease_shm *shm);
+void lease_shm_put(struct lease_shm *shm, const struct lease_shm_record *rec);
+void lease_shm_remove(struct lease_shm *shm, int kind, const u_int8_t *addr);
+int lease_shm_duid_hw(u_int8_t *hw, const u_int8_t *duid, unsigned len);
+isc_result_t lease_shm_open(struct lease_shm **result, const char *path);
+void lease_shm_close(struct lease_shm *shm);
+isc_result_t lease_shm_find_address(struct lease_shm *shm,
+				    const u_int8_t *addr, unsigned len,
+				    struct lease_shm_record *out,
+				    unsigned max, unsigned *count);
+isc_result_t lease_shm_find_id(struct lease_shm *shm,
+			       const u_int8_t *id, unsigned len,
+			       struct lease_shm_record *out,
+			       unsigned max, unsigned *count);
+isc_result_t lease_shm_find_hw(struct lease_shm *shm, const u_int8_t *hw,
+			       struct lease_shm_record *out,
+			       unsigned max, unsigned *count);
+
 /* client/dbus.c */
 
 int dhcp_option_ev_name (char *, size_t, struct option *);
@@ -967,6 +1154,8 @@ void set_ip_address(struct interface_info *, struct in_addr);
 void new_relay_server (char *, struct server_list **);
 void relay(struct interface_info *,
 	   struct dhcp_packet *, unsigned, unsigned int, struct iaddr);
+
+/* agentopts.c */
 int strip_relay_agent_options(struct interface_info *,
 				      struct interface_info **,
 				      struct dhcp_packet *, unsigned);
@@ -982,7 +1171,7 @@ extern struct icmp_state *icmp_state;
 void icmp_startup (int, void (*)(struct iaddr,
 				 u_int8_t *, int));
 int icmp_readsocket(void *);
-int icmp_echorequest(struct iaddr *);
+int icmp_echorequest(struct iaddr *, u_int16_t, u_int16_t);
 isc_result_t icmp_echoreply(void *);
 
 /* inet_addr.c */
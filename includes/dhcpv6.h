@@ -113,6 +113,15 @@ typedef struct dhcpv6_cs_message {
 #define DHCPV6_RELAY_FORWARD		12
 #define DHCPV6_RELAY_REPLY		13
 
+/* The most relay agents a message can go through. */
+#define DHCPV6_HOP_COUNT_LIMIT		32
+
+/* Leasequery (RFC 5007) and bulk leasequery (RFC 5460). */
+#define DHCPV6_LEASEQUERY		14
+#define DHCPV6_LEASEQUERY_REPLY		15
+#define DHCPV6_LEASEQUERY_DONE		16
+#define DHCPV6_LEASEQUERY_DATA		17
+
 /* Get the transaction ID out of the message. */
 #define DHCPV6_MSG_GET_XID(msg) (			 \
 		(((unsigned)(msg)->type_xid[1]) << 16) | \
@@ -138,8 +147,8 @@ typedef struct dhcpv6_relay_message {
 #define DHCPV6_PREFERENCE			7
 #define DHCPV6_ELAPSED_TIME			8
 #define DHCPV6_RELAY_MESSAGE			9
-#define DHCPV6_AUTHENTICATION			10
-#define DHCPV6_SERVER_UNICAST_ADDRESS		11
+#define DHCPV6_AUTHENTICATION			11
+#define DHCPV6_SERVER_UNICAST_ADDRESS		12
 #define DHCPV6_STATUS_CODE			13
 #define DHCPV6_RAPID_COMMIT			14
 #define DHCPV6_USER_CLASS			15
@@ -153,13 +162,20 @@ typedef struct dhcpv6_relay_message {
 #define DHCPV6_DOMAIN_NAME_SERVERS		23
 #define DHCPV6_DOMAIN_SEARCH_LIST		24
 #define DHCPV6_IA_PD				25
-#define DHCPV6_IA_PREFIX			27
+#define DHCPV6_IA_PREFIX			26
 #define DHCPV6_NIS_SERVERS			28
 #define DHCPV6_NISPLUS_SERVERS			29
 #define DHCPV6_NIS_DOMAINS			30
 #define DHCPV6_NISPLUS_DOMAINS			31
 #define DHCPV6_INFORMATION_REFRESH_TIME		32
+#define DHCPV6_REMOTE_ID			37
 #define DHCPV6_FQDN				39
+#define DHCPV6_LQ_QUERY				44
+#define DHCPV6_CLIENT_DATA			45
+#define DHCPV6_CLT_TIME				46
+#define DHCPV6_LQ_RELAY_DATA			47
+#define DHCPV6_LQ_CLIENT_LINK			48
+#define DHCPV6_RELAY_ID				53
 
 /* Status codes: */
 #define DHCPV6_SUCCESS				0
@@ -168,3 +184,15 @@ typedef struct dhcpv6_relay_message {
 #define DHCPV6_BINDING_UNAVAILABLE		3
 #define DHCPV6_BINDING_NOT_ON_LINK		4
 #define DHCPV6_USE_MULTICAST			5
+#define DHCPV6_UNKNOWN_QUERY_TYPE		7
+#define DHCPV6_MALFORMED_QUERY			8
+#define DHCPV6_NOT_CONFIGURED			9
+#define DHCPV6_NOT_ALLOWED			10
+#define DHCPV6_QUERY_TERMINATED			11
+
+/* Leasequery query types: */
+#define DHCPV6_QUERY_BY_ADDRESS			1
+#define DHCPV6_QUERY_BY_CLIENTID		2
+#define DHCPV6_QUERY_BY_RELAY_ID		3
+#define DHCPV6_QUERY_BY_LINK_ADDRESS		4
+#define DHCPV6_QUERY_BY_REMOTE_ID		5
@@ -61,13 +61,16 @@ struct hash_bucket {
 
 typedef int (*hash_comparator_t)(const void *, const void *, unsigned long);
 
+/* The buckets come last, so that new_hash_table() can make a table with
+ * any number of them.
+ */
 struct hash_table {
 	unsigned hash_count;
-	struct hash_bucket *buckets [DEFAULT_HASH_SIZE];
 	hash_reference referencer;
 	hash_dereference dereferencer;
 	hash_comparator_t cmp;
 	int (*do_hash) (const unsigned char *, unsigned, unsigned);
+	struct hash_bucket *buckets [DEFAULT_HASH_SIZE];
 };
 
 struct named_hash {
@@ -127,6 +130,7 @@ void free_hash_table (struct hash_table **);
 struct hash_bucket *new_hash_bucket(void);
 void free_hash_bucket (struct hash_bucket *);
 int new_hash (struct hash_table **, int);
+int new_hash_sized (struct hash_table **, unsigned);
 void add_hash (struct hash_table *,
 	       const unsigned char *, unsigned, hashed_object_t *);
 void delete_hash_entry (struct hash_table *, const unsigned char *, unsigned);
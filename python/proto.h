@@ -29,4 +29,5 @@
 void interface_object_init(PyObject *module);
 void v4client_object_init(PyObject *module);
 void v6client_object_init(PyObject *module);
+void lease_table_object_init(PyObject *module);
 PyObject *pythonify_option(struct option *option, struct data_string *data);
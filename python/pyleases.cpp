@@ -0,0 +1,259 @@
+/* Copyright (c) 2009 Nominum, Inc.   All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Nominum nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NOMINUM AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL NOMINUM OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Python.h"
+
+#include "dhcpd.h"
+
+#include "python/proto.h"
+
+/* Lookups in the binding table a server publishes with -lease-table; see
+ * common/leaseshm.cpp.   The server doesn't notice them.
+ */
+
+#define LEASES_MAX	64
+
+typedef struct {
+    PyObject_HEAD
+    struct lease_shm *shm;
+} leasesobj;
+
+static int leasesinit(leasesobj *self, PyObject *args, PyObject *kwds);
+static void leasesdealloc(leasesobj *self);
+static PyObject *by_address(leasesobj *self, PyObject *args);
+static PyObject *by_id(leasesobj *self, PyObject *args);
+static PyObject *by_mac(leasesobj *self, PyObject *args);
+
+static PyMethodDef leasesmethods[] = {
+    {"by_address", (PyCFunction)by_address, METH_VARARGS,
+     "bindings on an IPv4 or IPv6 address, or delegated at an IPv6 prefix"},
+    {"by_id", (PyCFunction)by_id, METH_VARARGS,
+     "bindings of a DHCPv4 client identifier or DHCPv6 DUID"},
+    {"by_mac", (PyCFunction)by_mac, METH_VARARGS,
+     "bindings of a six-byte Ethernet address"},
+    {NULL}
+};
+
+static PyTypeObject leasestype = {
+    PyObject_HEAD_INIT(NULL)
+    0,					/*ob_size*/
+    "dhcp.LeaseTable",			/*tp_name*/
+    sizeof(leasesobj),			/*tp_basicsize*/
+    0,					/*tp_itemsize*/
+    (destructor)leasesdealloc,		/*tp_dealloc*/
+    0,					/*tp_print*/
+    0,					/*tp_getattr*/
+    0,					/*tp_setattr*/
+    0,					/*tp_compare*/
+    0,					/*tp_repr*/
+    0,					/*tp_as_number*/
+    0,					/*tp_as_sequence*/
+    0,					/*tp_as_mapping*/
+    0,					/*tp_hash */
+    0,					/*tp_call*/
+    0,					/*tp_str*/
+    0,					/*tp_getattro*/
+    0,					/*tp_setattro*/
+    0,					/*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,			/*tp_flags*/
+    "Server binding table",		/* tp_doc */
+    0,					/* tp_traverse */
+    0,					/* tp_clear */
+    0,					/* tp_richcompare */
+    0,					/* tp_weaklistoffset */
+    0,					/* tp_iter */
+    0,					/* tp_iternext */
+    leasesmethods,			/* tp_methods */
+    0,					/* tp_members */
+    0,					/* tp_getset */
+    0,					/* tp_base */
+    0,					/* tp_dict */
+    0,					/* tp_descr_get */
+    0,					/* tp_descr_set */
+    0,					/* tp_dictoffset */
+    (initproc)leasesinit,		/* tp_init */
+    0,					/* tp_alloc */
+    0,					/* tp_new */
+};
+
+void
+lease_table_object_init(PyObject *module)
+{
+  leasestype.tp_new = PyType_GenericNew;
+  if (PyType_Ready(&leasestype) < 0)
+    return;
+  Py_INCREF(&leasestype);
+
+  PyModule_AddObject(module, "LeaseTable", (PyObject *)&leasestype);
+}
+
+static void
+leasesdealloc(leasesobj *self)
+{
+  if (self->shm)
+    lease_shm_close(self->shm);
+  self->ob_type->tp_free((PyObject *)self);
+}
+
+static int
+leasesinit(leasesobj *self, PyObject *args, PyObject *kwds)
+{
+  const char *path = _PATH_DHCP_LEASE_TABLE;
+  isc_result_t status;
+
+  if (!PyArg_ParseTuple(args, "|s", &path))
+    return -1;
+
+  if (self->shm)
+    {
+      lease_shm_close(self->shm);
+      self->shm = 0;
+    }
+  status = lease_shm_open(&self->shm, path);
+  if (status != ISC_R_SUCCESS)
+    {
+      PyErr_Format(PyExc_IOError, "%s: %s", path,
+		   isc_result_totext(status));
+      return -1;
+    }
+  return 0;
+}
+
+/* Turn what a lookup found into a list of dictionaries. */
+static PyObject *
+pythonify_leases(isc_result_t status,
+		 struct lease_shm_record *found, unsigned count)
+{
+  static const char *kinds[] = { "none", "v4", "v6", "pd" };
+  char buf[INET6_ADDRSTRLEN];
+  PyObject *leases, *lease;
+  unsigned i;
+
+  if (status != ISC_R_SUCCESS)
+    {
+      PyErr_SetString(PyExc_IOError, isc_result_totext(status));
+      return NULL;
+    }
+
+  leases = PyList_New(0);
+  for (i = 0; i < count; i++)
+    {
+      inet_ntop(found[i].kind == LEASE_SHM_V4 ? AF_INET : AF_INET6,
+		found[i].address, buf, sizeof buf);
+      lease = Py_BuildValue("{s:s,s:s,s:i,s:K,s:s#,s:k}",
+			    "kind", kinds[found[i].kind & 3],
+			    "address", buf,
+			    "prefixlen", (int)found[i].prefixlen,
+			    "expiry", (unsigned long long)found[i].expiry,
+			    "id", (const char *)found[i].id,
+			    (int)found[i].id_len,
+			    "iaid", (unsigned long)found[i].iaid);
+      if (lease == NULL)
+	{
+	  Py_DECREF(leases);
+	  return NULL;
+	}
+      if (found[i].has_hw)
+	{
+	  PyObject *hw = PyString_FromStringAndSize((char *)found[i].hw,
+						    sizeof found[i].hw);
+	  PyDict_SetItemString(lease, "mac", hw);
+	  Py_DECREF(hw);
+	}
+      PyList_Append(leases, lease);
+      Py_DECREF(lease);
+    }
+  return leases;
+}
+
+static PyObject *
+by_address(leasesobj *self, PyObject *args)
+{
+  struct lease_shm_record found[LEASES_MAX];
+  u_int8_t addr[16];
+  unsigned len, count = 0;
+  isc_result_t status;
+  const char *text;
+
+  if (!PyArg_ParseTuple(args, "s", &text))
+    return NULL;
+  if (inet_pton(AF_INET, text, addr) == 1)
+    len = 4;
+  else if (inet_pton(AF_INET6, text, addr) == 1)
+    len = 16;
+  else
+    {
+      PyErr_SetString(PyExc_ValueError, "not an IPv4 or IPv6 address");
+      return NULL;
+    }
+  status = lease_shm_find_address(self->shm, addr, len,
+				  found, LEASES_MAX, &count);
+  return pythonify_leases(status, found, count);
+}
+
+static PyObject *
+by_id(leasesobj *self, PyObject *args)
+{
+  struct lease_shm_record found[LEASES_MAX];
+  unsigned count = 0;
+  isc_result_t status;
+  const char *id;
+  int len;
+
+  if (!PyArg_ParseTuple(args, "s#", &id, &len))
+    return NULL;
+  status = lease_shm_find_id(self->shm, (const u_int8_t *)id, len,
+			     found, LEASES_MAX, &count);
+  return pythonify_leases(status, found, count);
+}
+
+static PyObject *
+by_mac(leasesobj *self, PyObject *args)
+{
+  struct lease_shm_record found[LEASES_MAX];
+  unsigned count = 0;
+  isc_result_t status;
+  const char *hw;
+  int len;
+
+  if (!PyArg_ParseTuple(args, "s#", &hw, &len))
+    return NULL;
+  if (len != 6)
+    {
+      PyErr_SetString(PyExc_ValueError, "Ethernet addresses are six bytes");
+      return NULL;
+    }
+  status = lease_shm_find_hw(self->shm, (const u_int8_t *)hw,
+			     found, LEASES_MAX, &count);
+  return pythonify_leases(status, found, count);
+}
+
+/* Local Variables:  */
+/* mode:C++ */
+/* c-file-style:"gnu" */
+/* end: */
@@ -390,6 +390,8 @@ extern "C" {
     v4client_object_init(module);
     /* And the v6 client object. */
     v6client_object_init(module);
+    /* And the server binding table. */
+    lease_table_object_init(module);
   }
 }
 
@@ -0,0 +1,503 @@
+/* agentbench.cpp
+ *
+ * Measure how fast the relay adds Relay Agent Information options to
+ * requests and takes them out of replies.
+ */
+
+/* Copyright (c) 2009 Nominum, Inc.   All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Nominum nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NOMINUM AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL NOMINUM OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+
+#ifndef lint
+static char ocopyright[] __attribute__((unused)) =
+  "$Id: agentbench.cpp,v 1.1 2009/10/21 18:02:40 mellon Exp $ Copyright (c) 2009 Nominum, Inc.  All rights reserved.\n";
+#endif /* not lint */
+
+#include "dhcpd.h"
+#include "relay/v4relay.h"
+
+/* Usage: agentbench [packets]
+ *
+ * Makes a set of synthetic requests with varying numbers of options, a
+ * quarter of which already carry a Relay Agent Information option from a
+ * relay further downstream, then adds our option to each (replacing
+ * theirs) and strips it from the resulting reply, first with the code in
+ * agentopts.cpp and then with the same code as it was before it checked
+ * option and packet lengths, and prints the time each took per packet.
+ * Copying each packet into a scratch buffer is included in both.
+ */
+
+#define BENCH_PACKETS	1024
+
+u_int16_t local_port_dhcpv6 = 0;
+u_int16_t remote_port_dhcpv6 = 0;
+struct relay_stats relay_stats_blocks[RELAY_MAX_THREADS];
+__thread struct relay_stats *relay_stats = &relay_stats_blocks[0];
+
+struct bench_packet {
+  struct dhcp_packet raw;
+  unsigned length;
+};
+
+static u_int64_t now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return NANO_SECONDS(ts.tv_sec) + ts.tv_nsec;
+}
+
+static u_int8_t *put_option(u_int8_t *op, u_int8_t code,
+			    const void *data, unsigned len)
+{
+  *op++ = code;
+  *op++ = len;
+  memcpy(op, data, len);
+  return op + len;
+}
+
+static void make_packet(struct bench_packet *bp, unsigned n)
+{
+  static const u_int8_t prl[] = { 1, 3, 6, 15, 26, 28, 42, 51, 54, 58, 59,
+				  119, 121, 249, 252 };
+  u_int8_t *op, buf[32];
+  unsigned i;
+
+  memset(bp, 0, sizeof *bp);
+  bp->raw.op = BOOTREQUEST;
+  bp->raw.htype = HTYPE_ETHER;
+  bp->raw.hlen = 6;
+  bp->raw.xid = n;
+  bp->raw.chaddr[1] = 0x16;
+  putULong(&bp->raw.chaddr[2], n);
+  memcpy(bp->raw.options, DHCP_OPTIONS_COOKIE, 4);
+
+  op = &bp->raw.options[4];
+  buf[0] = (n & 1) ? DHCPREQUEST : DHCPDISCOVER;
+  op = put_option(op, DHO_DHCP_MESSAGE_TYPE, buf, 1);
+  buf[0] = HTYPE_ETHER;
+  memcpy(&buf[1], bp->raw.chaddr, 6);
+  op = put_option(op, DHO_DHCP_CLIENT_IDENTIFIER, buf, 7);
+  if (n & 1)
+    {
+      putULong(buf, 0xc0000200 | (n & 0xff));
+      op = put_option(op, DHO_DHCP_REQUESTED_ADDRESS, buf, 4);
+    }
+  op = put_option(op, DHO_DHCP_PARAMETER_REQUEST_LIST, prl,
+		  5 + n % (sizeof prl - 5));
+  snprintf((char *)buf, sizeof buf, "host-%u", n);
+  op = put_option(op, DHO_HOST_NAME, buf, strlen((char *)buf));
+  for (i = 0; i < n % 4; i++)
+    {
+      snprintf((char *)buf, sizeof buf, "vendor-%u/%u", n, i);
+      op = put_option(op, DHO_VENDOR_CLASS_IDENTIFIER, buf,
+		      strlen((char *)buf));
+    }
+
+  /* Some came through another relay first. */
+  if (!(n & 3))
+    {
+      buf[0] = RAI_CIRCUIT_ID;
+      buf[1] = snprintf((char *)&buf[2], sizeof buf - 2, "port-%u", n);
+      op = put_option(op, DHO_DHCP_AGENT_OPTIONS, buf, buf[1] + 2);
+    }
+  *op++ = DHO_END;
+  bp->length = op - (u_int8_t *)&bp->raw;
+}
+
+/* Adding and stripping options without the length checks. */
+
+static int old_strip(struct interface_info *in,
+		     struct interface_info **out,
+		     struct dhcp_packet *packet,
+		     unsigned length)
+{
+  int is_dhcp = 0;
+  u_int8_t *op, *sp, *max;
+  int good_agent_option = 0;
+  int status;
+
+  /* If we're not adding agent options to packets, we're not taking
+     them out either. */
+  if (!add_agent_options)
+    return length;
+
+  /* If there's no cookie, it's a bootp packet, so we should just
+     forward it unchanged. */
+  if (memcmp (packet->options, DHCP_OPTIONS_COOKIE, 4))
+    return length;
+
+  max = ((u_int8_t *)packet) + length;
+  sp = op = &packet->options [4];
+
+  while (op < max)
+    {
+      switch (*op)
+	{
+	  /* Skip padding... */
+	case DHO_PAD:
+	  if (sp != op)
+	    *sp = *op;
+	  ++op;
+	  ++sp;
+	  continue;
+
+	  /* If we see a message type, it's a DHCP packet. */
+	case DHO_DHCP_MESSAGE_TYPE:
+	  is_dhcp = 1;
+	  goto skip;
+	  break;
+
+	  /* Quit immediately if we hit an End option. */
+	case DHO_END:
+	  if (sp != op)
+	    *sp++ = *op++;
+	  goto out;
+
+	case DHO_DHCP_AGENT_OPTIONS:
+	  /* We shouldn't see a relay agent option in a
+	     packet before we've seen the DHCP packet type,
+	     but if we do, we have to leave it alone. */
+	  if (!is_dhcp)
+	    goto skip;
+
+	  status = find_interface_by_agent_option(packet,
+						  out, op + 2, op [1]);
+	  if (status == -1 && drop_agent_mismatches)
+	    return 0;
+	  if (status)
+	    good_agent_option = 1;
+	  op += op [1] + 2;
+	  break;
+
+	skip:
+	  /* Skip over other options. */
+	default:
+	  if (sp != op)
+	    memcpy (sp, op, (unsigned)(op [1] + 2));
+	  sp += op [1] + 2;
+	  op += op [1] + 2;
+	  break;
+	}
+    }
+ out:
+
+  /* If it's not a DHCP packet, we're not supposed to touch it. */
+  if (!is_dhcp)
+    return length;
+
+  /* If none of the agent options we found matched, or if we didn't
+     find any agent options, count this packet as not having any
+     matching agent options, and if we're relying on agent options
+     to determine the outgoing interface, drop the packet. */
+
+  if (!good_agent_option)
+    {
+      ++relay_stats->missing_agent_option;
+      if (drop_agent_mismatches)
+	return 0;
+    }
+
+  /* Adjust the length... */
+  if (sp != op)
+    {
+      length = sp - ((u_int8_t *)packet);
+
+      /* Make sure the packet isn't short (this is unlikely,
+	 but WTH) */
+      if (length < BOOTP_MIN_LEN)
+	{
+	  memset (sp, 0, BOOTP_MIN_LEN - length);
+	  length = BOOTP_MIN_LEN;
+	}
+    }
+  return length;
+}
+
+
+static int old_add(struct interface_info *ip,
+		   struct dhcp_packet *packet,
+		   unsigned length,
+		   struct in_addr giaddr)
+{
+  int is_dhcp = 0;
+  u_int8_t *op, *sp, *max, *end_pad = 0;
+
+  /* If we're not adding agent options to packets, we can skip
+     this. */
+  if (!add_agent_options)
+    return length;
+
+  /* If there's no cookie, it's a bootp packet, so we should just
+     forward it unchanged. */
+  if (memcmp (packet->options, DHCP_OPTIONS_COOKIE, 4))
+    return length;
+
+  max = ((u_int8_t *)packet) + length;
+  sp = op = &packet->options [4];
+
+  while (op < max)
+    {
+      switch (*op)
+	{
+	  /* Skip padding... */
+	case DHO_PAD:
+	  end_pad = sp;
+	  if (sp != op)
+	    *sp = *op;
+	  ++op;
+	  ++sp;
+	  continue;
+
+	  /* If we see a message type, it's a DHCP packet. */
+	case DHO_DHCP_MESSAGE_TYPE:
+	  is_dhcp = 1;
+	  goto skip;
+	  break;
+
+	  /* Quit immediately if we hit an End option. */
+	case DHO_END:
+	  goto out;
+
+	case DHO_DHCP_AGENT_OPTIONS:
+	  /* We shouldn't see a relay agent option in a
+	     packet before we've seen the DHCP packet type,
+	     but if we do, we have to leave it alone. */
+	  if (!is_dhcp)
+	    goto skip;
+	  end_pad = 0;
+
+	  /* There's already a Relay Agent Information option
+	     in this packet.   How embarrassing.   Decide what
+	     to do based on the mode the user specified. */
+
+	  switch (agent_relay_mode)
+	    {
+	    case forward_and_append:
+	      goto skip;
+	    case forward_untouched:
+	      return length;
+	    case discard:
+	      return 0;
+	    case forward_and_replace:
+	    default:
+	      break;
+	    }
+
+	  /* Skip over the agent option and start copying
+	     if we aren't copying already. */
+	  op += op [1] + 2;
+	  break;
+
+	skip:
+	  /* Skip over other options. */
+	default:
+	  end_pad = 0;
+	  if (sp != op)
+	    memcpy (sp, op, (unsigned)(op [1] + 2));
+	  sp += op [1] + 2;
+	  op += op [1] + 2;
+	  break;
+	}
+    }
+ out:
+
+  /* If it's not a DHCP packet, we're not supposed to touch it. */
+  if (!is_dhcp)
+    return length;
+
+  /* If the packet was padded out, we can store the agent option
+     at the beginning of the padding. */
+
+  if (end_pad)
+    sp = end_pad;
+
+  /* Remember where the end of the packet was after parsing
+     it. */
+  op = sp;
+
+  /* XXX Is there room? */
+
+  /* Okay, cons up *our* Relay Agent Information option. */
+  *sp++ = DHO_DHCP_AGENT_OPTIONS;
+  *sp++ = 0;	/* Dunno... */
+
+  /* Copy in the circuit id... */
+  *sp++ = RAI_CIRCUIT_ID;
+  /* Sanity check.   Had better not every happen. */
+  if (ip->circuit_id_len > 255 || ip->circuit_id_len < 1)
+    log_fatal ("completely bogus circuit id length %d on %s\n",
+	       ip->circuit_id_len, ip->name);
+  *sp++ = ip->circuit_id_len;
+  memcpy (sp, ip->circuit_id, ip->circuit_id_len);
+  sp += ip->circuit_id_len;
+
+  /* Copy in remote ID... */
+  if (ip->remote_id)
+    {
+      *sp++ = RAI_REMOTE_ID;
+      if (ip->remote_id_len > 255 || ip->remote_id_len < 1)
+	log_fatal ("bogus remote id length %d on %s\n",
+		   ip->circuit_id_len, ip->name);
+      *sp++ = ip->remote_id_len;
+      memcpy (sp, ip->remote_id, ip->remote_id_len);
+      sp += ip->remote_id_len;
+    }
+
+  /* Relay option's total length shouldn't ever get to be more than
+     257 bytes. */
+  if (sp - op > 257)
+    log_fatal ("total agent option length exceeds 257 (%ld) on %s\n",
+	       (long)(sp - op), ip->name);
+
+  /* Calculate length of RAI option. */
+  op [1] = sp - op - 2;
+
+  /* Deposit an END token. */
+  *sp++ = DHO_END;
+
+  /* Recalculate total packet length. */
+  length = sp - ((u_int8_t *)packet);
+
+  /* Make sure the packet isn't short (this is unlikely, but WTH) */
+  if (length < BOOTP_MIN_LEN)
+    {
+      memset (sp, 0, BOOTP_MIN_LEN - length);
+      length = BOOTP_MIN_LEN;
+    }
+
+  return length;
+}
+
+int main(int argc, char **argv)
+{
+  static struct bench_packet requests[BENCH_PACKETS], replies[BENCH_PACKETS];
+  static struct bench_packet scratch, check;
+  static u_int8_t remote_id[] = { 0x00, 0x16, 0x3e, 0x01, 0x02, 0x03 };
+  struct interface_info *ip, *out;
+  struct in_addr giaddr;
+  unsigned packets = 1000000, i, j, len;
+  u_int64_t start, add_new, add_old, strip_new, strip_old, sum = 0;
+
+  if (argc > 1)
+    packets = strtoul(argv[1], 0, 0);
+  if (!packets)
+    log_fatal("Usage: agentbench [packets]");
+
+  ip = (struct interface_info *)safemalloc(sizeof *ip);
+  strcpy(ip->name, "ge-0/0/1");
+  ip->circuit_id = (u_int8_t *)ip->name;
+  ip->circuit_id_len = strlen(ip->name);
+  ip->remote_id = remote_id;
+  ip->remote_id_len = sizeof remote_id;
+  interfaces = ip;
+  interfaces_invalidated = 1;
+  giaddr.s_addr = htonl(0xc0000201);
+
+  add_agent_options = 1;
+  drop_agent_mismatches = 1;
+  agent_relay_mode = forward_and_replace;
+
+  /* Both ways had better produce the same packets. */
+  for (i = 0; i < BENCH_PACKETS; i++)
+    {
+      make_packet(&requests[i], i);
+      replies[i] = requests[i];
+      replies[i].length = add_relay_agent_options(ip, &replies[i].raw,
+						  replies[i].length, giaddr);
+      scratch = requests[i];
+      len = old_add(ip, &scratch.raw, scratch.length, giaddr);
+      if (!len || len != replies[i].length ||
+	  memcmp(&scratch.raw, &replies[i].raw, len))
+	log_fatal("packet %u: old and new added options differ", i);
+      replies[i].raw.op = BOOTREPLY;
+
+      scratch = replies[i];
+      check = replies[i];
+      out = 0;
+      len = strip_relay_agent_options(ip, &out, &scratch.raw,
+				      scratch.length);
+      if (!len || out != ip)
+	log_fatal("packet %u: our agent option wasn't recognized", i);
+      if ((unsigned)old_strip(ip, &out, &check.raw, check.length) != len ||
+	  memcmp(&scratch.raw, &check.raw, len))
+	log_fatal("packet %u: old and new stripped packets differ", i);
+    }
+
+  start = now();
+  for (i = 0; i < packets; i++)
+    {
+      j = i % BENCH_PACKETS;
+      memcpy(&scratch.raw, &requests[j].raw, requests[j].length);
+      sum += add_relay_agent_options(ip, &scratch.raw, requests[j].length,
+				     giaddr);
+    }
+  add_new = now() - start;
+
+  start = now();
+  for (i = 0; i < packets; i++)
+    {
+      j = i % BENCH_PACKETS;
+      memcpy(&scratch.raw, &requests[j].raw, requests[j].length);
+      sum += old_add(ip, &scratch.raw, requests[j].length, giaddr);
+    }
+  add_old = now() - start;
+
+  start = now();
+  for (i = 0; i < packets; i++)
+    {
+      j = i % BENCH_PACKETS;
+      memcpy(&scratch.raw, &replies[j].raw, replies[j].length);
+      sum += strip_relay_agent_options(ip, &out, &scratch.raw,
+				       replies[j].length);
+    }
+  strip_new = now() - start;
+
+  start = now();
+  for (i = 0; i < packets; i++)
+    {
+      j = i % BENCH_PACKETS;
+      memcpy(&scratch.raw, &replies[j].raw, replies[j].length);
+      sum += old_strip(ip, &out, &scratch.raw, replies[j].length);
+    }
+  strip_old = now() - start;
+
+  printf("add:   %.1f ns per packet (%.1f unchecked)\n",
+	 (double)add_new / packets, (double)add_old / packets);
+  printf("strip: %.1f ns per packet (%.1f unchecked)\n",
+	 (double)strip_new / packets, (double)strip_old / packets);
+  printf("(checksum %llx)\n", (unsigned long long)sum);
+  return 0;
+}
+
+/* Local Variables:  */
+/* mode:C++ */
+/* c-file-style:"gnu" */
+/* end: */
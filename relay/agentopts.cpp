@@ -0,0 +1,432 @@
+/* agentopts.cpp
+ *
+ * Adding Relay Agent Information options to the requests the relay
+ * forwards, and taking them out of the replies.
+ */
+
+/* Copyright (c) 2009 Nominum, Inc.   All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Nominum nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NOMINUM AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL NOMINUM OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef lint
+static char ocopyright[] __attribute__((unused)) =
+  "$Id: agentopts.cpp,v 1.1 2009/10/21 18:02:40 mellon Exp $ Copyright (c) 2009 Nominum, Inc.  All rights reserved.\n";
+#endif /* not lint */
+
+#include "dhcpd.h"
+#include "relay/v4relay.h"
+
+int add_agent_options = 0;	/* If nonzero, add relay agent options. */
+int drop_agent_mismatches = 0;	/* If nonzero, drop server replies that
+				   don't contain a Relay Agent Information
+				   option whose Agent ID suboption matches
+				   our giaddr. */
+
+/* Maximum size of a packet with agent options added. */
+int dhcp_max_agent_option_packet_length = 576;
+
+/* What to do about packets we're asked to relay that
+   already have a relay option: */
+enum agent_mode agent_relay_mode = forward_and_replace;
+
+/* Strip any Relay Agent Information options from the DHCP packet
+   option buffer.   If an RAI option is found whose Agent ID matches
+   the giaddr (i.e., ours), try to look up the outgoing interface
+   based on the circuit ID suboption. */
+
+int strip_relay_agent_options(struct interface_info *in,
+			      struct interface_info **out,
+			      struct dhcp_packet *packet,
+			      unsigned length)
+{
+  int is_dhcp = 0;
+  u_int8_t *op, *sp, *max;
+  int good_agent_option = 0;
+  int status;
+
+  /* If we're not adding agent options to packets, we're not taking
+     them out either. */
+  if (!add_agent_options)
+    return length;
+
+  /* If there's no cookie, it's a bootp packet, so we should just
+     forward it unchanged. */
+  if (memcmp (packet->options, DHCP_OPTIONS_COOKIE, 4))
+    return length;
+
+  max = ((u_int8_t *)packet) + length;
+  sp = op = &packet->options [4];
+
+  while (op < max)
+    {
+      /* An option that runs off the end of the packet means the
+	 option buffer is garbage. */
+      if (*op != DHO_PAD && *op != DHO_END &&
+	  (max - op < 2 || max - op < op [1] + 2))
+	{
+	  log_info ("Discarding packet with truncated options.");
+	  return 0;
+	}
+
+      switch (*op)
+	{
+	  /* Skip padding... */
+	case DHO_PAD:
+	  if (sp != op)
+	    *sp = *op;
+	  ++op;
+	  ++sp;
+	  continue;
+
+	  /* If we see a message type, it's a DHCP packet. */
+	case DHO_DHCP_MESSAGE_TYPE:
+	  is_dhcp = 1;
+	  goto skip;
+	  break;
+
+	  /* Quit immediately if we hit an End option. */
+	case DHO_END:
+	  if (sp != op)
+	    *sp++ = *op++;
+	  goto out;
+
+	case DHO_DHCP_AGENT_OPTIONS:
+	  /* We shouldn't see a relay agent option in a
+	     packet before we've seen the DHCP packet type,
+	     but if we do, we have to leave it alone. */
+	  if (!is_dhcp)
+	    goto skip;
+
+	  status = find_interface_by_agent_option(packet,
+						  out, op + 2, op [1]);
+	  if (status == -1 && drop_agent_mismatches)
+	    return 0;
+	  if (status)
+	    good_agent_option = 1;
+	  op += op [1] + 2;
+	  break;
+
+	skip:
+	  /* Skip over other options. */
+	default:
+	  if (sp != op)
+	    memcpy (sp, op, (unsigned)(op [1] + 2));
+	  sp += op [1] + 2;
+	  op += op [1] + 2;
+	  break;
+	}
+    }
+ out:
+
+  /* If it's not a DHCP packet, we're not supposed to touch it. */
+  if (!is_dhcp)
+    return length;
+
+  /* If none of the agent options we found matched, or if we didn't
+     find any agent options, count this packet as not having any
+     matching agent options, and if we're relying on agent options
+     to determine the outgoing interface, drop the packet. */
+
+  if (!good_agent_option)
+    {
+      ++relay_stats->missing_agent_option;
+      if (drop_agent_mismatches)
+	return 0;
+    }
+
+  /* Adjust the length... */
+  if (sp != op)
+    {
+      length = sp - ((u_int8_t *)packet);
+
+      /* Make sure the packet isn't short (this is unlikely,
+	 but WTH) */
+      if (length < BOOTP_MIN_LEN)
+	{
+	  memset (sp, 0, BOOTP_MIN_LEN - length);
+	  length = BOOTP_MIN_LEN;
+	}
+    }
+  return length;
+}
+
+
+/* Find an interface that matches the circuit ID specified in the
+   Relay Agent Information option.   If one is found, store it through
+   the pointer given; otherwise, leave the existing pointer alone.
+
+   We actually deviate somewhat from the current specification here:
+   if the option buffer is corrupt, we suggest that the caller not
+   respond to this packet.  If the circuit ID doesn't match any known
+   interface, we suggest that the caller to drop the packet.  Only if
+   we find a circuit ID that matches an existing interface do we tell
+   the caller to go ahead and process the packet. */
+
+int find_interface_by_agent_option(struct dhcp_packet *packet,
+				   struct interface_info **out,
+				   u_int8_t *buf,
+				   int len)
+{
+  int i = 0;
+  u_int8_t *circuit_id = 0;
+  unsigned circuit_id_len;
+  struct interface_info *ip;
+
+  while (i < len)
+    {
+      /* If the next agent option overflows the end of the
+	 packet, the agent option buffer is corrupt. */
+      if (i + 1 == len ||
+	  i + buf [i + 1] + 2 > len)
+	{
+	  ++relay_stats->corrupt_agent_options;
+	  return -1;
+	}
+      switch (buf [i])
+	{
+	  /* Remember where the circuit ID is... */
+	case RAI_CIRCUIT_ID:
+	  circuit_id = &buf [i + 2];
+	  circuit_id_len = buf [i + 1];
+	  i += circuit_id_len + 2;
+	  continue;
+
+	default:
+	  i += buf [i + 1] + 2;
+	  break;
+	}
+    }
+
+  /* If there's no circuit ID, it's not really ours, tell the caller
+     it's no good. */
+  if (!circuit_id)
+    {
+      ++relay_stats->missing_circuit_id;
+      return -1;
+    }
+
+  /* Look for the interface whose circuit ID this is. */
+  ip = interface_find_circuit_id(circuit_id, circuit_id_len);
+
+  /* If we got a match, use it. */
+  if (ip)
+    {
+      *out = ip;
+      return 1;
+    }
+
+  /* If we didn't get a match, the circuit ID was bogus. */
+  ++relay_stats->bad_circuit_id;
+  return -1;
+}
+
+/* Examine a packet to see if it's a candidate to have a Relay
+   Agent Information option tacked onto its tail.   If it is, tack
+   the option on, unless that would make the packet longer than
+   dhcp_max_agent_option_packet_length, in which case it's forwarded
+   without one.  */
+
+int add_relay_agent_options (struct interface_info *ip,
+			     struct dhcp_packet *packet,
+			     unsigned length,
+			     struct in_addr giaddr)
+{
+  int is_dhcp = 0;
+  u_int8_t *op, *sp, *max, *end_pad = 0;
+  unsigned optlen, limit;
+
+  /* If we're not adding agent options to packets, we can skip
+     this. */
+  if (!add_agent_options)
+    return length;
+
+  /* If there's no cookie, it's a bootp packet, so we should just
+     forward it unchanged. */
+  if (memcmp (packet->options, DHCP_OPTIONS_COOKIE, 4))
+    return length;
+
+  max = ((u_int8_t *)packet) + length;
+  sp = op = &packet->options [4];
+
+  while (op < max)
+    {
+      /* An option that runs off the end of the packet means the
+	 option buffer is garbage. */
+      if (*op != DHO_PAD && *op != DHO_END &&
+	  (max - op < 2 || max - op < op [1] + 2))
+	{
+	  log_info ("Discarding packet with truncated options.");
+	  return 0;
+	}
+
+      switch (*op)
+	{
+	  /* Skip padding, remembering where it started... */
+	case DHO_PAD:
+	  if (!end_pad)
+	    end_pad = sp;
+	  if (sp != op)
+	    *sp = *op;
+	  ++op;
+	  ++sp;
+	  continue;
+
+	  /* If we see a message type, it's a DHCP packet. */
+	case DHO_DHCP_MESSAGE_TYPE:
+	  is_dhcp = 1;
+	  goto skip;
+	  break;
+
+	  /* Quit immediately if we hit an End option. */
+	case DHO_END:
+	  goto out;
+
+	case DHO_DHCP_AGENT_OPTIONS:
+	  /* We shouldn't see a relay agent option in a
+	     packet before we've seen the DHCP packet type,
+	     but if we do, we have to leave it alone. */
+	  if (!is_dhcp)
+	    goto skip;
+	  end_pad = 0;
+
+	  /* There's already a Relay Agent Information option
+	     in this packet.   How embarrassing.   Decide what
+	     to do based on the mode the user specified. */
+
+	  switch (agent_relay_mode)
+	    {
+	    case forward_and_append:
+	      goto skip;
+	    case forward_untouched:
+	      return length;
+	    case discard:
+	      return 0;
+	    case forward_and_replace:
+	    default:
+	      break;
+	    }
+
+	  /* Skip over the agent option and start copying
+	     if we aren't copying already. */
+	  op += op [1] + 2;
+	  break;
+
+	skip:
+	  /* Skip over other options. */
+	default:
+	  end_pad = 0;
+	  if (sp != op)
+	    memcpy (sp, op, (unsigned)(op [1] + 2));
+	  sp += op [1] + 2;
+	  op += op [1] + 2;
+	  break;
+	}
+    }
+ out:
+
+  /* If it's not a DHCP packet, we're not supposed to touch it. */
+  if (!is_dhcp)
+    return length;
+
+  /* If the packet was padded out, we can store the agent option
+     at the beginning of the padding. */
+
+  if (end_pad)
+    sp = end_pad;
+
+  /* Sanity checks.   Had better not ever happen. */
+  if (ip->circuit_id_len > 255 || ip->circuit_id_len < 1)
+    log_fatal ("completely bogus circuit id length %d on %s",
+	       ip->circuit_id_len, ip->name);
+  if (ip->remote_id &&
+      (ip->remote_id_len > 255 || ip->remote_id_len < 1))
+    log_fatal ("bogus remote id length %d on %s",
+	       ip->remote_id_len, ip->name);
+
+  /* Work out how long our option will be, code and length included. */
+  optlen = ip->circuit_id_len + 4;
+  if (ip->remote_id)
+    optlen += ip->remote_id_len + 2;
+
+  /* Relay option's total length shouldn't ever get to be more than
+     257 bytes. */
+  if (optlen > 257)
+    log_fatal ("total agent option length exceeds 257 (%d) on %s",
+	       optlen, ip->name);
+
+  /* Our option and an End option have to fit in the packet buffer and
+     within the length the user will let us make the packet. */
+  limit = dhcp_max_agent_option_packet_length;
+  if (limit > sizeof *packet)
+    limit = sizeof *packet;
+  if ((unsigned)(sp - ((u_int8_t *)packet)) + optlen + 1 > limit)
+    ++relay_stats->agent_options_omitted;
+  else
+    {
+      /* Okay, cons up *our* Relay Agent Information option. */
+      *sp++ = DHO_DHCP_AGENT_OPTIONS;
+      *sp++ = optlen - 2;
+
+      /* Copy in the circuit id... */
+      *sp++ = RAI_CIRCUIT_ID;
+      *sp++ = ip->circuit_id_len;
+      memcpy (sp, ip->circuit_id, ip->circuit_id_len);
+      sp += ip->circuit_id_len;
+
+      /* Copy in remote ID... */
+      if (ip->remote_id)
+	{
+	  *sp++ = RAI_REMOTE_ID;
+	  *sp++ = ip->remote_id_len;
+	  memcpy (sp, ip->remote_id, ip->remote_id_len);
+	  sp += ip->remote_id_len;
+	}
+    }
+
+  /* Deposit an END token, unless the packet already fills the
+     buffer. */
+  if ((unsigned)(sp - ((u_int8_t *)packet)) < sizeof *packet)
+    *sp++ = DHO_END;
+
+  /* Recalculate total packet length. */
+  length = sp - ((u_int8_t *)packet);
+
+  /* Make sure the packet isn't short (this is unlikely, but WTH) */
+  if (length < BOOTP_MIN_LEN)
+    {
+      memset (sp, 0, BOOTP_MIN_LEN - length);
+      length = BOOTP_MIN_LEN;
+    }
+
+  return length;
+}
+
+/* Local Variables:  */
+/* mode:C++ */
+/* c-file-style:"gnu" */
+/* end: */
@@ -41,59 +41,63 @@ static char ocopyright[] __attribute__((unused)) =
 #endif /* not lint */
 
 #include "dhcpd.h"
+#include <signal.h>
 #include "version.h"
 #include "relay/v4relay.h"
+#include "relay/v6relay.h"
 
 static void usage PROTO ((void));
+static void forward_request(struct server_list *, struct dhcp_packet *,
+			    unsigned);
+static void server_replied(struct in_addr);
+static unsigned request_thread(struct dhcp_packet *);
+static void relay_stats_setup(void);
 
 const char *path_dhcrelay_pid = _PATH_DHCRELAY_PID;
 
-int bogus_agent_drops = 0;	/* Packets dropped because agent option
-				   field was specified and we're not relaying
-				   packets that already have an agent option
-				   specified. */
-int bogus_giaddr_drops = 0;	/* Packets sent to us to relay back to a
-				   client, but with a bogus giaddr. */
-int client_packets_relayed = 0;	/* Packets relayed from client to server. */
-int server_packet_errors = 0;	/* Errors sending packets to servers. */
-int server_packets_relayed = 0;	/* Packets relayed from server to client. */
-int client_packet_errors = 0;	/* Errors sending packets to clients. */
-
-int add_agent_options = 0;	/* If nonzero, add relay agent options. */
-int drop_agent_mismatches = 0;	/* If nonzero, drop server replies that
-				   don't contain a Relay Agent Information
-				   option whose Agent ID suboption matches
-				   our giaddr. */
-int corrupt_agent_options = 0;	/* Number of packets dropped because
-				   relay agent information option was bad. */
-int missing_agent_option = 0;	/* Number of packets dropped because no
-				   RAI option matching our ID was found. */
-int bad_circuit_id = 0;		/* Circuit ID option in matching RAI option
-				   did not match any known circuit ID. */
-int missing_circuit_id = 0;	/* Circuit ID option in matching RAI option
-				   was missing. */
 int max_hop_count = 10;		/* Maximum hop count */
 
+/* What the kernel lets through to the DHCPv4 sockets. */
+struct dhcpv4_udp_filter relay_v4_filter;
 
-/* Maximum size of a packet with agent options added. */
-int dhcp_max_agent_option_packet_length = 576;
+int raw_unicast_replies = 0;	/* If nonzero, send replies to clients
+				   that have no address yet as frames
+				   addressed to their hardware address. */
 
-/* What to do about packets we're asked to relay that
-   already have a relay option: */
+/* Which servers a request is forwarded to: */
 static enum
   {
-    forward_and_append,		/* Forward and append our own relay option. */
-    forward_and_replace,	/* Forward, but replace theirs with ours. */
-    forward_untouched,		/* Forward without changes. */
-    discard
-  } agent_relay_mode = forward_and_replace;
+    forward_to_all,		/* All of them. */
+    forward_by_hash,		/* The two the client hashes to. */
+    forward_with_failover	/* The first of those that's answering. */
+  } forward_policy = forward_to_all;
+
+/* A server that has answered none of the last RELAY_SERVER_MISSES requests
+   sent to it, over at least RELAY_SERVER_TIMEOUT seconds, is taken to be
+   down.   With failover, it's skipped, but still gets a request every
+   RELAY_SERVER_PROBE seconds, so that we notice when it's back. */
+#define RELAY_SERVER_MISSES	8
+#define RELAY_SERVER_TIMEOUT	10
+#define RELAY_SERVER_PROBE	10
 
 u_int16_t local_port_dhcpv6;
 u_int16_t remote_port_dhcpv6;
+u_int16_t listen_port_dhcpv6;
 
 /* Server list. */
 struct server_list *servers;
 
+/* The health of each server, by address, so that a reply can be
+   credited to its server without searching every interface's list.
+   It's filled in while the arguments are parsed, so the relay threads
+   only ever look things up in it. */
+typedef struct hash_table server_health_hash_t;
+HASH_FUNCTIONS_DECL(server_health, const u_int8_t *,
+		    struct server_health, server_health_hash_t)
+HASH_FUNCTIONS(server_health, const u_int8_t *,
+	       struct server_health, server_health_hash_t)
+static server_health_hash_t *server_health;
+
 static char copyright [] = "Copyright 1997-2002 Internet Software Consortium.";
 static char arr [] = "All rights reserved.";
 static char message [] = "Internet Software Consortium DHCP Relay Agent";
@@ -108,6 +112,10 @@ int main(int argc, char **argv)
   int quiet = 0;
   char *s;
   struct interface_info *tmp = (struct interface_info *)0;
+  const char *handoff_path = 0;
+  RelayHandoff *handoff = 0;
+  int v4fd = -1, v6fd = -1;
+  isc_result_t status;
 
   /* Make sure we have stdin, stdout and stderr. */
   i = open ("/dev/null", O_RDWR);
@@ -145,6 +153,14 @@ int main(int argc, char **argv)
 	  log_debug ("binding to user-specified port %d",
 		     ntohs (local_port));
 	}
+      else if (!strcmp (argv [i], "-p6"))
+	{
+	  if (++i == argc)
+	    usage ();
+	  local_port_dhcpv6 = htons (atoi (argv [i]));
+	  log_debug ("binding to user-specified dhcpv6 port %d",
+		     ntohs (local_port_dhcpv6));
+	}
       else if (!strcmp (argv [i], "-d"))
 	{
 	  no_daemon = 1;
@@ -177,6 +193,26 @@ int main(int argc, char **argv)
 	    }
 	  new_relay_server(argv[i], &tmp->servers);
 	}
+      else if (!strcmp(argv [i], "-ir"))
+	{
+	  if (++i == argc)
+	    usage();
+	  if (!tmp)
+	    {
+	      log_error("-ir must follow -i.");
+	      usage();
+	    }
+	  tmp->remote_id = (u_int8_t *)argv[i];
+	  tmp->remote_id_len = strlen(argv[i]);
+	  if (tmp->remote_id_len > 255)
+	    usage();
+	}
+      else if (!strcmp(argv [i], "-enterprise"))
+	{
+	  if (++i == argc)
+	    usage();
+	  relay6_enterprise_number = strtoul(argv[i], 0, 0);
+	}
       else if (!strcmp(argv [i], "-q"))
 	{
 	  quiet = 1;
@@ -226,10 +262,59 @@ int main(int argc, char **argv)
 	  else
 	    usage();
 	}
+      else if (!strcmp(argv [i], "-policy"))
+	{
+	  if (++i == argc)
+	    usage();
+	  if (!strcasecmp(argv [i], "broadcast"))
+	    forward_policy = forward_to_all;
+	  else if (!strcasecmp(argv [i], "hash"))
+	    forward_policy = forward_by_hash;
+	  else if (!strcasecmp(argv [i], "failover"))
+	    forward_policy = forward_with_failover;
+	  else
+	    usage();
+	}
+      else if (!strcmp(argv [i], "-raw-unicast"))
+	{
+#if defined (NEED_LPF)
+	  raw_unicast_replies = 1;
+#else
+	  log_fatal("-raw-unicast isn't supported on this platform.");
+#endif
+	}
+      else if (!strcmp(argv [i], "-threads"))
+	{
+	  if (++i == argc)
+	    usage();
+#if defined (SO_REUSEPORT) && defined (IP_PKTINFO)
+	  relay_threads = atoi(argv [i]);
+	  if (!relay_threads)
+	    relay_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	  if (relay_threads > RELAY_MAX_THREADS)
+	    relay_threads = RELAY_MAX_THREADS;
+	  if (relay_threads < 1)
+	    usage();
+#else
+	  log_fatal("-threads isn't supported on this platform.");
+#endif
+	}
+      else if (!strcmp(argv [i], "-dup-window"))
+	{
+	  if (++i == argc)
+	    usage();
+	  duplicate_window = atoi(argv [i]) * 1000000ULL;
+	}
       else if (!strcmp(argv[i], "-D"))
 	{
 	  drop_agent_mismatches = 1;
 	}
+      else if (!strcmp(argv[i], "-handoff"))
+	{
+	  if (++i == argc)
+	    usage();
+	  handoff_path = argv[i];
+	}
       else if (argv[i][0] == '-')
 	{
 	  usage();
@@ -239,7 +324,7 @@ int main(int argc, char **argv)
 	  log_info("nom-dhcrelay-%s", DHCP_VERSION);
 	  exit(0);
 	}
-      else
+      else if (!new_relay6_server(argv [i]))
 	{
 	  new_relay_server(argv [i], &servers);
 	}
@@ -276,9 +361,22 @@ int main(int argc, char **argv)
       endservent ();
     }
   remote_port = htons (ntohs (local_port) + 1);
-  
+  listen_port = local_port;
+
+  if (!local_port_dhcpv6)
+    {
+      ent = getservbyname ("dhcpv6-server", "udp");
+      if (!ent)
+	local_port_dhcpv6 = htons (547);
+      else
+	local_port_dhcpv6 = ent->s_port;
+      endservent ();
+    }
+  remote_port_dhcpv6 = htons (ntohs (local_port_dhcpv6) - 1);
+  listen_port_dhcpv6 = local_port_dhcpv6;
+
   /* We need at least one server. */
-  if (!servers)
+  if (!servers && !servers6)
     {
       usage ();
     }
@@ -305,19 +403,83 @@ int main(int argc, char **argv)
 	}
     }
 
+  /* The relay threads' sockets all share the DHCPv4 port.   A socket
+   * that's handed off can't be shared with threads that go away.
+   */
+  if (relay_threads > 1)
+    {
+      if (handoff_path)
+	log_fatal("-threads can't be used with -handoff.");
+      dhcpv4_socket_reuseport = 1;
+    }
+
   /* Get the current time... */
   fetch_time();
 
-  /* Open the network socket(s). */
-  dhcpv4_socket_setup();
+  /* If there's a relay running with the same handoff path, take over its
+   * socket and counters.
+   */
+  if (handoff_path)
+    {
+      handoff = new RelayHandoff(handoff_path);
+      status = handoff->takeover(&v4fd, &v6fd);
+      if (status != ISC_R_SUCCESS && status != ISC_R_NOTFOUND)
+	log_fatal("Can't take over from the relay on %s: %s",
+		  handoff_path, isc_result_totext(status));
+      if (v4fd >= 0 && !servers)
+	{
+	  close(v4fd);
+	  v4fd = -1;
+	}
+      if (v6fd >= 0 && !servers6)
+	{
+	  close(v6fd);
+	  v6fd = -1;
+	}
+    }
+
+  /* Open the network socket(s).   A DHCPv6 socket we were handed is
+   * already in the multicast group.
+   */
+  if (v4fd >= 0)
+    dhcpv4_socket_adopt(v4fd);
+  else if (servers)
+    dhcpv4_socket_setup();
+
+  /* Have the kernel drop the requests we'd only throw away.   A socket
+     we were handed still has the old relay's filter until then. */
+  relay_v4_filter.min_length = (DHCP_FIXED_NON_UDP - DHCP_SNAME_LEN -
+				DHCP_FILE_LEN);
+  relay_v4_filter.max_hops = max_hop_count;
+  relay_v4_filter.shards = relay_threads;
+#if defined (NEED_LPF)
+  if (servers)
+    lpf_udp_filter_v4(dhcpv4_socket_fd(), &relay_v4_filter);
+#endif
 
-  /* Join the relay agent multicast group on all requested interfaces. */
-  for (tmp = interfaces; tmp; tmp = tmp->next)
+  if (servers6)
     {
-      dhcpv6_multicast_relay_join(tmp);
-      tmp->v4listener = new DHCPv4Relay(tmp);
+      int any_requested = 0;
+
+      if (v6fd >= 0)
+	dhcpv6_socket_adopt(v6fd);
+      else
+	{
+	  dhcpv6_socket_setup();
+	  for (tmp = interfaces; tmp; tmp = tmp->next)
+	    if (tmp->requested)
+	      any_requested = 1;
+	  for (tmp = interfaces; tmp; tmp = tmp->next)
+	    if (tmp->v6configured && (tmp->requested || !any_requested))
+	      dhcpv6_multicast_relay_join(tmp);
+	}
+      relay6_setup();
     }
 
+  /* Listen for DHCPv4 packets on every interface. */
+  for (tmp = interfaces; servers && tmp; tmp = tmp->next)
+    tmp->v4listener = new DHCPv4Relay(tmp);
+
   /* Become a daemon... */
   if (!no_daemon)
     {
@@ -358,6 +520,16 @@ int main(int argc, char **argv)
       pid = setsid ();
     }
 
+  /* Start the other relay threads, now that there's only one process. */
+  if (relay_threads > 1 && servers)
+    relay_workers_start();
+
+  /* Be ready to hand off to whatever replaces us. */
+  if (handoff)
+    handoff->listen();
+
+  relay_stats_setup();
+
   /* Start dispatching packets and timeouts... */
   dispatch ();
 
@@ -394,6 +566,19 @@ void new_relay_server(char *arg, struct server_list **servers)
       sp->next = *servers;
       *servers = sp;
       memcpy (&sp->to.sin_addr, iap, sizeof *iap);
+
+      if (!server_health && !server_health_new_hash(&server_health, 0))
+	log_fatal ("Can't allocate the server health table.");
+      if (!server_health_hash_lookup(&sp->health, server_health,
+				     (const u_int8_t *)iap, sizeof *iap))
+	{
+	  sp->health = (struct server_health *)
+	    safemalloc(sizeof *sp->health);
+	  sp->health->addr = *iap;
+	  server_health_hash_add(server_health,
+				 (const u_int8_t *)&sp->health->addr,
+				 sizeof sp->health->addr, sp->health);
+	}
     }
 }
 
@@ -407,11 +592,9 @@ isc_result_t DHCPv4Relay::got_packet(struct interface_info *ip,
 				     unsigned char *contents,
 				     ssize_t length)
 {
-  struct server_list *sp;
   struct sockaddr_in to;
   struct interface_info *out;
   struct hardware hto;
-  int i;
   struct dhcp_packet *packet = (struct dhcp_packet *)contents;
 
   if (length < DHCP_FIXED_NON_UDP - DHCP_SNAME_LEN - DHCP_FILE_LEN)
@@ -423,28 +606,27 @@ isc_result_t DHCPv4Relay::got_packet(struct interface_info *ip,
       return ISC_R_FORMERR;
     }
 
+  /* With more than one relay thread, each thread's socket gets a copy
+     of a broadcast, so only the thread the client hashes to relays it.
+     The same thread then sees all of the client's broadcasts.   The
+     socket filters usually drop the other copies already. */
+  if (relay_threads > 1 && packet->op == BOOTREQUEST &&
+      !interface_find_address(dhcpv4_packet_dest) &&
+      request_thread(packet) != relay_thread_index)
+    return ISC_R_SUCCESS;
+
   /* Find the interface that corresponds to the giaddr
      in the packet. */
   if (packet->giaddr.s_addr)
-    {
-      for (out = interfaces; out; out = out->next)
-	{
-	  for (i = 0; i < out->ipv4_addr_count; i++)
-	    {
-	      if (out->ipv4s[i].s_addr == packet->giaddr.s_addr)
-		goto matched;
-	    }
-	}
-    }
+    out = interface_find_address(packet->giaddr);
   else
-    {
-      out = (struct interface_info *)0;
-    }
- matched:
+    out = (struct interface_info *)0;
 
   /* If it's a bootreply, forward it to the client. */
   if (packet->op == BOOTREPLY)
     {
+      server_replied(from->sin_addr);
+
       if (!(packet->flags & htons(BOOTP_BROADCAST)))
 	{
 	  to.sin_addr = packet->yiaddr;
@@ -475,7 +657,7 @@ isc_result_t DHCPv4Relay::got_packet(struct interface_info *ip,
 	{
 	  log_error ("packet to bogus giaddr %s.",
 		     inet_ntoa (packet->giaddr));
-	  ++bogus_giaddr_drops;
+	  ++relay_stats->bogus_giaddr_drops;
 	  return ISC_R_NOTFOUND;
 	}
 
@@ -486,11 +668,35 @@ isc_result_t DHCPv4Relay::got_packet(struct interface_info *ip,
 		       out->name);
 	  return ISC_R_NOTFOUND;
 	}
+#if defined (NEED_LPF)
+      /* A client without an address can't answer ARP, so the reply would
+	 have to be broadcast.   Instead, send it straight to the client's
+	 hardware address.   The IP destination is still the broadcast
+	 address if the client asked for it, since it may not accept
+	 packets for an address it doesn't have yet. */
+      if (raw_unicast_replies && !packet->ciaddr.s_addr &&
+	  packet->htype == HTYPE_ETHER && packet->hlen == 6)
+	{
+	  if (!packet->yiaddr.s_addr)
+	    to.sin_addr.s_addr = htonl(INADDR_BROADCAST);
+	  if (lpf_send_packet (out, packet, length, &to, &hto) >= 0)
+	    {
+	      log_debug ("unicast BOOTREPLY for %s to %s",
+			 print_hw_addr (packet->htype, packet->hlen,
+					packet->chaddr),
+			 inet_ntoa (to.sin_addr));
+	      ++relay_stats->server_packets_relayed;
+	      return ISC_R_SUCCESS;
+	    }
+	  /* Otherwise, fall back to sending it the usual way. */
+	}
+#endif
+
       if (send_packet (out,
 		       packet, length,
 		       (struct sockaddr *)&to) < 0)
 	{
-	  ++server_packet_errors;
+	  ++relay_stats->server_packet_errors;
 	}
       else
 	{
@@ -499,7 +705,7 @@ isc_result_t DHCPv4Relay::got_packet(struct interface_info *ip,
 				    packet->chaddr),
 		     inet_ntoa (to.sin_addr));
 
-	  ++server_packets_relayed;
+	  ++relay_stats->server_packets_relayed;
 	}
       return ISC_R_SUCCESS;
     }
@@ -518,6 +724,10 @@ isc_result_t DHCPv4Relay::got_packet(struct interface_info *ip,
       return ISC_R_NOTFOUND;
     }
 
+  /* Don't pass on a request the servers already have. */
+  if (duplicate_window && relay_request_is_duplicate(packet, length))
+    return ISC_R_SUCCESS;
+
   /* Add relay agent options if indicated.   If something goes wrong,
      drop the packet. */
   if (!(length = add_relay_agent_options (ip, packet, length,
@@ -537,383 +747,347 @@ isc_result_t DHCPv4Relay::got_packet(struct interface_info *ip,
   else
     return ISC_R_SUCCESS;
 
-  /* Otherwise, it's a BOOTREQUEST, so forward it to all the
-     servers. */
-  for (sp = (ip->servers
-	     ? ip->servers : servers); sp; sp = sp->next)
-    {
-      if (send_packet(0, packet, length,
-		      (struct sockaddr *)&sp->to) < 0)
-	{
-	  ++client_packet_errors;
-	}
-      else
-	{
-	  log_debug ("forwarded BOOTREQUEST for %s to %s",
-		     print_hw_addr (packet->htype, packet->hlen,
-				    packet->chaddr),
-		     inet_ntoa (sp->to.sin_addr));
-	  ++client_packets_relayed;
-	}
-    }
+  /* Otherwise, it's a BOOTREQUEST, so forward it to the servers. */
+  forward_request(ip->servers ? ip->servers : servers, packet, length);
   return ISC_R_SUCCESS;
 }
 
-static void usage()
+/* Send a request to one server, and count it as unanswered until the
+   server replies to something.   Any relay thread can do this, so the
+   server's fields are only changed atomically; since they just decide
+   whether it seems to be down, reading them isn't synchronized. */
+
+static void forward_to(struct server_list *sp,
+		       struct dhcp_packet *packet, unsigned length)
 {
-  log_fatal ("Usage: dhcrelay [-p <port>] [-d] [-D] [-i %s%s%s%s",
-	     "interface [-is server ... ]]\n                ",
-	     "[-c count] [-A length] ",
-	     "[-m append|replace|forward|discard]\n",
-	     "                [server1 [... serverN]]");
+  if (send_packet(0, packet, length,
+		  (struct sockaddr *)&sp->to) < 0)
+    {
+      ++relay_stats->client_packet_errors;
+      return;
+    }
+  log_debug ("forwarded BOOTREQUEST for %s to %s",
+	     print_hw_addr (packet->htype, packet->hlen,
+			    packet->chaddr),
+	     inet_ntoa (sp->to.sin_addr));
+  ++relay_stats->client_packets_relayed;
+  __atomic_add_fetch(&sp->health->requests, 1, __ATOMIC_RELAXED);
+  if (!__atomic_fetch_add(&sp->health->unanswered, 1, __ATOMIC_RELAXED))
+    __atomic_store_n(&sp->health->unanswered_since, cur_time,
+		     __ATOMIC_RELAXED);
 }
 
-/* Strip any Relay Agent Information options from the DHCP packet
-   option buffer.   If an RAI option is found whose Agent ID matches
-   the giaddr (i.e., ours), try to look up the outgoing interface
-   based on the circuit ID suboption. */
+/* Decide whether a server is down, from how long it's been since it
+   answered anything. */
 
-int strip_relay_agent_options(struct interface_info *in,
-			      struct interface_info **out,
-			      struct dhcp_packet *packet,
-			      unsigned length)
+static int server_is_down(struct server_list *sp)
 {
-  int is_dhcp = 0;
-  u_int8_t *op, *sp, *max;
-  int good_agent_option = 0;
-  int status;
+  struct server_health *h = sp->health;
 
-  /* If we're not adding agent options to packets, we're not taking
-     them out either. */
-  if (!add_agent_options)
-    return length;
+  if (!h->down && h->unanswered >= RELAY_SERVER_MISSES &&
+      cur_time >= h->unanswered_since + NANO_SECONDS(RELAY_SERVER_TIMEOUT) &&
+      !__atomic_exchange_n(&h->down, 1, __ATOMIC_RELAXED))
+    {
+      h->probe = cur_time;
+      log_error ("server %s has answered none of the last %u requests "
+		 "(%u requests, %u replies in all)",
+		 inet_ntoa (h->addr), h->unanswered,
+		 h->requests, h->replies);
+    }
+  return h->down;
+}
 
-  /* If there's no cookie, it's a bootp packet, so we should just
-     forward it unchanged. */
-  if (memcmp (packet->options, DHCP_OPTIONS_COOKIE, 4))
-    return length;
+/* Note a reply from a server. */
 
-  max = ((u_int8_t *)packet) + length;
-  sp = op = &packet->options [4];
+static void server_replied(struct in_addr from)
+{
+  struct server_health *h;
+
+  if (!server_health_hash_lookup(&h, server_health,
+				 (const u_int8_t *)&from, sizeof from))
+    return;
+  __atomic_add_fetch(&h->replies, 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&h->unanswered, 0, __ATOMIC_RELAXED);
+  if (h->down && __atomic_exchange_n(&h->down, 0, __ATOMIC_RELAXED))
+    log_info ("server %s is answering again", inet_ntoa (h->addr));
+}
 
-  while (op < max)
-    {
-      switch (*op)
-	{
-	  /* Skip padding... */
-	case DHO_PAD:
-	  if (sp != op)
-	    *sp = *op;
-	  ++op;
-	  ++sp;
-	  continue;
-
-	  /* If we see a message type, it's a DHCP packet. */
-	case DHO_DHCP_MESSAGE_TYPE:
-	  is_dhcp = 1;
-	  goto skip;
-	  break;
-
-	  /* Quit immediately if we hit an End option. */
-	case DHO_END:
-	  if (sp != op)
-	    *sp++ = *op++;
-	  goto out;
-
-	case DHO_DHCP_AGENT_OPTIONS:
-	  /* We shouldn't see a relay agent option in a
-	     packet before we've seen the DHCP packet type,
-	     but if we do, we have to leave it alone. */
-	  if (!is_dhcp)
-	    goto skip;
-
-	  status = find_interface_by_agent_option(packet,
-						  out, op + 2, op [1]);
-	  if (status == -1 && drop_agent_mismatches)
-	    return 0;
-	  if (status)
-	    good_agent_option = 1;
-	  op += op [1] + 2;
-	  break;
-
-	skip:
-	  /* Skip over other options. */
-	default:
-	  if (sp != op)
-	    memcpy (sp, op, (unsigned)(op [1] + 2));
-	  sp += op [1] + 2;
-	  op += op [1] + 2;
-	  break;
-	}
-    }
- out:
+/* The relay thread a broadcast request belongs to, from its hardware
+   address.   The filter lpf_udp_filter_v4() puts on each thread's socket
+   works this out the same way. */
 
-  /* If it's not a DHCP packet, we're not supposed to touch it. */
-  if (!is_dhcp)
-    return length;
+static unsigned request_thread(struct dhcp_packet *packet)
+{
+  u_int32_t hash = 2166136261U;
+  unsigned i;
 
-  /* If none of the agent options we found matched, or if we didn't
-     find any agent options, count this packet as not having any
-     matching agent options, and if we're relying on agent options
-     to determine the outgoing interface, drop the packet. */
+  for (i = 0; i < 6; i++)
+    hash = (hash ^ packet->chaddr [i]) * 16777619U;
+  return (hash ^ (hash >> 16)) % relay_threads;
+}
 
-  if (!good_agent_option)
-    {
-      ++missing_agent_option;
-      if (drop_agent_mismatches)
-	return 0;
-    }
+/* A hash of the client: its client identifier if it sent one, and
+   otherwise its hardware address. */
 
-  /* Adjust the length... */
-  if (sp != op)
-    {
-      length = sp - ((u_int8_t *)packet);
+static u_int32_t client_hash(struct dhcp_packet *packet, unsigned length)
+{
+  u_int8_t *op, *max, *id = packet->chaddr;
+  unsigned id_len = packet->hlen, i;
+  u_int32_t hash = 2166136261U;
 
-      /* Make sure the packet isn't short (this is unlikely,
-	 but WTH) */
-      if (length < BOOTP_MIN_LEN)
+  max = ((u_int8_t *)packet) + length;
+  op = &packet->options [4];
+  if (length > DHCP_FIXED_NON_UDP + 4 &&
+      !memcmp (packet->options, DHCP_OPTIONS_COOKIE, 4))
+    {
+      while (op < max && *op != DHO_END)
 	{
-	  memset (sp, 0, BOOTP_MIN_LEN - length);
-	  length = BOOTP_MIN_LEN;
+	  if (*op == DHO_PAD)
+	    {
+	      ++op;
+	      continue;
+	    }
+	  if (max - op < 2 || max - op < op [1] + 2)
+	    break;
+	  if (*op == DHO_DHCP_CLIENT_IDENTIFIER && op [1])
+	    {
+	      id = op + 2;
+	      id_len = op [1];
+	      break;
+	    }
+	  op += op [1] + 2;
 	}
     }
-  return length;
+
+  /* FNV-1a. */
+  for (i = 0; i < id_len; i++)
+    hash = (hash ^ id [i]) * 16777619U;
+  return hash;
 }
 
+/* Where a server ranks for a client: servers are tried in order of
+   decreasing weight, so adding or removing one only moves the clients
+   that rank it first or second. */
 
-/* Find an interface that matches the circuit ID specified in the
-   Relay Agent Information option.   If one is found, store it through
-   the pointer given; otherwise, leave the existing pointer alone.
+static u_int32_t server_weight(u_int32_t hash, struct server_list *sp)
+{
+  const u_int8_t *addr = (const u_int8_t *)&sp->to.sin_addr;
+  unsigned i;
+
+  for (i = 0; i < sizeof sp->to.sin_addr; i++)
+    hash = (hash ^ addr [i]) * 16777619U;
+  hash ^= hash >> 15;
+  hash *= 0x2c1b3c6dU;
+  hash ^= hash >> 12;
+  return hash;
+}
 
-   We actually deviate somewhat from the current specification here:
-   if the option buffer is corrupt, we suggest that the caller not
-   respond to this packet.  If the circuit ID doesn't match any known
-   interface, we suggest that the caller to drop the packet.  Only if
-   we find a circuit ID that matches an existing interface do we tell
-   the caller to go ahead and process the packet. */
+/* Forward a request according to the forwarding policy. */
 
-int find_interface_by_agent_option(struct dhcp_packet *packet,
-				   struct interface_info **out,
-				   u_int8_t *buf,
-				   int len)
+static void forward_request(struct server_list *list,
+			    struct dhcp_packet *packet, unsigned length)
 {
-  int i = 0;
-  u_int8_t *circuit_id = 0;
-  unsigned circuit_id_len;
-  struct interface_info *ip;
+  struct server_list *sp, *first = 0, *second = 0, *live = 0;
+  u_int32_t hash, weight, w1 = 0, w2 = 0, wl = 0;
 
-  while (i < len)
+  if (forward_policy == forward_to_all)
     {
-      /* If the next agent option overflows the end of the
-	 packet, the agent option buffer is corrupt. */
-      if (i + 1 == len ||
-	  i + buf [i + 1] + 2 > len)
+      for (sp = list; sp; sp = sp->next)
 	{
-	  ++corrupt_agent_options;
-	  return -1;
-	}
-      switch (buf [i])
-	{
-	  /* Remember where the circuit ID is... */
-	case RAI_CIRCUIT_ID:
-	  circuit_id = &buf [i + 2];
-	  circuit_id_len = buf [i + 1];
-	  i += circuit_id_len + 2;
-	  continue;
-
-	default:
-	  i += buf [i + 1] + 2;
-	  break;
+	  server_is_down(sp);
+	  forward_to(sp, packet, length);
 	}
+      return;
     }
 
-  /* If there's no circuit ID, it's not really ours, tell the caller
-     it's no good. */
-  if (!circuit_id)
+  /* Find the two servers the client ranks highest, and the highest
+     ranked one that's answering. */
+  hash = client_hash(packet, length);
+  for (sp = list; sp; sp = sp->next)
     {
-      ++missing_circuit_id;
-      return -1;
+      weight = server_weight(hash, sp);
+      if (!first || weight > w1)
+	{
+	  second = first;
+	  w2 = w1;
+	  first = sp;
+	  w1 = weight;
+	}
+      else if (!second || weight > w2)
+	{
+	  second = sp;
+	  w2 = weight;
+	}
+      if (!server_is_down(sp) && (!live || weight > wl))
+	{
+	  live = sp;
+	  wl = weight;
+	}
     }
+  if (!first)
+    return;
 
-  /* Scan the interface list looking for an interface whose
-     name matches the one specified in circuit_id. */
-
-  for (ip = interfaces; ip; ip = ip->next)
+  if (forward_policy == forward_by_hash)
     {
-      if (ip->circuit_id &&
-	  ip->circuit_id_len == circuit_id_len &&
-	  !memcmp (ip->circuit_id, circuit_id, circuit_id_len))
-	break;
+      forward_to(first, packet, length);
+      if (second)
+	forward_to(second, packet, length);
+      return;
     }
 
-  /* If we got a match, use it. */
-  if (ip)
+  /* With failover, the request goes to one server that's answering, or
+     to the client's first choice if none is.   Servers that are down
+     get a request every so often anyway. */
+  if (!live)
+    live = first;
+  forward_to(live, packet, length);
+  for (sp = list; sp; sp = sp->next)
     {
-      *out = ip;
-      return 1;
+      u_int64_t probe = sp->health->probe;
+
+      if (sp->health->down && sp != live && cur_time >= probe &&
+	  __atomic_compare_exchange_n(&sp->health->probe, &probe,
+				      cur_time +
+				      NANO_SECONDS(RELAY_SERVER_PROBE),
+				      0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	forward_to(sp, packet, length);
     }
+}
 
-  /* If we didn't get a match, the circuit ID was bogus. */
-  ++bad_circuit_id;
-  return -1;
+static void usage()
+{
+  log_fatal ("Usage: dhcrelay [-p <port>] [-p6 <port>] [-d] [-D] [-i %s%s%s%s",
+	     "interface [-is server ... ] [-ir remote-id]]\n                ",
+	     "[-c count] [-A length] [-enterprise number] "
+	     "[-dup-window ms] [-raw-unicast] [-threads n]\n"
+	     "                ",
+	     "[-m append|replace|forward|discard]\n"
+	     "                [-policy broadcast|hash|failover] "
+	     "[-handoff socket]\n",
+	     "                [server1 [... serverN]]");
 }
 
-/* Examine a packet to see if it's a candidate to have a Relay
-   Agent Information option tacked onto its tail.   If it is, tack
-   the option on.  */
+RelayHandoff::RelayHandoff(const char *path): Handoff(path)
+{
+}
 
-int add_relay_agent_options (struct interface_info *ip,
-			     struct dhcp_packet *packet,
-			     unsigned length,
-			     struct in_addr giaddr)
+/* The counters, in the order they're handed off, and the names they're
+   logged under. */
+static struct relay_counter {
+  const char *name;
+  int relay_stats::*counter;
+} relay_counters[] = {
+  { "bogus-agent-drops", &relay_stats::bogus_agent_drops },
+  { "bogus-giaddr-drops", &relay_stats::bogus_giaddr_drops },
+  { "client-packets-relayed", &relay_stats::client_packets_relayed },
+  { "server-packet-errors", &relay_stats::server_packet_errors },
+  { "server-packets-relayed", &relay_stats::server_packets_relayed },
+  { "client-packet-errors", &relay_stats::client_packet_errors },
+  { "corrupt-agent-options", &relay_stats::corrupt_agent_options },
+  { "missing-agent-option", &relay_stats::missing_agent_option },
+  { "bad-circuit-id", &relay_stats::bad_circuit_id },
+  { "missing-circuit-id", &relay_stats::missing_circuit_id },
+  { "v6-client-packets-relayed", &relay_stats::v6_client_packets_relayed },
+  { "v6-server-packets-relayed", &relay_stats::v6_server_packets_relayed },
+  { "v6-packet-errors", &relay_stats::v6_packet_errors },
+  { "v6-hop-limit-drops", &relay_stats::v6_hop_limit_drops },
+  { "v6-bogus-packet-drops", &relay_stats::v6_bogus_packet_drops },
+  { "v6-bad-interface-id", &relay_stats::v6_bad_interface_id },
+  { "duplicate-requests-suppressed",
+    &relay_stats::duplicate_requests_suppressed },
+  { "duplicate-cache-evictions", &relay_stats::duplicate_cache_evictions },
+  { "agent-options-omitted", &relay_stats::agent_options_omitted }
+};
+
+#define RELAY_COUNTERS	(sizeof relay_counters / sizeof relay_counters[0])
+
+/* A counter's total over all the relay threads. */
+static u_int32_t relay_counter_total(unsigned i)
 {
-  int is_dhcp = 0;
-  u_int8_t *op, *sp, *max, *end_pad = 0;
+  u_int32_t total = 0;
+  unsigned t;
 
-  /* If we're not adding agent options to packets, we can skip
-     this. */
-  if (!add_agent_options)
-    return length;
+  for (t = 0; t < relay_threads; t++)
+    total += relay_stats_blocks[t].*relay_counters[i].counter;
+  return total;
+}
 
-  /* If there's no cookie, it's a bootp packet, so we should just
-     forward it unchanged. */
-  if (memcmp (packet->options, DHCP_OPTIONS_COOKIE, 4))
-    return length;
+void RelayHandoff::save(struct handoff_buffer *buf)
+{
+  unsigned i;
 
-  max = ((u_int8_t *)packet) + length;
-  sp = op = &packet->options [4];
+  handoff_put_ulong(buf, RELAY_COUNTERS);
+  for (i = 0; i < RELAY_COUNTERS; i++)
+    handoff_put_ulong(buf, relay_counter_total(i));
+}
 
-  while (op < max)
-    {
-      switch (*op)
-	{
-	  /* Skip padding... */
-	case DHO_PAD:
-	  end_pad = sp;
-	  if (sp != op)
-	    *sp = *op;
-	  ++op;
-	  ++sp;
-	  continue;
-
-	  /* If we see a message type, it's a DHCP packet. */
-	case DHO_DHCP_MESSAGE_TYPE:
-	  is_dhcp = 1;
-	  goto skip;
-	  break;
-
-	  /* Quit immediately if we hit an End option. */
-	case DHO_END:
-	  goto out;
-
-	case DHO_DHCP_AGENT_OPTIONS:
-	  /* We shouldn't see a relay agent option in a
-	     packet before we've seen the DHCP packet type,
-	     but if we do, we have to leave it alone. */
-	  if (!is_dhcp)
-	    goto skip;
-	  end_pad = 0;
-
-	  /* There's already a Relay Agent Information option
-	     in this packet.   How embarrassing.   Decide what
-	     to do based on the mode the user specified. */
-
-	  switch (agent_relay_mode)
-	    {
-	    case forward_and_append:
-	      goto skip;
-	    case forward_untouched:
-	      return length;
-	    case discard:
-	      return 0;
-	    case forward_and_replace:
-	    default:
-	      break;
-	    }
+/* A newer relay may count more things; an older one fewer. */
+isc_result_t RelayHandoff::restore(struct handoff_buffer *buf)
+{
+  unsigned i, n;
+  u_int32_t val;
 
-	  /* Skip over the agent option and start copying
-	     if we aren't copying already. */
-	  op += op [1] + 2;
-	  break;
-
-	skip:
-	  /* Skip over other options. */
-	default:
-	  end_pad = 0;
-	  if (sp != op)
-	    memcpy (sp, op, (unsigned)(op [1] + 2));
-	  sp += op [1] + 2;
-	  op += op [1] + 2;
-	  break;
-	}
+  n = handoff_get_ulong(buf);
+  for (i = 0; i < n && !buf->error; i++)
+    {
+      val = handoff_get_ulong(buf);
+      if (i < RELAY_COUNTERS)
+	relay_stats_blocks[0].*relay_counters[i].counter += val;
     }
- out:
-
-  /* If it's not a DHCP packet, we're not supposed to touch it. */
-  if (!is_dhcp)
-    return length;
-
-  /* If the packet was padded out, we can store the agent option
-     at the beginning of the padding. */
-
-  if (end_pad)
-    sp = end_pad;
-
-  /* Remember where the end of the packet was after parsing
-     it. */
-  op = sp;
-
-  /* XXX Is there room? */
+  return buf->error ? ISC_R_UNEXPECTEDEND : ISC_R_SUCCESS;
+}
 
-  /* Okay, cons up *our* Relay Agent Information option. */
-  *sp++ = DHO_DHCP_AGENT_OPTIONS;
-  *sp++ = 0;	/* Dunno... */
+/* A SIGUSR1 logs the counters.   The handler only writes to a pipe, and
+   the dispatcher does the logging when the pipe becomes readable. */
+static int relay_stats_pipe[2] = { -1, -1 };
 
-  /* Copy in the circuit id... */
-  *sp++ = RAI_CIRCUIT_ID;
-  /* Sanity check.   Had better not every happen. */
-  if (ip->circuit_id_len > 255 || ip->circuit_id_len < 1)
-    log_fatal ("completely bogus circuit id length %d on %s\n",
-	       ip->circuit_id_len, ip->name);
-  *sp++ = ip->circuit_id_len;
-  memcpy (sp, ip->circuit_id, ip->circuit_id_len);
-  sp += ip->circuit_id_len;
+static void relay_stats_signal(int sig)
+{
+  int saved = errno;
 
-  /* Copy in remote ID... */
-  if (ip->remote_id)
+  if (write(relay_stats_pipe[1], "", 1) < 0)
     {
-      *sp++ = RAI_REMOTE_ID;
-      if (ip->remote_id_len > 255 || ip->remote_id_len < 1)
-	log_fatal ("bogus remote id length %d on %s\n",
-		   ip->circuit_id_len, ip->name);
-      *sp++ = ip->remote_id_len;
-      memcpy (sp, ip->remote_id, ip->remote_id_len);
-      sp += ip->remote_id_len;
+      /* The pipe is full, so the counters are about to be logged. */
     }
+  errno = saved;
+}
 
-  /* Relay option's total length shouldn't ever get to be more than
-     257 bytes. */
-  if (sp - op > 257)
-    log_fatal ("total agent option length exceeds 257 (%ld) on %s\n",
-	       (long)(sp - op), ip->name);
-
-  /* Calculate length of RAI option. */
-  op [1] = sp - op - 2;
+static int relay_stats_readfd(void *v)
+{
+  return relay_stats_pipe[0];
+}
 
-  /* Deposit an END token. */
-  *sp++ = DHO_END;
+static isc_result_t relay_stats_readable(void *v)
+{
+  char buf[64];
+  unsigned i;
 
-  /* Recalculate total packet length. */
-  length = sp - ((u_int8_t *)packet);
+  while (read(relay_stats_pipe[0], buf, sizeof buf) > 0)
+    ;
+  for (i = 0; i < RELAY_COUNTERS; i++)
+    log_info("%s: %u", relay_counters[i].name, relay_counter_total(i));
+  return ISC_R_SUCCESS;
+}
 
-  /* Make sure the packet isn't short (this is unlikely, but WTH) */
-  if (length < BOOTP_MIN_LEN)
-    {
-      memset (sp, 0, BOOTP_MIN_LEN - length);
-      length = BOOTP_MIN_LEN;
-    }
+static void relay_stats_setup()
+{
+  struct sigaction sa;
+  int i;
 
-  return length;
+  if (pipe(relay_stats_pipe) < 0)
+    log_fatal("Can't make a pipe for SIGUSR1: %m");
+  for (i = 0; i < 2; i++)
+    if (fcntl(relay_stats_pipe[i], F_SETFL, O_NONBLOCK) < 0 ||
+	fcntl(relay_stats_pipe[i], F_SETFD, 1) < 0)
+      log_fatal("Can't set up the SIGUSR1 pipe: %m");
+  register_io_object(0, relay_stats_readfd, 0, relay_stats_readable, 0, 0);
+
+  memset(&sa, 0, sizeof sa);
+  sa.sa_handler = relay_stats_signal;
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = SA_RESTART;
+  if (sigaction(SIGUSR1, &sa, 0) < 0)
+    log_fatal("Can't catch SIGUSR1: %m");
 }
 
 /* Local Variables:  */
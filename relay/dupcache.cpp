@@ -0,0 +1,189 @@
+/* dupcache.cpp
+ *
+ * Suppressing copies of a request that a client sends again before the
+ * servers could have answered the first one.
+ */
+
+/* Copyright (c) 2009 Nominum, Inc.   All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Nominum nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NOMINUM AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL NOMINUM OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef lint
+static char ocopyright[] __attribute__((unused)) =
+  "$Id: dupcache.cpp,v 1.1 2009/10/23 11:20:51 mellon Exp $ Copyright (c) 2009 Nominum, Inc.  All rights reserved.\n";
+#endif /* not lint */
+
+#include "dhcpd.h"
+#include "relay/v4relay.h"
+
+/* The cache is a fixed table of the requests forwarded recently, keyed by
+   hardware address, transaction ID and DHCP message type.   A key hashes
+   to a set of RELAY_DUP_WAYS slots; when none of them is free or out of
+   the window, one is picked by a clock hand that skips, once, slots whose
+   request has been sent again, so that the clients that are
+   retransmitting are the last to be forgotten.   Nothing is allocated
+   per packet. */
+#define RELAY_DUP_SLOTS		8192
+#define RELAY_DUP_WAYS		8
+#define RELAY_DUP_SETS		(RELAY_DUP_SLOTS / RELAY_DUP_WAYS)
+
+struct dup_slot {
+  u_int64_t seen;				/* ns; 0 if it's free. */
+  u_int32_t hash;
+  u_int32_t xid;
+  u_int8_t type;
+  u_int8_t htype;
+  u_int8_t hlen;
+  u_int8_t referenced;		/* A copy has been suppressed. */
+  u_int8_t chaddr[16];
+};
+
+/* Each relay thread has a cache of its own, allocated the first time it
+   relays a request; all the copies of a client's request reach the same
+   thread (see workers.cpp). */
+struct dup_cache {
+  struct dup_slot slots[RELAY_DUP_SLOTS];
+  u_int8_t hands[RELAY_DUP_SETS];
+};
+
+static __thread struct dup_cache *dup_cache;
+
+/* How long a request is remembered, in ns; 0 if the cache isn't used. */
+u_int64_t duplicate_window = 0;
+
+/* The DHCP message type, or 0 if it's a BOOTP request. */
+
+static u_int8_t request_type(struct dhcp_packet *packet, unsigned length)
+{
+  u_int8_t *op, *max;
+
+  if (length < DHCP_FIXED_NON_UDP + 4 ||
+      memcmp (packet->options, DHCP_OPTIONS_COOKIE, 4))
+    return 0;
+
+  max = ((u_int8_t *)packet) + length;
+  op = &packet->options [4];
+  while (op < max && *op != DHO_END)
+    {
+      if (*op == DHO_PAD)
+	{
+	  ++op;
+	  continue;
+	}
+      if (max - op < 2 || max - op < op [1] + 2)
+	break;
+      if (*op == DHO_DHCP_MESSAGE_TYPE && op [1] == 1)
+	return op [2];
+      op += op [1] + 2;
+    }
+  return 0;
+}
+
+/* Return nonzero if this request was forwarded less than the duplicate
+   window ago, and otherwise remember that it's being forwarded now.   A
+   client that keeps retransmitting gets one copy through per window. */
+
+int relay_request_is_duplicate(struct dhcp_packet *packet, unsigned length)
+{
+  struct dup_slot *set, *sp;
+  u_int32_t hash = 2166136261U;
+  u_int8_t type = request_type(packet, length);
+  unsigned i, setno, hand;
+
+  /* FNV-1a. */
+  for (i = 0; i < packet->hlen; i++)
+    hash = (hash ^ packet->chaddr [i]) * 16777619U;
+  for (i = 0; i < sizeof packet->xid; i++)
+    hash = (hash ^ ((u_int8_t *)&packet->xid) [i]) * 16777619U;
+  hash = (hash ^ type) * 16777619U;
+
+  /* FNV's low bits don't vary much with keys this alike, so mix the high
+     ones down before picking the set. */
+  hash ^= hash >> 15;
+  hash *= 0x2c1b3c6dU;
+  hash ^= hash >> 12;
+
+  setno = hash % RELAY_DUP_SETS;
+  if (!dup_cache)
+    dup_cache = (struct dup_cache *)safemalloc(sizeof *dup_cache);
+  set = &dup_cache->slots [setno * RELAY_DUP_WAYS];
+  for (i = 0; i < RELAY_DUP_WAYS; i++)
+    {
+      sp = &set [i];
+      if (sp->seen && sp->hash == hash && sp->xid == packet->xid &&
+	  sp->type == type && sp->htype == packet->htype &&
+	  sp->hlen == packet->hlen &&
+	  !memcmp (sp->chaddr, packet->chaddr, packet->hlen))
+	{
+	  if (cur_time - sp->seen < duplicate_window)
+	    {
+	      sp->referenced = 1;
+	      ++relay_stats->duplicate_requests_suppressed;
+	      return 1;
+	    }
+	  goto remember;
+	}
+    }
+
+  /* Use a slot that's free or has expired, if there is one... */
+  for (i = 0; i < RELAY_DUP_WAYS; i++)
+    {
+      sp = &set [i];
+      if (!sp->seen || cur_time - sp->seen >= duplicate_window)
+	goto remember;
+    }
+
+  /* ...and otherwise go round the set with the clock hand. */
+  hand = dup_cache->hands [setno];
+  for (;;)
+    {
+      sp = &set [hand];
+      hand = (hand + 1) % RELAY_DUP_WAYS;
+      if (!sp->referenced)
+	break;
+      sp->referenced = 0;
+    }
+  dup_cache->hands [setno] = hand;
+  ++relay_stats->duplicate_cache_evictions;
+
+ remember:
+  sp->seen = cur_time;
+  sp->hash = hash;
+  sp->xid = packet->xid;
+  sp->type = type;
+  sp->htype = packet->htype;
+  sp->hlen = packet->hlen;
+  sp->referenced = 0;
+  memcpy (sp->chaddr, packet->chaddr, packet->hlen);
+  return 0;
+}
+
+/* Local Variables:  */
+/* mode:C++ */
+/* c-file-style:"gnu" */
+/* end: */
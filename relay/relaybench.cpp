@@ -0,0 +1,508 @@
+/* relaybench.cpp
+ *
+ * Measure how many packets a running dhcrelay forwards, and how long
+ * each spends in it.
+ */
+
+/* Copyright (c) 2009 Nominum, Inc.   All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Nominum nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NOMINUM AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL NOMINUM OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+
+
+#ifndef lint
+static char ocopyright[] __attribute__((unused)) =
+  "$Id: relaybench.cpp,v 1.1 2009/10/28 16:40:12 mellon Exp $ Copyright (c) 2009 Nominum, Inc.  All rights reserved.\n";
+#endif /* not lint */
+
+#include "dhcpd.h"
+#include <pthread.h>
+#include <sys/wait.h>
+
+/* Usage: relaybench [-p port] [-rate pps] [-seconds n] [-threads n]
+ *		     [-relay path] [-handoff socket-path]
+ *
+ * Starts the dhcrelay at path (./dhcrelay by default) on the loopback
+ * interface once for each agent option mode, with and without -a, and
+ * for each one sends it DHCPDISCOVERs and DHCPREQUESTs at the given
+ * rate from 127.0.0.2.   The relay listens on the given port (1067 by
+ * default, so that nothing has to run as root) and forwards them to a
+ * stand-in server on 127.0.0.3, which bounces each one straight back
+ * as a reply.   A quarter of the requests already carry a Relay Agent
+ * Information option from a switch further down, so that the modes
+ * differ.
+ *
+ * For each run it prints the packets forwarded in each direction per
+ * second, the 50th and 99th percentile of the time a request and its
+ * reply spent in the relay, and the requests and replies that never
+ * came out of it, whether dropped on purpose or lost.   The time in the
+ * relay is the time from sending a request to the server getting it,
+ * plus the time from the server sending the reply to the client getting
+ * it, so it includes the loopback interface, but not the server.   The
+ * slowest such time is printed too.
+ *
+ * With -handoff, each relay is started with that handoff path, and
+ * halfway through the run a second one is started with the same
+ * arguments to take over from it, so that the drop counts are the
+ * transactions lost across the handoff and the slowest time is the
+ * longest any packet was held up by it.
+ */
+
+#define BENCH_CLIENT		"127.0.0.2"
+#define BENCH_SERVER		"127.0.0.3"
+#define BENCH_MAX_PACKETS	(1 << 24)
+#define BENCH_PROBE_INDEX	(BENCH_MAX_PACKETS - 1)
+
+struct bench_run {
+  unsigned id;			/* Top byte of each request's xid. */
+  unsigned packets;		/* Requests to send. */
+  u_int64_t *sent;		/* Times, indexed by the rest of the xid. */
+  u_int64_t *served;		/* When the server got each request. */
+  u_int64_t *bounced;		/* When it sent the reply. */
+  u_int64_t *answered;		/* When the client got the reply. */
+  unsigned forwarded, replies;
+  volatile int done;
+};
+
+static struct bench_run run;
+static int client_sock, server_sock;
+static u_int16_t bench_port;
+static const char *handoff_path;
+
+static u_int64_t now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return NANO_SECONDS(ts.tv_sec) + ts.tv_nsec;
+}
+
+static int bench_socket(const char *address, u_int16_t port)
+{
+  struct sockaddr_in name;
+  struct timeval tv;
+  int sock, flag = 1, size = 1 << 22;
+
+  memset(&name, 0, sizeof name);
+  name.sin_family = AF_INET;
+  name.sin_port = htons(port);
+  inet_aton(address, &name.sin_addr);
+
+  if ((sock = socket(PF_INET, SOCK_DGRAM, 0)) < 0)
+    log_fatal("Can't create a socket: %m");
+  setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof flag);
+  setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof size);
+
+  /* The receiving threads look up now and then to see if the run is
+     over. */
+  tv.tv_sec = 0;
+  tv.tv_usec = 100000;
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+
+  if (bind(sock, (struct sockaddr *)&name, sizeof name) < 0)
+    log_fatal("Can't bind to %s/%u: %m", address, port);
+  return sock;
+}
+
+static u_int8_t *put_option(u_int8_t *op, u_int8_t code,
+			    const void *data, unsigned len)
+{
+  *op++ = code;
+  *op++ = len;
+  memcpy(op, data, len);
+  return op + len;
+}
+
+/* Make request n of the current run.   Even ones are DHCPDISCOVERs and
+   odd ones DHCPREQUESTs; every fourth carries a downstream agent option. */
+
+static unsigned make_request(struct dhcp_packet *packet, unsigned n)
+{
+  u_int8_t *op, buf[32];
+  u_int8_t type = n & 1 ? DHCPREQUEST : DHCPDISCOVER;
+  struct in_addr addr;
+
+  memset(packet, 0, BOOTP_MIN_LEN);
+  packet->op = BOOTREQUEST;
+  packet->htype = HTYPE_ETHER;
+  packet->hlen = 6;
+  packet->xid = htonl(run.id << 24 | n);
+  packet->chaddr[0] = 2;
+  packet->chaddr[3] = n >> 16;
+  packet->chaddr[4] = n >> 8;
+  packet->chaddr[5] = n;
+
+  op = (u_int8_t *)packet->options;
+  memcpy(op, DHCP_OPTIONS_COOKIE, 4);
+  op += 4;
+  op = put_option(op, DHO_DHCP_MESSAGE_TYPE, &type, 1);
+  if (type == DHCPREQUEST)
+    {
+      addr.s_addr = htonl(0x0a000000 | n);
+      op = put_option(op, DHO_DHCP_REQUESTED_ADDRESS, &addr, sizeof addr);
+      inet_aton(BENCH_SERVER, &addr);
+      op = put_option(op, DHO_DHCP_SERVER_IDENTIFIER, &addr, sizeof addr);
+    }
+  if (!(n & 3) && n != BENCH_PROBE_INDEX)
+    {
+      buf[0] = RAI_CIRCUIT_ID;
+      buf[1] = snprintf((char *)&buf[2], sizeof buf - 2, "sw1/port-%u",
+			n % 48);
+      op = put_option(op, DHO_DHCP_AGENT_OPTIONS, buf, buf[1] + 2);
+    }
+  *op++ = DHO_END;
+
+  if (op - (u_int8_t *)packet < BOOTP_MIN_LEN)
+    return BOOTP_MIN_LEN;
+  return op - (u_int8_t *)packet;
+}
+
+/* Work out which request of the current run a packet belongs to. */
+
+static int run_index(struct dhcp_packet *packet, ssize_t length,
+		     u_int8_t op)
+{
+  u_int32_t xid;
+
+  if (length < DHCP_FIXED_NON_UDP || packet->op != op)
+    return -1;
+  xid = ntohl(packet->xid);
+  if (xid >> 24 != run.id || (xid & (BENCH_MAX_PACKETS - 1)) >= run.packets)
+    return -1;
+  return xid & (BENCH_MAX_PACKETS - 1);
+}
+
+/* Turn a request into its reply, keeping its options, so that the
+   relay sees its agent option again, and send it back to the relay. */
+
+static void bounce(struct dhcp_packet *packet, ssize_t length)
+{
+  struct sockaddr_in to;
+  u_int8_t *op, *max;
+
+  packet->op = BOOTREPLY;
+  packet->flags = 0;
+  inet_aton(BENCH_CLIENT, &packet->yiaddr);
+
+  max = (u_int8_t *)packet + length;
+  for (op = (u_int8_t *)&packet->options[4];
+       op + 2 < max && *op != DHO_END; op += op[0] == DHO_PAD ? 1 : op[1] + 2)
+    if (op[0] == DHO_DHCP_MESSAGE_TYPE)
+      {
+	op[2] = op[2] == DHCPDISCOVER ? DHCPOFFER : DHCPACK;
+	break;
+      }
+
+  memset(&to, 0, sizeof to);
+  to.sin_family = AF_INET;
+  to.sin_port = htons(bench_port);
+  to.sin_addr = packet->giaddr;
+  sendto(server_sock, packet, length, 0, (struct sockaddr *)&to, sizeof to);
+}
+
+static void *server_main(void *v)
+{
+  union {
+    struct dhcp_packet packet;
+    u_int8_t buf[1500];
+  } u;
+  ssize_t length;
+  int n;
+
+  while (!run.done)
+    {
+      if ((length = recv(server_sock, &u, sizeof u, 0)) < 0)
+	continue;
+      if ((n = run_index(&u.packet, length, BOOTREQUEST)) < 0)
+	continue;
+      if (!run.served[n])
+	run.forwarded++;
+      run.served[n] = now();
+      run.bounced[n] = now();
+      bounce(&u.packet, length);
+    }
+  return 0;
+}
+
+static void *client_main(void *v)
+{
+  union {
+    struct dhcp_packet packet;
+    u_int8_t buf[1500];
+  } u;
+  ssize_t length;
+  int n;
+
+  while (!run.done)
+    {
+      if ((length = recv(client_sock, &u, sizeof u, 0)) < 0)
+	continue;
+      if ((n = run_index(&u.packet, length, BOOTREPLY)) < 0 ||
+	  run.answered[n])
+	continue;
+      run.answered[n] = now();
+      run.replies++;
+    }
+  return 0;
+}
+
+static pid_t start_relay(const char *path, const char *mode, int agent,
+			 const char *threads)
+{
+  char *argv[18];
+  char port[8];
+  int argc = 0, fd;
+  pid_t pid;
+
+  if ((pid = fork()) < 0)
+    log_fatal("Can't fork: %m");
+  if (pid)
+    return pid;
+
+  /* execv() wants writable strings. */
+  snprintf(port, sizeof port, "%u", bench_port);
+  argv[argc++] = strdup(path);
+  argv[argc++] = strdup("-d");
+  argv[argc++] = strdup("-q");
+  argv[argc++] = strdup("-p");
+  argv[argc++] = port;
+  argv[argc++] = strdup("-m");
+  argv[argc++] = strdup(mode);
+  if (agent)
+    argv[argc++] = strdup("-a");
+  if (threads)
+    {
+      argv[argc++] = strdup("-threads");
+      argv[argc++] = strdup(threads);
+    }
+  if (handoff_path)
+    {
+      argv[argc++] = strdup("-handoff");
+      argv[argc++] = strdup(handoff_path);
+    }
+  argv[argc++] = strdup("-i");
+  argv[argc++] = strdup("lo");
+  argv[argc++] = strdup(BENCH_SERVER);
+  argv[argc] = 0;
+
+  if ((fd = open("/dev/null", O_RDWR)) >= 0)
+    {
+      dup2(fd, 1);
+      dup2(fd, 2);
+    }
+  execv(path, argv);
+  _exit(127);
+}
+
+/* Wait until a request makes it through the relay and back, so that
+   the relay is known to be listening. */
+
+static void wait_for_relay(pid_t pid)
+{
+  union {
+    struct dhcp_packet packet;
+    u_int8_t buf[1500];
+  } u;
+  struct sockaddr_in to;
+  ssize_t length;
+  int i, status;
+
+  memset(&to, 0, sizeof to);
+  to.sin_family = AF_INET;
+  to.sin_port = htons(bench_port);
+  inet_aton("127.0.0.1", &to.sin_addr);
+
+  for (i = 0; i < 50; i++)
+    {
+      if (waitpid(pid, &status, WNOHANG) == pid)
+	log_fatal("dhcrelay exited with status %d", WEXITSTATUS(status));
+      length = make_request(&u.packet, BENCH_PROBE_INDEX);
+      sendto(client_sock, &u, length, 0, (struct sockaddr *)&to, sizeof to);
+      if ((length = recv(server_sock, &u, sizeof u, 0)) < 0)
+	continue;
+      bounce(&u.packet, length);
+      if (recv(client_sock, &u, sizeof u, 0) >= 0)
+	return;
+    }
+  log_fatal("dhcrelay isn't relaying.");
+}
+
+static int compare_times(const void *a, const void *b)
+{
+  u_int64_t x = *(const u_int64_t *)a, y = *(const u_int64_t *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+static void bench(const char *path, const char *mode, int agent,
+		  const char *threads, unsigned rate, unsigned seconds)
+{
+  static union {
+    struct dhcp_packet packet;
+    u_int8_t buf[1500];
+  } requests[64];
+  struct sockaddr_in to;
+  pthread_t server, client;
+  u_int64_t start, elapsed, next, *latency;
+  unsigned i, n, length, answered = 0;
+  pid_t pid, successor = 0;
+
+  if (handoff_path)
+    unlink(handoff_path);
+  pid = start_relay(path, mode, agent, threads);
+  wait_for_relay(pid);
+
+  run.id++;
+  run.packets = rate * seconds;
+  run.forwarded = run.replies = 0;
+  run.done = 0;
+  memset(run.sent, 0, run.packets * sizeof *run.sent);
+  memset(run.served, 0, run.packets * sizeof *run.served);
+  memset(run.answered, 0, run.packets * sizeof *run.answered);
+
+  memset(&to, 0, sizeof to);
+  to.sin_family = AF_INET;
+  to.sin_port = htons(bench_port);
+  inet_aton("127.0.0.1", &to.sin_addr);
+
+  pthread_create(&server, 0, server_main, 0);
+  pthread_create(&client, 0, client_main, 0);
+
+  /* Send each request at its time, sleeping when ahead and catching up
+     without sleeping when behind. */
+  start = now();
+  for (n = 0; n < run.packets; n++)
+    {
+      next = start + (u_int64_t)n * NANO_SECONDS(1) / rate;
+      while (now() < next)
+	{
+	  struct timespec ts = { 0, 20000 };
+	  nanosleep(&ts, 0);
+	}
+      if (handoff_path && n == run.packets / 2)
+	successor = start_relay(path, mode, agent, threads);
+      i = n % (sizeof requests / sizeof requests[0]);
+      length = make_request(&requests[i].packet, n);
+      run.sent[n] = now();
+      sendto(client_sock, &requests[i], length, 0,
+	     (struct sockaddr *)&to, sizeof to);
+    }
+  elapsed = now() - start;
+
+  /* Give the last replies time to get back. */
+  sleep(1);
+  run.done = 1;
+  pthread_join(server, 0);
+  pthread_join(client, 0);
+  kill(pid, SIGTERM);
+  waitpid(pid, 0, 0);
+  if (successor)
+    {
+      kill(successor, SIGTERM);
+      waitpid(successor, 0, 0);
+    }
+
+  /* The latencies go where the bounce times were, since each is only
+     needed until its own latency is worked out. */
+  latency = run.bounced;
+  for (n = 0; n < run.packets; n++)
+    if (run.answered[n] && run.served[n])
+      latency[answered++] = ((run.served[n] - run.sent[n]) +
+			     (run.answered[n] - run.bounced[n]));
+  qsort(latency, answered, sizeof *latency, compare_times);
+
+  printf("%-8s %-3s %9.0f %9.0f %8.1f %8.1f %9.1f %8u %8u\n",
+	 mode, agent ? "-a" : "",
+	 run.forwarded * 1e9 / elapsed, run.replies * 1e9 / elapsed,
+	 answered ? latency[answered / 2] / 1e3 : 0.0,
+	 answered ? latency[answered * 99 / 100] / 1e3 : 0.0,
+	 answered ? latency[answered - 1] / 1e3 : 0.0,
+	 run.packets - run.forwarded, run.forwarded - run.replies);
+  fflush(stdout);
+}
+
+static void usage(void)
+{
+  log_fatal("Usage: relaybench [-p port] [-rate pps] [-seconds n] "
+	    "[-threads n] [-relay path] [-handoff socket-path]");
+}
+
+int main(int argc, char **argv)
+{
+  static const char *modes[] = { "append", "replace", "forward", "discard" };
+  const char *path = "./dhcrelay", *threads = 0;
+  unsigned rate = 20000, seconds = 5, port = 1067;
+  int agent, i;
+
+  for (i = 1; i < argc; i++)
+    {
+      if (i + 1 == argc)
+	usage();
+      if (!strcmp(argv[i], "-p"))
+	port = strtoul(argv[++i], 0, 0);
+      else if (!strcmp(argv[i], "-rate"))
+	rate = strtoul(argv[++i], 0, 0);
+      else if (!strcmp(argv[i], "-seconds"))
+	seconds = strtoul(argv[++i], 0, 0);
+      else if (!strcmp(argv[i], "-threads"))
+	threads = argv[++i];
+      else if (!strcmp(argv[i], "-relay"))
+	path = argv[++i];
+      else if (!strcmp(argv[i], "-handoff"))
+	handoff_path = argv[++i];
+      else
+	usage();
+    }
+  if (!rate || !seconds || !port || port > 65534 ||
+      (u_int64_t)rate * seconds >= BENCH_PROBE_INDEX)
+    usage();
+  bench_port = port;
+
+  client_sock = bench_socket(BENCH_CLIENT, port + 1);
+  server_sock = bench_socket(BENCH_SERVER, port);
+
+  run.sent = (u_int64_t *)safemalloc(rate * seconds * sizeof *run.sent);
+  run.served = (u_int64_t *)safemalloc(rate * seconds * sizeof *run.sent);
+  run.bounced = (u_int64_t *)safemalloc(rate * seconds * sizeof *run.sent);
+  run.answered = (u_int64_t *)safemalloc(rate * seconds * sizeof *run.sent);
+
+  printf("%u requests/s for %us%s\n", rate, seconds,
+	 handoff_path ? ", handing off halfway" : "");
+  printf("%-8s %-3s %9s %9s %8s %8s %9s %8s %8s\n", "mode", "", "fwd/s",
+	 "reply/s", "p50 us", "p99 us", "max us", "req drop", "rep drop");
+  for (agent = 0; agent < 2; agent++)
+    for (i = 0; i < (int)(sizeof modes / sizeof modes[0]); i++)
+      bench(path, modes[i], agent, threads, rate, seconds);
+  return 0;
+}
+
+/* Local Variables:  */
+/* mode:C++ */
+/* c-file-style:"gnu" */
+/* end: */
@@ -35,7 +35,74 @@
 #define DHCPP_V4RELAY_H
 
 #include "dhc++/v4listener.h"
+#include "dhc++/handoff.h"
 
+/* What to do about packets we're asked to relay that already have a relay
+   option. */
+enum agent_mode
+  {
+    forward_and_append,		/* Forward and append our own relay option. */
+    forward_and_replace,	/* Forward, but replace theirs with ours. */
+    forward_untouched,		/* Forward without changes. */
+    discard
+  };
+
+/* The relay's counters.   Each thread that relays packets counts in its
+   own block, which is cache line aligned so that no two threads write to
+   the same line; relay_stats points to the current thread's block. */
+struct relay_stats {
+  int bogus_agent_drops;	/* Requests dropped because they already
+				   had an agent option we won't relay. */
+  int bogus_giaddr_drops;	/* Replies whose giaddr isn't ours. */
+  int client_packets_relayed;	/* Requests relayed to servers. */
+  int server_packet_errors;	/* Errors sending replies to clients. */
+  int server_packets_relayed;	/* Replies relayed to clients. */
+  int client_packet_errors;	/* Errors sending requests to servers. */
+  int corrupt_agent_options;	/* Replies whose agent option was bad. */
+  int missing_agent_option;	/* Replies without our agent option. */
+  int bad_circuit_id;		/* Replies whose circuit ID is unknown. */
+  int missing_circuit_id;	/* Replies whose agent option has no
+				   circuit ID. */
+  int v6_client_packets_relayed; /* Relay-Forwards sent. */
+  int v6_server_packets_relayed; /* Messages unwrapped from Relay-Replies
+				   and sent on. */
+  int v6_packet_errors;		/* Errors sending either. */
+  int v6_hop_limit_drops;	/* Messages that had been through too many
+				   relay agents. */
+  int v6_bogus_packet_drops;	/* Messages that were garbled, or that
+				   relay agents don't relay. */
+  int v6_bad_interface_id;	/* Relay-Replies whose Interface-Id was
+				   missing or matched no interface. */
+  int duplicate_requests_suppressed; /* Copies of a request that weren't
+				   forwarded. */
+  int duplicate_cache_evictions; /* Requests forgotten before the window
+				   was up, to make room. */
+  int agent_options_omitted;	/* Requests forwarded without our agent
+				   option because it didn't fit. */
+} __attribute__ ((aligned (64)));
+
+#define RELAY_MAX_THREADS	64
+
+/* The DHCPv4 socket filter; each relay thread's socket gets a copy with
+   its own shard. */
+extern struct dhcpv4_udp_filter relay_v4_filter;
+
+/* Relay threads; see workers.cpp. */
+extern struct relay_stats relay_stats_blocks[RELAY_MAX_THREADS];
+extern __thread struct relay_stats *relay_stats;
+extern __thread unsigned relay_thread_index;
+extern unsigned relay_threads;
+void relay_workers_start(void);
+
+/* Relay Agent Information option settings; see agentopts.cpp. */
+extern int add_agent_options;
+extern int drop_agent_mismatches;
+extern int dhcp_max_agent_option_packet_length;
+extern enum agent_mode agent_relay_mode;
+
+/* Duplicate request suppression; see dupcache.cpp. */
+extern u_int64_t duplicate_window;
+int relay_request_is_duplicate(struct dhcp_packet *packet, unsigned length);
 
 class DHCPv4Relay: public DHCPv4Listener
 {
@@ -51,6 +118,17 @@ private:
   struct interface_info *interface;
 };
 
+/* All the relay has to hand off besides its socket is its counters. */
+class RelayHandoff: public Handoff
+{
+public:
+  RelayHandoff(const char *path);
+
+protected:
+  void save(struct handoff_buffer *buf);
+  isc_result_t restore(struct handoff_buffer *buf);
+};
+
 #endif
 
 /* Local Variables:  */
@@ -0,0 +1,303 @@
+/* v6relay.cpp
+ *
+ * Relaying DHCPv6 messages: wrapping what clients and other relay agents
+ * send in Relay-Forward messages, and unwrapping the Relay-Replies that
+ * come back.
+ */
+
+/* Copyright (c) 2009 Nominum, Inc.   All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Nominum nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NOMINUM AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL NOMINUM OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef lint
+static char ocopyright[] __attribute__((unused)) =
+  "$Id: v6relay.cpp,v 1.1 2009/10/22 16:40:12 mellon Exp $ Copyright (c) 2009 Nominum, Inc.  All rights reserved.\n";
+#endif /* not lint */
+
+#include "dhcpd.h"
+#include "relay/v4relay.h"
+#include "relay/v6relay.h"
+
+/* Servers to relay to. */
+struct server6_list *servers6;
+
+/* Enterprise number that goes in the Remote-ID options we add. */
+u_int32_t relay6_enterprise_number = 0;
+
+/* The fixed part of a relay message, before its options. */
+#define RELAY6_FIXED_LEN	34
+
+/* Everything we put in front of a message we relay: the fixed part, an
+   Interface-Id option, a Remote-ID option, and the code and length of the
+   Relay Message option that the message itself is the data of. */
+#define RELAY6_HEADER_MAX	(RELAY6_FIXED_LEN + 4 + 255 + 8 + 255 + 4)
+
+static isc_result_t relay6_got_packet(struct interface_info *,
+				      struct sockaddr_in6 *,
+				      unsigned char *, ssize_t);
+
+/* If arg is an IPv6 address, add it to the list of DHCPv6 servers and
+   return nonzero. */
+
+int new_relay6_server(const char *arg)
+{
+  struct server6_list *sp, **tail;
+  struct in6_addr addr;
+
+  if (inet_pton(AF_INET6, arg, &addr) != 1)
+    return 0;
+
+  sp = (struct server6_list *)safemalloc(sizeof *sp);
+  sp->to.sin6_family = AF_INET6;
+#ifdef HAVE_SA_LEN
+  sp->to.sin6_len = sizeof sp->to;
+#endif
+  sp->to.sin6_addr = addr;
+  for (tail = &servers6; *tail; tail = &(*tail)->next)
+    ;
+  *tail = sp;
+  return 1;
+}
+
+/* Start relaying the DHCPv6 messages that come in on the DHCPv6 socket.
+   The kernel drops the messages relay6_got_packet() would. */
+
+void relay6_setup(void)
+{
+  struct server6_list *sp;
+#if defined (NEED_LPF)
+  struct dhcpv6_udp_filter filter;
+
+  filter.types = (1 << DHCPV6_SOLICIT | 1 << DHCPV6_REQUEST |
+		  1 << DHCPV6_CONFIRM | 1 << DHCPV6_RENEW |
+		  1 << DHCPV6_REBIND | 1 << DHCPV6_RELEASE |
+		  1 << DHCPV6_DECLINE | 1 << DHCPV6_INFORMATION_REQUEST |
+		  1 << DHCPV6_RELAY_FORWARD | 1 << DHCPV6_RELAY_REPLY);
+  filter.max_hops = DHCPV6_HOP_COUNT_LIMIT;
+  lpf_udp_filter_v6(dhcpv6_socket_fd(), &filter);
+#endif
+
+  for (sp = servers6; sp; sp = sp->next)
+    sp->to.sin6_port = local_port_dhcpv6;
+  dhcpv6_packet_hook = relay6_got_packet;
+}
+
+static u_int8_t *put_option_header(u_int8_t *op, unsigned code, unsigned len)
+{
+  putUShort(op, code);
+  putUShort(op + 2, len);
+  return op + 4;
+}
+
+/* Wrap a message in a Relay-Forward and send it to the servers.   The
+   message itself isn't copied; the Relay-Forward goes out as a header
+   we build here followed by the message as it came in. */
+
+static isc_result_t relay_forward(struct interface_info *ip,
+				  struct sockaddr_in6 *from,
+				  unsigned char *msg, unsigned len,
+				  int from_client, unsigned hops)
+{
+  u_int8_t header[RELAY6_HEADER_MAX], *hp;
+  dhcpv6_relay_message_t *rm = (dhcpv6_relay_message_t *)header;
+  struct server6_list *sp;
+  struct iovec iov[2];
+  int i;
+
+  rm->type = DHCPV6_RELAY_FORWARD;
+  rm->hop_count = hops;
+
+  /* The link address tells the server which link the client is on, if
+     we have an address on it that isn't link-local.   For a message
+     from another relay agent, the one it put in says that. */
+  memset(rm->link_address, 0, sizeof rm->link_address);
+  if (from_client)
+    {
+      for (i = 0; i < ip->ipv6_addr_count; i++)
+	{
+	  if (!IN6_IS_ADDR_LINKLOCAL(&ip->ipv6s[i]))
+	    {
+	      memcpy(rm->link_address, &ip->ipv6s[i],
+		     sizeof rm->link_address);
+	      break;
+	    }
+	}
+    }
+  memcpy(rm->peer_address, &from->sin6_addr, sizeof rm->peer_address);
+
+  /* The Interface-Id is what we look up to find where the reply goes, so
+     it's always there. */
+  hp = put_option_header((u_int8_t *)rm->options,
+			 DHCPV6_INTERFACE_IDENTIFIER, ip->circuit_id_len);
+  memcpy(hp, ip->circuit_id, ip->circuit_id_len);
+  hp += ip->circuit_id_len;
+
+  if (ip->remote_id)
+    {
+      hp = put_option_header(hp, DHCPV6_REMOTE_ID, ip->remote_id_len + 4);
+      putULong(hp, relay6_enterprise_number);
+      memcpy(hp + 4, ip->remote_id, ip->remote_id_len);
+      hp += ip->remote_id_len + 4;
+    }
+
+  hp = put_option_header(hp, DHCPV6_RELAY_MESSAGE, len);
+
+  iov[0].iov_base = (caddr_t)header;
+  iov[0].iov_len = hp - header;
+  iov[1].iov_base = (caddr_t)msg;
+  iov[1].iov_len = len;
+
+  for (sp = servers6; sp; sp = sp->next)
+    {
+      if (send_packetv(0, iov, 2, (struct sockaddr *)&sp->to) < 0)
+	++relay_stats->v6_packet_errors;
+      else
+	++relay_stats->v6_client_packets_relayed;
+    }
+  return ISC_R_SUCCESS;
+}
+
+/* Take the message out of a Relay-Reply and send it on to the peer
+   address, on the interface the Interface-Id names.   If that message is
+   itself a Relay-Reply, the peer is the relay agent that will unwrap the
+   next layer. */
+
+static isc_result_t relay_reply(unsigned char *msg, unsigned len)
+{
+  dhcpv6_relay_message_t *rm = (dhcpv6_relay_message_t *)msg;
+  struct interface_info *ip;
+  struct sockaddr_in6 to;
+  unsigned char *op, *end, *ifid = 0, *inner = 0;
+  unsigned code, optlen, ifid_len = 0, inner_len = 0;
+
+  if (len < RELAY6_FIXED_LEN)
+    {
+      ++relay_stats->v6_bogus_packet_drops;
+      return ISC_R_FORMERR;
+    }
+
+  end = msg + len;
+  for (op = (unsigned char *)rm->options; end - op >= 4; op += optlen + 4)
+    {
+      code = getUShort(op);
+      optlen = getUShort(op + 2);
+      if ((unsigned)(end - op) - 4 < optlen)
+	{
+	  ++relay_stats->v6_bogus_packet_drops;
+	  return ISC_R_FORMERR;
+	}
+      if (code == DHCPV6_INTERFACE_IDENTIFIER)
+	{
+	  ifid = op + 4;
+	  ifid_len = optlen;
+	}
+      else if (code == DHCPV6_RELAY_MESSAGE)
+	{
+	  inner = op + 4;
+	  inner_len = optlen;
+	}
+    }
+  if (!inner || !inner_len)
+    {
+      ++relay_stats->v6_bogus_packet_drops;
+      return ISC_R_FORMERR;
+    }
+
+  if (!ifid || !(ip = interface_find_circuit_id(ifid, ifid_len)))
+    {
+      ++relay_stats->v6_bad_interface_id;
+      return ISC_R_NOTFOUND;
+    }
+
+  /* A Relay-Reply goes to the relay agent's port, anything else to the
+     client's. */
+  memset(&to, 0, sizeof to);
+  to.sin6_family = AF_INET6;
+#ifdef HAVE_SA_LEN
+  to.sin6_len = sizeof to;
+#endif
+  memcpy(&to.sin6_addr, rm->peer_address, sizeof to.sin6_addr);
+  to.sin6_port = (inner[0] == DHCPV6_RELAY_REPLY
+		  ? local_port_dhcpv6 : remote_port_dhcpv6);
+
+  if (send_packet(ip, inner, inner_len, (struct sockaddr *)&to) < 0)
+    ++relay_stats->v6_packet_errors;
+  else
+    ++relay_stats->v6_server_packets_relayed;
+  return ISC_R_SUCCESS;
+}
+
+/* Every DHCPv6 message the relay gets comes here, without being decoded:
+   a relay agent only needs to look at the message type, and, for
+   Relay-Replies, at the relay options. */
+
+static isc_result_t relay6_got_packet(struct interface_info *ip,
+				      struct sockaddr_in6 *from,
+				      unsigned char *contents,
+				      ssize_t length)
+{
+  if (length < 4)
+    {
+      ++relay_stats->v6_bogus_packet_drops;
+      return ISC_R_FORMERR;
+    }
+
+  switch (contents[0])
+    {
+    case DHCPV6_SOLICIT:
+    case DHCPV6_REQUEST:
+    case DHCPV6_CONFIRM:
+    case DHCPV6_RENEW:
+    case DHCPV6_REBIND:
+    case DHCPV6_RELEASE:
+    case DHCPV6_DECLINE:
+    case DHCPV6_INFORMATION_REQUEST:
+      return relay_forward(ip, from, contents, length, 1, 0);
+
+    case DHCPV6_RELAY_FORWARD:
+      if ((size_t)length < RELAY6_FIXED_LEN)
+	break;
+      if (contents[1] >= DHCPV6_HOP_COUNT_LIMIT)
+	{
+	  ++relay_stats->v6_hop_limit_drops;
+	  return ISC_R_SUCCESS;
+	}
+      return relay_forward(ip, from, contents, length, 0, contents[1] + 1);
+
+    case DHCPV6_RELAY_REPLY:
+      return relay_reply(contents, length);
+    }
+
+  ++relay_stats->v6_bogus_packet_drops;
+  return ISC_R_SUCCESS;
+}
+
+/* Local Variables:  */
+/* mode:C++ */
+/* c-file-style:"gnu" */
+/* end: */
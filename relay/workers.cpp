@@ -0,0 +1,136 @@
+/* workers.cpp
+ *
+ * Relaying DHCPv4 packets on more than one thread.
+ */
+
+/* Copyright (c) 2009 Nominum, Inc.   All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Nominum nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NOMINUM AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL NOMINUM OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef lint
+static char ocopyright[] __attribute__((unused)) =
+  "$Id: workers.cpp,v 1.1 2009/10/24 14:05:37 mellon Exp $ Copyright (c) 2009 Nominum, Inc.  All rights reserved.\n";
+#endif /* not lint */
+
+#include "dhcpd.h"
+#include "relay/v4relay.h"
+#include <pthread.h>
+#include <poll.h>
+
+/* Each thread has its own DHCPv4 socket on the relay port, opened with
+ * SO_REUSEPORT so that the kernel spreads unicast packets across them.
+ * The main thread keeps the socket dispatch() reads, along with the
+ * DHCPv6 socket and the timeouts; the others do nothing but relay.
+ * Broadcasts go to every socket, so DHCPv4Relay::got_packet() only
+ * relays one if the client hashes to its thread.
+ *
+ * Apart from the counters, the dup cache and the server health fields,
+ * which are updated atomically, nothing the threads use is written once
+ * they've started.   cur_time is per thread, so a server's timestamps
+ * may come from a clock a little ahead of the thread reading them.
+ */
+
+struct relay_stats relay_stats_blocks[RELAY_MAX_THREADS];
+__thread struct relay_stats *relay_stats = &relay_stats_blocks[0];
+__thread unsigned relay_thread_index;
+
+/* How many threads relay DHCPv4 packets, counting the main one. */
+unsigned relay_threads = 1;
+
+struct relay_worker {
+  unsigned index;
+  int fd;
+};
+
+static void *relay_worker_main(void *v)
+{
+  struct relay_worker *worker = (struct relay_worker *)v;
+  struct pollfd pfd;
+
+  relay_thread_index = worker->index;
+  relay_stats = &relay_stats_blocks[worker->index];
+
+  pfd.fd = worker->fd;
+  pfd.events = POLLIN;
+  for (;;)
+    {
+      if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+	log_fatal("relay thread %u: poll: %m", worker->index);
+
+      /* Read until the socket is empty, so that poll() is only called
+	 when there's nothing to do. */
+      do
+	fetch_time();
+      while (dhcpv4_socket_receive(worker->fd) != ISC_R_NOMORE);
+    }
+  return 0;
+}
+
+/* Start the threads other than the main one.   This has to happen after
+ * the relay has forked, since only the thread that forks survives, and
+ * after the main thread's socket is open, with dhcpv4_socket_reuseport
+ * set.
+ */
+
+void relay_workers_start(void)
+{
+  struct relay_worker *worker;
+  pthread_t thread;
+  unsigned i;
+  int err;
+
+  /* Build the interface indexes now, while nothing else is using them. */
+  interface_find_address(limited_broadcast);
+
+  for (i = 1; i < relay_threads; i++)
+    {
+      worker = (struct relay_worker *)safemalloc(sizeof *worker);
+      worker->index = i;
+      worker->fd = dhcpv4_socket_open();
+#if defined (NEED_LPF)
+      {
+	struct dhcpv4_udp_filter filter = relay_v4_filter;
+
+	filter.shard = i;
+	lpf_udp_filter_v4(worker->fd, &filter);
+      }
+#endif
+      if (fcntl(worker->fd, F_SETFL, O_NONBLOCK) < 0)
+	log_fatal("Can't make relay thread %u's socket nonblocking: %m", i);
+
+      err = pthread_create(&thread, 0, relay_worker_main, worker);
+      if (err)
+	log_fatal("Can't start relay thread %u: %s", i, strerror(err));
+      pthread_detach(thread);
+    }
+}
+
+/* Local Variables:  */
+/* mode:C++ */
+/* c-file-style:"gnu" */
+/* end: */
@@ -0,0 +1,130 @@
+/* allocbench.cpp
+ *
+ * Measures how often hash-based DHCPv6 address assignment collides.
+ */
+
+/* Copyright (c) 2009 Nominum, Inc.   All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Nominum nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NOMINUM AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL NOMINUM OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef lint
+static char ocopyright[] __attribute__((unused)) =
+  "$Id: allocbench.cpp,v 1.1 2009/10/16 18:22:41 mellon Exp $ Copyright (c) 2009 Nominum, Inc.  All rights reserved.\n";
+#endif /* not lint */
+
+#include "dhcpd.h"
+#include "server/v6pool.h"
+
+/* Usage: allocbench [bits]
+ *
+ * Fills a hash-mode pool of 2^bits addresses (65536 by default) to 50%,
+ * 80% and 95% with clients that have random DUIDs and IAIDs, and prints
+ * the fraction of allocations whose hashed address was already taken,
+ * the mean number of addresses tried per allocation, and the mean time
+ * an allocation took.
+ */
+
+u_int16_t local_port_dhcpv6 = 0;
+u_int16_t remote_port_dhcpv6 = 0;
+
+static void random_key(u_int8_t *key, unsigned len)
+{
+  unsigned i;
+
+  for (i = 0; i < len; i++)
+    key[i] = random();
+}
+
+static void fill(unsigned n, unsigned bits, unsigned percent)
+{
+  struct in6_addr prefix, low, high;
+  struct v6_subnet *subnet;
+  struct v6_pool *pool;
+  u_int64_t size = (u_int64_t)1 << bits, target, i;
+  u_int8_t key[14];			      /* DUID-LL, then the IAID. */
+  struct timespec start, end;
+  double ns;
+
+  memset(&prefix, 0, sizeof prefix);
+  prefix.s6_addr[0] = 0x20;
+  prefix.s6_addr[1] = 0x01;
+  prefix.s6_addr[2] = 0x0d;
+  prefix.s6_addr[3] = 0xb8;
+  putUShort(&prefix.s6_addr[4], n);
+  low = prefix;
+  high = prefix;
+  putULong(&high.s6_addr[12], size - 1);
+
+  subnet = v6_subnet_create(&prefix, 64);
+  if (v6_pool_create(subnet, &low, &high, V6_ALLOC_HASH) != ISC_R_SUCCESS)
+    log_fatal("can't create a pool of %llu addresses",
+	      (unsigned long long)size);
+  pool = subnet->pools;
+
+  putUShort(key, 3);
+  putUShort(&key[2], 1);
+  target = size * percent / 100;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (i = 0; i < target; i++)
+    {
+      random_key(&key[4], sizeof key - 4);
+      if (!v6_lease_allocate(subnet, key, sizeof key))
+	log_fatal("pool full after %llu allocations", (unsigned long long)i);
+    }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+
+  printf("%3u%% full: %5.1f%% collided, %6.2f probes per allocation, "
+	 "%6.0f ns each\n",
+	 percent, 100.0 * pool->collisions / pool->allocations,
+	 (double)pool->probes / pool->allocations, ns / target);
+  fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+  static const unsigned percents[] = { 50, 80, 95 };
+  unsigned bits = 16, i;
+
+  if (argc > 1)
+    bits = strtoul(argv[1], 0, 0);
+  if (bits < 8 || bits > 24)
+    log_fatal("Usage: allocbench [bits]");
+
+  srandom(1);
+  random_key(v6_hash_key, sizeof v6_hash_key);
+  printf("%llu addresses\n", (unsigned long long)1 << bits);
+  for (i = 0; i < sizeof percents / sizeof percents[0]; i++)
+    fill(i, bits, percents[i]);
+  return 0;
+}
+
+/* Local Variables:  */
+/* mode:C++ */
+/* c-file-style:"gnu" */
+/* end: */
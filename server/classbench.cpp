@@ -0,0 +1,204 @@
+/* classbench.cpp
+ *
+ * Measure how fast clients are classified against a large rule set.
+ */
+
+/* Copyright (c) 2009 Nominum, Inc.   All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Nominum nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NOMINUM AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL NOMINUM OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#ifndef lint
+static char ocopyright[] __attribute__((unused)) =
+  "$Id: classbench.cpp,v 1.1 2009/10/14 21:07:55 mellon Exp $ Copyright (c) 2009 Nominum, Inc.  All rights reserved.\n";
+#endif /* not lint */
+
+#include "dhcpd.h"
+#include "server/classify.h"
+
+/* Usage: classbench [rules [lookups]]
+ *
+ * Spreads the rules over all the classes and over several fields, with a
+ * mix of exact and prefix matches, then classifies a set of synthetic
+ * clients, about half of which match something, first with the compiled
+ * classifier and then by testing every rule in turn, and prints the time
+ * each took per client.
+ */
+
+#define BENCH_CLIENTS	1024
+
+u_int16_t local_port_dhcpv6 = 0;
+u_int16_t remote_port_dhcpv6 = 0;
+
+struct bench_client {
+  u_int8_t mac[6];
+  char vendor[32];
+  char circuit[32];
+  u_int8_t remote[8];
+  struct data_string fields[CLASS_FIELD_COUNT];
+};
+
+static u_int64_t now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return NANO_SECONDS(ts.tv_sec) + ts.tv_nsec;
+}
+
+static void make_rule(unsigned r)
+{
+  struct client_class *cc;
+  u_int8_t buf[32];
+  char name[32];
+
+  snprintf(name, sizeof name, "class-%u", r % CLASS_MAX);
+  if (!(cc = client_class_find(name)))
+    cc = client_class_create(name);
+
+  switch (r % 5)
+    {
+    case 0:
+    case 1:
+      buf[0] = 0x00;
+      buf[1] = 0x16;
+      putULong(&buf[2], r);
+      client_class_add_rule(cc, CLASS_FIELD_MAC, 0, buf, 6);
+      break;
+    case 2:
+      snprintf((char *)buf, sizeof buf, "vendor-%u/", r);
+      client_class_add_rule(cc, CLASS_FIELD_VENDOR_CLASS, 1, buf,
+			    strlen((char *)buf));
+      break;
+    case 3:
+      snprintf((char *)buf, sizeof buf, "ge-0/0/%u", r);
+      client_class_add_rule(cc, CLASS_FIELD_CIRCUIT_ID, 0, buf,
+			    strlen((char *)buf));
+      break;
+    case 4:
+      putULong(buf, 0x7f000000 | r);
+      client_class_add_rule(cc, CLASS_FIELD_REMOTE_ID, 1, buf, 3);
+      break;
+    }
+}
+
+/* Client n matches rule n * 2 if that's a rule; the odd ones look similar
+ * but match nothing.
+ */
+static void make_client(struct bench_client *c, unsigned n, unsigned rules)
+{
+  unsigned r = (n & 1) ? rules + n : (n * 2) % rules;
+
+  c->mac[0] = 0x00;
+  c->mac[1] = 0x16;
+  putULong(&c->mac[2], r);
+  snprintf(c->vendor, sizeof c->vendor, "vendor-%u/model-%u", r, n);
+  snprintf(c->circuit, sizeof c->circuit, "ge-0/0/%u", r);
+  putULong(c->remote, 0x7f000000 | r);
+  putULong(&c->remote[4], n);
+
+  memset(c->fields, 0, sizeof c->fields);
+  c->fields[CLASS_FIELD_MAC].data = c->mac;
+  c->fields[CLASS_FIELD_MAC].len = 6;
+  c->fields[CLASS_FIELD_VENDOR_CLASS].data = (u_int8_t *)c->vendor;
+  c->fields[CLASS_FIELD_VENDOR_CLASS].len = strlen(c->vendor);
+  c->fields[CLASS_FIELD_CIRCUIT_ID].data = (u_int8_t *)c->circuit;
+  c->fields[CLASS_FIELD_CIRCUIT_ID].len = strlen(c->circuit);
+  c->fields[CLASS_FIELD_REMOTE_ID].data = c->remote;
+  c->fields[CLASS_FIELD_REMOTE_ID].len = sizeof c->remote;
+}
+
+/* What classifying a client costs without the compiled indexes. */
+static u_int64_t classify_linear(const struct data_string *fields)
+{
+  const struct class_rule *rule;
+  const struct data_string *f;
+  u_int64_t classes = 0;
+
+  for (rule = class_rules; rule; rule = rule->next)
+    {
+      f = &fields[rule->field];
+      if (f->data && (rule->prefix ? f->len >= rule->len : f->len == rule->len)
+	  && !memcmp(f->data, rule->value, rule->len))
+	classes |= (u_int64_t)1 << rule->class_index;
+    }
+  return classes;
+}
+
+int main(int argc, char **argv)
+{
+  static struct bench_client clients[BENCH_CLIENTS];
+  struct classifier *cl;
+  unsigned rules = 10000, lookups = 1000000, i;
+  u_int64_t start, compiled, linear, sum = 0;
+
+  if (argc > 1)
+    rules = strtoul(argv[1], 0, 0);
+  if (argc > 2)
+    lookups = strtoul(argv[2], 0, 0);
+  if (!rules || !lookups)
+    log_fatal("Usage: classbench [rules [lookups]]");
+
+  for (i = 0; i < rules; i++)
+    make_rule(i);
+  for (i = 0; i < BENCH_CLIENTS; i++)
+    make_client(&clients[i], i, rules);
+
+  start = now();
+  cl = classifier_compile(class_rules);
+  printf("compiled %u rules in %.3f ms\n", rules, (now() - start) / 1e6);
+
+  for (i = 0; i < BENCH_CLIENTS; i++)
+    if (classify_fields(cl, clients[i].fields) !=
+	classify_linear(clients[i].fields))
+      log_fatal("client %u: compiled and linear classification differ", i);
+
+  start = now();
+  for (i = 0; i < lookups; i++)
+    sum += classify_fields(cl, clients[i % BENCH_CLIENTS].fields);
+  compiled = now() - start;
+
+  /* The linear scan is slow enough that a tenth as many will do. */
+  start = now();
+  for (i = 0; i < lookups / 10 + 1; i++)
+    sum += classify_linear(clients[i % BENCH_CLIENTS].fields);
+  linear = now() - start;
+
+  printf("compiled: %.1f ns per client\n", (double)compiled / lookups);
+  printf("linear:   %.1f ns per client\n",
+	 (double)linear / (lookups / 10 + 1));
+  printf("(checksum %llx)\n", (unsigned long long)sum);
+
+  classifier_free(cl);
+  return 0;
+}
+
+/* Local Variables:  */
+/* mode:C++ */
+/* c-file-style:"gnu" */
+/* end: */
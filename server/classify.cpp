@@ -0,0 +1,555 @@
+/* classify.cpp
+ *
+ * Client classification.
+ */
+
+/* Copyright (c) 2009 Nominum, Inc.   All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Nominum nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NOMINUM AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL NOMINUM OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef lint
+static char ocopyright[] __attribute__((unused)) =
+  "$Id: classify.cpp,v 1.1 2009/10/12 20:03:51 mellon Exp $ Copyright (c) 2009 Nominum, Inc.  All rights reserved.\n";
+#endif /* not lint */
+
+#include "dhcpd.h"
+#include "server/classify.h"
+
+/* One distinct exact-match value and the classes that match it. */
+struct class_match {
+  u_int8_t *value;
+  unsigned len;
+  u_int64_t classes;
+};
+
+typedef struct hash_table class_match_hash_t;
+HASH_FUNCTIONS_DECL(class_match, const u_int8_t *,
+		    struct class_match, class_match_hash_t)
+HASH_FUNCTIONS(class_match, const u_int8_t *,
+	       struct class_match, class_match_hash_t)
+
+struct client_class *client_classes;
+struct class_rule *class_rules;
+struct classifier *classifier;
+
+static unsigned class_count;
+static struct client_class *class_by_index[CLASS_MAX];
+
+static const char *class_field_names[CLASS_FIELD_COUNT] = {
+  "vendor-class",
+  "user-class",
+  "circuit-id",
+  "remote-id",
+  "duid-enterprise",
+  "mac"
+};
+
+/* Returns the field with the specified name, or -1. */
+int class_field_parse(const char *name)
+{
+  int i;
+
+  for (i = 0; i < CLASS_FIELD_COUNT; i++)
+    if (!strcmp(class_field_names[i], name))
+      return i;
+  return -1;
+}
+
+struct client_class *client_class_find(const char *name)
+{
+  struct client_class *cc;
+
+  for (cc = client_classes; cc; cc = cc->next)
+    if (!strcmp(cc->name, name))
+      return cc;
+  return 0;
+}
+
+/* Make the classes on client_classes the ones that class bits refer to,
+ * e.g. after a reload has set one set of classes aside or put it back.
+ */
+void client_classes_reindex()
+{
+  struct client_class *cc;
+
+  memset(class_by_index, 0, sizeof class_by_index);
+  class_count = 0;
+  for (cc = client_classes; cc; cc = cc->next)
+    {
+      class_by_index[cc->index] = cc;
+      class_count = cc->index + 1;
+    }
+}
+
+/* Free classes and rules that are no longer in use.   Their option states
+ * can share option caches with other states, so those are left alone.
+ */
+void client_classes_free(struct client_class *classes, struct class_rule *rules)
+{
+  struct client_class *cc;
+  struct class_rule *rule;
+
+  while ((cc = classes))
+    {
+      classes = cc->next;
+      free(cc->name);
+      free(cc);
+    }
+  while ((rule = rules))
+    {
+      rules = rule->next;
+      free(rule->value);
+      free(rule);
+    }
+}
+
+/* Returns null if there are already CLASS_MAX classes. */
+struct client_class *client_class_create(const char *name)
+{
+  struct client_class *cc, **cp;
+
+  if (class_count == CLASS_MAX)
+    return 0;
+  cc = (struct client_class *)safemalloc(sizeof *cc);
+  cc->name = (char *)safemalloc(strlen(name) + 1);
+  strcpy(cc->name, name);
+  cc->index = class_count++;
+  class_by_index[cc->index] = cc;
+  cc->options = new_option_state();
+  cc->options6 = new_option_state();
+
+  /* Keep the list in the order the classes were declared. */
+  for (cp = &client_classes; *cp; cp = &(*cp)->next)
+    ;
+  *cp = cc;
+  return cc;
+}
+
+void client_class_add_rule(struct client_class *cc, enum class_field field,
+			   int prefix, const u_int8_t *value, unsigned len)
+{
+  struct class_rule *rule;
+
+  rule = (struct class_rule *)safemalloc(sizeof *rule);
+  rule->field = field;
+  rule->prefix = prefix;
+  rule->value = (u_int8_t *)safemalloc(len ? len : 1);
+  memcpy(rule->value, value, len);
+  rule->len = len;
+  rule->class_index = cc->index;
+  rule->next = class_rules;
+  class_rules = rule;
+}
+
+static struct class_prefix_node *prefix_child(struct class_prefix_node *node,
+					      u_int8_t label)
+{
+  unsigned lo = 0, hi = node->nchildren, mid;
+
+  while (lo < hi)
+    {
+      mid = (lo + hi) / 2;
+      if (node->labels[mid] == label)
+	return node->children[mid];
+      if (node->labels[mid] < label)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  return 0;
+}
+
+static void prefix_insert(struct class_prefix_node *node,
+			  const u_int8_t *value, unsigned len,
+			  u_int64_t classes)
+{
+  struct class_prefix_node *child, **children;
+  u_int8_t *labels;
+  unsigned i, j;
+
+  for (i = 0; i < len; i++)
+    {
+      child = prefix_child(node, value[i]);
+      if (!child)
+	{
+	  /* Keep the children sorted by label so lookups can bisect. */
+	  child = (struct class_prefix_node *)safemalloc(sizeof *child);
+	  labels = (u_int8_t *)safemalloc(node->nchildren + 1);
+	  children = (struct class_prefix_node **)
+	    safemalloc((node->nchildren + 1) * sizeof *children);
+	  for (j = 0; j < node->nchildren && node->labels[j] < value[i]; j++)
+	    ;
+	  if (node->nchildren)
+	    {
+	      memcpy(labels, node->labels, j);
+	      memcpy(&labels[j + 1], &node->labels[j], node->nchildren - j);
+	      memcpy(children, node->children, j * sizeof *children);
+	      memcpy(&children[j + 1], &node->children[j],
+		     (node->nchildren - j) * sizeof *children);
+	      free(node->labels);
+	      free(node->children);
+	    }
+	  labels[j] = value[i];
+	  children[j] = child;
+	  node->labels = labels;
+	  node->children = children;
+	  node->nchildren++;
+	}
+      node = child;
+    }
+  node->classes |= classes;
+}
+
+static void prefix_free(struct class_prefix_node *node)
+{
+  unsigned i;
+
+  for (i = 0; i < node->nchildren; i++)
+    prefix_free(node->children[i]);
+  free(node->labels);
+  free(node->children);
+  free(node);
+}
+
+/* Compile a list of rules.   Rules for the same field and value share a
+ * hash entry or a trie node, so the cost of classifying a packet doesn't
+ * depend on the number of rules.
+ */
+struct classifier *classifier_compile(struct class_rule *rules)
+{
+  struct classifier *cl;
+  struct class_field_index *idx;
+  struct class_match *match;
+  struct class_rule *rule;
+  u_int64_t bit;
+
+  cl = (struct classifier *)safemalloc(sizeof *cl);
+  for (rule = rules; rule; rule = rule->next)
+    {
+      idx = &cl->fields[rule->field];
+      cl->active |= 1 << rule->field;
+      bit = (u_int64_t)1 << rule->class_index;
+
+      if (rule->prefix)
+	{
+	  if (!idx->prefixes)
+	    idx->prefixes = (struct class_prefix_node *)
+	      safemalloc(sizeof *idx->prefixes);
+	  prefix_insert(idx->prefixes, rule->value, rule->len, bit);
+	  continue;
+	}
+
+      if (!idx->exact)
+	class_match_new_hash(&idx->exact, 0);
+      if (class_match_hash_lookup(&match, idx->exact, rule->value, rule->len))
+	{
+	  match->classes |= bit;
+	  continue;
+	}
+      /* The hash table keeps the value pointer, so the match owns a copy. */
+      match = (struct class_match *)safemalloc(sizeof *match);
+      match->value = (u_int8_t *)safemalloc(rule->len ? rule->len : 1);
+      memcpy(match->value, rule->value, rule->len);
+      match->len = rule->len;
+      match->classes = bit;
+      class_match_hash_add(idx->exact, match->value, match->len, match);
+    }
+  return cl;
+}
+
+static void free_match(const u_int8_t *value, unsigned len,
+		       struct class_match *match)
+{
+  free(match->value);
+  free(match);
+}
+
+void classifier_free(struct classifier *cl)
+{
+  int i;
+
+  if (!cl)
+    return;
+  for (i = 0; i < CLASS_FIELD_COUNT; i++)
+    {
+      if (cl->fields[i].exact)
+	{
+	  class_match_hash_foreach(cl->fields[i].exact, free_match);
+	  free_hash_table(&cl->fields[i].exact);
+	}
+      if (cl->fields[i].prefixes)
+	prefix_free(cl->fields[i].prefixes);
+    }
+  free(cl);
+}
+
+/* Compile the configured rules and make them the ones in use. */
+void classifier_rebuild()
+{
+  struct classifier *nouveau = 0;
+
+  if (class_rules)
+    nouveau = classifier_compile(class_rules);
+  __sync_synchronize();
+  classifier_free(__sync_lock_test_and_set(&classifier, nouveau));
+}
+
+/* Classify a packet, given the values of its fields.   A field that the
+ * packet doesn't have has a null data pointer.
+ */
+u_int64_t classify_fields(struct classifier *cl,
+			  const struct data_string *fields)
+{
+  const struct class_field_index *idx;
+  struct class_prefix_node *node;
+  struct class_match *match;
+  u_int64_t classes = 0;
+  unsigned i;
+  int f;
+
+  for (f = 0; f < CLASS_FIELD_COUNT; f++)
+    {
+      if (!(cl->active & (1 << f)) || !fields[f].data)
+	continue;
+      idx = &cl->fields[f];
+      if (idx->exact &&
+	  class_match_hash_lookup(&match, idx->exact,
+				  fields[f].data, fields[f].len))
+	classes |= match->classes;
+
+      /* Every node on the path matches a prefix of the value. */
+      for (node = idx->prefixes, i = 0; node; i++)
+	{
+	  classes |= node->classes;
+	  if (i == fields[f].len)
+	    break;
+	  node = prefix_child(node, fields[f].data[i]);
+	}
+    }
+  return classes;
+}
+
+static void set_field(struct data_string *field,
+		      const unsigned char *data, unsigned len)
+{
+  field->data = data;
+  field->len = len;
+}
+
+/* Find a suboption of a relay agent information option. */
+static void agent_suboption(struct data_string *field,
+			    const struct data_string *agent, unsigned code)
+{
+  unsigned ix;
+
+  for (ix = 0; ix + 2 <= agent->len; ix += 2 + agent->data[ix + 1])
+    {
+      if (ix + 2 + agent->data[ix + 1] > agent->len)
+	return;
+      if (agent->data[ix] == code)
+	{
+	  set_field(field, &agent->data[ix + 2], agent->data[ix + 1]);
+	  return;
+	}
+    }
+}
+
+u_int64_t classify_v4(struct classifier *cl, struct packet *packet)
+{
+  struct data_string fields[CLASS_FIELD_COUNT];
+  struct option_cache *oc;
+
+  if (!cl)
+    return 0;
+  memset(fields, 0, sizeof fields);
+
+  if ((oc = lookup_option(&dhcp_option_space, packet->options,
+			  DHO_VENDOR_CLASS_IDENTIFIER)))
+    fields[CLASS_FIELD_VENDOR_CLASS] = oc->data;
+  if ((oc = lookup_option(&dhcp_option_space, packet->options,
+			  DHO_USER_CLASS)))
+    fields[CLASS_FIELD_USER_CLASS] = oc->data;
+  if ((cl->active & ((1 << CLASS_FIELD_CIRCUIT_ID) |
+		     (1 << CLASS_FIELD_REMOTE_ID))) &&
+      (oc = lookup_option(&dhcp_option_space, packet->options,
+			  DHO_DHCP_AGENT_OPTIONS)))
+    {
+      agent_suboption(&fields[CLASS_FIELD_CIRCUIT_ID], &oc->data, 1);
+      agent_suboption(&fields[CLASS_FIELD_REMOTE_ID], &oc->data, 2);
+    }
+
+  /* An RFC4361 client identifier is 255, an IAID and a DUID. */
+  if ((oc = lookup_option(&dhcp_option_space, packet->options,
+			  DHO_DHCP_CLIENT_IDENTIFIER)) &&
+      oc->data.len >= 11 && oc->data.data[0] == 255 &&
+      getUShort(&oc->data.data[5]) == DUID_EN)
+    set_field(&fields[CLASS_FIELD_DUID_ENTERPRISE], &oc->data.data[7], 4);
+
+  if (packet->raw->htype == HTYPE_ETHER && packet->raw->hlen == 6)
+    set_field(&fields[CLASS_FIELD_MAC], packet->raw->chaddr, 6);
+
+  return classify_fields(cl, fields);
+}
+
+/* The user and vendor class options are lists of length-prefixed items;
+ * the first item is the one that's matched.
+ */
+static void first_item(struct data_string *field,
+		       const unsigned char *data, unsigned len)
+{
+  if (len >= 2 && getUShort(data) <= len - 2)
+    set_field(field, data + 2, getUShort(data));
+}
+
+u_int64_t classify_v6(struct classifier *cl, struct dhcpv6_response *msg)
+{
+  struct data_string fields[CLASS_FIELD_COUNT];
+  struct dhcpv6_response *relay;
+  struct option_cache *oc;
+  const unsigned char *duid;
+  unsigned len;
+
+  if (!cl)
+    return 0;
+  memset(fields, 0, sizeof fields);
+
+  if ((oc = lookup_option(&dhcpv6_option_space, msg->options,
+			  DHCPV6_VENDOR_CLASS)) && oc->data.len >= 4)
+    first_item(&fields[CLASS_FIELD_VENDOR_CLASS],
+	       oc->data.data + 4, oc->data.len - 4);
+  if ((oc = lookup_option(&dhcpv6_option_space, msg->options,
+			  DHCPV6_USER_CLASS)))
+    first_item(&fields[CLASS_FIELD_USER_CLASS], oc->data.data, oc->data.len);
+
+  /* The relay agent nearest the client knows the most about it. */
+  for (relay = msg->outer; relay; relay = relay->outer)
+    {
+      if (!fields[CLASS_FIELD_CIRCUIT_ID].data &&
+	  (oc = lookup_option(&dhcpv6_option_space, relay->options,
+			      DHCPV6_INTERFACE_IDENTIFIER)))
+	fields[CLASS_FIELD_CIRCUIT_ID] = oc->data;
+      if (!fields[CLASS_FIELD_REMOTE_ID].data &&
+	  (oc = lookup_option(&dhcpv6_option_space, relay->options,
+			      DHCPV6_REMOTE_ID)) && oc->data.len >= 4)
+	set_field(&fields[CLASS_FIELD_REMOTE_ID],
+		  oc->data.data + 4, oc->data.len - 4);
+    }
+
+  if ((oc = lookup_option(&dhcpv6_option_space, msg->options, DHCPV6_DUID)) &&
+      oc->data.len >= 4)
+    {
+      duid = oc->data.data;
+      len = oc->data.len;
+      if (getUShort(duid) == DUID_EN && len >= 6)
+	set_field(&fields[CLASS_FIELD_DUID_ENTERPRISE], duid + 2, 4);
+      else if (getUShort(duid) == DUID_LLT && len == 14 &&
+	       getUShort(duid + 2) == HTYPE_ETHER)
+	set_field(&fields[CLASS_FIELD_MAC], duid + 8, 6);
+      else if (getUShort(duid) == DUID_LL && len == 10 &&
+	       getUShort(duid + 2) == HTYPE_ETHER)
+	set_field(&fields[CLASS_FIELD_MAC], duid + 4, 6);
+    }
+
+  return classify_fields(cl, fields);
+}
+
+/* Options the server generates for itself.   In a DHCPv4 reply the class
+ * layer sits above the offer/ack layer (see v4_subnet_class_options()),
+ * so a class option with one of these codes would mask the server's.
+ */
+static const unsigned v4_server_options[] = {
+  DHO_DHCP_MESSAGE_TYPE, DHO_DHCP_SERVER_IDENTIFIER, DHO_DHCP_LEASE_TIME,
+  DHO_DHCP_RENEWAL_TIME, DHO_DHCP_REBINDING_TIME, DHO_DHCP_OPTION_OVERLOAD,
+  DHO_DHCP_AGENT_OPTIONS
+};
+static const unsigned v6_server_options[] = {
+  DHCPV6_DUID, DHCPV6_SERVER_IDENTIFIER, DHCPV6_IA_NA, DHCPV6_IA_TA,
+  DHCPV6_IA_ADDRESS, DHCPV6_RELAY_MESSAGE, DHCPV6_AUTHENTICATION,
+  DHCPV6_STATUS_CODE, DHCPV6_INTERFACE_IDENTIFIER,
+  DHCPV6_RECONFIGURE_MESSAGE, DHCPV6_IA_PD, DHCPV6_IA_PREFIX
+};
+
+/* Return nonzero if the server supplies the option with this code itself,
+ * in which case a class may not set it.
+ */
+int classify_server_option(int v6, unsigned code)
+{
+  const unsigned *codes = v6 ? v6_server_options : v4_server_options;
+  unsigned i, n = (v6 ? sizeof v6_server_options
+		   : sizeof v4_server_options) / sizeof *codes;
+
+  for (i = 0; i < n; i++)
+    if (codes[i] == code)
+      return 1;
+  return 0;
+}
+
+/* Copy an option into the reply unless it already has one with that
+ * code, either from a class that takes precedence or from the server.
+ * The configuration parser refuses server-generated options in a class,
+ * but check again here, since nothing in the layering would stop one.
+ */
+static void copy_option(struct option_cache *oc, struct option_state *in,
+			struct option_space *option_space, void *stuff)
+{
+  struct option_state *options = (struct option_state *)stuff;
+  unsigned code = oc->option->code;
+
+  if (classify_server_option(option_space == &dhcpv6_option_space, code))
+    return;
+  if (!(*option_space->lookup_func)(option_space, options, code))
+    save_option(option_space, options, oc);
+}
+
+/* Add the options for each of the classes to the top layer of a reply's
+ * option state.   Where classes disagree, the one declared last wins.
+ */
+void classify_add_options(struct option_state *options,
+			  u_int64_t classes, int v6)
+{
+  struct client_class *cc;
+  int i;
+
+  for (i = CLASS_MAX - 1; i >= 0 && classes; i--)
+    {
+      if (!(classes & ((u_int64_t)1 << i)) || !(cc = class_by_index[i]))
+	continue;
+      classes &= ~((u_int64_t)1 << i);
+      if (v6)
+	option_space_foreach(cc->options6, &dhcpv6_option_space,
+			     options, copy_option);
+      else
+	option_space_foreach(cc->options, &dhcp_option_space,
+			     options, copy_option);
+    }
+}
+
+/* Local Variables:  */
+/* mode:C++ */
+/* c-file-style:"gnu" */
+/* end: */
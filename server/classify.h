@@ -0,0 +1,125 @@
+/* classify.h
+ *
+ * Definitions for client classification.
+ */
+
+/* Copyright (c) 2009 Nominum, Inc.   All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Nominum nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NOMINUM AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL NOMINUM OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef DHCPP_CLASSIFY_H
+#define DHCPP_CLASSIFY_H
+
+/* Clients are sorted into classes by matching fields of their packets
+ * against rules.   Each class has a bit in a 64-bit class mask, and a
+ * packet's classes are the union of the classes of all the rules it
+ * matches.   Rules are compiled into one index per field, so that a packet
+ * is classified by extracting each field once and probing a hash table of
+ * exact values and a trie of prefixes, however many rules there are.
+ */
+
+#define CLASS_MAX	64
+
+enum class_field {
+  CLASS_FIELD_VENDOR_CLASS,
+  CLASS_FIELD_USER_CLASS,
+  CLASS_FIELD_CIRCUIT_ID,	    /* Or the DHCPv6 relay's interface-id. */
+  CLASS_FIELD_REMOTE_ID,
+  CLASS_FIELD_DUID_ENTERPRISE,	       /* Four bytes, network order. */
+  CLASS_FIELD_MAC,
+  CLASS_FIELD_COUNT
+};
+
+struct client_class {
+  struct client_class *next;
+  char *name;
+  unsigned index;			/* Bit in class masks. */
+  struct option_state *options;	    /* DHCPv4 options for members. */
+  struct option_state *options6;    /* DHCPv6 options for members. */
+};
+
+/* A match rule, as configured. */
+struct class_rule {
+  struct class_rule *next;
+  enum class_field field;
+  int prefix;		      /* Match a prefix rather than the value. */
+  u_int8_t *value;
+  unsigned len;
+  unsigned class_index;
+};
+
+struct class_prefix_node {
+  u_int64_t classes;	     /* Classes whose prefix ends here. */
+  unsigned nchildren;
+  u_int8_t *labels;			     /* Sorted. */
+  struct class_prefix_node **children;
+};
+
+struct class_field_index {
+  struct hash_table *exact;
+  struct class_prefix_node *prefixes;
+};
+
+/* The compiled rules.   A new classifier is built whenever the rules
+ * change and swapped in for the old one, so it is never modified once
+ * it's in use.
+ */
+struct classifier {
+  unsigned active;	     /* Bit for each field that has rules. */
+  struct class_field_index fields[CLASS_FIELD_COUNT];
+};
+
+extern struct client_class *client_classes;
+extern struct class_rule *class_rules;
+extern struct classifier *classifier;
+
+int class_field_parse(const char *name);
+struct client_class *client_class_create(const char *name);
+struct client_class *client_class_find(const char *name);
+void client_classes_reindex(void);
+void client_classes_free(struct client_class *classes,
+			 struct class_rule *rules);
+void client_class_add_rule(struct client_class *cc, enum class_field field,
+			   int prefix, const u_int8_t *value, unsigned len);
+void classifier_rebuild(void);
+struct classifier *classifier_compile(struct class_rule *rules);
+void classifier_free(struct classifier *cl);
+
+u_int64_t classify_fields(struct classifier *cl,
+			  const struct data_string *fields);
+u_int64_t classify_v4(struct classifier *cl, struct packet *packet);
+u_int64_t classify_v6(struct classifier *cl, struct dhcpv6_response *msg);
+int classify_server_option(int v6, unsigned code);
+void classify_add_options(struct option_state *options,
+			  u_int64_t classes, int v6);
+
+#endif
+
+/* Local Variables:  */
+/* mode:c++ */
+/* c-file-style:"gnu" */
+/* end: */
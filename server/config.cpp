@@ -0,0 +1,1113 @@
+/* config.cpp
+ *
+ * Read the server configuration file.
+ */
+
+/* Copyright (c) 2009 Nominum, Inc.   All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Nominum nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NOMINUM AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL NOMINUM OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef lint
+static char ocopyright[] __attribute__((unused)) =
+  "$Id: config.cpp,v 1.1 2009/10/02 18:11:40 mellon Exp $ Copyright (c) 2009 Nominum, Inc.  All rights reserved.\n";
+#endif /* not lint */
+
+#include "dhcpd.h"
+#include "server/v4pool.h"
+#include "server/v6pool.h"
+#include "server/reservation.h"
+#include "server/classify.h"
+#include "server/pdpool.h"
+#include "server/pingcheck.h"
+#include "server/reconfigure.h"
+#include "server/config.h"
+
+struct in_addr server_identifier;
+
+/* Changes whenever a new configuration is put in place, so that anything
+ * that caches part of it knows to look again.
+ */
+unsigned config_generation;
+
+#define MAX_CONFIG_ARGS	64
+
+/* The declaration that subsequent directives apply to. */
+struct config_scope {
+  struct v4_subnet *subnet;
+  struct v6_subnet *subnet6;
+  struct client_class *cls;
+};
+
+static const char *config_path;
+static int config_line;
+
+static void config_error(const char *fmt, ...)
+  __attribute__((__format__(__printf__,1,2)));
+
+static void config_error(const char *fmt, ...)
+{
+  char buf[512];
+  va_list list;
+
+  va_start(list, fmt);
+  vsnprintf(buf, sizeof buf, fmt, list);
+  va_end(list);
+  log_error("%s line %d: %s", config_path, config_line, buf);
+}
+
+/* Split a line into whitespace-separated words.   Double quotes group
+ * words together, and a '#' outside of quotes ends the line.   Returns
+ * the number of words, or -1 if there's an unterminated quote.
+ */
+static int tokenize(char *line, char **argv, int max)
+{
+  char *s = line;
+  int argc = 0;
+
+  while (*s)
+    {
+      while (*s && isspace((unsigned char)*s))
+	s++;
+      if (!*s || *s == '#')
+	break;
+      if (argc == max)
+	return -1;
+      if (*s == '"')
+	{
+	  argv[argc++] = ++s;
+	  while (*s && *s != '"')
+	    s++;
+	  if (!*s)
+	    return -1;
+	}
+      else
+	{
+	  argv[argc++] = s;
+	  while (*s && !isspace((unsigned char)*s))
+	    s++;
+	  if (!*s)
+	    break;
+	}
+      *s++ = 0;
+    }
+  return argc;
+}
+
+static int parse_number(const char *s, long long min, long long max,
+			long long *result)
+{
+  char *end;
+  long long n;
+
+  errno = 0;
+  n = strtoll(s, &end, 0);
+  if (errno || end == s || *end || n < min || n > max)
+    return 0;
+  *result = n;
+  return 1;
+}
+
+/* Encode one element of an option according to its format character.
+ * See the description of option formats in tables.cpp.
+ */
+static int encode_element(char fmt, const char *arg,
+			  u_int8_t *buf, unsigned *lenp, unsigned max)
+{
+  unsigned len = *lenp;
+  long long n;
+  unsigned i;
+  int hi, lo;
+
+  switch(fmt)
+    {
+    case 'I':
+      if (len + 4 > max || !inet_aton(arg, (struct in_addr *)&buf[len]))
+	return 0;
+      len += 4;
+      break;
+
+    case '6':
+      if (len + 16 > max || inet_pton(AF_INET6, arg, &buf[len]) != 1)
+	return 0;
+      len += 16;
+      break;
+
+    case 'L':
+    case 'l':
+      if (len + 4 > max ||
+	  !parse_number(arg, fmt == 'l' ? INT_MIN : 0,
+			fmt == 'l' ? INT_MAX : UINT_MAX, &n))
+	return 0;
+      putULong(&buf[len], (u_int32_t)n);
+      len += 4;
+      break;
+
+    case 'S':
+    case 's':
+      if (len + 2 > max ||
+	  !parse_number(arg, fmt == 's' ? -32768 : 0,
+			fmt == 's' ? 32767 : 65535, &n))
+	return 0;
+      putUShort(&buf[len], (u_int16_t)n);
+      len += 2;
+      break;
+
+    case 'B':
+    case 'b':
+      if (len + 1 > max ||
+	  !parse_number(arg, fmt == 'b' ? -128 : 0,
+			fmt == 'b' ? 127 : 255, &n))
+	return 0;
+      buf[len++] = (u_int8_t)n;
+      break;
+
+    case 'f':
+      if (len + 1 > max)
+	return 0;
+      if (!strcasecmp(arg, "true") || !strcasecmp(arg, "on"))
+	buf[len++] = 1;
+      else if (!strcasecmp(arg, "false") || !strcasecmp(arg, "off"))
+	buf[len++] = 0;
+      else
+	return 0;
+      break;
+
+    case 'X':
+      /* Colon-separated hex if it looks like it, otherwise text. */
+      if (strlen(arg) >= 2 && isxdigit((unsigned char)arg[0]) &&
+	  isxdigit((unsigned char)arg[1]) && (!arg[2] || arg[2] == ':'))
+	{
+	  for (i = 0; arg[i]; )
+	    {
+	      if (!isxdigit((unsigned char)arg[i]) ||
+		  !isxdigit((unsigned char)arg[i + 1]) || len + 1 > max)
+		return 0;
+	      hi = isdigit((unsigned char)arg[i])
+		? arg[i] - '0' : tolower((unsigned char)arg[i]) - 'a' + 10;
+	      lo = isdigit((unsigned char)arg[i + 1])
+		? arg[i + 1] - '0'
+		: tolower((unsigned char)arg[i + 1]) - 'a' + 10;
+	      buf[len++] = (hi << 4) | lo;
+	      i += 2;
+	      if (arg[i] == ':')
+		i++;
+	      else if (arg[i])
+		return 0;
+	    }
+	  break;
+	}
+      /* Fall through. */
+    case 't':
+    case 'd':
+      if (len + strlen(arg) > max)
+	return 0;
+      memcpy(&buf[len], arg, strlen(arg));
+      len += strlen(arg);
+      break;
+
+    default:
+      return 0;
+    }
+  *lenp = len;
+  return 1;
+}
+
+/* Encode the arguments of an option statement into wire format. */
+static int encode_option(struct option *option, char **argv, int argc,
+			 u_int8_t *buf, unsigned *lenp, unsigned max)
+{
+  const char *fmt = option->format;
+  const char *f;
+  int i = 0;
+
+  *lenp = 0;
+  if (*fmt == 'e')
+    fmt++;
+  for (f = fmt; *f; f++)
+    {
+      if (*f == 'A' || *f == 'a')
+	{
+	  if (f == fmt)
+	    return 0;
+	  while (i < argc)
+	    if (!encode_element(f[-1], argv[i++], buf, lenp, max))
+	      return 0;
+	  break;
+	}
+      if (*f == 'o')
+	continue;
+      if (i == argc)
+	{
+	  if (f[1] == 'o')
+	    continue;
+	  return 0;
+	}
+      if (!encode_element(*f, argv[i++], buf, lenp, max))
+	return 0;
+    }
+  return i == argc;
+}
+
+/* Find an option by name, or by number if the name is all digits. */
+static struct option *config_find_option(struct option_space *option_space,
+					 const char *name)
+{
+  unsigned i;
+  long long code;
+
+  if (parse_number(name, 1, 254, &code))
+    return find_option(option_space, code);
+  for (i = 0; i < option_space->max_option; i++)
+    {
+      if (option_space->optvec[i] &&
+	  !strcmp(option_space->optvec[i]->name, name))
+	return option_space->optvec[i];
+    }
+  return 0;
+}
+
+/* Parse the name and value of an option statement into wire format. */
+static struct option *parse_option_value(struct option_space *option_space,
+					 char **argv, int argc,
+					 u_int8_t *buf, unsigned *len,
+					 unsigned max)
+{
+  struct option *option;
+
+  if (argc < 3)
+    {
+      config_error("option: name and value expected");
+      return 0;
+    }
+  option = config_find_option(option_space, argv[1]);
+  if (!option)
+    {
+      config_error("unknown option %s", argv[1]);
+      return 0;
+    }
+  if (!encode_option(option, &argv[2], argc - 2, buf, len, max))
+    {
+      config_error("bad value for option %s", option->name);
+      return 0;
+    }
+  return option;
+}
+
+static int parse_option_statement(struct option_space *option_space,
+				  struct option_state *options,
+				  char **argv, int argc)
+{
+  struct option *option;
+  struct option_cache *oc;
+  u_int8_t buf[1024];
+  unsigned len, max;
+
+  max = option_space == &dhcp_option_space ? 255 : sizeof buf;
+  option = parse_option_value(option_space, argv, argc, buf, &len, max);
+  if (!option)
+    return 0;
+  oc = make_const_option_cache((struct buffer **)0, buf, len, option);
+  save_option(option_space, options, oc);
+  return 1;
+}
+
+static int parse_subnet(char **argv, int argc, struct config_scope *scope)
+{
+  char *slash;
+  struct in_addr network;
+  struct in6_addr prefix;
+  long long prefixlen;
+  int v6 = !strcmp(argv[0], "subnet6");
+
+  if (argc != 2 || !(slash = strchr(argv[1], '/')))
+    {
+      config_error("%s: network/prefix-length expected", argv[0]);
+      return 0;
+    }
+  *slash++ = 0;
+  if (v6 ? (inet_pton(AF_INET6, argv[1], &prefix) != 1 ||
+	    !parse_number(slash, 0, 128, &prefixlen))
+      : (!inet_aton(argv[1], &network) ||
+	 !parse_number(slash, 0, 32, &prefixlen)))
+    {
+      config_error("%s: bad network %s/%s", argv[0], argv[1], slash);
+      return 0;
+    }
+  scope->subnet = 0;
+  scope->subnet6 = 0;
+  scope->cls = 0;
+  if (v6)
+    scope->subnet6 = v6_subnet_create(&prefix, prefixlen);
+  else
+    scope->subnet = v4_subnet_create(network, prefixlen);
+  return 1;
+}
+
+static int parse_time(char **argv, int argc, u_int32_t *result)
+{
+  long long n;
+
+  if (argc != 2 || !parse_number(argv[1], 1, MAX_TIME, &n))
+    {
+      config_error("%s: number of seconds expected", argv[0]);
+      return 0;
+    }
+  *result = n;
+  return 1;
+}
+
+static int parse_class(char **argv, int argc, struct config_scope *scope)
+{
+  if (argc != 2)
+    {
+      config_error("class: name expected");
+      return 0;
+    }
+  if (client_class_find(argv[1]))
+    {
+      config_error("class %s is already declared", argv[1]);
+      return 0;
+    }
+  scope->subnet = 0;
+  scope->subnet6 = 0;
+  scope->cls = client_class_create(argv[1]);
+  if (!scope->cls)
+    {
+      config_error("class %s: no more than %d classes may be declared",
+		   argv[1], CLASS_MAX);
+      return 0;
+    }
+  return 1;
+}
+
+/* match <field> [prefix] <value> */
+static int parse_match(char **argv, int argc, struct client_class *cls)
+{
+  u_int8_t buf[255];
+  unsigned len = 0;
+  long long n;
+  int field, prefix;
+
+  prefix = argc == 4 && !strcmp(argv[2], "prefix");
+  if (argc != 3 + prefix || (field = class_field_parse(argv[1])) < 0)
+    {
+      config_error("match: field, optional prefix, and value expected");
+      return 0;
+    }
+  if (field == CLASS_FIELD_DUID_ENTERPRISE)
+    {
+      if (prefix || !parse_number(argv[2], 0, UINT_MAX, &n))
+	{
+	  config_error("match: enterprise number expected");
+	  return 0;
+	}
+      putULong(buf, (u_int32_t)n);
+      len = 4;
+    }
+  else if (!encode_element('X', argv[2 + prefix], buf, &len, sizeof buf))
+    {
+      config_error("match: bad value %s", argv[2 + prefix]);
+      return 0;
+    }
+  client_class_add_rule(cls, (enum class_field)field, prefix, buf, len);
+  return 1;
+}
+
+/* option[6] <name> <value> in a class.   The server's own options (server
+ * identifier, lease times and so on) can't be overridden per class.
+ */
+static int parse_class_option(struct option_space *option_space,
+			      struct option_state *options,
+			      char **argv, int argc)
+{
+  struct option *option;
+  u_int8_t buf[1024];
+  unsigned len, max;
+
+  max = option_space == &dhcp_option_space ? 255 : sizeof buf;
+  option = parse_option_value(option_space, argv, argc, buf, &len, max);
+  if (!option)
+    return 0;
+  if (classify_server_option(option_space == &dhcpv6_option_space,
+			     option->code))
+    {
+      config_error("%s %s: set by the server, not valid in a class",
+		   argv[0], option->name);
+      return 0;
+    }
+  save_option(option_space, options,
+	      make_const_option_cache((struct buffer **)0, buf, len, option));
+  return 1;
+}
+
+/* Directives that apply to a client class. */
+static int parse_class_directive(char **argv, int argc,
+				 struct client_class *cls)
+{
+  if (!strcmp(argv[0], "match"))
+    return parse_match(argv, argc, cls);
+  if (!strcmp(argv[0], "option"))
+    return parse_class_option(&dhcp_option_space, cls->options, argv, argc);
+  if (!strcmp(argv[0], "option6"))
+    return parse_class_option(&dhcpv6_option_space,
+			      cls->options6, argv, argc);
+
+  config_error("%s is not valid in a class declaration", argv[0]);
+  return 0;
+}
+
+/* prefix-pool <aggregate>/<length> <delegated-length> [<max-length>] */
+static int parse_prefix_pool(char **argv, int argc, struct v6_subnet *subnet6)
+{
+  struct in6_addr prefix;
+  long long prefixlen, len, max;
+  char *slash;
+
+  if ((argc != 3 && argc != 4) || !(slash = strchr(argv[1], '/')))
+    {
+      config_error("prefix-pool: prefix/length and delegated length "
+		   "expected");
+      return 0;
+    }
+  *slash++ = 0;
+  if (inet_pton(AF_INET6, argv[1], &prefix) != 1 ||
+      !parse_number(slash, 0, 128, &prefixlen))
+    {
+      config_error("prefix-pool: bad prefix %s/%s", argv[1], slash);
+      return 0;
+    }
+  if (!parse_number(argv[2], prefixlen, 128, &len) ||
+      (argc == 4 && !parse_number(argv[3], len, 128, &max)))
+    {
+      config_error("prefix-pool: delegated lengths must be between %lld "
+		   "and 128, shortest first", prefixlen);
+      return 0;
+    }
+  if (argc == 3)
+    max = len;
+  if (pd_pool_create(subnet6, &prefix, prefixlen, len, max) != ISC_R_SUCCESS)
+    {
+      config_error("prefix-pool: can't create pool");
+      return 0;
+    }
+  return 1;
+}
+
+/* range6 <low> <high> [hash] */
+static int parse_range6(char **argv, int argc, struct v6_subnet *subnet6)
+{
+  struct in6_addr low, high;
+
+  if ((argc != 3 && (argc != 4 || strcmp(argv[3], "hash"))) ||
+      inet_pton(AF_INET6, argv[1], &low) != 1 ||
+      inet_pton(AF_INET6, argv[2], &high) != 1)
+    {
+      config_error("range6: low and high addresses expected");
+      return 0;
+    }
+  if (v6_pool_create(subnet6, &low, &high,
+		     argc == 4 ? V6_ALLOC_HASH : V6_ALLOC_SEQUENTIAL)
+      != ISC_R_SUCCESS)
+    {
+      config_error("range6 %s %s is not within the subnet, or spans more "
+		   "than a /64", argv[1], argv[2]);
+      return 0;
+    }
+  return 1;
+}
+
+/* Directives that apply to a DHCPv6 subnet. */
+static int parse_subnet6_directive(char **argv, int argc,
+				   struct v6_subnet *subnet6)
+{
+  if (!strcmp(argv[0], "option"))
+    return parse_option_statement(&dhcpv6_option_space,
+				  subnet6->options, argv, argc);
+  if (!strcmp(argv[0], "range6"))
+    return parse_range6(argv, argc, subnet6);
+  if (!strcmp(argv[0], "lease-time"))
+    return parse_time(argv, argc, &subnet6->lifetime);
+  if (!strcmp(argv[0], "prefix-pool"))
+    return parse_prefix_pool(argv, argc, subnet6);
+  if (!strcmp(argv[0], "prefix-lifetime"))
+    return parse_time(argv, argc, &subnet6->pd_lifetime);
+
+  config_error("%s is not valid in a subnet6 declaration", argv[0]);
+  return 0;
+}
+
+static int parse_directive(char **argv, int argc, void *stuff)
+{
+  struct config_scope *scope = (struct config_scope *)stuff;
+  struct v4_subnet *subnet = scope->subnet;
+  struct client_class *cls;
+  struct in_addr low, high;
+  unsigned len;
+
+  if (!strcmp(argv[0], "server-identifier"))
+    {
+      if (argc != 2 || !inet_aton(argv[1], &server_identifier))
+	{
+	  config_error("server-identifier: IPv4 address expected");
+	  return 0;
+	}
+      return 1;
+    }
+  if (!strcmp(argv[0], "hash-key"))
+    {
+      len = 0;
+      if (argc != 2 ||
+	  !encode_element('X', argv[1], v6_hash_key, &len,
+			  sizeof v6_hash_key) || len != sizeof v6_hash_key)
+	{
+	  config_error("hash-key: 16 bytes of hex expected");
+	  return 0;
+	}
+      return 1;
+    }
+  if (!strcmp(argv[0], "ping-check"))
+    {
+      /* ping-check [<milliseconds>] */
+      long long n = PING_TIMEOUT;
+
+      if (argc > 2 || (argc == 2 && !parse_number(argv[1], 1, 60000, &n)))
+	{
+	  config_error("ping-check: timeout in milliseconds expected");
+	  return 0;
+	}
+      ping_timeout = n;
+      return 1;
+    }
+  if (!strcmp(argv[0], "reservations"))
+    {
+      if (argc != 2)
+	{
+	  config_error("reservations: file name expected");
+	  return 0;
+	}
+      if (reservations)
+	{
+	  config_error("reservations: already loaded");
+	  return 0;
+	}
+      reservations = reservation_db_open(argv[1]);
+      return reservations != 0;
+    }
+  if (!strcmp(argv[0], "subnet") || !strcmp(argv[0], "subnet6"))
+    return parse_subnet(argv, argc, scope);
+  if (!strcmp(argv[0], "class"))
+    return parse_class(argv, argc, scope);
+
+  /* Everything else applies to a subnet or class. */
+  if (scope->cls)
+    return parse_class_directive(argv, argc, scope->cls);
+  if (scope->subnet6)
+    return parse_subnet6_directive(argv, argc, scope->subnet6);
+  if (!subnet)
+    {
+      config_error("%s must follow a subnet declaration", argv[0]);
+      return 0;
+    }
+  if (!strcmp(argv[0], "range"))
+    {
+      /* range <low> <high> [class <name>] */
+      if ((argc != 3 && (argc != 5 || strcmp(argv[3], "class"))) ||
+	  !inet_aton(argv[1], &low) || !inet_aton(argv[2], &high))
+	{
+	  config_error("range: low and high addresses expected");
+	  return 0;
+	}
+      cls = 0;
+      if (argc == 5 && !(cls = client_class_find(argv[4])))
+	{
+	  config_error("range: unknown class %s", argv[4]);
+	  return 0;
+	}
+      if (v4_pool_create(subnet, low, high,
+			 cls ? (u_int64_t)1 << cls->index : 0)
+	  != ISC_R_SUCCESS)
+	{
+	  config_error("range %s %s is not within the subnet",
+		       argv[1], argv[2]);
+	  return 0;
+	}
+      return 1;
+    }
+  if (!strcmp(argv[0], "lease-time"))
+    return parse_time(argv, argc, &subnet->lease_time);
+  if (!strcmp(argv[0], "renewal-time"))
+    return parse_time(argv, argc, &subnet->renewal_time);
+  if (!strcmp(argv[0], "rebinding-time"))
+    return parse_time(argv, argc, &subnet->rebinding_time);
+  if (!strcmp(argv[0], "option"))
+    return parse_option_statement(&dhcp_option_space,
+				  subnet->options, argv, argc);
+
+  config_error("unknown directive %s", argv[0]);
+  return 0;
+}
+
+/* Read a file of directives, calling directive for each line that has
+ * one on it.   Returns ISC_R_BADPARSE if any of them were bad.
+ */
+static isc_result_t read_config_file(const char *path,
+				     int (*directive)(char **, int, void *),
+				     void *stuff)
+{
+  FILE *f;
+  char line[1024];
+  char *argv[MAX_CONFIG_ARGS];
+  int argc;
+  int errors = 0;
+
+  f = fopen(path, "r");
+  if (!f)
+    {
+      log_error("Can't open %s: %m", path);
+      return ISC_R_NOTFOUND;
+    }
+  config_path = path;
+  config_line = 0;
+
+  while (fgets(line, sizeof line, f))
+    {
+      config_line++;
+      argc = tokenize(line, argv, MAX_CONFIG_ARGS);
+      if (argc < 0)
+	{
+	  config_error("unterminated quote or too many arguments");
+	  errors++;
+	  continue;
+	}
+      if (argc && !(*directive)(argv, argc, stuff))
+	errors++;
+    }
+  fclose(f);
+
+  if (errors)
+    {
+      log_error("%s: %d error%s", path, errors, errors == 1 ? "" : "s");
+      return ISC_R_BADPARSE;
+    }
+  return ISC_R_SUCCESS;
+}
+
+isc_result_t read_server_config(const char *path)
+{
+  struct config_scope scope;
+
+  memset(&scope, 0, sizeof scope);
+  return read_config_file(path, parse_directive, &scope);
+}
+
+/* A host declaration in a reservation source file, and the options that
+ * follow it.
+ */
+struct host_decl {
+  struct reservation_builder *builder;
+  int key_type;				      /* Zero if no host yet. */
+  u_int8_t key[255];
+  unsigned key_len;
+  u_int8_t address[16];
+  unsigned address_len;
+  u_int8_t options[4096];
+  unsigned options_len;
+};
+
+static int finish_host(struct host_decl *host)
+{
+  isc_result_t status;
+
+  if (!host->key_type)
+    return 1;
+  status = reservation_builder_add(host->builder, host->key_type,
+				   host->key, host->key_len,
+				   host->address, host->address_len,
+				   host->options, host->options_len);
+  host->key_type = 0;
+  if (status != ISC_R_SUCCESS)
+    {
+      config_error("can't add host: %s", isc_result_totext(status));
+      return 0;
+    }
+  return 1;
+}
+
+static int parse_host_directive(char **argv, int argc, void *stuff)
+{
+  struct host_decl *host = (struct host_decl *)stuff;
+  struct option_space *option_space;
+  struct option *option;
+  unsigned len, hdr, max, i;
+
+  if (!strcmp(argv[0], "host"))
+    {
+      if (!finish_host(host))
+	return 0;
+      if (argc < 3 || argc > 4 ||
+	  (strcmp(argv[1], "ethernet") && strcmp(argv[1], "duid")))
+	{
+	  config_error("host: ethernet or duid, key and address expected");
+	  return 0;
+	}
+      for (i = 0; argv[2][i]; i++)
+	if (!isxdigit((unsigned char)argv[2][i]) && argv[2][i] != ':')
+	  break;
+      host->key_len = 0;
+      if (argv[1][0] == 'e')
+	{
+	  host->key_type = RESERVATION_HW;
+	  host->key[host->key_len++] = HTYPE_ETHER;
+	}
+      else
+	host->key_type = RESERVATION_DUID;
+      if (argv[2][i] ||
+	  !encode_element('X', argv[2], host->key, &host->key_len,
+			  sizeof host->key) ||
+	  (host->key_type == RESERVATION_HW && host->key_len != 7))
+	{
+	  config_error("host: bad %s %s", argv[1], argv[2]);
+	  host->key_type = 0;
+	  return 0;
+	}
+      host->address_len = 0;
+      if (argc == 4 &&
+	  !encode_element(host->key_type == RESERVATION_HW ? 'I' : '6',
+			  argv[3], host->address, &host->address_len,
+			  sizeof host->address))
+	{
+	  config_error("host: bad address %s", argv[3]);
+	  host->key_type = 0;
+	  return 0;
+	}
+      host->options_len = 0;
+      return 1;
+    }
+
+  if (strcmp(argv[0], "option"))
+    {
+      config_error("unknown directive %s", argv[0]);
+      return 0;
+    }
+  if (!host->key_type)
+    {
+      config_error("option must follow a host declaration");
+      return 0;
+    }
+
+  /* Options are stored with their tag and length, the way the server
+   * will send them.
+   */
+  if (host->key_type == RESERVATION_HW)
+    {
+      option_space = &dhcp_option_space;
+      hdr = 2;
+    }
+  else
+    {
+      option_space = &dhcpv6_option_space;
+      hdr = 4;
+    }
+  if (host->options_len + hdr > sizeof host->options)
+    {
+      config_error("too many options for host");
+      return 0;
+    }
+  max = sizeof host->options - host->options_len - hdr;
+  if (hdr == 2 && max > 255)
+    max = 255;
+  option = parse_option_value(option_space, argv, argc,
+			      &host->options[host->options_len + hdr], &len,
+			      max);
+  if (!option)
+    return 0;
+  if (hdr == 2)
+    {
+      host->options[host->options_len] = option->code;
+      host->options[host->options_len + 1] = len;
+    }
+  else
+    {
+      putUShort(&host->options[host->options_len], option->code);
+      putUShort(&host->options[host->options_len + 2], len);
+    }
+  host->options_len += hdr + len;
+  return 1;
+}
+
+/* Compile a reservation source file into the mapped format the server
+ * reads with the reservations directive.   The source looks like:
+ *
+ *	host ethernet 00:11:22:33:44:55 192.0.2.10
+ *	  option host-name "printer"
+ *	host duid 00:01:00:01:12:34:56:78:00:11:22:33:44:55 2001:db8:1::10
+ */
+isc_result_t compile_reservations(const char *source, const char *path)
+{
+  struct host_decl *host;
+  isc_result_t status;
+
+  host = (struct host_decl *)safemalloc(sizeof *host);
+  host->builder = reservation_builder_create();
+  status = read_config_file(source, parse_host_directive, host);
+  if (status == ISC_R_SUCCESS && !finish_host(host))
+    status = ISC_R_BADPARSE;
+  if (status == ISC_R_SUCCESS)
+    status = reservation_builder_write(host->builder, path);
+  reservation_builder_free(host->builder);
+  free(host);
+  return status;
+}
+
+static int parse_campaign_directive(char **argv, int argc, void *stuff)
+{
+  struct reconfigure_campaign *c = (struct reconfigure_campaign *)stuff;
+  struct reconfigure_target *target;
+  long long n, max;
+  char *slash;
+
+  if (!strcmp(argv[0], "message"))
+    {
+      if (argc == 2 && !strcmp(argv[1], "renew"))
+	c->message = DHCPV6_RENEW;
+      else if (argc == 2 && !strcmp(argv[1], "information-request"))
+	c->message = DHCPV6_INFORMATION_REQUEST;
+      else
+	{
+	  config_error("message: renew or information-request expected");
+	  return 0;
+	}
+      return 1;
+    }
+  if (!strcmp(argv[0], "rate") || !strcmp(argv[0], "burst") ||
+      !strcmp(argv[0], "retries"))
+    {
+      max = strcmp(argv[0], "retries") ? 1000000 : REC_MAX_RC;
+      if (argc != 2 || !parse_number(argv[1], 1, max, &n))
+	{
+	  config_error("%s: number from 1 to %lld expected", argv[0], max);
+	  return 0;
+	}
+      if (!strcmp(argv[0], "rate"))
+	c->rate = n;
+      else if (!strcmp(argv[0], "burst"))
+	c->burst = n;
+      else
+	c->retries = n;
+      return 1;
+    }
+
+  target = (struct reconfigure_target *)safemalloc(sizeof *target);
+  if (!strcmp(argv[0], "class") && argc == 2)
+    {
+      target->type = RECONFIGURE_TARGET_CLASS;
+      target->class_name = strdup(argv[1]);
+    }
+  else if ((!strcmp(argv[0], "link") || !strcmp(argv[0], "prefix")) &&
+	   argc == 2)
+    {
+      target->type = argv[0][0] == 'l' ? RECONFIGURE_TARGET_LINK
+	: RECONFIGURE_TARGET_PREFIX;
+      if (!(slash = strchr(argv[1], '/')))
+	n = 128;
+      else
+	*slash++ = 0;
+      if (inet_pton(AF_INET6, argv[1], &target->prefix) != 1 ||
+	  (slash && !parse_number(slash, 0, 128, &n)))
+	{
+	  config_error("%s: bad prefix %s", argv[0], argv[1]);
+	  free(target);
+	  return 0;
+	}
+      target->prefixlen = n;
+    }
+  else
+    {
+      config_error("unknown directive %s", argv[0]);
+      free(target);
+      return 0;
+    }
+  target->next = c->targets;
+  c->targets = target;
+  return 1;
+}
+
+/* Read a Reconfigure campaign file, which says which clients to send
+ * Reconfigures to, and how:
+ *
+ *	message renew
+ *	rate 200
+ *	burst 20
+ *	retries 8
+ *	link 2001:db8:1::/64
+ *	prefix 2001:db8:100::/40
+ *	class printers
+ *
+ * A link target picks the clients on links whose address (or, for
+ * clients that aren't relayed, subnet) is in the prefix; a prefix target
+ * picks the ones with an address or delegated prefix in it.   With no
+ * targets, every client is picked.   The message defaults to renew, and
+ * the rate, burst and retries to RECONFIGURE_RATE, RECONFIGURE_BURST and
+ * REC_MAX_RC.
+ */
+isc_result_t read_reconfigure_campaign(const char *path,
+				       struct reconfigure_campaign **result)
+{
+  struct reconfigure_campaign *c;
+  isc_result_t status;
+
+  c = (struct reconfigure_campaign *)safemalloc(sizeof *c);
+  c->message = DHCPV6_RENEW;
+  c->rate = RECONFIGURE_RATE;
+  c->burst = RECONFIGURE_BURST;
+  c->retries = REC_MAX_RC;
+  status = read_config_file(path, parse_campaign_directive, c);
+  if (status != ISC_R_SUCCESS)
+    {
+      reconfigure_campaign_free(c);
+      return status;
+    }
+  *result = c;
+  return ISC_R_SUCCESS;
+}
+
+/* Once we know which interfaces we're serving, fill in the server
+ * identifier if it wasn't configured, and compute the reply options.
+ */
+void finish_server_config()
+{
+  struct interface_info *ip;
+  struct v4_subnet *subnet;
+
+  if (!server_identifier.s_addr)
+    {
+      for (ip = interfaces; ip; ip = ip->next)
+	{
+	  if (ip->requested && ip->ipv4_addr_count)
+	    {
+	      server_identifier = ip->ipv4s[0];
+	      break;
+	    }
+	}
+      if (!server_identifier.s_addr && v4_subnets)
+	log_fatal("No IPv4 address to use as the server identifier; "
+		  "please configure one with server-identifier.");
+    }
+
+  v4_nak_options_setup(server_identifier);
+  for (subnet = v4_subnets; subnet; subnet = subnet->next)
+    {
+      if (!subnet->pools)
+	log_info("subnet %s/%d has no ranges.",
+		 inet_ntoa(subnet->network), subnet->prefixlen);
+      v4_subnet_finish(subnet, server_identifier);
+    }
+
+  v4_subnet_index_rebuild();
+  v4_client_index_rebuild();
+  v6_subnet_index_rebuild();
+  classifier_rebuild();
+}
+
+/* Take the current configuration out of service, leaving the server
+ * with none, and return it.   Leases stay in the subnets they're in.
+ */
+struct server_config *server_config_detach()
+{
+  struct server_config *config;
+
+  config = (struct server_config *)safemalloc(sizeof *config);
+  memset(config, 0, sizeof *config);
+  config->server_identifier = server_identifier;
+  config->v4_subnets = v4_subnets;
+  config->v4_subnet_index = v4_subnet_index;
+  config->v4_nak_options = v4_nak_options;
+  config->v6_subnets = v6_subnets;
+  config->v6_subnet_index = v6_subnet_index;
+  memcpy(config->v6_hash_key, v6_hash_key, sizeof v6_hash_key);
+  config->client_classes = client_classes;
+  config->class_rules = class_rules;
+  config->classifier = classifier;
+  config->reservations = reservations;
+  config->ping_timeout = ping_timeout;
+
+  memset(&server_identifier, 0, sizeof server_identifier);
+  v4_subnets = 0;
+  v4_subnet_index = 0;
+  v4_nak_options = 0;
+  v6_subnets = 0;
+  v6_subnet_index = 0;
+  memset(v6_hash_key, 0, sizeof v6_hash_key);
+  client_classes = 0;
+  class_rules = 0;
+  classifier = 0;
+  client_classes_reindex();
+  reservations = 0;
+  ping_timeout = 0;
+  return config;
+}
+
+/* Put a configuration that was taken out of service back, in place of
+ * whatever is there now, which the caller should already have detached.
+ */
+void server_config_attach(struct server_config *config)
+{
+  server_identifier = config->server_identifier;
+  v4_subnets = config->v4_subnets;
+  v4_subnet_index = config->v4_subnet_index;
+  v4_nak_options = config->v4_nak_options;
+  v6_subnets = config->v6_subnets;
+  v6_subnet_index = config->v6_subnet_index;
+  memcpy(v6_hash_key, config->v6_hash_key, sizeof v6_hash_key);
+  client_classes = config->client_classes;
+  class_rules = config->class_rules;
+  classifier = config->classifier;
+  client_classes_reindex();
+  reservations = config->reservations;
+  ping_timeout = config->ping_timeout;
+  free(config);
+}
+
+/* Free a configuration that is out of service and has had its leases
+ * moved out of it.
+ */
+void server_config_free(struct server_config *config)
+{
+  v4_subnets_free(config->v4_subnets);
+  ptrie_free(config->v4_subnet_index);
+  v6_subnets_free(config->v6_subnets);
+  ptrie_free(config->v6_subnet_index);
+  client_classes_free(config->client_classes, config->class_rules);
+  classifier_free(config->classifier);
+  reservation_db_close(config->reservations);
+  free(config);
+}
+
+/* Local Variables:  */
+/* mode:C++ */
+/* c-file-style:"gnu" */
+/* end: */
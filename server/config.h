@@ -0,0 +1,125 @@
+/* config.h
+ *
+ * Definitions for the server configuration file reader.
+ */
+
+/* Copyright (c) 2009 Nominum, Inc.   All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Nominum nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NOMINUM AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL NOMINUM OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef DHCPP_SERVER_CONFIG_H
+#define DHCPP_SERVER_CONFIG_H
+
+/* The server configuration file is line-oriented.   Each line is a
+ * directive followed by its arguments; '#' starts a comment.   Directives
+ * that follow a "subnet" or "class" line apply to that subnet or class:
+ *
+ *	server-identifier 192.0.2.1
+ *	ping-check 500
+ *	class printers
+ *	  match mac prefix 00:00:aa
+ *	  match vendor-class prefix "HP "
+ *	  option domain-name "printers.example.com"
+ *	subnet 192.0.2.0/24
+ *	  range 192.0.2.10 192.0.2.199
+ *	  range 192.0.2.200 192.0.2.250 class printers
+ *	  lease-time 3600
+ *	  option routers 192.0.2.1
+ *	  option domain-name-servers 192.0.2.53 192.0.2.54
+ *	  option domain-name "example.com"
+ *	hash-key 00:11:22:33:44:55:66:77:88:99:aa:bb:cc:dd:ee:ff
+ *	subnet6 2001:db8:1::/64
+ *	  range6 2001:db8:1::1:0 2001:db8:1::ffff:ffff hash
+ *	  lease-time 7200
+ *	  option domain-name-servers 2001:db8:1::53
+ *	  prefix-pool 2001:db8:100::/40 56 60
+ *	  prefix-lifetime 86400
+ *	reservations /var/db/dhcp-reservations.db
+ *
+ * With ping-check, an address is only offered to a DHCPv4 client that
+ * didn't have it already once a ping to it has gone unanswered for the
+ * number of milliseconds given (one second if none is).
+ *
+ * Addresses in a range6 marked "hash" are assigned by hashing the client's
+ * DUID and IAID, with the hash-key, so that servers sharing a key and
+ * configuration make the same assignments.
+ *
+ * A prefix-pool delegates prefixes of the first length from the aggregate,
+ * or of any length up to the second to clients that hint they want one.
+ *
+ * The reservations file is compiled from a list of host declarations by
+ * compile_reservations(); see config.cpp for its format.
+ *
+ * The server rereads the file when it gets a SIGHUP; see reload.h.
+ * Leases move to the same addresses in the new configuration, if they're
+ * still in a pool.
+ */
+
+/* Everything reading a configuration file sets up.   When the server is
+ * told to reload, the running configuration is set aside in one of these
+ * while the file is read again, and is then either put back, if the file
+ * is no good, or retired.   A retired configuration is kept for
+ * CONFIG_GRACE_PERIOD seconds before it's freed, since DHCPDISCOVERs that
+ * are waiting on a ping check still refer to its subnets and reservations.
+ */
+struct server_config {
+  struct server_config *next;		/* On the list of retired ones. */
+  u_int64_t retired;					     /* ns. */
+  struct in_addr server_identifier;
+  struct v4_subnet *v4_subnets;
+  struct ptrie *v4_subnet_index;
+  struct option_state *v4_nak_options;
+  struct v6_subnet *v6_subnets;
+  struct ptrie *v6_subnet_index;
+  u_int8_t v6_hash_key[16];
+  struct client_class *client_classes;
+  struct class_rule *class_rules;
+  struct classifier *classifier;
+  struct reservation_db *reservations;
+  u_int32_t ping_timeout;
+};
+
+#define CONFIG_GRACE_PERIOD	300
+
+extern struct in_addr server_identifier;
+extern unsigned config_generation;
+
+isc_result_t read_server_config(const char *path);
+void finish_server_config(void);
+isc_result_t compile_reservations(const char *source, const char *path);
+isc_result_t read_reconfigure_campaign(const char *path,
+				       struct reconfigure_campaign **result);
+struct server_config *server_config_detach(void);
+void server_config_attach(struct server_config *config);
+void server_config_free(struct server_config *config);
+
+#endif
+
+/* Local Variables:  */
+/* mode:c++ */
+/* c-file-style:"gnu" */
+/* end: */
@@ -0,0 +1,255 @@
+/* dorabench.cpp
+ *
+ * Measures how many DHCPv4 clients a DHCPv4Server can take through
+ * DISCOVER, OFFER, REQUEST and ACK a second.
+ */
+
+/* Copyright (c) 2009 Nominum, Inc.   All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Nominum nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NOMINUM AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL NOMINUM OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#ifndef lint
+static char ocopyright[] __attribute__((unused)) =
+  "$Id: dorabench.cpp,v 1.1 2009/11/02 17:40:12 mellon Exp $ Copyright (c) 2009 Nominum, Inc.  All rights reserved.\n";
+#endif /* not lint */
+
+#include "dhcpd.h"
+#include "server/v4server.h"
+#include "server/config.h"
+
+/* Usage: dorabench [clients]
+ *
+ * Sets up a subnet with a pool of twice as many addresses as there are
+ * clients (100000 by default), and a DHCPv4Server listening on it the
+ * way the server does.   Each client sends a relayed DHCPDISCOVER, and a
+ * DHCPREQUEST for the address it's offered; the replies go out on the
+ * server's socket to the relay address, where the benchmark reads them.
+ * This is done first with clients the server has never seen, then again
+ * with the same clients, which now have bindings.
+ *
+ * For each round it prints how many clients a second the server got
+ * through, counting only the time spent in the listener, including
+ * sending the replies, and how many a second it all took counting the
+ * benchmark's own work.   Logging is off, since what it costs depends on
+ * where the log goes.
+ */
+
+#define BENCH_PORT	6767
+#define BENCH_RELAY	"127.0.0.2"
+
+u_int16_t local_port_dhcpv6 = 0;
+u_int16_t remote_port_dhcpv6 = 0;
+u_int16_t listen_port_dhcpv6 = 0;
+
+static struct interface_info *bench_interface;
+static DHCPv4Server *bench_server;
+static struct sockaddr_in bench_relay;
+static u_int64_t server_time;
+
+static u_int64_t now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return NANO_SECONDS(ts.tv_sec) + ts.tv_nsec;
+}
+
+/* Make client n's request of the given type, relayed from BENCH_RELAY. */
+static unsigned make_request(struct dhcp_packet *raw, unsigned n,
+			     u_int32_t xid, int type,
+			     const struct in_addr *requested)
+{
+  static const u_int8_t prl[] = { DHO_SUBNET_MASK, DHO_ROUTERS,
+				  DHO_DOMAIN_NAME_SERVERS,
+				  DHO_DHCP_LEASE_TIME,
+				  DHO_DHCP_SERVER_IDENTIFIER };
+  u_int8_t *op;
+
+  memset(raw, 0, DHCP_FIXED_NON_UDP);
+  raw->op = BOOTREQUEST;
+  raw->htype = HTYPE_ETHER;
+  raw->hlen = 6;
+  raw->hops = 1;
+  raw->xid = htonl(xid);
+  raw->giaddr = bench_relay.sin_addr;
+  raw->chaddr[0] = 0x02;
+  putULong(&raw->chaddr[2], n);
+
+  op = raw->options;
+  memcpy(op, DHCP_OPTIONS_COOKIE, 4);
+  op += 4;
+  *op++ = DHO_DHCP_MESSAGE_TYPE;
+  *op++ = 1;
+  *op++ = type;
+  if (requested)
+    {
+      *op++ = DHO_DHCP_REQUESTED_ADDRESS;
+      *op++ = 4;
+      memcpy(op, requested, 4);
+      op += 4;
+      *op++ = DHO_DHCP_SERVER_IDENTIFIER;
+      *op++ = 4;
+      memcpy(op, &server_identifier, 4);
+      op += 4;
+    }
+  *op++ = DHO_DHCP_PARAMETER_REQUEST_LIST;
+  *op++ = sizeof prl;
+  memcpy(op, prl, sizeof prl);
+  op += sizeof prl;
+  *op++ = DHO_END;
+  return op - (u_int8_t *)raw;
+}
+
+/* Hand a request to the server the way the socket code would. */
+static void deliver(struct dhcp_packet *raw, unsigned length)
+{
+  u_int64_t start;
+
+  fetch_time();
+  start = now();
+  bench_server->got_packet(bench_interface, &bench_relay,
+			   (unsigned char *)raw, length);
+  server_time += now() - start;
+}
+
+/* Read the server's reply to xid, and check that it's the type we
+ * expected.   Returns the address it gives the client, or 0.
+ */
+static u_int32_t read_reply(u_int32_t xid, int type)
+{
+  union {
+    struct dhcp_packet raw;
+    u_int8_t buf[1500];
+  } u;
+  ssize_t length;
+  unsigned ix;
+
+  length = recv(dhcpv4_socket_fd(), &u, sizeof u, 0);
+  if (length < DHCP_FIXED_NON_UDP + 4 || u.raw.op != BOOTREPLY ||
+      u.raw.xid != htonl(xid))
+    return 0;
+  length -= DHCP_FIXED_NON_UDP;
+  for (ix = 4; ix + 2 < (unsigned)length; ix += 2 + u.raw.options[ix + 1])
+    if (u.raw.options[ix] == DHO_DHCP_MESSAGE_TYPE)
+      return u.raw.options[ix + 2] == type ? u.raw.yiaddr.s_addr : 0;
+  return 0;
+}
+
+static void run_round(const char *name, unsigned clients, unsigned pass)
+{
+  union {
+    struct dhcp_packet raw;
+    u_int8_t buf[1500];
+  } u;
+  struct in_addr offered;
+  unsigned n, length, failed = 0;
+  u_int32_t xid;
+  u_int64_t start, elapsed;
+
+  server_time = 0;
+  start = now();
+  for (n = 0; n < clients; n++)
+    {
+      xid = pass << 24 | n;
+      length = make_request(&u.raw, n, xid, DHCPDISCOVER, 0);
+      deliver(&u.raw, length);
+      if (!(offered.s_addr = read_reply(xid, DHCPOFFER)))
+	{
+	  failed++;
+	  continue;
+	}
+      length = make_request(&u.raw, n, xid, DHCPREQUEST, &offered);
+      deliver(&u.raw, length);
+      if (read_reply(xid, DHCPACK) != offered.s_addr)
+	failed++;
+    }
+  elapsed = now() - start;
+
+  printf("%-18s %9.0f DORA/s in the server, %9.0f DORA/s in all, "
+	 "%u failed\n", name,
+	 (double)clients * NANO_SECONDS(1) / server_time,
+	 (double)clients * NANO_SECONDS(1) / elapsed, failed);
+}
+
+int main(int argc, char **argv)
+{
+  struct v4_subnet *subnet;
+  struct in_addr network, low, high;
+  struct timeval tv;
+  unsigned clients = 100000;
+
+  if (argc > 1)
+    clients = strtoul(argv[1], 0, 0);
+  if (clients < 1 || clients > (1 << 22))
+    log_fatal("Usage: dorabench [clients]");
+
+  log_perror = 0;
+  log_syslog = 0;
+  fetch_time();
+  initialize_common_option_spaces();
+
+  local_port = htons(BENCH_PORT);
+  remote_port = htons(BENCH_PORT + 1);
+  listen_port = local_port;
+
+  /* A subnet the relay is on, with room for everybody twice over. */
+  inet_aton("127.0.0.0", &network);
+  inet_aton("127.0.0.1", &server_identifier);
+  subnet = v4_subnet_create(network, 8);
+  low.s_addr = htonl(ntohl(network.s_addr) + 0x10000);
+  high.s_addr = htonl(ntohl(low.s_addr) + clients * 2 - 1);
+  if (v4_pool_create(subnet, low, high, 0) != ISC_R_SUCCESS)
+    log_fatal("Can't make a pool for %u clients", clients);
+  finish_server_config();
+
+  dhcpv4_socket_setup();
+  tv.tv_sec = 1;
+  tv.tv_usec = 0;
+  setsockopt(dhcpv4_socket_fd(), SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+
+  memset(&bench_relay, 0, sizeof bench_relay);
+  bench_relay.sin_family = AF_INET;
+  bench_relay.sin_port = local_port;
+  inet_aton(BENCH_RELAY, &bench_relay.sin_addr);
+
+  bench_interface = (struct interface_info *)
+    safemalloc(sizeof *bench_interface);
+  strcpy(bench_interface->name, "bench");
+  bench_server = new DHCPv4Server(bench_interface, server_identifier);
+
+  printf("%u clients\n", clients);
+  run_round("new clients", clients, 1);
+  run_round("returning clients", clients, 2);
+  return 0;
+}
+
+/* Local Variables:  */
+/* mode:C++ */
+/* c-file-style:"gnu" */
+/* end: */
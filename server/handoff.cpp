@@ -0,0 +1,95 @@
+/* handoff.cpp
+ *
+ * Saving and restoring the server's leases across a handoff.
+ */
+
+/* Copyright (c) 2009 Nominum, Inc.   All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Nominum nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NOMINUM AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL NOMINUM OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef lint
+static char ocopyright[] __attribute__((unused)) =
+  "$Id: handoff.cpp,v 1.1 2009/10/23 19:05:37 mellon Exp $ Copyright (c) 2009 Nominum, Inc.  All rights reserved.\n";
+#endif /* not lint */
+
+#include "dhcpd.h"
+#include "server/v4pool.h"
+#include "server/v6pool.h"
+#include "server/pdpool.h"
+#include "server/handoff.h"
+#include "server/leasesync.h"
+#include "server/leasequery.h"
+
+ServerHandoff::ServerHandoff(const char *path): Handoff(path)
+{
+}
+
+void ServerHandoff::save(struct handoff_buffer *buf)
+{
+  lease_records_save(buf);
+}
+
+isc_result_t ServerHandoff::restore(struct handoff_buffer *buf)
+{
+  isc_result_t status;
+  unsigned restored = 0, dropped = 0;
+
+  while ((status = lease_record_apply(buf)) == ISC_R_SUCCESS ||
+	 status == ISC_R_NOTFOUND)
+    {
+      if (status == ISC_R_SUCCESS)
+	restored++;
+      else
+	dropped++;
+    }
+
+  if (status != ISC_R_NOMORE)
+    {
+      log_error("Bad handoff state: %s", isc_result_totext(status));
+      return status;
+    }
+  log_info("Restored %u lease%s from the old server.",
+	   restored, restored == 1 ? "" : "s");
+  if (dropped)
+    log_info("Dropped %u lease%s on addresses that are no longer "
+	     "configured.", dropped, dropped == 1 ? "" : "s");
+  return ISC_R_SUCCESS;
+}
+
+void ServerHandoff::handed_off()
+{
+  if (lease_sync)
+    lease_sync->stop_listening();
+  if (bulk_leasequery)
+    bulk_leasequery->stop_listening();
+}
+
+/* Local Variables:  */
+/* mode:C++ */
+/* c-file-style:"gnu" */
+/* end: */
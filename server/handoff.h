@@ -0,0 +1,65 @@
+/* handoff.h
+ *
+ * Definitions for handing the server's leases to its replacement.
+ */
+
+/* Copyright (c) 2009 Nominum, Inc.   All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Nominum nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NOMINUM AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL NOMINUM OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef DHCPP_SERVER_HANDOFF_H
+#define DHCPP_SERVER_HANDOFF_H
+
+#include "dhc++/handoff.h"
+
+/* The state the server hands off is its leases and delegations, which
+ * are restored into the pools the new process has read from the same (or
+ * a newer) configuration file; any whose addresses aren't in a pool any
+ * more are dropped, as on a reload.   Offers that the old process makes
+ * after the handoff, once a ping check finishes, aren't handed off, so a
+ * client that requests one of those addresses gets it allocated afresh.
+ * The TCP ports the server listens on are let go of once the new process
+ * has taken over, for it to listen on.
+ */
+class ServerHandoff: public Handoff
+{
+public:
+  ServerHandoff(const char *path);
+
+protected:
+  void save(struct handoff_buffer *buf);
+  isc_result_t restore(struct handoff_buffer *buf);
+  void handed_off(void);
+};
+
+#endif
+
+/* Local Variables:  */
+/* mode:c++ */
+/* c-file-style:"gnu" */
+/* end: */
@@ -0,0 +1,175 @@
+/* leaselookup.cpp
+ *
+ * Look up bindings in the table a server publishes with -lease-table.
+ */
+
+/* Copyright (c) 2009 Nominum, Inc.   All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Nominum nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NOMINUM AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL NOMINUM OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef lint
+static char ocopyright[] __attribute__((unused)) =
+  "$Id: leaselookup.cpp,v 1.1 2009/10/23 17:45:10 mellon Exp $ Copyright (c) 2009 Nominum, Inc.  All rights reserved.\n";
+#endif /* not lint */
+
+#include "dhcpd.h"
+
+/* Usage: dhcp-lookup [-f <file>] <address>
+ *        dhcp-lookup [-f <file>] -id <client-id or DUID>
+ *        dhcp-lookup [-f <file>] -mac <Ethernet address>
+ *
+ * Prints the bindings the server has published that match, one a line,
+ * and exits with status 0 if there were any, 1 if not and 2 if the table
+ * couldn't be read.   Identifiers and addresses are colon-separated hex.
+ * The server doesn't notice lookups; see common/leaseshm.cpp.
+ */
+
+#define LOOKUP_MAX	64
+
+u_int16_t local_port_dhcpv6 = 0;
+u_int16_t remote_port_dhcpv6 = 0;
+
+static void usage(void)
+{
+  fprintf(stderr, "Usage: dhcp-lookup [-f <file>] "
+	  "<address> | -id <identifier> | -mac <address>\n");
+  exit(2);
+}
+
+static unsigned parse_hex(const char *s, u_int8_t *buf, unsigned max)
+{
+  unsigned len = 0;
+  char *end;
+
+  while (*s)
+    {
+      if (len == max || !isxdigit((unsigned char)*s))
+	return 0;
+      buf[len++] = strtoul(s, &end, 16);
+      if (end - s > 2 || (*end && *end != ':'))
+	return 0;
+      s = *end ? end + 1 : end;
+    }
+  return len;
+}
+
+static void print_hex(const char *name, const u_int8_t *data, unsigned len)
+{
+  unsigned i;
+
+  printf(" %s ", name);
+  for (i = 0; i < len; i++)
+    printf(i ? ":%02x" : "%02x", data[i]);
+}
+
+static void print_record(const struct lease_shm_record *rec)
+{
+  char buf[INET6_ADDRSTRLEN];
+  char when[32];
+  time_t expiry = rec->expiry;
+
+  inet_ntop(rec->kind == LEASE_SHM_V4 ? AF_INET : AF_INET6,
+	    rec->address, buf, sizeof buf);
+  if (rec->kind == LEASE_SHM_PD)
+    printf("%s/%d", buf, rec->prefixlen);
+  else
+    printf("%s", buf);
+  strftime(when, sizeof when, "%Y-%m-%d %H:%M:%S", gmtime(&expiry));
+  printf(" until %s UTC", when);
+  if (rec->kind == LEASE_SHM_V4)
+    print_hex("client-id", rec->id, rec->id_len);
+  else
+    {
+      print_hex("duid", rec->id, rec->id_len);
+      printf(" iaid %u", rec->iaid);
+    }
+  if (rec->has_hw)
+    print_hex("mac", rec->hw, sizeof rec->hw);
+  printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+  const char *path = _PATH_DHCP_LEASE_TABLE;
+  struct lease_shm_record found[LOOKUP_MAX];
+  struct lease_shm *shm;
+  u_int8_t key[LEASE_SHM_ID_MAX];
+  unsigned len, count, i;
+  isc_result_t status;
+  int arg = 1;
+
+  if (argc > 2 && !strcmp(argv[1], "-f"))
+    {
+      path = argv[2];
+      arg = 3;
+    }
+  if (arg >= argc)
+    usage();
+
+  status = lease_shm_open(&shm, path);
+  if (status != ISC_R_SUCCESS)
+    {
+      fprintf(stderr, "Can't read %s: %s\n", path, isc_result_totext(status));
+      exit(2);
+    }
+
+  if (!strcmp(argv[arg], "-id") && arg + 2 == argc)
+    {
+      if (!(len = parse_hex(argv[arg + 1], key, sizeof key)))
+	usage();
+      status = lease_shm_find_id(shm, key, len, found, LOOKUP_MAX, &count);
+    }
+  else if (!strcmp(argv[arg], "-mac") && arg + 2 == argc)
+    {
+      if (parse_hex(argv[arg + 1], key, sizeof key) != 6)
+	usage();
+      status = lease_shm_find_hw(shm, key, found, LOOKUP_MAX, &count);
+    }
+  else if (arg + 1 == argc && inet_pton(AF_INET, argv[arg], key) == 1)
+    status = lease_shm_find_address(shm, key, 4, found, LOOKUP_MAX, &count);
+  else if (arg + 1 == argc && inet_pton(AF_INET6, argv[arg], key) == 1)
+    status = lease_shm_find_address(shm, key, 16, found, LOOKUP_MAX, &count);
+  else
+    usage();
+
+  if (status != ISC_R_SUCCESS)
+    {
+      fprintf(stderr, "Can't look up %s: %s\n", argv[argc - 1],
+	      isc_result_totext(status));
+      exit(2);
+    }
+  for (i = 0; i < count; i++)
+    print_record(&found[i]);
+  lease_shm_close(shm);
+  return count ? 0 : 1;
+}
+
+/* Local Variables:  */
+/* mode:C++ */
+/* c-file-style:"gnu" */
+/* end: */
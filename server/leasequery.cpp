@@ -0,0 +1,684 @@
+/* leasequery.cpp
+ *
+ * Bulk leasequery: sending a requester the bindings that match a query,
+ * over TCP, as fast as it reads them.
+ */
+
+/* Copyright (c) 2009 Nominum, Inc.   All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Nominum nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NOMINUM AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL NOMINUM OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef lint
+static char ocopyright[] __attribute__((unused)) =
+  "$Id: leasequery.cpp,v 1.1 2009/10/28 15:02:11 mellon Exp $ Copyright (c) 2009 Nominum, Inc.  All rights reserved.\n";
+#endif /* not lint */
+
+#include "dhcpd.h"
+#include "server/v6pool.h"
+#include "server/pdpool.h"
+#include "server/config.h"
+#include "server/leasequery.h"
+
+BulkLeasequery *bulk_leasequery;
+
+/* Where a query's walk is in the subnet it's walking. */
+enum lq_stage {
+  LQ_SUBNET,			 /* Hasn't started on the subnet yet. */
+  LQ_ADDRESSES,			      /* On a pool's list of bindings. */
+  LQ_PREFIXES		       /* On a prefix pool's list of bindings. */
+};
+
+static void lq_put_option(struct handoff_buffer *buf, int code,
+			  const void *data, unsigned len)
+{
+  u_int8_t header[4];
+
+  putUShort(header, code);
+  putUShort(&header[2], len);
+  handoff_put(buf, header, sizeof header);
+  handoff_put(buf, data, len);
+}
+
+/* An option that other options go in; lq_option_end() fills in its
+ * length once they have.
+ */
+static unsigned lq_option_begin(struct handoff_buffer *buf, int code)
+{
+  unsigned start = buf->len;
+
+  lq_put_option(buf, code, 0, 0);
+  return start;
+}
+
+static void lq_option_end(struct handoff_buffer *buf, unsigned start)
+{
+  putUShort(&buf->data[start + 2], buf->len - start - 4);
+}
+
+/* Seconds until a binding runs out, and since it was last extended. */
+static u_int32_t lq_remaining(u_int64_t expiry)
+{
+  return expiry > cur_time ? (expiry - cur_time) / NANO_SECONDS(1) : 0;
+}
+
+static u_int32_t lq_since(u_int64_t expiry, u_int32_t lifetime)
+{
+  u_int32_t remaining = lq_remaining(expiry);
+
+  return remaining < lifetime ? lifetime - remaining : 0;
+}
+
+/* Does a binding belong to the client or relay agent asked about? */
+static int lq_matches(struct lq_query *q, const u_int8_t *key,
+		      unsigned key_len, struct v6_relay_id *relay)
+{
+  switch (q->type)
+    {
+    case DHCPV6_QUERY_BY_CLIENTID:
+      return key_len == q->id_len + 4 && !memcmp(key, q->id, q->id_len);
+    case DHCPV6_QUERY_BY_RELAY_ID:
+      return (relay && relay->len == q->id_len &&
+	      !memcmp(relay->id, q->id, q->id_len));
+    }
+  return 1;
+}
+
+/* Is the address asked about in a delegated prefix? */
+static int lq_prefix_contains(struct pd_node *node,
+			      const struct in6_addr *addr)
+{
+  unsigned bytes = node->prefixlen / 8, bits = node->prefixlen % 8;
+
+  if (memcmp(&node->prefix, addr, bytes))
+    return 0;
+  return (!bits ||
+	  !((node->prefix.s6_addr[bytes] ^ addr->s6_addr[bytes]) &
+	    (0xff << (8 - bits))));
+}
+
+/* Move a query on to the next list of bindings to walk.   Returns 0 when
+ * there are none left.   A query on every link walks every subnet;
+ * otherwise the walk starts and ends with the one subnet.
+ */
+static int lq_next_list(struct lq_query *q)
+{
+  while (q->subnet)
+    {
+      if (q->stage == LQ_SUBNET)
+	{
+	  q->stage = LQ_ADDRESSES;
+	  q->pool = (q->type == DHCPV6_QUERY_BY_ADDRESS
+		     ? 0 : q->subnet->pools);
+	}
+      else if (q->stage == LQ_ADDRESSES)
+	q->pool = q->pool->next;
+      else
+	q->pd_pool = q->pd_pool->next;
+
+      if (q->stage == LQ_ADDRESSES)
+	{
+	  if (q->pool)
+	    {
+	      q->cursor.lease = q->pool->bound.head;
+	      return 1;
+	    }
+	  q->stage = LQ_PREFIXES;
+	  q->pd_pool = q->subnet->pd_pools;
+	}
+      if (q->pd_pool)
+	{
+	  q->pd_cursor.lease = q->pd_pool->bound.head;
+	  return 1;
+	}
+
+      q->subnet = q->all ? q->subnet->next : 0;
+      q->stage = LQ_SUBNET;
+    }
+  return 0;
+}
+
+BulkLeasequery::BulkLeasequery(u_int16_t listen_port, duid_t *duid)
+{
+  struct lq_connection *conn;
+  int i;
+
+  port = listen_port;
+  listener = -1;
+  complained = 0;
+  server_duid = duid;
+
+  register_io_object(this, listenfd, 0, incoming, 0, 0);
+  for (i = 0; i < LQ_MAX_CONNECTIONS; i++)
+    {
+      conn = &connections[i];
+      memset(conn, 0, sizeof *conn);
+      conn->server = this;
+      conn->fd = -1;
+      register_io_object(conn, readfd, writefd, readable, writable, 0);
+    }
+  listen_requesters();
+}
+
+/* As with the lease sync port, a server we've just taken over from can
+ * still have the port; keep trying until it lets go.
+ */
+void BulkLeasequery::listen_requesters()
+{
+  if ((listener = tcp_listener_setup(AF_INET6, port)) >= 0)
+    {
+      log_info("Listening for bulk leasequeries on port %d.", ntohs(port));
+      return;
+    }
+  if (errno != EADDRINUSE)
+    log_fatal("Can't listen for bulk leasequeries on port %d: %m",
+	      ntohs(port));
+  if (!complained++)
+    log_error("Port %d is in use; will keep trying.", ntohs(port));
+  addTimeout(cur_time + NANO_SECONDS(1), 0);
+}
+
+void BulkLeasequery::event(const char *evname, int selector, int status)
+{
+  if (port && listener < 0)
+    listen_requesters();
+}
+
+void BulkLeasequery::stop_listening()
+{
+  if (listener >= 0)
+    close(listener);
+  listener = -1;
+  port = 0;
+}
+
+int BulkLeasequery::listenfd(void *v)
+{
+  return ((BulkLeasequery *)v)->listener;
+}
+
+isc_result_t BulkLeasequery::incoming(void *v)
+{
+  BulkLeasequery *lq = (BulkLeasequery *)v;
+  struct sockaddr_in6 from;
+  socklen_t len = sizeof from;
+  char addrbuf[128];
+  int fd, i;
+
+  if ((fd = accept(lq->listener, (struct sockaddr *)&from, &len)) < 0)
+    return ISC_R_SUCCESS;
+  inet_ntop(AF_INET6, &from.sin6_addr, addrbuf, sizeof addrbuf);
+  for (i = 0; i < LQ_MAX_CONNECTIONS; i++)
+    if (lq->connections[i].fd < 0)
+      break;
+  if (i == LQ_MAX_CONNECTIONS)
+    {
+      log_error("Refusing leasequery connection from %s: "
+		"too many connections.", addrbuf);
+      close(fd);
+      return ISC_R_SUCCESS;
+    }
+  fcntl(fd, F_SETFL, O_NONBLOCK);
+  fcntl(fd, F_SETFD, 1);
+  lq->connections[i].fd = fd;
+  log_info("Leasequery connection from %s.", addrbuf);
+  return ISC_R_SUCCESS;
+}
+
+/* A connection that's answering a query doesn't read the next one until
+ * it's done, so a requester can't queue up more work than one query.
+ */
+int BulkLeasequery::readfd(void *v)
+{
+  struct lq_connection *conn = (struct lq_connection *)v;
+
+  return conn->busy ? -1 : conn->fd;
+}
+
+int BulkLeasequery::writefd(void *v)
+{
+  struct lq_connection *conn = (struct lq_connection *)v;
+
+  return conn->busy || conn->out.offset < conn->out.len ? conn->fd : -1;
+}
+
+void BulkLeasequery::close_connection(struct lq_connection *conn)
+{
+  if (conn->busy)
+    {
+      v6_lease_cursor_detach(&conn->query.cursor);
+      pd_lease_cursor_detach(&conn->query.pd_cursor);
+    }
+  close(conn->fd);
+  free(conn->in.data);
+  free(conn->out.data);
+  memset(&conn->in, 0, sizeof conn->in);
+  memset(&conn->out, 0, sizeof conn->out);
+  conn->fd = -1;
+  conn->busy = 0;
+}
+
+isc_result_t BulkLeasequery::readable(void *v)
+{
+  struct lq_connection *conn = (struct lq_connection *)v;
+  BulkLeasequery *lq = conn->server;
+  u_int8_t buf[16384];
+  ssize_t n;
+
+  n = read(conn->fd, buf, sizeof buf);
+  if (n < 0 && (errno == EINTR || errno == EAGAIN))
+    return ISC_R_SUCCESS;
+  if (n <= 0)
+    {
+      lq->close_connection(conn);
+      return ISC_R_SUCCESS;
+    }
+  handoff_put(&conn->in, buf, n);
+  lq->next_query(conn);
+  lq->push(conn);
+  return ISC_R_SUCCESS;
+}
+
+/* Start on the next query the requester has sent, if we're not busy with
+ * one.   Each is a DHCPv6 message preceded by its length.
+ */
+void BulkLeasequery::next_query(struct lq_connection *conn)
+{
+  u_int8_t *p;
+  unsigned len;
+
+  while (!conn->busy && conn->in.len - conn->in.offset >= 2)
+    {
+      p = &conn->in.data[conn->in.offset];
+      len = getUShort(p);
+      if (conn->in.len - conn->in.offset < 2 + len)
+	break;
+      conn->in.offset += 2 + len;
+      if (!start_query(conn, p + 2, len))
+	{
+	  log_error("Closing leasequery connection: not a Leasequery.");
+	  close_connection(conn);
+	  return;
+	}
+    }
+
+  if (conn->in.offset)
+    {
+      memmove(conn->in.data, &conn->in.data[conn->in.offset],
+	      conn->in.len - conn->in.offset);
+      conn->in.len -= conn->in.offset;
+      conn->in.offset = 0;
+    }
+}
+
+/* The requester has read some of what we've sent; send more, and make
+ * more to send if there's room for it.
+ */
+isc_result_t BulkLeasequery::writable(void *v)
+{
+  struct lq_connection *conn = (struct lq_connection *)v;
+  BulkLeasequery *lq = conn->server;
+
+  lq->push(conn);
+  if (conn->fd >= 0 && conn->busy)
+    {
+      lq->fill(conn);
+      if (!conn->busy)
+	lq->next_query(conn);
+      lq->push(conn);
+    }
+  return ISC_R_SUCCESS;
+}
+
+void BulkLeasequery::push(struct lq_connection *conn)
+{
+  ssize_t n;
+
+  while (conn->fd >= 0 && conn->out.offset < conn->out.len)
+    {
+      n = ::send(conn->fd, &conn->out.data[conn->out.offset],
+		 conn->out.len - conn->out.offset, MSG_NOSIGNAL);
+      if (n < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  if (errno != EAGAIN && errno != EWOULDBLOCK)
+	    {
+	      log_error("Leasequery connection: %m");
+	      close_connection(conn);
+	    }
+	  break;
+	}
+      conn->out.offset += n;
+    }
+
+  if (conn->out.offset == conn->out.len)
+    conn->out.offset = conn->out.len = 0;
+  else if (conn->out.offset > LQ_BUFFER_MAX / 2)
+    {
+      memmove(conn->out.data, &conn->out.data[conn->out.offset],
+	      conn->out.len - conn->out.offset);
+      conn->out.len -= conn->out.offset;
+      conn->out.offset = 0;
+    }
+}
+
+/* Start a reply message, and return where it starts so that
+ * end_message() can fill in its length.   The first message of a reply
+ * says who it's from and who it's to.
+ */
+unsigned BulkLeasequery::begin_message(struct lq_connection *conn, int type)
+{
+  struct lq_query *q = &conn->query;
+  unsigned start = conn->out.len;
+
+  handoff_put(&conn->out, "\0\0", 2);
+  handoff_put_uchar(&conn->out, type);
+  handoff_put(&conn->out, q->xid, 3);
+  if (type == DHCPV6_LEASEQUERY_REPLY)
+    {
+      lq_put_option(&conn->out, DHCPV6_SERVER_IDENTIFIER,
+		    &server_duid->data, server_duid->len);
+      if (q->requester_len)
+	lq_put_option(&conn->out, DHCPV6_DUID,
+		      q->requester, q->requester_len);
+    }
+  return start;
+}
+
+void BulkLeasequery::end_message(struct lq_connection *conn, unsigned start)
+{
+  putUShort(&conn->out.data[start], conn->out.len - start - 2);
+}
+
+void BulkLeasequery::put_status(struct lq_connection *conn, int status,
+				const char *text)
+{
+  unsigned start;
+
+  start = lq_option_begin(&conn->out, DHCPV6_STATUS_CODE);
+  handoff_put(&conn->out, "\0", 1);
+  handoff_put_uchar(&conn->out, status);
+  handoff_put(&conn->out, text, strlen(text));
+  lq_option_end(&conn->out, start);
+}
+
+void BulkLeasequery::put_v6_binding(struct lq_connection *conn,
+				    struct v6_lease *lease)
+{
+  struct lq_query *q = &conn->query;
+  u_int8_t iaaddr[24], clt[4];
+  u_int32_t lifetime = lease->pool->subnet->lifetime;
+  unsigned start, data;
+
+  start = begin_message(conn, (q->sent ? DHCPV6_LEASEQUERY_DATA
+			       : DHCPV6_LEASEQUERY_REPLY));
+  data = lq_option_begin(&conn->out, DHCPV6_CLIENT_DATA);
+  lq_put_option(&conn->out, DHCPV6_DUID, lease->key, lease->key_len - 4);
+  memcpy(iaaddr, &lease->address, 16);
+  putULong(&iaaddr[16], lq_remaining(lease->expiry));
+  putULong(&iaaddr[20], lq_remaining(lease->expiry));
+  lq_put_option(&conn->out, DHCPV6_IA_ADDRESS, iaaddr, sizeof iaaddr);
+  putULong(clt, lq_since(lease->expiry, lifetime));
+  lq_put_option(&conn->out, DHCPV6_CLT_TIME, clt, sizeof clt);
+  lq_option_end(&conn->out, data);
+  end_message(conn, start);
+  q->sent++;
+}
+
+void BulkLeasequery::put_pd_binding(struct lq_connection *conn,
+				    struct pd_lease *lease)
+{
+  struct lq_query *q = &conn->query;
+  u_int8_t iaprefix[25], clt[4];
+  u_int32_t lifetime = lease->pool->subnet->pd_lifetime;
+  unsigned start, data;
+
+  start = begin_message(conn, (q->sent ? DHCPV6_LEASEQUERY_DATA
+			       : DHCPV6_LEASEQUERY_REPLY));
+  data = lq_option_begin(&conn->out, DHCPV6_CLIENT_DATA);
+  lq_put_option(&conn->out, DHCPV6_DUID, lease->key, lease->key_len - 4);
+  putULong(iaprefix, lq_remaining(lease->expiry));
+  putULong(&iaprefix[4], lq_remaining(lease->expiry));
+  iaprefix[8] = lease->node->prefixlen;
+  memcpy(&iaprefix[9], &lease->node->prefix, 16);
+  lq_put_option(&conn->out, DHCPV6_IA_PREFIX, iaprefix, sizeof iaprefix);
+  putULong(clt, lq_since(lease->expiry, lifetime));
+  lq_put_option(&conn->out, DHCPV6_CLT_TIME, clt, sizeof clt);
+  lq_option_end(&conn->out, data);
+  end_message(conn, start);
+  q->sent++;
+}
+
+/* Parse a query and start answering it.   A query we can't answer gets a
+ * Leasequery-Reply saying why.   Returns 0 if the message isn't a
+ * Leasequery at all, in which case the connection is closed.
+ */
+int BulkLeasequery::start_query(struct lq_connection *conn,
+				const u_int8_t *msg, unsigned len)
+{
+  struct lq_query *q = &conn->query;
+  const u_int8_t *opt, *sub, *query = 0;
+  unsigned off, code, olen, qlen = 0, soff;
+  struct v6_lease *lease;
+  int have_address = 0, status = DHCPV6_SUCCESS, all;
+  const char *text = "";
+
+  if (len < 4 || msg[0] != DHCPV6_LEASEQUERY)
+    return 0;
+
+  memset(q, 0, sizeof *q);
+  memcpy(q->xid, &msg[1], 3);
+  for (off = 4; off + 4 <= len; off += 4 + olen)
+    {
+      opt = &msg[off];
+      code = getUShort(opt);
+      olen = getUShort(&opt[2]);
+      if (off + 4 + olen > len)
+	return 0;
+      if (code == DHCPV6_DUID && olen <= sizeof q->requester)
+	{
+	  memcpy(q->requester, &opt[4], olen);
+	  q->requester_len = olen;
+	}
+      else if (code == DHCPV6_LQ_QUERY)
+	{
+	  query = &opt[4];
+	  qlen = olen;
+	}
+    }
+
+  /* The query option is a query type and a link address, followed by
+   * options saying what to look for.
+   */
+  if (!query || qlen < 17)
+    {
+      status = DHCPV6_MALFORMED_QUERY;
+      text = "No query.";
+    }
+  else
+    {
+      q->type = query[0];
+      memcpy(&q->link, &query[1], 16);
+      for (soff = 17; soff + 4 <= qlen; soff += 4 + olen)
+	{
+	  sub = &query[soff];
+	  code = getUShort(sub);
+	  olen = getUShort(&sub[2]);
+	  if (soff + 4 + olen > qlen)
+	    break;
+	  if (code == DHCPV6_IA_ADDRESS && olen >= 16)
+	    {
+	      memcpy(&q->address, &sub[4], 16);
+	      have_address = 1;
+	    }
+	  else if ((code == DHCPV6_DUID || code == DHCPV6_RELAY_ID) &&
+		   olen && olen <= sizeof q->id)
+	    {
+	      memcpy(q->id, &sub[4], olen);
+	      q->id_len = olen;
+	    }
+	}
+
+      switch (q->type)
+	{
+	case DHCPV6_QUERY_BY_ADDRESS:
+	  if (!have_address)
+	    {
+	      status = DHCPV6_MALFORMED_QUERY;
+	      text = "No address.";
+	    }
+	  break;
+	case DHCPV6_QUERY_BY_CLIENTID:
+	case DHCPV6_QUERY_BY_RELAY_ID:
+	  if (!q->id_len)
+	    {
+	      status = DHCPV6_MALFORMED_QUERY;
+	      text = "No DUID.";
+	    }
+	  break;
+	case DHCPV6_QUERY_BY_LINK_ADDRESS:
+	  break;
+	default:
+	  status = DHCPV6_UNKNOWN_QUERY_TYPE;
+	  text = "Query type not supported.";
+	}
+    }
+
+  /* A query by address looks on the link the address is on; others look
+   * on the link asked about, or on every link.
+   */
+  all = 0;
+  if (status == DHCPV6_SUCCESS)
+    {
+      if (q->type == DHCPV6_QUERY_BY_ADDRESS)
+	q->subnet = v6_subnet_find(&q->address);
+      else if (!IN6_IS_ADDR_UNSPECIFIED(&q->link))
+	q->subnet = v6_subnet_find(&q->link);
+      else
+	{
+	  q->subnet = v6_subnets;
+	  all = 1;
+	}
+      if (!q->subnet && !all)
+	{
+	  status = DHCPV6_NOT_CONFIGURED;
+	  text = "No such link.";
+	}
+    }
+
+  if (status != DHCPV6_SUCCESS)
+    {
+      off = begin_message(conn, DHCPV6_LEASEQUERY_REPLY);
+      put_status(conn, status, text);
+      end_message(conn, off);
+      return 1;
+    }
+
+  q->all = all;
+  q->stage = LQ_SUBNET;
+  q->generation = config_generation;
+  v6_lease_cursor_attach(&q->cursor, 0);
+  pd_lease_cursor_attach(&q->pd_cursor, 0);
+  conn->busy = 1;
+
+  if (q->type == DHCPV6_QUERY_BY_ADDRESS &&
+      (lease = v6_lease_find_address(&q->address)) &&
+      lease->list == &lease->pool->bound && lease->expiry > cur_time)
+    put_v6_binding(conn, lease);
+  return 1;
+}
+
+/* Send what we found, and end with a status if it isn't success. */
+void BulkLeasequery::finish_query(struct lq_connection *conn, int status)
+{
+  struct lq_query *q = &conn->query;
+  unsigned start;
+
+  start = begin_message(conn, (q->sent ? DHCPV6_LEASEQUERY_DONE
+			       : DHCPV6_LEASEQUERY_REPLY));
+  if (status != DHCPV6_SUCCESS)
+    put_status(conn, status, "The configuration was reloaded.");
+  end_message(conn, start);
+
+  v6_lease_cursor_detach(&q->cursor);
+  pd_lease_cursor_detach(&q->pd_cursor);
+  conn->busy = 0;
+}
+
+/* Walk on through the bindings, queueing the ones that match, until
+ * we've looked at LQ_BATCH of them or queued as much as we'll queue.
+ */
+void BulkLeasequery::fill(struct lq_connection *conn)
+{
+  struct lq_query *q = &conn->query;
+  struct v6_lease *lease;
+  struct pd_lease *pdl;
+  unsigned visited = 0;
+
+  while (visited < LQ_BATCH &&
+	 conn->out.len - conn->out.offset < LQ_BUFFER_MAX - LQ_MESSAGE_MAX)
+    {
+      /* A reload moves the leases to the new configuration's pools and
+       * frees the ones we were walking.
+       */
+      if (q->generation != config_generation)
+	{
+	  finish_query(conn, DHCPV6_QUERY_TERMINATED);
+	  return;
+	}
+
+      if ((lease = q->cursor.lease))
+	{
+	  q->cursor.lease = lease->next;
+	  visited++;
+	  if (lease->expiry > cur_time &&
+	      lq_matches(q, lease->key, lease->key_len, lease->relay))
+	    put_v6_binding(conn, lease);
+	}
+      else if ((pdl = q->pd_cursor.lease))
+	{
+	  q->pd_cursor.lease = pdl->next;
+	  visited++;
+	  if (pdl->expiry > cur_time &&
+	      (q->type == DHCPV6_QUERY_BY_ADDRESS
+	       ? lq_prefix_contains(pdl->node, &q->address)
+	       : lq_matches(q, pdl->key, pdl->key_len, pdl->relay)))
+	    put_pd_binding(conn, pdl);
+	}
+      else if (!lq_next_list(q))
+	{
+	  finish_query(conn, DHCPV6_SUCCESS);
+	  return;
+	}
+    }
+}
+
+/* Local Variables:  */
+/* mode:C++ */
+/* c-file-style:"gnu" */
+/* end: */
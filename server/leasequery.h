@@ -0,0 +1,141 @@
+/* leasequery.h
+ *
+ * Definitions for the bulk leasequery server.
+ */
+
+/* Copyright (c) 2009 Nominum, Inc.   All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Nominum nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NOMINUM AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL NOMINUM OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef DHCPP_LEASEQUERY_H
+#define DHCPP_LEASEQUERY_H
+
+#include "dhc++/timeout.h"
+#include "dhc++/handoff.h"
+#include "server/v6pool.h"
+#include "server/pdpool.h"
+
+/* Requesters that can be connected at once. */
+#define LQ_MAX_CONNECTIONS	8
+
+/* Bytes of replies queued for a requester before we wait for it to read
+ * some; each binding is well under LQ_MESSAGE_MAX.
+ */
+#define LQ_BUFFER_MAX		65536
+#define LQ_MESSAGE_MAX		1024
+
+/* The most leases looked at for a query on one trip through the
+ * dispatcher, so that DHCP packets keep being answered.
+ */
+#define LQ_BATCH		256
+
+/* A query being answered.   The lease lists are walked with cursors,
+ * so leases can come and go while the results are sent; a binding that
+ * is renewed during the walk may be sent twice.
+ */
+struct lq_query {
+  int type;
+  u_int8_t xid[3];
+  struct in6_addr link;			/* :: for every link. */
+  struct in6_addr address;		/* QUERY_BY_ADDRESS. */
+  u_int8_t id[130];	  /* Client DUID, or relay DUID, looked for. */
+  unsigned id_len;
+  u_int8_t requester[130];	/* Requester's DUID, to echo back. */
+  unsigned requester_len;
+  unsigned generation;		     /* Of the configuration walked. */
+  unsigned sent;			/* Bindings sent so far. */
+  int all;				   /* Walking every subnet. */
+  struct v6_subnet *subnet;		/* Being walked, or 0. */
+  int stage;
+  struct v6_pool *pool;
+  struct pd_pool *pd_pool;
+  struct v6_lease_cursor cursor;
+  struct pd_lease_cursor pd_cursor;
+};
+
+struct lq_connection {
+  class BulkLeasequery *server;
+  int fd;				     /* -1 if not in use. */
+  int busy;				/* Answering a query. */
+  struct handoff_buffer in, out;
+  struct lq_query query;
+};
+
+/* Answers bulk leasequeries (RFC 5460) for DHCPv6 bindings over TCP.
+ * Queries by address, by client DUID, by relay DUID and by link address
+ * are supported.   Each binding found goes in its own Client Data
+ * option, the first in the Leasequery-Reply and the rest in
+ * Leasequery-Data messages, followed by a Leasequery-Done.   Results are
+ * made as the requester reads them rather than all at once, so a query
+ * that matches millions of bindings takes no more memory than one that
+ * matches a few; a query still running when the configuration is
+ * reloaded ends with a QueryTerminated status.
+ */
+class BulkLeasequery: public Timeout
+{
+public:
+  BulkLeasequery(u_int16_t listen_port, duid_t *duid);
+  void event(const char *evname, int selector, int status);
+  void stop_listening(void);
+
+private:
+  static int listenfd(void *v);
+  static isc_result_t incoming(void *v);
+  static int readfd(void *v);
+  static int writefd(void *v);
+  static isc_result_t readable(void *v);
+  static isc_result_t writable(void *v);
+  void listen_requesters(void);
+  void close_connection(struct lq_connection *conn);
+  void next_query(struct lq_connection *conn);
+  int start_query(struct lq_connection *conn,
+		  const u_int8_t *msg, unsigned len);
+  void fill(struct lq_connection *conn);
+  void finish_query(struct lq_connection *conn, int status);
+  void push(struct lq_connection *conn);
+  unsigned begin_message(struct lq_connection *conn, int type);
+  void end_message(struct lq_connection *conn, unsigned start);
+  void put_status(struct lq_connection *conn, int status, const char *text);
+  void put_v6_binding(struct lq_connection *conn, struct v6_lease *lease);
+  void put_pd_binding(struct lq_connection *conn, struct pd_lease *lease);
+
+  u_int16_t port;				 /* Or 0. */
+  int listener;
+  int complained;
+  duid_t *server_duid;
+  struct lq_connection connections[LQ_MAX_CONNECTIONS];
+};
+
+extern BulkLeasequery *bulk_leasequery;
+
+#endif
+
+/* Local Variables:  */
+/* mode:c++ */
+/* c-file-style:"gnu" */
+/* end: */
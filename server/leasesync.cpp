@@ -0,0 +1,975 @@
+/* leasesync.cpp
+ *
+ * Keeping a standby server's leases in step with the primary's.
+ */
+
+/* Copyright (c) 2009 Nominum, Inc.   All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Nominum nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NOMINUM AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL NOMINUM OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef lint
+static char ocopyright[] __attribute__((unused)) =
+  "$Id: leasesync.cpp,v 1.1 2009/10/26 17:20:44 mellon Exp $ Copyright (c) 2009 Nominum, Inc.  All rights reserved.\n";
+#endif /* not lint */
+
+#include "dhcpd.h"
+#include <netinet/tcp.h>
+#include "server/v4pool.h"
+#include "server/v6pool.h"
+#include "server/pdpool.h"
+#include "server/config.h"
+#include "server/leasesync.h"
+
+LeaseSync *lease_sync;
+int lease_sync_standby;
+
+/* Each message is a type, a change number and the length of what
+ * follows, which for the messages that carry leases is lease records
+ * ending with LEASE_RECORD_END.
+ */
+enum sync_message {
+  SYNC_HELLO,		   /* Epoch; the last change the standby applied. */
+  SYNC_SNAPSHOT_BEGIN,	/* Epoch; the last change the snapshot covers. */
+  SYNC_SNAPSHOT,		     /* Part of the snapshot's records. */
+  SYNC_SNAPSHOT_END,
+  SYNC_UPDATE,			/* Records; the last change in them. */
+  SYNC_ACK			  /* The last change the standby applied. */
+};
+
+#define SYNC_HEADER_LEN		13
+#define SYNC_MESSAGE_MAX	(2 * SYNC_BATCH_MAX)
+
+/* Timeout selectors. */
+#define SYNC_FLUSH		0
+#define SYNC_RETRY		1
+#define SYNC_LISTEN		2
+
+struct sync_entry {
+  struct sync_entry *next;
+  u_int64_t seq;
+  unsigned len;
+  u_int8_t data[1];
+};
+
+void lease_record_v4(struct handoff_buffer *buf, struct v4_lease *lease)
+{
+  handoff_put_uchar(buf, LEASE_RECORD_V4);
+  handoff_put(buf, &lease->address, 4);
+  handoff_put_uchar(buf, lease->state);
+  handoff_put_time(buf, lease->expiry);
+  handoff_put_ulong(buf, lease->client_id_len);
+  handoff_put(buf, lease->client_id, lease->client_id_len);
+}
+
+void lease_record_v6(struct handoff_buffer *buf, struct v6_lease *lease,
+		     int gone)
+{
+  handoff_put_uchar(buf, LEASE_RECORD_V6);
+  handoff_put(buf, &lease->address, 16);
+  handoff_put_uchar(buf, lease->list == &lease->pool->bound);
+  handoff_put_time(buf, gone ? 0 : lease->expiry);
+  handoff_put_ulong(buf, lease->key_len);
+  handoff_put(buf, lease->key, lease->key_len);
+}
+
+void lease_record_pd(struct handoff_buffer *buf, struct pd_lease *lease,
+		     int gone)
+{
+  handoff_put_uchar(buf, LEASE_RECORD_PD);
+  handoff_put(buf, &lease->node->prefix, 16);
+  handoff_put_uchar(buf, lease->node->prefixlen);
+  handoff_put_uchar(buf, lease->list == &lease->pool->bound);
+  handoff_put_time(buf, gone ? 0 : lease->expiry);
+  handoff_put_ulong(buf, lease->key_len);
+  handoff_put(buf, lease->key, lease->key_len);
+}
+
+/* Where a walk is in a DHCPv6 subnet's lists. */
+enum lease_walk_stage {
+  LEASE_WALK_SUBNET,
+  LEASE_WALK_ADDRESSES,
+  LEASE_WALK_PREFIXES
+};
+
+void lease_walk_begin(struct lease_walk *walk)
+{
+  memset(walk, 0, sizeof *walk);
+  walk->generation = config_generation;
+  walk->subnet = v4_subnets;
+  walk->pool = v4_subnets ? v4_subnets->pools : 0;
+  walk->subnet6 = v6_subnets;
+  walk->stage = LEASE_WALK_SUBNET;
+  v6_lease_cursor_attach(&walk->cursor, 0);
+  pd_lease_cursor_attach(&walk->pd_cursor, 0);
+}
+
+void lease_walk_end(struct lease_walk *walk)
+{
+  v6_lease_cursor_detach(&walk->cursor);
+  pd_lease_cursor_detach(&walk->pd_cursor);
+}
+
+/* Move a walk on to the next DHCPv6 list.   Each subnet's offers are
+ * walked, address pools first, and then its bindings.   Returns 0 when
+ * there are no lists left.
+ */
+static int lease_walk_next_list(struct lease_walk *walk)
+{
+  while (walk->subnet6)
+    {
+      if (walk->stage == LEASE_WALK_SUBNET)
+	{
+	  walk->stage = LEASE_WALK_ADDRESSES;
+	  walk->pool6 = walk->subnet6->pools;
+	}
+      else if (walk->stage == LEASE_WALK_ADDRESSES)
+	walk->pool6 = walk->pool6->next;
+      else
+	walk->pd_pool = walk->pd_pool->next;
+
+      if (walk->stage == LEASE_WALK_ADDRESSES)
+	{
+	  if (walk->pool6)
+	    {
+	      walk->cursor.lease = (walk->bound ? walk->pool6->bound.head
+				    : walk->pool6->offered.head);
+	      return 1;
+	    }
+	  walk->stage = LEASE_WALK_PREFIXES;
+	  walk->pd_pool = walk->subnet6->pd_pools;
+	}
+      if (walk->pd_pool)
+	{
+	  walk->pd_cursor.lease = (walk->bound ? walk->pd_pool->bound.head
+				   : walk->pd_pool->offered.head);
+	  return 1;
+	}
+
+      walk->stage = LEASE_WALK_SUBNET;
+      if (!walk->bound)
+	walk->bound = 1;
+      else
+	{
+	  walk->bound = 0;
+	  walk->subnet6 = walk->subnet6->next;
+	}
+    }
+  return 0;
+}
+
+/* Save leases until the buffer holds max bytes or there are none left.
+ * Returns 0 once every lease has been saved.   The DHCPv6 lists are
+ * saved in order, so restoring them just appends to the new ones.
+ */
+int lease_walk(struct lease_walk *walk, struct handoff_buffer *buf,
+	       unsigned max)
+{
+  struct v4_lease *lease;
+  struct v6_lease *lease6;
+  struct pd_lease *pdl;
+
+  while (buf->len < max)
+    {
+      if (walk->pool)
+	{
+	  if (walk->index < walk->pool->size)
+	    {
+	      lease = &walk->pool->leases[walk->index++];
+	      if (lease->state != V4_LEASE_FREE)
+		lease_record_v4(buf, lease);
+	    }
+	  else
+	    {
+	      walk->pool = walk->pool->next;
+	      walk->index = 0;
+	    }
+	}
+      else if (walk->subnet && (walk->subnet = walk->subnet->next))
+	walk->pool = walk->subnet->pools;
+      else if ((lease6 = walk->cursor.lease))
+	{
+	  walk->cursor.lease = lease6->next;
+	  lease_record_v6(buf, lease6, 0);
+	}
+      else if ((pdl = walk->pd_cursor.lease))
+	{
+	  walk->pd_cursor.lease = pdl->next;
+	  lease_record_pd(buf, pdl, 0);
+	}
+      else if (!lease_walk_next_list(walk))
+	return 0;
+    }
+  return 1;
+}
+
+/* Save every lease and delegation. */
+void lease_records_save(struct handoff_buffer *buf)
+{
+  struct lease_walk walk;
+
+  lease_walk_begin(&walk);
+  lease_walk(&walk, buf, UINT_MAX);
+  lease_walk_end(&walk);
+  handoff_put_uchar(buf, LEASE_RECORD_END);
+}
+
+/* A record replaces whatever lease there was on the address, and any
+ * other lease the client had.
+ */
+static isc_result_t lease_apply_v4(struct in_addr addr,
+				   enum v4_lease_state state, u_int64_t expiry,
+				   const u_int8_t *id, unsigned len)
+{
+  struct v4_subnet *subnet;
+  struct v4_lease *lease, *other;
+
+  subnet = v4_subnet_find(addr);
+  lease = subnet ? v4_lease_find_address(subnet, addr) : 0;
+  if (!lease)
+    return ISC_R_NOTFOUND;
+  v4_lease_free(lease);
+  if (state == V4_LEASE_FREE)
+    return ISC_R_SUCCESS;
+
+  if (len && (other = v4_lease_find_client(id, len)))
+    v4_lease_free(other);
+  v4_lease_claim(lease);
+  lease->state = state;
+  v4_lease_set_expiry(lease, expiry);
+  if (len)
+    v4_lease_set_client(lease, id, len);
+  return ISC_R_SUCCESS;
+}
+
+static isc_result_t lease_apply_v6(const struct in6_addr *addr, int bound,
+				   u_int64_t expiry,
+				   const u_int8_t *key, unsigned len)
+{
+  struct v6_lease *lease;
+
+  if ((lease = v6_lease_find_address(addr)))
+    v6_lease_free(lease);
+  if (!expiry)
+    return ISC_R_SUCCESS;
+  if ((lease = v6_lease_find_client(key, len)))
+    v6_lease_free(lease);
+  return (v6_lease_restore(addr, key, len, expiry, bound)
+	  ? ISC_R_SUCCESS : ISC_R_NOTFOUND);
+}
+
+static isc_result_t lease_apply_pd(const struct in6_addr *prefix,
+				   int prefixlen, int bound, u_int64_t expiry,
+				   const u_int8_t *key, unsigned len)
+{
+  struct pd_lease *lease;
+
+  if ((lease = pd_lease_find(key, len)))
+    pd_lease_free(lease);
+  if (!expiry)
+    return ISC_R_SUCCESS;
+  return (pd_lease_restore(prefix, prefixlen, key, len, expiry, bound)
+	  ? ISC_R_SUCCESS : ISC_R_NOTFOUND);
+}
+
+/* Read one record and make our leases agree with it.   Returns
+ * ISC_R_NOTFOUND if the address isn't in any pool we have, and
+ * ISC_R_NOMORE at the end of the records.
+ */
+isc_result_t lease_record_apply(struct handoff_buffer *buf)
+{
+  struct in_addr addr;
+  struct in6_addr addr6;
+  enum v4_lease_state state = V4_LEASE_FREE;
+  u_int8_t id[256];
+  u_int64_t expiry;
+  unsigned len;
+  int type, bound = 0, prefixlen = 0;
+
+  type = handoff_get_uchar(buf);
+  switch (type)
+    {
+    case LEASE_RECORD_END:
+      return buf->error ? ISC_R_UNEXPECTEDEND : ISC_R_NOMORE;
+
+    case LEASE_RECORD_V4:
+      handoff_get(buf, &addr, 4);
+      state = (enum v4_lease_state)handoff_get_uchar(buf);
+      expiry = handoff_get_time(buf);
+      break;
+
+    case LEASE_RECORD_V6:
+    case LEASE_RECORD_PD:
+      handoff_get(buf, &addr6, 16);
+      if (type == LEASE_RECORD_PD)
+	prefixlen = handoff_get_uchar(buf);
+      bound = handoff_get_uchar(buf);
+      expiry = handoff_get_time(buf);
+      break;
+
+    default:
+      return ISC_R_FORMERR;
+    }
+
+  len = handoff_get_ulong(buf);
+  if (len > sizeof id)
+    return ISC_R_FORMERR;
+  handoff_get(buf, id, len);
+  if (buf->error)
+    return ISC_R_UNEXPECTEDEND;
+
+  if (type == LEASE_RECORD_V4)
+    return lease_apply_v4(addr, state, expiry, id, len);
+  if (type == LEASE_RECORD_V6)
+    return lease_apply_v6(&addr6, bound, expiry, id, len);
+  return lease_apply_pd(&addr6, prefixlen, bound, expiry, id, len);
+}
+
+/* Free every lease and delegation, e.g., before loading a snapshot. */
+void lease_records_clear()
+{
+  v4_lease_reap(~0ULL, ~0U);
+  v6_lease_reap(~0ULL, ~0U);
+  pd_lease_reap(~0ULL, ~0U);
+}
+
+/* Journal a change to a binding, if there's a standby to tell. */
+void lease_sync_v4(struct v4_lease *lease)
+{
+  static struct handoff_buffer record;
+
+  if (!lease_sync || lease_sync_standby)
+    return;
+  record.len = 0;
+  lease_record_v4(&record, lease);
+  lease_sync->journal(&record);
+}
+
+void lease_sync_v6(struct v6_lease *lease, int gone)
+{
+  static struct handoff_buffer record;
+
+  if (!lease_sync || lease_sync_standby)
+    return;
+  record.len = 0;
+  lease_record_v6(&record, lease, gone);
+  lease_sync->journal(&record);
+}
+
+void lease_sync_pd(struct pd_lease *lease, int gone)
+{
+  static struct handoff_buffer record;
+
+  if (!lease_sync || lease_sync_standby)
+    return;
+  record.len = 0;
+  lease_record_pd(&record, lease, gone);
+  lease_sync->journal(&record);
+}
+
+void LeaseSync::init()
+{
+  standby = 0;
+  port = 0;
+  memset(&peer, 0, sizeof peer);
+  listener = conn = -1;
+  connecting = ready = complained = flush_pending = 0;
+  memset(&in, 0, sizeof in);
+  memset(&out, 0, sizeof out);
+  snapshotting = 0;
+  snapshot_bytes = 0;
+  snapshot_epoch = snapshot_seq = 0;
+  loaded = 0;
+  epoch = seq = acked = 0;
+  head = tail = unsent = 0;
+  count = 0;
+}
+
+/* The primary listens for its standby.   Its epoch only has to differ
+ * from that of any earlier primary the standby might have heard from.
+ */
+LeaseSync::LeaseSync(u_int16_t listen_port)
+{
+  init();
+  epoch = cur_time;
+  port = listen_port;
+
+  register_io_object(this, listenfd, 0, incoming, 0, 0);
+  register_io_object(this, readfd, writefd, readable, writable, 0);
+  listen_standby();
+}
+
+/* The port can still be taken by a server we've just taken over from,
+ * which lets go of it once it has handed off; until then, keep trying.
+ */
+void LeaseSync::listen_standby()
+{
+  if ((listener = tcp_listener_setup(AF_INET, port)) >= 0)
+    {
+      log_info("Listening for a standby on port %d.", ntohs(port));
+      return;
+    }
+  if (errno != EADDRINUSE)
+    log_fatal("Can't listen for a standby on port %d: %m", ntohs(port));
+  if (!complained++)
+    log_error("Port %d is in use; will keep trying.", ntohs(port));
+  addTimeout(cur_time + NANO_SECONDS(1), SYNC_LISTEN);
+}
+
+/* Stop taking connections from a standby, when handing off to a new
+ * server that will.
+ */
+void LeaseSync::stop_listening()
+{
+  if (listener >= 0)
+    close(listener);
+  listener = -1;
+  port = 0;
+}
+
+/* The standby connects to its primary, and keeps trying if it can't. */
+LeaseSync::LeaseSync(struct in_addr primary, u_int16_t port)
+{
+  init();
+  standby = 1;
+  lease_sync_standby = 1;
+#if defined(HAVE_SA_LEN)
+  peer.sin_len = sizeof peer;
+#endif
+  peer.sin_family = AF_INET;
+  peer.sin_addr = primary;
+  peer.sin_port = port;
+
+  register_io_object(this, readfd, writefd, readable, writable, 0);
+  connect_primary();
+}
+
+void LeaseSync::connect_primary()
+{
+  int fd;
+
+  if ((fd = socket(PF_INET, SOCK_STREAM, 0)) < 0 ||
+      fcntl(fd, F_SETFL, O_NONBLOCK) < 0 || fcntl(fd, F_SETFD, 1) < 0 ||
+      (connect(fd, (struct sockaddr *)&peer, sizeof peer) < 0 &&
+       errno != EINPROGRESS))
+    {
+      if (!complained++)
+	log_error("Can't connect to primary %s: %m",
+		  inet_ntoa(peer.sin_addr));
+      if (fd >= 0)
+	close(fd);
+      addTimeout(cur_time + NANO_SECONDS(SYNC_RETRY_INTERVAL), SYNC_RETRY);
+      return;
+    }
+  conn = fd;
+  connecting = 1;
+}
+
+/* Forget the connection.   A standby tries again in a while; a primary
+ * waits for the standby to.
+ */
+void LeaseSync::drop()
+{
+  if (conn >= 0)
+    close(conn);
+  conn = -1;
+  connecting = ready = 0;
+  if (snapshotting)
+    lease_walk_end(&walk);
+  snapshotting = 0;
+  snapshot_epoch = 0;
+  free(in.data);
+  free(out.data);
+  memset(&in, 0, sizeof in);
+  memset(&out, 0, sizeof out);
+  if (standby)
+    addTimeout(cur_time + NANO_SECONDS(SYNC_RETRY_INTERVAL), SYNC_RETRY);
+}
+
+void LeaseSync::event(const char *evname, int selector, int status)
+{
+  if (selector == SYNC_RETRY)
+    {
+      if (conn < 0)
+	connect_primary();
+      return;
+    }
+  if (selector == SYNC_LISTEN)
+    {
+      if (port && listener < 0)
+	listen_standby();
+      return;
+    }
+  flush_pending = 0;
+  flush();
+  push();
+}
+
+int LeaseSync::listenfd(void *v)
+{
+  return ((LeaseSync *)v)->listener;
+}
+
+/* There's only one standby; if another connects, the first one is
+ * probably still there.
+ */
+isc_result_t LeaseSync::incoming(void *v)
+{
+  LeaseSync *ls = (LeaseSync *)v;
+  struct sockaddr_in from;
+  socklen_t len = sizeof from;
+  int fd, flag = 1;
+
+  if ((fd = accept(ls->listener, (struct sockaddr *)&from, &len)) < 0)
+    return ISC_R_SUCCESS;
+  if (ls->conn >= 0)
+    {
+      log_error("Refusing a second standby from %s.",
+		inet_ntoa(from.sin_addr));
+      close(fd);
+      return ISC_R_SUCCESS;
+    }
+  fcntl(fd, F_SETFL, O_NONBLOCK);
+  fcntl(fd, F_SETFD, 1);
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof flag);
+  ls->conn = fd;
+  log_info("Standby %s connected.", inet_ntoa(from.sin_addr));
+  return ISC_R_SUCCESS;
+}
+
+int LeaseSync::readfd(void *v)
+{
+  LeaseSync *ls = (LeaseSync *)v;
+
+  return ls->connecting ? -1 : ls->conn;
+}
+
+int LeaseSync::writefd(void *v)
+{
+  LeaseSync *ls = (LeaseSync *)v;
+
+  return (ls->connecting || ls->snapshotting || ls->out.offset < ls->out.len
+	  ? ls->conn : -1);
+}
+
+void LeaseSync::put_message(int type, u_int64_t n,
+			    const u_int8_t *data, unsigned len)
+{
+  u_int8_t header[SYNC_HEADER_LEN];
+
+  header[0] = type;
+  putULong(&header[1], (u_int32_t)(n >> 32));
+  putULong(&header[5], (u_int32_t)n);
+  putULong(&header[9], len);
+  handoff_put(&out, header, sizeof header);
+  if (len)
+    handoff_put(&out, data, len);
+}
+
+/* Send as much of what's queued as the socket will take. */
+void LeaseSync::push()
+{
+  ssize_t n;
+
+  while (conn >= 0 && !connecting && out.offset < out.len)
+    {
+      n = ::send(conn, &out.data[out.offset], out.len - out.offset,
+		 MSG_NOSIGNAL);
+      if (n < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  if (errno == EAGAIN || errno == EWOULDBLOCK)
+	    return;
+	  log_error("Lost the connection to the %s: %m",
+		    standby ? "primary" : "standby");
+	  drop();
+	  return;
+	}
+      out.offset += n;
+    }
+  if (out.offset == out.len)
+    out.offset = out.len = 0;
+}
+
+/* A standby's connection has come up, or failed to.   Once it's up, the
+ * standby says where it's got to.
+ */
+isc_result_t LeaseSync::writable(void *v)
+{
+  LeaseSync *ls = (LeaseSync *)v;
+  u_int8_t buf[8];
+  socklen_t len = sizeof (int);
+  int err = 0, flag = 1;
+
+  if (!ls->connecting)
+    {
+      ls->send_snapshot();
+      ls->push();
+      return ISC_R_SUCCESS;
+    }
+
+  if (getsockopt(ls->conn, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+    err = errno;
+  if (err)
+    {
+      errno = err;
+      if (!ls->complained++)
+	log_error("Can't connect to primary %s: %m",
+		  inet_ntoa(ls->peer.sin_addr));
+      ls->drop();
+      return ISC_R_SUCCESS;
+    }
+  ls->connecting = 0;
+  ls->complained = 0;
+  setsockopt(ls->conn, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof flag);
+  log_info("Connected to primary %s.", inet_ntoa(ls->peer.sin_addr));
+
+  putULong(buf, (u_int32_t)(ls->epoch >> 32));
+  putULong(&buf[4], (u_int32_t)ls->epoch);
+  ls->put_message(SYNC_HELLO, ls->seq, buf, sizeof buf);
+  ls->push();
+  return ISC_R_SUCCESS;
+}
+
+isc_result_t LeaseSync::readable(void *v)
+{
+  LeaseSync *ls = (LeaseSync *)v;
+  struct handoff_buffer msg;
+  u_int8_t buf[16384], *p;
+  u_int64_t n;
+  unsigned len;
+  ssize_t count;
+  int type;
+
+  count = read(ls->conn, buf, sizeof buf);
+  if (count < 0 && (errno == EINTR || errno == EAGAIN))
+    return ISC_R_SUCCESS;
+  if (count <= 0)
+    {
+      if (count)
+	log_error("Lost the connection to the %s: %m",
+		  ls->standby ? "primary" : "standby");
+      else
+	log_info("The %s closed the connection.",
+		 ls->standby ? "primary" : "standby");
+      ls->drop();
+      return ISC_R_SUCCESS;
+    }
+  handoff_put(&ls->in, buf, count);
+
+  while (ls->in.len - ls->in.offset >= SYNC_HEADER_LEN)
+    {
+      p = &ls->in.data[ls->in.offset];
+      type = p[0];
+      n = (u_int64_t)getULong(&p[1]) << 32 | getULong(&p[5]);
+      len = getULong(&p[9]);
+      if (len > SYNC_MESSAGE_MAX)
+	{
+	  log_error("Lease sync message of %u bytes.", len);
+	  ls->drop();
+	  return ISC_R_SUCCESS;
+	}
+      if (ls->in.len - ls->in.offset < SYNC_HEADER_LEN + len)
+	break;
+      memset(&msg, 0, sizeof msg);
+      msg.data = &p[SYNC_HEADER_LEN];
+      msg.len = msg.size = len;
+      ls->in.offset += SYNC_HEADER_LEN + len;
+      if (!ls->message(type, n, &msg))
+	{
+	  ls->drop();
+	  return ISC_R_SUCCESS;
+	}
+    }
+
+  if (ls->in.offset)
+    {
+      memmove(ls->in.data, &ls->in.data[ls->in.offset],
+	      ls->in.len - ls->in.offset);
+      ls->in.len -= ls->in.offset;
+      ls->in.offset = 0;
+    }
+  ls->push();
+  return ISC_R_SUCCESS;
+}
+
+/* Act on a message.   Returns 0 if the connection should be dropped. */
+int LeaseSync::message(int type, u_int64_t n, struct handoff_buffer *msg)
+{
+  isc_result_t status;
+
+  if (!standby)
+    {
+      switch (type)
+	{
+	case SYNC_HELLO:
+	  hello(handoff_get_time(msg), n);
+	  return 1;
+
+	case SYNC_ACK:
+	  if (n > acked && n <= seq)
+	    acked = n;
+	  trim();
+	  flush();
+	  return 1;
+	}
+    }
+  else
+    {
+      switch (type)
+	{
+	case SYNC_SNAPSHOT_BEGIN:
+	  snapshot_epoch = handoff_get_time(msg);
+	  snapshot_seq = n;
+	  epoch = 0;
+	  lease_records_clear();
+	  loaded = 0;
+	  return 1;
+
+	case SYNC_SNAPSHOT:
+	  if (!snapshot_epoch)
+	    return 0;
+	  while ((status = lease_record_apply(msg)) == ISC_R_SUCCESS ||
+		 status == ISC_R_NOTFOUND)
+	    if (status == ISC_R_SUCCESS)
+	      loaded++;
+	  if (status != ISC_R_NOMORE)
+	    {
+	      log_error("Bad snapshot from the primary: %s",
+			isc_result_totext(status));
+	      return 0;
+	    }
+	  return 1;
+
+	case SYNC_SNAPSHOT_END:
+	  if (!snapshot_epoch)
+	    return 0;
+	  epoch = snapshot_epoch;
+	  seq = snapshot_seq;
+	  snapshot_epoch = 0;
+	  log_info("Loaded %u lease%s from the primary.",
+		   loaded, loaded == 1 ? "" : "s");
+	  put_message(SYNC_ACK, seq, 0, 0);
+	  return 1;
+
+	case SYNC_UPDATE:
+	  if (!epoch || n <= seq)
+	    return 0;
+	  while ((status = lease_record_apply(msg)) == ISC_R_SUCCESS ||
+		 status == ISC_R_NOTFOUND)
+	    ;
+	  if (status != ISC_R_NOMORE)
+	    {
+	      log_error("Bad update from the primary: %s",
+			isc_result_totext(status));
+	      epoch = 0;
+	      return 0;
+	    }
+	  seq = n;
+	  put_message(SYNC_ACK, seq, 0, 0);
+	  return 1;
+	}
+    }
+
+  log_error("Unexpected lease sync message %d.", type);
+  return 0;
+}
+
+/* The standby has said which of our changes it has.   Carry on from
+ * there if we still have the ones after it; otherwise, start it afresh
+ * with a snapshot, which covers everything in the journal.
+ */
+void LeaseSync::hello(u_int64_t their_epoch, u_int64_t their_seq)
+{
+  struct sync_entry *e;
+
+  if (their_epoch == epoch && their_seq <= seq &&
+      (head ? head->seq <= their_seq + 1 : their_seq == seq))
+    {
+      for (e = head; e && e->seq <= their_seq; e = e->next)
+	;
+      unsent = e;
+      acked = their_seq;
+      log_info("Standby has changes up to %llu; sending %llu more.",
+	       (unsigned long long)their_seq,
+	       (unsigned long long)(seq - their_seq));
+    }
+  else
+    begin_snapshot();
+  ready = 1;
+  trim();
+  send_snapshot();
+  flush();
+}
+
+/* Start sending a snapshot as of the latest change.   Changes from then
+ * on are sent once it's over.
+ */
+void LeaseSync::begin_snapshot()
+{
+  u_int8_t buf[8];
+
+  if (snapshotting)
+    lease_walk_end(&walk);
+  lease_walk_begin(&walk);
+  snapshotting = 1;
+  snapshot_bytes = 0;
+  putULong(buf, (u_int32_t)(epoch >> 32));
+  putULong(&buf[4], (u_int32_t)epoch);
+  put_message(SYNC_SNAPSHOT_BEGIN, seq, buf, sizeof buf);
+  log_info("Sending the standby a snapshot.");
+  unsent = 0;
+  acked = seq;
+}
+
+/* Queue the next batches of the snapshot, as long as no more than a
+ * batch is waiting for the socket.   A reload frees the leases being
+ * walked, so the snapshot starts again.
+ */
+void LeaseSync::send_snapshot()
+{
+  static struct handoff_buffer batch;
+  int more = 1;
+
+  while (snapshotting && conn >= 0 && more &&
+	 out.len - out.offset < SYNC_BATCH_MAX)
+    {
+      if (walk.generation != config_generation)
+	{
+	  log_info("The configuration was reloaded; "
+		   "starting the snapshot again.");
+	  begin_snapshot();
+	}
+      batch.len = 0;
+      more = lease_walk(&walk, &batch, SYNC_BATCH_MAX);
+      if (batch.len)
+	{
+	  handoff_put_uchar(&batch, LEASE_RECORD_END);
+	  put_message(SYNC_SNAPSHOT, seq, batch.data, batch.len);
+	  snapshot_bytes += batch.len;
+	}
+    }
+  if (snapshotting && !more)
+    {
+      put_message(SYNC_SNAPSHOT_END, seq, 0, 0);
+      lease_walk_end(&walk);
+      snapshotting = 0;
+      log_info("Sent the standby a snapshot of %llu bytes.",
+	       (unsigned long long)snapshot_bytes);
+      flush();
+    }
+}
+
+/* Queue batches of changes the standby hasn't been sent, as long as it
+ * isn't too far behind in acknowledging them.
+ */
+void LeaseSync::flush()
+{
+  static struct handoff_buffer batch;
+  u_int64_t last;
+
+  if (standby || conn < 0 || !ready || snapshotting)
+    return;
+  while (unsent && unsent->seq - acked <= SYNC_WINDOW)
+    {
+      batch.len = 0;
+      do
+	{
+	  handoff_put(&batch, unsent->data, unsent->len);
+	  last = unsent->seq;
+	  unsent = unsent->next;
+	}
+      while (unsent && batch.len < SYNC_BATCH_MAX &&
+	     unsent->seq - acked <= SYNC_WINDOW);
+      handoff_put_uchar(&batch, LEASE_RECORD_END);
+      put_message(SYNC_UPDATE, last, batch.data, batch.len);
+    }
+}
+
+/* Forget the changes the standby has, and the oldest ones if there are
+ * too many.   A standby that needs those will have to start again.
+ */
+void LeaseSync::trim()
+{
+  struct sync_entry *e;
+
+  while ((e = head) && (e->seq <= acked || count > SYNC_JOURNAL_MAX))
+    {
+      if (e->seq > acked && ready)
+	{
+	  log_error("The standby is more than %d changes behind.",
+		    SYNC_JOURNAL_MAX);
+	  drop();
+	}
+      head = e->next;
+      if (!head)
+	tail = 0;
+      if (unsent == e)
+	unsent = head;
+      free(e);
+      count--;
+    }
+}
+
+void LeaseSync::schedule_flush()
+{
+  if (!flush_pending && ready)
+    {
+      flush_pending = 1;
+      addTimeout(cur_time, SYNC_FLUSH);
+    }
+}
+
+/* Add a change to the journal.   It goes to the standby with whatever
+ * else changes before the dispatcher runs out of packets to answer.
+ */
+void LeaseSync::journal(struct handoff_buffer *record)
+{
+  struct sync_entry *e;
+
+  e = (struct sync_entry *)safemalloc(sizeof *e + record->len);
+  e->next = 0;
+  e->seq = ++seq;
+  e->len = record->len;
+  memcpy(e->data, record->data, record->len);
+  if (tail)
+    tail->next = e;
+  else
+    head = e;
+  tail = e;
+  count++;
+  if (!unsent)
+    unsent = e;
+  trim();
+  schedule_flush();
+}
+
+/* Local Variables:  */
+/* mode:C++ */
+/* c-file-style:"gnu" */
+/* end: */
@@ -0,0 +1,201 @@
+/* leasesync.h
+ *
+ * Definitions for keeping a standby server's leases in step with the
+ * primary's.
+ */
+
+/* Copyright (c) 2009 Nominum, Inc.   All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Nominum nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NOMINUM AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL NOMINUM OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef DHCPP_LEASESYNC_H
+#define DHCPP_LEASESYNC_H
+
+#include "dhc++/timeout.h"
+#include "dhc++/handoff.h"
+#include "server/v6pool.h"
+#include "server/pdpool.h"
+
+/* Leases are passed between servers, and from a server to its
+ * replacement, as records that start with one of these.   A record for a
+ * lease that has gone has state V4_LEASE_FREE, or an expiry of 0.
+ */
+enum lease_record_type {
+  LEASE_RECORD_END,
+  LEASE_RECORD_V4,	/* Address, state, expiry, client id length, id. */
+  LEASE_RECORD_V6,	/* Address, bound, expiry, key length, key. */
+  LEASE_RECORD_PD	/* Prefix, length, bound, expiry, key length, key. */
+};
+
+void lease_record_v4(struct handoff_buffer *buf, struct v4_lease *lease);
+void lease_record_v6(struct handoff_buffer *buf, struct v6_lease *lease,
+		     int gone);
+void lease_record_pd(struct handoff_buffer *buf, struct pd_lease *lease,
+		     int gone);
+void lease_records_save(struct handoff_buffer *buf);
+isc_result_t lease_record_apply(struct handoff_buffer *buf);
+void lease_records_clear(void);
+
+/* A place in a walk through every lease and delegation, for saving them
+ * a piece at a time.   The DHCPv6 lists are walked with cursors, so
+ * leases can come and go between pieces; one that moves along its list
+ * may be saved twice.   A reload frees what's being walked, so the walk
+ * has to start again if config_generation changes.
+ */
+struct lease_walk {
+  unsigned generation;
+  struct v4_subnet *subnet;
+  struct v4_pool *pool;
+  u_int32_t index;
+  struct v6_subnet *subnet6;
+  int bound;			      /* Walking the bound lists. */
+  int stage;
+  struct v6_pool *pool6;
+  struct pd_pool *pd_pool;
+  struct v6_lease_cursor cursor;
+  struct pd_lease_cursor pd_cursor;
+};
+
+void lease_walk_begin(struct lease_walk *walk);
+int lease_walk(struct lease_walk *walk, struct handoff_buffer *buf,
+	       unsigned max);
+void lease_walk_end(struct lease_walk *walk);
+
+/* The most updates kept for a standby that isn't keeping up or isn't
+ * connected.   One that misses more than this gets a new snapshot.
+ */
+#define SYNC_JOURNAL_MAX	65536
+
+/* The most updates sent to the standby that it hasn't acknowledged. */
+#define SYNC_WINDOW		4096
+
+/* Updates are sent in batches of up to this many bytes. */
+#define SYNC_BATCH_MAX		32768
+
+/* Seconds between a standby's attempts to reach its primary. */
+#define SYNC_RETRY_INTERVAL	5
+
+/* Keeps the leases on a standby server the same as the primary's, over a
+ * TCP connection the standby makes to the primary.
+ *
+ * The primary numbers each change to a binding and keeps it in a
+ * journal.   Changes made while answering one batch of packets go to the
+ * standby together, as soon as the dispatcher has nothing else to do,
+ * without waiting for earlier batches to be acknowledged unless
+ * SYNC_WINDOW changes are outstanding; the standby acknowledges each
+ * batch once it has applied it, and the primary then forgets it.
+ *
+ * When the standby connects, it says which primary (by the epoch the
+ * primary picked when it started) it last heard from and the last change
+ * it applied.   If the journal goes back that far, the primary carries on
+ * from there.   Otherwise, it sends a snapshot of all its leases,
+ * followed by the changes made after the snapshot.   A restarted primary
+ * has a new epoch, so its standby starts again with whatever leases it
+ * has; restart it with -handoff to keep them.
+ *
+ * The snapshot is made a batch at a time as the connection drains, and
+ * the standby applies each batch as it arrives, so neither end ever
+ * holds a copy of the whole lease database.   Leases that change while
+ * it's being sent are in the journal too, which goes to the standby
+ * after the snapshot ends, so the standby ends up with their latest
+ * state even if the snapshot caught an older or newer one.   A standby
+ * that loses the connection part way through has only some of the
+ * leases, and gets a new snapshot when it reconnects.
+ *
+ * The standby doesn't answer clients.   To promote it, start a server
+ * without a -sync-from option with the standby's -handoff path; it takes
+ * over the standby's sockets and leases.
+ */
+class LeaseSync: public Timeout
+{
+public:
+  LeaseSync(u_int16_t listen_port);
+  LeaseSync(struct in_addr primary, u_int16_t port);
+  void event(const char *evname, int selector, int status);
+  void journal(struct handoff_buffer *record);
+  void stop_listening(void);
+
+private:
+  static int listenfd(void *v);
+  static isc_result_t incoming(void *v);
+  static int readfd(void *v);
+  static int writefd(void *v);
+  static isc_result_t readable(void *v);
+  static isc_result_t writable(void *v);
+  void init(void);
+  void listen_standby(void);
+  void connect_primary(void);
+  void drop(void);
+  void put_message(int type, u_int64_t seq,
+		   const u_int8_t *data, unsigned len);
+  void push(void);
+  int message(int type, u_int64_t seq, struct handoff_buffer *msg);
+  void hello(u_int64_t their_epoch, u_int64_t their_seq);
+  void begin_snapshot(void);
+  void send_snapshot(void);
+  void flush(void);
+  void trim(void);
+  void schedule_flush(void);
+
+  int standby;
+  u_int16_t port;		   /* Primary: where to listen, or 0. */
+  struct sockaddr_in peer;		/* Standby: the primary. */
+  int listener;
+  int conn;
+  int connecting;		/* Standby: waiting for connect(). */
+  int ready;			/* Primary: standby has said hello. */
+  int complained;	       /* Logged that the primary is unreachable. */
+  int flush_pending;
+  struct handoff_buffer in, out;
+  int snapshotting;		/* Primary: sending a snapshot. */
+  struct lease_walk walk;	/* Primary: how far it has got. */
+  u_int64_t snapshot_bytes;
+  u_int64_t snapshot_epoch, snapshot_seq;	/* Standby: arriving. */
+  unsigned loaded;		/* Standby: leases loaded from it. */
+
+  u_int64_t epoch;	      /* Of the primary; 0 if not heard from. */
+  u_int64_t seq;	  /* Last change journaled, or applied. */
+  u_int64_t acked;	 /* Primary: last change the standby applied. */
+  struct sync_entry *head, *tail;		    /* The journal. */
+  struct sync_entry *unsent;	     /* First change not sent yet. */
+  unsigned count;			     /* Changes journaled. */
+};
+
+extern LeaseSync *lease_sync;
+extern int lease_sync_standby;
+
+void lease_sync_v4(struct v4_lease *lease);
+void lease_sync_v6(struct v6_lease *lease, int gone);
+void lease_sync_pd(struct pd_lease *lease, int gone);
+
+#endif
+
+/* Local Variables:  */
+/* mode:c++ */
+/* c-file-style:"gnu" */
+/* end: */
@@ -0,0 +1,613 @@
+/* pdpool.cpp
+ *
+ * DHCPv6 prefix delegation pools, allocated buddy-style from a prefix
+ * trie.
+ */
+
+/* Copyright (c) 2009 Nominum, Inc.   All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Nominum nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NOMINUM AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL NOMINUM OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#ifndef lint
+static char ocopyright[] __attribute__((unused)) =
+  "$Id: pdpool.cpp,v 1.1 2009/10/19 16:03:27 mellon Exp $ Copyright (c) 2009 Nominum, Inc.  All rights reserved.\n";
+#endif /* not lint */
+
+#include "dhcpd.h"
+#include "server/v6pool.h"
+#include "server/pdpool.h"
+
+typedef struct hash_table pd_lease_hash_t;
+HASH_FUNCTIONS_DECL(pd_lease, const u_int8_t *,
+		    struct pd_lease, pd_lease_hash_t)
+HASH_FUNCTIONS(pd_lease, const u_int8_t *, struct pd_lease, pd_lease_hash_t)
+
+/* Delegated prefixes, indexed by the DUID and IAID they were delegated
+ * to, so that a client asking again gets the same prefix back.
+ */
+static pd_lease_hash_t *client_prefixes;
+
+/* Cursors on delegation lists. */
+static struct pd_lease_cursor *lease_cursors;
+
+static inline int prefix_bit(const struct in6_addr *prefix, unsigned bit)
+{
+  return (prefix->s6_addr[bit / 8] >> (7 - bit % 8)) & 1;
+}
+
+static struct pd_node *pd_node_create(struct pd_node *parent,
+				      const struct in6_addr *prefix,
+				      int prefixlen)
+{
+  struct pd_node *node;
+
+  node = (struct pd_node *)safemalloc(sizeof *node);
+  memset(node, 0, sizeof *node);
+  node->parent = parent;
+  node->prefix = *prefix;
+  node->prefixlen = prefixlen;
+  node->state = PD_NODE_FREE;
+  node->best = prefixlen;
+  return node;
+}
+
+isc_result_t pd_pool_create(struct v6_subnet *subnet,
+			    const struct in6_addr *prefix, int prefixlen,
+			    int delegated_len, int max_len)
+{
+  struct pd_pool *pool;
+  struct in6_addr network;
+  int i;
+
+  if (prefixlen < 0 || delegated_len < prefixlen ||
+      max_len < delegated_len || max_len > 128)
+    return ISC_R_INVALIDARG;
+
+  memset(&network, 0, sizeof network);
+  for (i = 0; i < prefixlen; i++)
+    if (prefix_bit(prefix, i))
+      network.s6_addr[i / 8] |= 0x80 >> (i % 8);
+
+  pool = (struct pd_pool *)safemalloc(sizeof *pool);
+  memset(pool, 0, sizeof *pool);
+  pool->subnet = subnet;
+  pool->root = pd_node_create(0, &network, prefixlen);
+  pool->delegated_len = delegated_len;
+  pool->max_len = max_len;
+
+  pool->next = subnet->pd_pools;
+  subnet->pd_pools = pool;
+  return ISC_R_SUCCESS;
+}
+
+/* Recompute the best free length of each node from this one up to the
+ * root, stopping as soon as one doesn't change.
+ */
+static void pd_node_update(struct pd_node *node)
+{
+  u_int8_t best;
+
+  for (; node; node = node->parent)
+    {
+      if (node->state == PD_NODE_FREE)
+	best = node->prefixlen;
+      else if (node->state == PD_NODE_DELEGATED)
+	best = PD_NONE_FREE;
+      else if (node->child[0]->best < node->child[1]->best)
+	best = node->child[0]->best;
+      else
+	best = node->child[1]->best;
+      if (node->best == best && node->state == PD_NODE_SPLIT)
+	return;
+      node->best = best;
+    }
+}
+
+/* Split a free block into two free halves. */
+static void pd_node_split(struct pd_node *node)
+{
+  struct in6_addr upper = node->prefix;
+
+  upper.s6_addr[node->prefixlen / 8] |= 0x80 >> (node->prefixlen % 8);
+  node->child[0] = pd_node_create(node, &node->prefix, node->prefixlen + 1);
+  node->child[1] = pd_node_create(node, &upper, node->prefixlen + 1);
+  node->state = PD_NODE_SPLIT;
+}
+
+/* Find a free block of the requested length under a node that has one
+ * (node->best <= len), splitting larger blocks as needed.   Where both
+ * halves have room, take the one whose largest free block is smaller, so
+ * that large blocks stay whole for clients that need them.
+ */
+static struct pd_node *pd_node_take(struct pd_node *node, int len)
+{
+  struct pd_node *c0, *c1;
+
+  while (node->state != PD_NODE_FREE || node->prefixlen < len)
+    {
+      if (node->state == PD_NODE_FREE)
+	pd_node_split(node);
+      c0 = node->child[0];
+      c1 = node->child[1];
+      if (c0->best > len)
+	node = c1;
+      else if (c1->best > len || c0->best >= c1->best)
+	node = c0;
+      else
+	node = c1;
+    }
+  node->state = PD_NODE_DELEGATED;
+  pd_node_update(node);
+  return node;
+}
+
+/* Find the node for a specific prefix, splitting free blocks on the way
+ * down, if the whole prefix is free.
+ */
+static struct pd_node *pd_node_take_exact(struct pd_node *root,
+					  const struct in6_addr *prefix,
+					  int len)
+{
+  struct pd_node *node;
+
+  /* Make sure it's free before changing anything. */
+  for (node = root; node->prefixlen < len && node->state == PD_NODE_SPLIT;
+       node = node->child[prefix_bit(prefix, node->prefixlen)])
+    ;
+  if (node->state == PD_NODE_DELEGATED ||
+      (node->state == PD_NODE_SPLIT && node->prefixlen == len))
+    return 0;
+
+  while (node->prefixlen < len)
+    {
+      pd_node_split(node);
+      node = node->child[prefix_bit(prefix, node->prefixlen)];
+    }
+  node->state = PD_NODE_DELEGATED;
+  pd_node_update(node);
+  return node;
+}
+
+/* Give a block back, merging it with its buddy for as long as the buddy
+ * is free too.
+ */
+static void pd_node_release(struct pd_node *node)
+{
+  struct pd_node *parent;
+
+  node->state = PD_NODE_FREE;
+  node->lease = 0;
+  while ((parent = node->parent) &&
+	 parent->child[0]->state == PD_NODE_FREE &&
+	 parent->child[1]->state == PD_NODE_FREE)
+    {
+      free(parent->child[0]);
+      free(parent->child[1]);
+      parent->child[0] = parent->child[1] = 0;
+      parent->state = PD_NODE_FREE;
+      node = parent;
+    }
+  pd_node_update(node);
+}
+
+/* Does the aggregate contain the prefix? */
+static int pd_pool_contains(struct pd_pool *pool,
+			    const struct in6_addr *prefix, int len)
+{
+  int i;
+
+  if (len < pool->root->prefixlen)
+    return 0;
+  for (i = 0; i < pool->root->prefixlen; i++)
+    if (prefix_bit(prefix, i) != prefix_bit(&pool->root->prefix, i))
+      return 0;
+  return 1;
+}
+
+static void pd_lease_list_remove(struct pd_lease *lease)
+{
+  struct pd_lease_list *list = lease->list;
+  struct pd_lease_cursor *cursor;
+
+  if (!list)
+    return;
+  for (cursor = lease_cursors; cursor; cursor = cursor->next)
+    if (cursor->lease == lease)
+      cursor->lease = lease->next;
+  if (lease->prev)
+    lease->prev->next = lease->next;
+  else
+    list->head = lease->next;
+  if (lease->next)
+    lease->next->prev = lease->prev;
+  else
+    list->tail = lease->prev;
+  lease->prev = lease->next = 0;
+  lease->list = 0;
+}
+
+static struct pd_lease *pd_lease_create(struct pd_pool *pool,
+					struct pd_node *node,
+					const u_int8_t *key, unsigned len)
+{
+  struct pd_lease *lease;
+
+  lease = (struct pd_lease *)safemalloc(sizeof *lease);
+  memset(lease, 0, sizeof *lease);
+  lease->pool = pool;
+  lease->node = node;
+  node->lease = lease;
+
+  /* The hash table keeps the name pointer, so the lease needs its own
+   * copy of the key.
+   */
+  lease->key = (u_int8_t *)safemalloc(len);
+  memcpy(lease->key, key, len);
+  lease->key_len = len;
+  if (!client_prefixes)
+    pd_lease_new_hash(&client_prefixes, 0);
+  pd_lease_hash_add(client_prefixes, lease->key, len, lease);
+  return lease;
+}
+
+struct pd_lease *pd_lease_find(const u_int8_t *key, unsigned len)
+{
+  struct pd_lease *lease;
+
+  if (!client_prefixes || !len)
+    return 0;
+  if (!pd_lease_hash_lookup(&lease, client_prefixes, key, len))
+    return 0;
+  return lease;
+}
+
+/* Delegate a prefix from one of the subnet's pools.   The client may have
+ * hinted at the length it wants; a hint outside what a pool allows gets
+ * the pool's usual length.   The lease is on no list until the caller
+ * extends it.
+ */
+struct pd_lease *pd_lease_allocate(struct v6_subnet *subnet, int hint_len,
+				   const u_int8_t *key, unsigned len)
+{
+  struct pd_pool *pool;
+  int want;
+
+  for (pool = subnet->pd_pools; pool; pool = pool->next)
+    {
+      want = pool->delegated_len;
+      if (hint_len > want && hint_len <= pool->max_len)
+	want = hint_len;
+      if (pool->root->best <= want)
+	return pd_lease_create(pool, pd_node_take(pool->root, want),
+			       key, len);
+    }
+  return 0;
+}
+
+/* Delegate a specific prefix, e.g., one a client that we've forgotten
+ * about is asking to keep.
+ */
+struct pd_lease *pd_lease_claim(struct v6_subnet *subnet,
+				const struct in6_addr *prefix, int prefixlen,
+				const u_int8_t *key, unsigned len)
+{
+  struct pd_pool *pool;
+  struct pd_node *node;
+
+  for (pool = subnet->pd_pools; pool; pool = pool->next)
+    {
+      if (prefixlen < pool->delegated_len || prefixlen > pool->max_len ||
+	  !pd_pool_contains(pool, prefix, prefixlen))
+	continue;
+      node = pd_node_take_exact(pool->root, prefix, prefixlen);
+      return node ? pd_lease_create(pool, node, key, len) : 0;
+    }
+  return 0;
+}
+
+/* Bring the published copy of a delegation up to date, if the bindings
+ * are being published; see v6_lease_publish().
+ */
+static void pd_lease_publish(struct pd_lease *lease)
+{
+  struct lease_shm_record rec;
+  unsigned len;
+
+  if (!lease_shm)
+    return;
+  if (!lease->list || lease->list != &lease->pool->bound)
+    {
+      lease_shm_remove(lease_shm, LEASE_SHM_PD, lease->node->prefix.s6_addr);
+      return;
+    }
+
+  memset(&rec, 0, sizeof rec);
+  rec.kind = LEASE_SHM_PD;
+  rec.prefixlen = lease->node->prefixlen;
+  rec.expiry = lease->expiry / NANO_SECONDS(1);
+  memcpy(rec.address, &lease->node->prefix, 16);
+  len = lease->key_len > 4 ? lease->key_len - 4 : 0;
+  if (len)
+    rec.iaid = getULong(&lease->key[len]);
+  rec.id_len = len < sizeof rec.id ? len : sizeof rec.id;
+  memcpy(rec.id, lease->key, rec.id_len);
+  rec.has_hw = lease_shm_duid_hw(rec.hw, lease->key, len);
+  lease_shm_put(lease_shm, &rec);
+}
+
+/* Extend an offer, or a binding for the subnet's prefix lifetime, and
+ * move the lease to the end of the corresponding list.
+ */
+void pd_lease_extend(struct pd_lease *lease, int bound)
+{
+  struct pd_pool *pool = lease->pool;
+  struct pd_lease_list *list = bound ? &pool->bound : &pool->offered;
+
+  pd_lease_list_remove(lease);
+  lease->expiry = cur_time + NANO_SECONDS(bound ? pool->subnet->pd_lifetime
+					  : PD_OFFER_HOLD_TIME);
+  lease->list = list;
+  lease->prev = list->tail;
+  if (list->tail)
+    list->tail->next = lease;
+  else
+    list->head = lease;
+  list->tail = lease;
+  pd_lease_publish(lease);
+}
+
+void pd_lease_free(struct pd_lease *lease)
+{
+  pd_lease_list_remove(lease);
+  pd_lease_publish(lease);
+  pd_lease_hash_delete(client_prefixes, lease->key, lease->key_len);
+  pd_node_release(lease->node);
+  if (lease->relay)
+    v6_relay_id_put(lease->relay);
+  free(lease->key);
+  free(lease);
+}
+
+/* Free up to max delegations that have run out by now.   Returns the
+ * number freed.
+ */
+unsigned pd_lease_reap(u_int64_t now, unsigned max)
+{
+  struct v6_subnet *subnet;
+  struct pd_pool *pool;
+  unsigned n = 0;
+
+  for (subnet = v6_subnets; subnet; subnet = subnet->next)
+    for (pool = subnet->pd_pools; pool; pool = pool->next)
+      {
+	while (n < max && pool->offered.head &&
+	       pool->offered.head->expiry <= now)
+	  {
+	    pd_lease_free(pool->offered.head);
+	    n++;
+	  }
+	while (n < max && pool->bound.head && pool->bound.head->expiry <= now)
+	  {
+	    pd_lease_free(pool->bound.head);
+	    n++;
+	  }
+      }
+  return n;
+}
+
+/* Put a lease on a list in expiry order.   Leases that were on the same
+ * list before arrive in order, so this rarely looks past the tail.
+ */
+static void pd_lease_list_insert(struct pd_lease_list *list,
+				 struct pd_lease *lease)
+{
+  struct pd_lease *after;
+
+  for (after = list->tail; after && after->expiry > lease->expiry;
+       after = after->prev)
+    ;
+  lease->list = list;
+  lease->prev = after;
+  lease->next = after ? after->next : list->head;
+  if (lease->next)
+    lease->next->prev = lease;
+  else
+    list->tail = lease;
+  if (after)
+    after->next = lease;
+  else
+    list->head = lease;
+  pd_lease_publish(lease);
+}
+
+/* Take a specific prefix from whichever current pool has it free. */
+static struct pd_node *pd_node_take_any(const struct in6_addr *prefix,
+					int len, struct pd_pool **poolp)
+{
+  struct v6_subnet *subnet;
+  struct pd_pool *pool;
+  struct pd_node *node;
+
+  for (subnet = v6_subnets; subnet; subnet = subnet->next)
+    for (pool = subnet->pd_pools; pool; pool = pool->next)
+      if (pd_pool_contains(pool, prefix, len) &&
+	  (node = pd_node_take_exact(pool->root, prefix, len)))
+	{
+	  *poolp = pool;
+	  return node;
+	}
+  return 0;
+}
+
+/* Move the delegations in subnets that are being replaced by a new
+ * configuration to whichever current pool has their prefixes.   A
+ * delegation that no current pool has room for is dropped.   Returns the
+ * number dropped.
+ */
+unsigned pd_lease_migrate(struct v6_subnet *old)
+{
+  struct pd_pool *pool, *np;
+  struct pd_lease *lease;
+  struct pd_lease_list *list;
+  struct pd_node *node;
+  unsigned dropped = 0;
+  int bound;
+
+  for (; old; old = old->next)
+    for (pool = old->pd_pools; pool; pool = pool->next)
+      for (bound = 0; bound < 2; bound++)
+	{
+	  list = bound ? &pool->bound : &pool->offered;
+	  while ((lease = list->head))
+	    {
+	      node = pd_node_take_any(&lease->node->prefix,
+				      lease->node->prefixlen, &np);
+	      if (!node)
+		{
+		  pd_lease_free(lease);
+		  dropped++;
+		  continue;
+		}
+
+	      /* The old pool's trie is freed as a whole, so the old node
+	       * doesn't need to be given back.
+	       */
+	      pd_lease_list_remove(lease);
+	      lease->node->lease = 0;
+	      lease->node = node;
+	      node->lease = lease;
+	      lease->pool = np;
+	      pd_lease_list_insert(bound ? &np->bound : &np->offered, lease);
+	    }
+	}
+  return dropped;
+}
+
+/* Recreate a delegation another process had, e.g., one that handed its
+ * state over to this one.   Returns 0 if no pool has the prefix free.
+ */
+struct pd_lease *pd_lease_restore(const struct in6_addr *prefix,
+				  int prefixlen,
+				  const u_int8_t *key, unsigned len,
+				  u_int64_t expiry, int bound)
+{
+  struct pd_pool *pool;
+  struct pd_node *node;
+  struct pd_lease *lease;
+
+  node = pd_node_take_any(prefix, prefixlen, &pool);
+  if (!node)
+    return 0;
+  lease = pd_lease_create(pool, node, key, len);
+  lease->expiry = expiry;
+  pd_lease_list_insert(bound ? &pool->bound : &pool->offered, lease);
+  return lease;
+}
+
+/* Record the relay agent a client's messages came through. */
+void pd_lease_set_relay(struct pd_lease *lease,
+			const u_int8_t *id, unsigned len)
+{
+  if (lease->relay && lease->relay->len == len &&
+      !memcmp(lease->relay->id, id, len))
+    return;
+  if (lease->relay)
+    v6_relay_id_put(lease->relay);
+  lease->relay = len ? v6_relay_id_get(id, len) : 0;
+}
+
+void pd_lease_cursor_attach(struct pd_lease_cursor *cursor,
+			    struct pd_lease *lease)
+{
+  cursor->lease = lease;
+  cursor->next = lease_cursors;
+  lease_cursors = cursor;
+}
+
+void pd_lease_cursor_detach(struct pd_lease_cursor *cursor)
+{
+  struct pd_lease_cursor **cp;
+
+  for (cp = &lease_cursors; *cp; cp = &(*cp)->next)
+    if (*cp == cursor)
+      {
+	*cp = cursor->next;
+	break;
+      }
+  cursor->next = 0;
+  cursor->lease = 0;
+}
+
+static void pd_node_free(struct pd_node *node)
+{
+  if (!node)
+    return;
+  pd_node_free(node->child[0]);
+  pd_node_free(node->child[1]);
+  free(node);
+}
+
+/* Free pools that are no longer in use, which must have no delegations
+ * left in them.
+ */
+void pd_pools_free(struct pd_pool *pools)
+{
+  struct pd_pool *pool;
+
+  while ((pool = pools))
+    {
+      pools = pool->next;
+      pd_node_free(pool->root);
+      free(pool);
+    }
+}
+
+/* When the next delegation runs out, or 0 if none will. */
+u_int64_t pd_lease_next_expiry()
+{
+  struct v6_subnet *subnet;
+  struct pd_pool *pool;
+  u_int64_t next = 0;
+
+  for (subnet = v6_subnets; subnet; subnet = subnet->next)
+    for (pool = subnet->pd_pools; pool; pool = pool->next)
+      {
+	if (pool->offered.head &&
+	    (!next || pool->offered.head->expiry < next))
+	  next = pool->offered.head->expiry;
+	if (pool->bound.head && (!next || pool->bound.head->expiry < next))
+	  next = pool->bound.head->expiry;
+      }
+  return next;
+}
+
+/* Local Variables:  */
+/* mode:C++ */
+/* c-file-style:"gnu" */
+/* end: */
@@ -0,0 +1,135 @@
+/* pdpool.h
+ *
+ * Definitions for DHCPv6 prefix delegation pools.
+ */
+
+/* Copyright (c) 2009 Nominum, Inc.   All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Nominum nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NOMINUM AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL NOMINUM OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef DHCPP_PDPOOL_H
+#define DHCPP_PDPOOL_H
+
+/* How long a prefix offered in an Advertise is held for the client, in
+ * seconds.
+ */
+#define PD_OFFER_HOLD_TIME	60
+
+/* A prefix pool is a buddy allocator: a binary trie in which each node
+ * covers the part of the pool's aggregate selected by the path to it, and
+ * is either free, delegated, or split into two halves.   Each node also
+ * records the shortest prefix length (largest block) that is free in its
+ * subtree, so allocation goes straight down to a block of the right size
+ * and release merges buddies on the way back up; both take time
+ * proportional to the prefix length.
+ */
+enum pd_node_state {
+  PD_NODE_FREE,
+  PD_NODE_SPLIT,
+  PD_NODE_DELEGATED
+};
+
+#define PD_NONE_FREE	255		/* Value of best if nothing is. */
+
+struct pd_node {
+  struct pd_node *parent;
+  struct pd_node *child[2];
+  struct in6_addr prefix;
+  u_int8_t prefixlen;
+  u_int8_t state;
+  u_int8_t best;	    /* Shortest free prefix length in subtree. */
+  struct pd_lease *lease;		      /* If delegated. */
+};
+
+/* Leases are kept on two lists per pool, one for offers and one for
+ * bindings, each in the order they were last extended.   Every lease on
+ * a list was extended by the same amount, so each list is also in expiry
+ * order and the reaper only has to look at the heads.
+ */
+struct pd_lease_list {
+  struct pd_lease *head, *tail;
+};
+
+struct pd_lease {
+  struct pd_lease *prev, *next;
+  struct pd_lease_list *list;		   /* List the lease is on. */
+  struct pd_pool *pool;
+  struct pd_node *node;
+  u_int64_t expiry;					     /* ns. */
+  u_int8_t *key;		   /* Client's DUID followed by IAID. */
+  unsigned key_len;
+  struct v6_relay_id *relay;			   /* Or 0 if none. */
+};
+
+/* A place on a delegation list; see struct v6_lease_cursor. */
+struct pd_lease_cursor {
+  struct pd_lease_cursor *next;
+  struct pd_lease *lease;
+};
+
+struct pd_pool {
+  struct pd_pool *next;
+  struct v6_subnet *subnet;
+  struct pd_node *root;			/* Covers the whole aggregate. */
+  int delegated_len;		    /* Length delegated by default. */
+  int max_len;		 /* Longest length a client may ask for. */
+  struct pd_lease_list offered, bound;
+};
+
+isc_result_t pd_pool_create(struct v6_subnet *subnet,
+			    const struct in6_addr *prefix, int prefixlen,
+			    int delegated_len, int max_len);
+
+struct pd_lease *pd_lease_find(const u_int8_t *key, unsigned len);
+struct pd_lease *pd_lease_allocate(struct v6_subnet *subnet, int hint_len,
+				   const u_int8_t *key, unsigned len);
+struct pd_lease *pd_lease_claim(struct v6_subnet *subnet,
+				const struct in6_addr *prefix, int prefixlen,
+				const u_int8_t *key, unsigned len);
+void pd_lease_extend(struct pd_lease *lease, int bound);
+void pd_lease_free(struct pd_lease *lease);
+unsigned pd_lease_reap(u_int64_t now, unsigned max);
+u_int64_t pd_lease_next_expiry(void);
+unsigned pd_lease_migrate(struct v6_subnet *old);
+struct pd_lease *pd_lease_restore(const struct in6_addr *prefix,
+				  int prefixlen,
+				  const u_int8_t *key, unsigned len,
+				  u_int64_t expiry, int bound);
+void pd_lease_set_relay(struct pd_lease *lease,
+			const u_int8_t *id, unsigned len);
+void pd_lease_cursor_attach(struct pd_lease_cursor *cursor,
+			    struct pd_lease *lease);
+void pd_lease_cursor_detach(struct pd_lease_cursor *cursor);
+void pd_pools_free(struct pd_pool *pools);
+
+#endif
+
+/* Local Variables:  */
+/* mode:c++ */
+/* c-file-style:"gnu" */
+/* end: */
@@ -0,0 +1,223 @@
+/* pingcheck.cpp
+ *
+ * Check that nobody is using an address before offering it, without
+ * holding up the dispatcher while we wait to find out.
+ */
+
+/* Copyright (c) 2009 Nominum, Inc.   All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Nominum nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NOMINUM AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL NOMINUM OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef lint
+static char ocopyright[] __attribute__((unused)) =
+  "$Id: pingcheck.cpp,v 1.1 2009/10/19 17:40:12 mellon Exp $ Copyright (c) 2009 Nominum, Inc.  All rights reserved.\n";
+#endif /* not lint */
+
+#include "dhcpd.h"
+#include "netinet/ip.h"
+#include "netinet/ip_icmp.h"
+#include "server/pingcheck.h"
+
+typedef struct hash_table ping_probe_hash_t;
+HASH_FUNCTIONS_DECL(ping_probe, const u_int8_t *,
+		    struct ping_probe, ping_probe_hash_t)
+HASH_FUNCTIONS(ping_probe, const u_int8_t *, struct ping_probe,
+	       ping_probe_hash_t)
+
+PingCheck *ping_check;
+u_int32_t ping_timeout;
+
+PingCheck::PingCheck(u_int32_t ms)
+{
+  set_timeout(ms);
+  id = (getpid() ^ random()) & 0xffff;
+  seq = 0;
+  head = tail = 0;
+  scheduled = 0;
+  ping_probe_new_hash(&by_key, 0);
+  ping_probe_new_hash(&by_address, 0);
+  icmp_startup(1, reply);
+}
+
+PingCheck::~PingCheck()
+{
+  while (head)
+    finish(head, 0);
+  free_hash_table(&by_key);
+  free_hash_table(&by_address);
+}
+
+void PingCheck::set_timeout(u_int32_t ms)
+{
+  timeout = NANO_SECONDS(ms) / 1000;
+}
+
+/* Make sure there's a timeout for the first probe on the list. */
+void PingCheck::schedule()
+{
+  if (head && !scheduled)
+    {
+      addTimeout(head->deadline, 0);
+      scheduled = 1;
+    }
+}
+
+/* Find out whether anybody answers at addr, and call callback with the
+ * answer.   If there's already a probe out to addr, wait for it rather
+ * than sending another.   Returns 0 if no probe could be sent, in which
+ * case the callback won't be called.
+ */
+int PingCheck::probe(struct in_addr addr, ping_callback callback, void *arg)
+{
+  struct ping_probe *probe, *p;
+  struct ping_waiter *waiter;
+  struct iaddr ia;
+  u_int8_t key[4];
+
+  if (!ping_probe_hash_lookup(&probe, by_address,
+			      (u_int8_t *)&addr, sizeof addr))
+    {
+      /* A sequence number still in use is from a probe 65536 probes ago
+       * that hasn't timed out; skip it.
+       */
+      putUShort(key, id);
+      do
+	putUShort(&key[2], ++seq);
+      while (ping_probe_hash_lookup(&p, by_key, key, sizeof key));
+
+      memcpy(ia.iabuf, &addr, sizeof addr);
+      ia.len = sizeof addr;
+      if (icmp_state->socket < 0 || !icmp_echorequest(&ia, id, seq))
+	return 0;
+
+      probe = (struct ping_probe *)safemalloc(sizeof *probe);
+      memset(probe, 0, sizeof *probe);
+      probe->address = addr;
+      memcpy(probe->key, key, sizeof key);
+      probe->deadline = cur_time + timeout;
+
+      /* Only a shorter timeout puts a probe anywhere but at the end. */
+      for (p = tail; p && p->deadline > probe->deadline; p = p->prev)
+	;
+      probe->prev = p;
+      probe->next = p ? p->next : head;
+      if (probe->next)
+	probe->next->prev = probe;
+      else
+	tail = probe;
+      if (p)
+	p->next = probe;
+      else
+	head = probe;
+      if (head == probe && scheduled)
+	{
+	  clearTimeouts();
+	  scheduled = 0;
+	}
+      ping_probe_hash_add(by_key, probe->key, sizeof probe->key, probe);
+      ping_probe_hash_add(by_address, (u_int8_t *)&probe->address,
+			  sizeof probe->address, probe);
+      schedule();
+    }
+
+  waiter = (struct ping_waiter *)safemalloc(sizeof *waiter);
+  waiter->callback = callback;
+  waiter->arg = arg;
+  waiter->next = probe->waiters;
+  probe->waiters = waiter;
+  return 1;
+}
+
+int PingCheck::pending(struct in_addr addr)
+{
+  struct ping_probe *probe;
+
+  return ping_probe_hash_lookup(&probe, by_address,
+				(u_int8_t *)&addr, sizeof addr);
+}
+
+/* Forget the probe, then tell everyone who was waiting for it.   They may
+ * send new probes, possibly to the same address.
+ */
+void PingCheck::finish(struct ping_probe *probe, int answered)
+{
+  struct ping_waiter *waiter, *next;
+
+  if (probe->prev)
+    probe->prev->next = probe->next;
+  else
+    head = probe->next;
+  if (probe->next)
+    probe->next->prev = probe->prev;
+  else
+    tail = probe->prev;
+  ping_probe_hash_delete(by_key, probe->key, sizeof probe->key);
+  ping_probe_hash_delete(by_address, (u_int8_t *)&probe->address,
+			 sizeof probe->address);
+
+  for (waiter = probe->waiters; waiter; waiter = next)
+    {
+      next = waiter->next;
+      (*waiter->callback)(waiter->arg, probe->address, answered);
+      free(waiter);
+    }
+  free(probe);
+}
+
+/* Every probe that has been out for the whole timeout went unanswered. */
+void PingCheck::event(const char *evname, int selector, int status)
+{
+  scheduled = 0;
+  while (head && head->deadline <= cur_time)
+    finish(head, 0);
+  schedule();
+}
+
+/* Called from icmp_echoreply() with each echo reply that arrives on the
+ * ICMP socket, which gets everybody's, not just ours.
+ */
+void PingCheck::reply(struct iaddr from, u_int8_t *icmp, int len)
+{
+  struct icmp *ic = (struct icmp *)icmp;
+  struct ping_probe *probe;
+  u_int8_t key[4];
+
+  if (!ping_check || len < 8 || from.len != 4)
+    return;
+  memcpy(key, &ic->icmp_id, 2);
+  memcpy(&key[2], &ic->icmp_seq, 2);
+  if (!ping_probe_hash_lookup(&probe, ping_check->by_key, key, sizeof key) ||
+      memcmp(&probe->address, from.iabuf, 4))
+    return;
+  ping_check->finish(probe, 1);
+}
+
+/* Local Variables:  */
+/* mode:C++ */
+/* c-file-style:"gnu" */
+/* end: */
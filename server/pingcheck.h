@@ -0,0 +1,102 @@
+/* pingcheck.h
+ *
+ * Definitions for checking that an address is unused before offering it.
+ */
+
+/* Copyright (c) 2009 Nominum, Inc.   All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Nominum nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NOMINUM AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL NOMINUM OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef DHCPP_PINGCHECK_H
+#define DHCPP_PINGCHECK_H
+
+#include "dhc++/timeout.h"
+
+/* How long to wait for an echo reply before deciding that nobody is using
+ * an address, in milliseconds, unless ping-timeout says otherwise.
+ */
+#define PING_TIMEOUT		1000
+
+/* Called when a probe is answered or times out. */
+typedef void (*ping_callback)(void *arg, struct in_addr addr, int answered);
+
+struct ping_waiter {
+  struct ping_waiter *next;
+  ping_callback callback;
+  void *arg;
+};
+
+/* An echo request that hasn't been answered yet.   Every probe waits the
+ * same time, unless the timeout is changed by a reload, so the list of
+ * them in the order they were sent is also in timeout order, and only
+ * the first one needs a timeout on the timer list.   Anyone else who wants to know about the same address while the
+ * probe is outstanding waits for its answer instead of sending another.
+ */
+struct ping_probe {
+  struct ping_probe *prev, *next;
+  struct in_addr address;
+  u_int8_t key[4];	      /* Identifier and sequence number, as sent. */
+  u_int64_t deadline;					     /* ns. */
+  struct ping_waiter *waiters;
+};
+
+/* All the probes go out over the one ICMP socket, and replies are matched
+ * to them by identifier and sequence number.
+ */
+class PingCheck: public Timeout
+{
+public:
+  PingCheck(u_int32_t timeout);
+  ~PingCheck();
+  void event(const char *evname, int selector, int status);
+
+  int probe(struct in_addr addr, ping_callback callback, void *arg);
+  int pending(struct in_addr addr);
+  void set_timeout(u_int32_t ms);
+
+private:
+  static void reply(struct iaddr from, u_int8_t *icmp, int len);
+  void finish(struct ping_probe *probe, int answered);
+  void schedule(void);
+
+  u_int64_t timeout;					     /* ns. */
+  u_int16_t id, seq;
+  struct ping_probe *head, *tail;
+  int scheduled;
+  struct hash_table *by_key, *by_address;
+};
+
+extern PingCheck *ping_check;
+extern u_int32_t ping_timeout;			     /* 0 if disabled. */
+
+#endif
+
+/* Local Variables:  */
+/* mode:c++ */
+/* c-file-style:"gnu" */
+/* end: */
@@ -0,0 +1,94 @@
+/* reaper.cpp
+ *
+ * Return expired DHCPv4 leases to their pools.
+ */
+
+/* Copyright (c) 2009 Nominum, Inc.   All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Nominum nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NOMINUM AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL NOMINUM OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#ifndef lint
+static char ocopyright[] __attribute__((unused)) =
+  "$Id: reaper.cpp,v 1.1 2009/10/16 19:22:41 mellon Exp $ Copyright (c) 2009 Nominum, Inc.  All rights reserved.\n";
+#endif /* not lint */
+
+#include "dhcpd.h"
+#include "server/v4pool.h"
+#include "server/v6pool.h"
+#include "server/pdpool.h"
+#include "server/reaper.h"
+
+LeaseReaper::LeaseReaper()
+{
+  schedule();
+}
+
+LeaseReaper::~LeaseReaper()
+{
+}
+
+/* Wake up when the next lease runs out, but no later than the next
+ * interval, since leases can be added that run out before the one we
+ * were waiting for.   If a lease is already due, the timeout is for now,
+ * which the dispatcher won't run until it has been around its loop again.
+ */
+void LeaseReaper::schedule()
+{
+  u_int64_t when = cur_time + NANO_SECONDS(REAPER_INTERVAL);
+  u_int64_t next = v4_lease_next_expiry();
+  u_int64_t v6 = v6_lease_next_expiry();
+  u_int64_t pd = pd_lease_next_expiry();
+
+  if (v6 && (!next || v6 < next))
+    next = v6;
+  if (pd && (!next || pd < next))
+    next = pd;
+  if (next && next < when)
+    when = next < cur_time ? cur_time : next;
+  addTimeout(when, 0);
+}
+
+void LeaseReaper::event(const char *evname, int selector, int status)
+{
+  unsigned n;
+
+  n = v4_lease_reap(cur_time, V4_REAP_BATCH);
+  if (n < V4_REAP_BATCH)
+    n += v6_lease_reap(cur_time, V4_REAP_BATCH - n);
+  if (n < V4_REAP_BATCH)
+    n += pd_lease_reap(cur_time, V4_REAP_BATCH - n);
+  if (n)
+    log_debug("reaped %u expired lease%s", n, n == 1 ? "" : "s");
+  schedule();
+}
+
+/* Local Variables:  */
+/* mode:C++ */
+/* c-file-style:"gnu" */
+/* end: */
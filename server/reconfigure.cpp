@@ -0,0 +1,792 @@
+/* reconfigure.cpp
+ *
+ * Paced sending of DHCPv6 Reconfigure messages.
+ */
+
+/* Copyright (c) 2009 Nominum, Inc.   All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Nominum nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NOMINUM AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL NOMINUM OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef lint
+static char ocopyright[] __attribute__((unused)) =
+  "$Id: reconfigure.cpp,v 1.1 2009/10/30 17:42:10 mellon Exp $ Copyright (c) 2009 Nominum, Inc.  All rights reserved.\n";
+#endif /* not lint */
+
+#include "dhcpd.h"
+#include <signal.h>
+#include "server/v6pool.h"
+#include "server/classify.h"
+#include "server/config.h"
+#include "server/reconfigure.h"
+
+typedef struct hash_table reconfigure_client_hash_t;
+HASH_FUNCTIONS_DECL(reconfigure_client, const u_int8_t *,
+		    struct reconfigure_client, reconfigure_client_hash_t)
+HASH_FUNCTIONS(reconfigure_client, const u_int8_t *,
+	       struct reconfigure_client, reconfigure_client_hash_t)
+
+Reconfigurer *reconfigurer;
+
+/* Clients, by DUID. */
+static reconfigure_client_hash_t *client_duids;
+
+/* The signal handler's end of the pipe, and the dispatcher's. */
+static int user1_pipe[2] = { -1, -1 };
+
+/* Authentication option protocol, algorithm and replay detection method
+ * for the reconfigure key authentication protocol (RFC 3315 21.5), and
+ * the types of its authentication information.
+ */
+#define RKAP_PROTOCOL		3
+#define RKAP_ALGORITHM_HMAC_MD5	1
+#define RKAP_RDM_COUNTER	0
+#define RKAP_KEY		1
+#define RKAP_HMAC		2
+
+/* Length of the option: protocol, algorithm, RDM, replay detection,
+ * type and key or HMAC.
+ */
+#define RKAP_OPTION_LEN		(3 + 8 + 1 + 16)
+
+/* MD5 (RFC 1321), which is only needed for HMAC-MD5 here. */
+struct md5_context {
+  u_int32_t state[4];
+  u_int64_t count;				/* Bytes hashed. */
+  u_int8_t block[64];
+};
+
+static const u_int32_t md5_sines[64] = {
+  0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
+  0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+  0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+  0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+  0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
+  0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+  0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
+  0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+  0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+  0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+  0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
+  0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+  0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
+  0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+  0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+  0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+static const u_int8_t md5_shifts[16] = {
+  7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21
+};
+
+static void md5_transform(u_int32_t *state, const u_int8_t *block)
+{
+  u_int32_t x[16], a, b, c, d, f, t;
+  unsigned i, g;
+
+  for (i = 0; i < 16; i++)
+    x[i] = (block[i * 4] | (block[i * 4 + 1] << 8) |
+	    (block[i * 4 + 2] << 16) | ((u_int32_t)block[i * 4 + 3] << 24));
+  a = state[0];
+  b = state[1];
+  c = state[2];
+  d = state[3];
+  for (i = 0; i < 64; i++)
+    {
+      switch (i / 16)
+	{
+	case 0:
+	  f = (b & c) | (~b & d);
+	  g = i;
+	  break;
+	case 1:
+	  f = (d & b) | (~d & c);
+	  g = (5 * i + 1) % 16;
+	  break;
+	case 2:
+	  f = b ^ c ^ d;
+	  g = (3 * i + 5) % 16;
+	  break;
+	default:
+	  f = c ^ (b | ~d);
+	  g = (7 * i) % 16;
+	  break;
+	}
+      t = a + f + md5_sines[i] + x[g];
+      a = d;
+      d = c;
+      c = b;
+      t = (t << md5_shifts[(i / 16) * 4 + i % 4]) |
+	(t >> (32 - md5_shifts[(i / 16) * 4 + i % 4]));
+      b += t;
+    }
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+}
+
+static void md5_init(struct md5_context *ctx)
+{
+  ctx->state[0] = 0x67452301;
+  ctx->state[1] = 0xefcdab89;
+  ctx->state[2] = 0x98badcfe;
+  ctx->state[3] = 0x10325476;
+  ctx->count = 0;
+}
+
+static void md5_update(struct md5_context *ctx, const u_int8_t *data,
+		       unsigned len)
+{
+  unsigned used = ctx->count % 64, n;
+
+  ctx->count += len;
+  while (len)
+    {
+      n = 64 - used < len ? 64 - used : len;
+      memcpy(&ctx->block[used], data, n);
+      used += n;
+      data += n;
+      len -= n;
+      if (used == 64)
+	{
+	  md5_transform(ctx->state, ctx->block);
+	  used = 0;
+	}
+    }
+}
+
+static void md5_final(struct md5_context *ctx, u_int8_t *digest)
+{
+  static const u_int8_t pad[64] = { 0x80 };
+  u_int8_t bits[8];
+  u_int64_t count = ctx->count * 8;
+  unsigned i;
+
+  for (i = 0; i < 8; i++)
+    bits[i] = count >> (i * 8);
+  md5_update(ctx, pad, 1 + (119 - ctx->count % 64) % 64);
+  md5_update(ctx, bits, 8);
+  for (i = 0; i < 16; i++)
+    digest[i] = ctx->state[i / 4] >> ((i % 4) * 8);
+}
+
+/* HMAC (RFC 2104) with MD5 and a 16-byte key. */
+static void hmac_md5(const u_int8_t *key, const u_int8_t *data, unsigned len,
+		     u_int8_t *digest)
+{
+  struct md5_context ctx;
+  u_int8_t pad[64];
+  unsigned i;
+
+  memset(pad, 0x36, sizeof pad);
+  for (i = 0; i < 16; i++)
+    pad[i] ^= key[i];
+  md5_init(&ctx);
+  md5_update(&ctx, pad, sizeof pad);
+  md5_update(&ctx, data, len);
+  md5_final(&ctx, digest);
+
+  memset(pad, 0x5c, sizeof pad);
+  for (i = 0; i < 16; i++)
+    pad[i] ^= key[i];
+  md5_init(&ctx);
+  md5_update(&ctx, pad, sizeof pad);
+  md5_update(&ctx, digest, 16);
+  md5_final(&ctx, digest);
+}
+
+/* Reconfigure keys have to be unguessable, so they come from the
+ * kernel's random number generator if there is one.
+ */
+static void make_key(u_int8_t *key)
+{
+  static int fd = -2;
+  unsigned i;
+
+  if (fd == -2)
+    fd = open("/dev/urandom", O_RDONLY);
+  if (fd >= 0 && read(fd, key, 16) == 16)
+    return;
+  for (i = 0; i < 16; i++)
+    key[i] = random();
+}
+
+/* Whether the first len bits of two addresses are the same. */
+static int prefix_match(const struct in6_addr *a, const struct in6_addr *b,
+			int len)
+{
+  int bytes = len / 8, bits = len % 8;
+
+  if (memcmp(a->s6_addr, b->s6_addr, bytes))
+    return 0;
+  return !bits || !((a->s6_addr[bytes] ^ b->s6_addr[bytes]) &
+		    (0xff00 >> bits));
+}
+
+static u_int8_t *put_option(u_int8_t *p, unsigned code,
+			   const u_int8_t *data, unsigned len)
+{
+  putUShort(p, code);
+  putUShort(&p[2], len);
+  memcpy(&p[4], data, len);
+  return &p[4 + len];
+}
+
+/* Put an Authentication option for the key protocol at p, with the
+ * replay detection value moved on from the last one the client was sent.
+ * Returns where the key or HMAC goes.
+ */
+static u_int8_t *put_auth_option(u_int8_t *p, struct reconfigure_client *rc,
+				 int type)
+{
+  rc->replay = rc->replay < cur_time ? cur_time : rc->replay + 1;
+  putUShort(p, DHCPV6_AUTHENTICATION);
+  putUShort(&p[2], RKAP_OPTION_LEN);
+  p[4] = RKAP_PROTOCOL;
+  p[5] = RKAP_ALGORITHM_HMAC_MD5;
+  p[6] = RKAP_RDM_COUNTER;
+  putULong(&p[7], rc->replay >> 32);
+  putULong(&p[11], rc->replay);
+  p[15] = type;
+  memset(&p[16], 0, 16);
+  return &p[16];
+}
+
+void reconfigure_campaign_free(struct reconfigure_campaign *campaign)
+{
+  struct reconfigure_target *target;
+
+  while ((target = campaign->targets))
+    {
+      campaign->targets = target->next;
+      free(target->class_name);
+      free(target);
+    }
+  free(campaign);
+}
+
+Reconfigurer::Reconfigurer(const char *file, duid_t *duid)
+{
+  struct sigaction sa;
+  int i;
+
+  path = file;
+  server_duid = duid;
+  clients = 0;
+  campaign = 0;
+  memset(head, 0, sizeof head);
+  memset(tail, 0, sizeof tail);
+  reconfigure_client_new_hash(&client_duids, 0);
+
+  if (pipe(user1_pipe) < 0)
+    log_fatal("Can't make a pipe for SIGUSR1: %m");
+  for (i = 0; i < 2; i++)
+    if (fcntl(user1_pipe[i], F_SETFL, O_NONBLOCK) < 0 ||
+	fcntl(user1_pipe[i], F_SETFD, 1) < 0)
+      log_fatal("Can't set up the SIGUSR1 pipe: %m");
+  register_io_object(this, readfd, 0, readable, 0, 0);
+
+  memset(&sa, 0, sizeof sa);
+  sa.sa_handler = user1;
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = SA_RESTART;
+  if (sigaction(SIGUSR1, &sa, 0) < 0)
+    log_fatal("Can't catch SIGUSR1: %m");
+  schedule();
+}
+
+void Reconfigurer::user1(int sig)
+{
+  int saved = errno;
+
+  if (write(user1_pipe[1], "", 1) < 0)
+    {
+      /* The pipe is full, so the file is about to be reread anyway. */
+    }
+  errno = saved;
+}
+
+int Reconfigurer::readfd(void *v)
+{
+  return user1_pipe[0];
+}
+
+isc_result_t Reconfigurer::readable(void *v)
+{
+  Reconfigurer *r = (Reconfigurer *)v;
+  char buf[64];
+
+  while (read(user1_pipe[0], buf, sizeof buf) > 0)
+    ;
+  r->start();
+  return ISC_R_SUCCESS;
+}
+
+/* Remember how to reach a client we're about to send a Reply to, if it
+ * said it would accept Reconfigures and the Reply binds something to it.
+ * Returns the client, or 0 if it isn't one we'll reconfigure.
+ */
+struct reconfigure_client *
+Reconfigurer::reply(struct dhcpv6_response *msg, struct interface_info *ip,
+		    struct sockaddr_in6 *dest, const struct data_string *duid,
+		    struct v6_subnet *subnet, u_int64_t classes)
+{
+  struct reconfigure_client *rc;
+  struct dhcpv6_response *relay;
+  struct option_cache *oc;
+  struct ia_addr *addr;
+  struct ia *ia;
+  u_int64_t valid = 0;
+  unsigned n = 0, len;
+  u_int8_t *p;
+
+  if (!duid->len ||
+      (msg->message_type != DHCPV6_REQUEST &&
+       msg->message_type != DHCPV6_RENEW &&
+       msg->message_type != DHCPV6_REBIND) ||
+      !lookup_option(&dhcpv6_option_space, msg->options,
+		     DHCPV6_RECONFIGURE_ACCEPTED))
+    return 0;
+  for (ia = msg->ias; ia; ia = ia->next)
+    for (addr = ia->addresses; addr; addr = addr->next)
+      if (addr->valid > valid)
+	valid = addr->valid;
+  if (valid <= cur_time)
+    return 0;
+
+  if (!reconfigure_client_hash_lookup(&rc, client_duids,
+				      duid->data, duid->len))
+    {
+      rc = (struct reconfigure_client *)safemalloc(sizeof *rc);
+      rc->duid = (u_int8_t *)safemalloc(duid->len);
+      memcpy(rc->duid, duid->data, duid->len);
+      rc->duid_len = duid->len;
+      make_key(rc->key);
+      reconfigure_client_hash_add(client_duids, rc->duid, rc->duid_len, rc);
+      rc->next = clients;
+      if (clients)
+	clients->prev = rc;
+      clients = rc;
+    }
+  rc->expiry = cur_time + NANO_SECONDS(valid - cur_time);
+  rc->classes = classes;
+  rc->generation = config_generation;
+
+  for (ia = msg->ias; ia; ia = ia->next)
+    for (addr = ia->addresses;
+	 addr && n < RECONFIGURE_MAX_BINDINGS; addr = addr->next)
+      {
+	memcpy(&rc->bindings[n], addr->address.iabuf, 16);
+	rc->binding_len[n++] = ia->type == DHCPV6_IA_PD ? addr->prefixlen : 128;
+      }
+  rc->nbindings = n;
+
+  /* The link is the one the relay agent nearest the client says it's on,
+   * as when the subnet was picked.
+   */
+  memset(&rc->link, 0, sizeof rc->link);
+  for (relay = msg->outer; relay; relay = relay->outer)
+    if (!IN6_IS_ADDR_UNSPECIFIED(&relay->link_address))
+      {
+	rc->link = relay->link_address;
+	break;
+      }
+  if (!relay && subnet)
+    rc->link = subnet->prefix;
+
+  rc->interface = ip;
+  rc->dest = *dest;
+  len = 0;
+  for (relay = msg->outer; relay; relay = relay->outer)
+    {
+      oc = lookup_option(&dhcpv6_option_space, relay->options,
+			 DHCPV6_INTERFACE_IDENTIFIER);
+      len += 36 + (oc ? oc->data.len : 0);
+    }
+  if (len != rc->relays_len)
+    {
+      free(rc->relays);
+      rc->relays = len ? (u_int8_t *)safemalloc(len) : 0;
+      rc->relays_len = len;
+    }
+  p = rc->relays;
+  for (relay = msg->outer; relay; relay = relay->outer)
+    {
+      oc = lookup_option(&dhcpv6_option_space, relay->options,
+			 DHCPV6_INTERFACE_IDENTIFIER);
+      p[0] = DHCPV6_RELAY_REPLY;
+      p[1] = relay->hop_count;
+      memcpy(&p[2], &relay->link_address, 16);
+      memcpy(&p[18], &relay->peer_address, 16);
+      putUShort(&p[34], oc ? oc->data.len : 0);
+      if (oc)
+	memcpy(&p[36], oc->data.data, oc->data.len);
+      p += 36 + (oc ? oc->data.len : 0);
+    }
+  return rc;
+}
+
+/* Tell a client in a Reply that we'll send it Reconfigures, and give it
+ * the key they'll be authenticated with.
+ */
+void Reconfigurer::add_options(struct data_string *packet,
+			       struct reconfigure_client *rc)
+{
+  u_int8_t *p;
+
+  data_string_need(packet, 8 + RKAP_OPTION_LEN);
+  p = &packet->buffer->data[packet->len];
+  p = put_option(p, DHCPV6_RECONFIGURE_ACCEPTED, 0, 0);
+  memcpy(put_auth_option(p, rc, RKAP_KEY), rc->key, 16);
+  packet->len += 8 + RKAP_OPTION_LEN;
+}
+
+/* A client that's in the campaign has answered when we hear from it,
+ * whether or not it's because of a Reconfigure.
+ */
+void Reconfigurer::heard(const struct data_string *duid)
+{
+  struct reconfigure_client *rc;
+
+  if (!campaign || !duid->len ||
+      !reconfigure_client_hash_lookup(&rc, client_duids,
+				      duid->data, duid->len))
+    return;
+  if (rc->state == RECONFIGURE_PENDING || rc->state == RECONFIGURE_SENT)
+    {
+      rc->state = RECONFIGURE_ANSWERED;
+      if (++answered + gave_up == picked_count)
+	{
+	  finish();
+	  schedule();
+	}
+    }
+}
+
+int Reconfigurer::picked(struct reconfigure_campaign *c,
+			 struct reconfigure_client *rc)
+{
+  struct reconfigure_target *target;
+  unsigned i;
+
+  if (!c->targets)
+    return 1;
+  for (target = c->targets; target; target = target->next)
+    switch (target->type)
+      {
+      case RECONFIGURE_TARGET_LINK:
+	if (prefix_match(&rc->link, &target->prefix, target->prefixlen))
+	  return 1;
+	break;
+      case RECONFIGURE_TARGET_PREFIX:
+	for (i = 0; i < rc->nbindings; i++)
+	  if (rc->binding_len[i] >= target->prefixlen &&
+	      prefix_match(&rc->bindings[i], &target->prefix,
+			   target->prefixlen))
+	    return 1;
+	break;
+      case RECONFIGURE_TARGET_CLASS:
+	if (target->class_index >= 0 &&
+	    rc->generation == config_generation &&
+	    (rc->classes & (1ULL << target->class_index)))
+	  return 1;
+	break;
+      }
+  return 0;
+}
+
+/* Read the campaign file and queue the clients it picks. */
+void Reconfigurer::start()
+{
+  struct reconfigure_campaign *c;
+  struct reconfigure_target *target;
+  struct reconfigure_client *rc;
+  struct client_class *cc;
+
+  log_info("Reading Reconfigure campaign from %s", path);
+  if (read_reconfigure_campaign(path, &c) != ISC_R_SUCCESS)
+    {
+      log_error("Not starting a Reconfigure campaign.");
+      return;
+    }
+  for (target = c->targets; target; target = target->next)
+    if (target->type == RECONFIGURE_TARGET_CLASS)
+      {
+	cc = client_class_find(target->class_name);
+	target->class_index = cc ? (int)cc->index : -1;
+	if (!cc)
+	  log_error("%s: no class %s", path, target->class_name);
+      }
+
+  if (campaign)
+    finish();
+  sweep();
+  campaign = c;
+  picked_count = answered = gave_up = 0;
+  for (rc = clients; rc; rc = rc->next)
+    {
+      rc->state = RECONFIGURE_IDLE;
+      if (!picked(c, rc))
+	continue;
+      rc->state = RECONFIGURE_PENDING;
+      rc->tries = 0;
+      enqueue(rc, 0);
+      picked_count++;
+    }
+
+  interval = NANO_SECONDS(1) / c->rate;
+  tokens = interval * c->burst;
+  refilled = cur_time;
+  log_info("Reconfigure campaign: %u client%s, %u a second.",
+	   picked_count, picked_count == 1 ? "" : "s", c->rate);
+  if (!picked_count)
+    finish();
+  schedule();
+}
+
+/* Say how the campaign went and forget it. */
+void Reconfigurer::finish()
+{
+  unsigned i;
+
+  for (i = 0; i <= REC_MAX_RC; i++)
+    while (head[i])
+      dequeue(i);
+  log_info("Reconfigure campaign done: %u client%s, %u answered, "
+	   "%u gave up, %u left.", picked_count,
+	   picked_count == 1 ? "" : "s", answered, gave_up,
+	   picked_count - answered - gave_up);
+  reconfigure_campaign_free(campaign);
+  campaign = 0;
+}
+
+void Reconfigurer::enqueue(struct reconfigure_client *rc, unsigned queue)
+{
+  rc->queue_next = 0;
+  rc->queued = 1;
+  if (tail[queue])
+    tail[queue]->queue_next = rc;
+  else
+    head[queue] = rc;
+  tail[queue] = rc;
+}
+
+void Reconfigurer::dequeue(unsigned queue)
+{
+  struct reconfigure_client *rc = head[queue];
+
+  head[queue] = rc->queue_next;
+  if (!head[queue])
+    tail[queue] = 0;
+  rc->queue_next = 0;
+  rc->queued = 0;
+}
+
+/* Take the client that's next in line for a Reconfigure off its queue:
+ * the retransmission that has been due longest, or if none is due, a
+ * client that hasn't been sent one yet.   Clients that have answered
+ * are left on their queues until they get to the head, and clients that
+ * have had their last try are given up on then.
+ */
+struct reconfigure_client *Reconfigurer::next_due()
+{
+  struct reconfigure_client *rc, *best;
+  unsigned i, queue;
+
+  for (;;)
+    {
+      best = 0;
+      queue = 0;
+      for (i = 1; i <= campaign->retries; i++)
+	{
+	  while ((rc = head[i]) && rc->state != RECONFIGURE_SENT)
+	    dequeue(i);
+	  if (rc && rc->due <= cur_time && (!best || rc->due < best->due))
+	    {
+	      best = rc;
+	      queue = i;
+	    }
+	}
+      if (!best)
+	{
+	  while ((rc = head[0]) && rc->state != RECONFIGURE_PENDING)
+	    dequeue(0);
+	  if (!(best = head[0]))
+	    return 0;
+	}
+      dequeue(queue);
+      if (best->tries < campaign->retries)
+	return best;
+      best->state = RECONFIGURE_GAVE_UP;
+      gave_up++;
+    }
+}
+
+/* Send a client a Reconfigure, wrapped for each relay agent its last
+ * request came through, and queue it to be sent another if it doesn't
+ * answer.   The message is put at the end of the buffer, and each
+ * Relay-Reply goes in front of what's there, innermost first.
+ */
+void Reconfigurer::send(struct reconfigure_client *rc)
+{
+  u_int8_t *buf, *msg, *start, *p, *end, *hmac, type;
+  unsigned len, wrap, iflen, hdr;
+  char addrbuf[128];
+
+  end = rc->relays + rc->relays_len;
+  wrap = 0;
+  for (p = rc->relays; p < end; p += 36 + iflen)
+    {
+      iflen = getUShort(&p[34]);
+      wrap += 38 + (iflen ? 4 + iflen : 0);
+    }
+  len = (4 + 4 + server_duid->len + 4 + rc->duid_len + 5 +
+	 4 + RKAP_OPTION_LEN);
+  buf = (u_int8_t *)safemalloc(wrap + len);
+
+  msg = &buf[wrap];
+  putULong(msg, 0);
+  msg[0] = DHCPV6_RECONFIGURE;
+  p = put_option(&msg[4], DHCPV6_SERVER_IDENTIFIER,
+		 (u_int8_t *)&server_duid->data, server_duid->len);
+  p = put_option(p, DHCPV6_DUID, rc->duid, rc->duid_len);
+  type = campaign->message;
+  p = put_option(p, DHCPV6_RECONFIGURE_MESSAGE, &type, 1);
+  hmac = put_auth_option(p, rc, RKAP_HMAC);
+  hmac_md5(rc->key, msg, len, hmac);
+
+  start = msg;
+  for (p = rc->relays; p < end; p += 36 + iflen)
+    {
+      iflen = getUShort(&p[34]);
+      hdr = 38 + (iflen ? 4 + iflen : 0);
+      start -= hdr;
+      memcpy(start, p, 34);
+      if (iflen)
+	put_option(&start[34], DHCPV6_INTERFACE_IDENTIFIER, &p[36], iflen);
+      putUShort(&start[hdr - 4], DHCPV6_RELAY_MESSAGE);
+      putUShort(&start[hdr - 2], len);
+      len += hdr;
+    }
+
+  if (send_packet(rc->interface, start, len,
+		  (struct sockaddr *)&rc->dest) < 0)
+    {
+      inet_ntop(AF_INET6, &rc->dest.sin6_addr, addrbuf, sizeof addrbuf);
+      log_error("Can't send Reconfigure to %s: %m", addrbuf);
+    }
+  free(buf);
+
+  rc->tries++;
+  rc->state = RECONFIGURE_SENT;
+  rc->due = cur_time + NANO_SECONDS((u_int64_t)REC_TIMEOUT << (rc->tries - 1));
+  enqueue(rc, rc->tries);
+}
+
+/* Wake up when there's a token for the next Reconfigure, or when the
+ * next retransmission is due if that's later.
+ */
+void Reconfigurer::schedule()
+{
+  u_int64_t when = 0;
+  unsigned i;
+
+  clearTimeouts();
+  if (!campaign)
+    {
+      addTimeout(cur_time + NANO_SECONDS(RECONFIGURE_SWEEP_INTERVAL), 0);
+      return;
+    }
+  for (i = 1; i <= campaign->retries; i++)
+    if (head[i] && (!when || head[i]->due < when))
+      when = head[i]->due;
+  if (head[0] || when < cur_time)
+    when = cur_time;
+  if (tokens < interval && when < cur_time + interval - tokens)
+    when = cur_time + interval - tokens;
+  addTimeout(when, 0);
+}
+
+/* Send as many Reconfigures as there are tokens for. */
+void Reconfigurer::event(const char *evname, int selector, int status)
+{
+  struct reconfigure_client *rc;
+
+  if (!campaign)
+    {
+      sweep();
+      schedule();
+      return;
+    }
+
+  tokens += cur_time - refilled;
+  refilled = cur_time;
+  if (tokens > interval * campaign->burst)
+    tokens = interval * campaign->burst;
+  while (tokens >= interval && (rc = next_due()))
+    {
+      tokens -= interval;
+      send(rc);
+    }
+
+  if (answered + gave_up == picked_count)
+    finish();
+  schedule();
+}
+
+/* Forget the clients whose bindings have all run out. */
+void Reconfigurer::sweep()
+{
+  struct reconfigure_client *rc, *next;
+
+  for (rc = clients; rc; rc = next)
+    {
+      next = rc->next;
+      if (rc->expiry <= cur_time && !rc->queued)
+	forget(rc);
+    }
+}
+
+void Reconfigurer::forget(struct reconfigure_client *rc)
+{
+  reconfigure_client_hash_delete(client_duids, rc->duid, rc->duid_len);
+  if (rc->prev)
+    rc->prev->next = rc->next;
+  else
+    clients = rc->next;
+  if (rc->next)
+    rc->next->prev = rc->prev;
+  free(rc->duid);
+  free(rc->relays);
+  free(rc);
+}
+
+/* Local Variables:  */
+/* mode:C++ */
+/* c-file-style:"gnu" */
+/* end: */
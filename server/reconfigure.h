@@ -0,0 +1,207 @@
+/* reconfigure.h
+ *
+ * Definitions for sending DHCPv6 Reconfigure messages to many clients.
+ */
+
+/* Copyright (c) 2009 Nominum, Inc.   All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Nominum nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NOMINUM AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL NOMINUM OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef DHCPP_SERVER_RECONFIGURE_H
+#define DHCPP_SERVER_RECONFIGURE_H
+
+#include "dhc++/timeout.h"
+
+/* Retransmission parameters for Reconfigure, from RFC 3315: the first
+ * retransmission is REC_TIMEOUT seconds after the first transmission,
+ * each wait after that is twice the one before, and a client is given up
+ * on after REC_MAX_RC transmissions.
+ */
+#define REC_TIMEOUT		2
+#define REC_MAX_RC		8
+
+/* Defaults for a campaign that doesn't say: Reconfigures per second, and
+ * how many can go out back to back after a lull.
+ */
+#define RECONFIGURE_RATE	100
+#define RECONFIGURE_BURST	10
+
+/* The most addresses and prefixes remembered per client for matching
+ * "prefix" targets.
+ */
+#define RECONFIGURE_MAX_BINDINGS	4
+
+/* Seconds between looks for clients whose bindings have all run out, so
+ * that they can be forgotten, when there's no campaign.
+ */
+#define RECONFIGURE_SWEEP_INTERVAL	3600
+
+/* How far a client has got in the current campaign. */
+enum reconfigure_state {
+  RECONFIGURE_IDLE,		/* Not a target. */
+  RECONFIGURE_PENDING,		/* Waiting for its first Reconfigure. */
+  RECONFIGURE_SENT,		/* Waiting for it to answer. */
+  RECONFIGURE_ANSWERED,
+  RECONFIGURE_GAVE_UP
+};
+
+/* A client that said it would accept Reconfigure messages.   Along with
+ * the key that authenticates them (RFC 3315 section 21.5), it keeps what
+ * campaigns select clients by, and the way back to it: the interface its
+ * last request arrived on, where the reply went, and a Relay-Reply header
+ * for each relay agent it came through, innermost first, each one the
+ * message type, hop count, link-address and peer-address, then a two
+ * byte length and the Interface-Id option's contents.
+ */
+struct reconfigure_client {
+  struct reconfigure_client *prev, *next;		/* All clients. */
+  struct reconfigure_client *queue_next;	     /* In a campaign. */
+  u_int8_t *duid;
+  unsigned duid_len;
+  u_int8_t key[16];
+  u_int64_t replay;	 /* Replay detection value last sent to it. */
+  u_int64_t expiry;	 /* When its last binding runs out, in ns. */
+  u_int64_t classes;
+  unsigned generation;	  /* Of the configuration classes is from. */
+  struct in6_addr link;
+  struct in6_addr bindings[RECONFIGURE_MAX_BINDINGS];
+  u_int8_t binding_len[RECONFIGURE_MAX_BINDINGS];
+  unsigned nbindings;
+  struct interface_info *interface;
+  struct sockaddr_in6 dest;
+  u_int8_t *relays;
+  unsigned relays_len;
+
+  enum reconfigure_state state;
+  int queued;		     /* On one of the campaign's queues. */
+  unsigned tries;			/* Reconfigures sent. */
+  u_int64_t due;	    /* When to send the next one, in ns. */
+};
+
+/* What a campaign picks clients by.   A client is picked if any target
+ * matches it, or if there are no targets.
+ */
+enum reconfigure_target_type {
+  RECONFIGURE_TARGET_LINK,    /* Link address or subnet in a prefix. */
+  RECONFIGURE_TARGET_PREFIX,  /* Has an address or prefix in a prefix. */
+  RECONFIGURE_TARGET_CLASS
+};
+
+struct reconfigure_target {
+  struct reconfigure_target *next;
+  enum reconfigure_target_type type;
+  struct in6_addr prefix;
+  int prefixlen;
+  char *class_name;
+  int class_index;	/* Looked up when the campaign starts. */
+};
+
+/* A campaign, as read from the campaign file; see config.cpp. */
+struct reconfigure_campaign {
+  int message;		/* DHCPV6_RENEW or DHCPV6_INFORMATION_REQUEST. */
+  unsigned rate;			/* Reconfigures per second. */
+  unsigned burst;
+  unsigned retries;	    /* Transmissions per client, at most. */
+  struct reconfigure_target *targets;
+};
+
+/* Sends a campaign of Reconfigures when the server gets a SIGUSR1.
+ *
+ * The campaign file is read when the signal arrives, and every client
+ * that it picks is queued.   Reconfigures go out at the campaign's rate
+ * through a token bucket: a timeout tops the bucket up by one token per
+ * 1/rate seconds, up to burst tokens, and each Reconfigure takes one, so
+ * a campaign over a million clients doesn't have them all renewing at
+ * once.   Retransmissions to clients that haven't answered take tokens
+ * first.   A client that hasn't answered is sent another Reconfigure
+ * after REC_TIMEOUT seconds, then after twice that, and so on; clients
+ * that were sent their nth Reconfigure at the same rate are due again in
+ * the order they were sent it, so there's a queue for each try and the
+ * next one due is at the head of one of them.   A client has answered
+ * when it sends a Renew, Rebind or Information-request.
+ *
+ * Another SIGUSR1 during a campaign replaces it with whatever the file
+ * says then.   Clients are only remembered by this server, so they aren't
+ * passed to a replacement or a standby, and a client is only picked by
+ * class once it's been heard from since the configuration was loaded.
+ */
+class Reconfigurer: public Timeout
+{
+public:
+  Reconfigurer(const char *path, duid_t *duid);
+  void event(const char *evname, int selector, int status);
+  struct reconfigure_client *reply(struct dhcpv6_response *msg,
+				   struct interface_info *ip,
+				   struct sockaddr_in6 *dest,
+				   const struct data_string *duid,
+				   struct v6_subnet *subnet,
+				   u_int64_t classes);
+  void add_options(struct data_string *packet,
+		   struct reconfigure_client *rc);
+  void heard(const struct data_string *duid);
+
+private:
+  static void user1(int sig);
+  static int readfd(void *v);
+  static isc_result_t readable(void *v);
+  void start(void);
+  void finish(void);
+  int picked(struct reconfigure_campaign *c, struct reconfigure_client *rc);
+  void enqueue(struct reconfigure_client *rc, unsigned queue);
+  void dequeue(unsigned queue);
+  struct reconfigure_client *next_due(void);
+  void send(struct reconfigure_client *rc);
+  void schedule(void);
+  void sweep(void);
+  void forget(struct reconfigure_client *rc);
+
+  const char *path;
+  duid_t *server_duid;
+  struct reconfigure_client *clients;
+  struct reconfigure_campaign *campaign;		 /* Or 0. */
+  u_int64_t interval;		     /* Between tokens, in ns. */
+  u_int64_t tokens;    /* In the bucket, as ns worth of intervals. */
+  u_int64_t refilled;		 /* When tokens was last topped up. */
+
+  /* Queue 0 is the clients that haven't been sent anything yet; queue n
+   * is the ones that have been sent n Reconfigures.
+   */
+  struct reconfigure_client *head[REC_MAX_RC + 1], *tail[REC_MAX_RC + 1];
+  unsigned picked_count, answered, gave_up;
+};
+
+extern Reconfigurer *reconfigurer;
+
+void reconfigure_campaign_free(struct reconfigure_campaign *campaign);
+
+#endif
+
+/* Local Variables:  */
+/* mode:c++ */
+/* c-file-style:"gnu" */
+/* end: */
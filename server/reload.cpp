@@ -0,0 +1,175 @@
+/* reload.cpp
+ *
+ * Replace the server configuration without restarting.
+ */
+
+/* Copyright (c) 2009 Nominum, Inc.   All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Nominum nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NOMINUM AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL NOMINUM OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef lint
+static char ocopyright[] __attribute__((unused)) =
+  "$Id: reload.cpp,v 1.1 2009/10/21 20:14:03 mellon Exp $ Copyright (c) 2009 Nominum, Inc.  All rights reserved.\n";
+#endif /* not lint */
+
+#include "dhcpd.h"
+#include <signal.h>
+#include "server/v4pool.h"
+#include "server/v6pool.h"
+#include "server/pdpool.h"
+#include "server/pingcheck.h"
+#include "server/config.h"
+#include "server/reload.h"
+
+/* The signal handler's end of the pipe, and the dispatcher's. */
+static int hangup_pipe[2] = { -1, -1 };
+
+ConfigReloader::ConfigReloader(const char *file)
+{
+  struct sigaction sa;
+  int i;
+
+  path = file;
+  retired = 0;
+
+  if (pipe(hangup_pipe) < 0)
+    log_fatal("Can't make a pipe for SIGHUP: %m");
+  for (i = 0; i < 2; i++)
+    if (fcntl(hangup_pipe[i], F_SETFL, O_NONBLOCK) < 0 ||
+	fcntl(hangup_pipe[i], F_SETFD, 1) < 0)
+      log_fatal("Can't set up the SIGHUP pipe: %m");
+  register_io_object(this, readfd, 0, readable, 0, 0);
+
+  memset(&sa, 0, sizeof sa);
+  sa.sa_handler = hangup;
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = SA_RESTART;
+  if (sigaction(SIGHUP, &sa, 0) < 0)
+    log_fatal("Can't catch SIGHUP: %m");
+}
+
+ConfigReloader::~ConfigReloader()
+{
+}
+
+/* If the pipe is full there's a reload pending already. */
+void ConfigReloader::hangup(int sig)
+{
+  int saved = errno;
+
+  if (write(hangup_pipe[1], "", 1) < 0)
+    {
+      /* Already pending. */
+    }
+  errno = saved;
+}
+
+int ConfigReloader::readfd(void *v)
+{
+  return hangup_pipe[0];
+}
+
+/* Any number of SIGHUPs that arrived before we got here are dealt with by
+ * one reload.
+ */
+isc_result_t ConfigReloader::readable(void *v)
+{
+  ConfigReloader *reloader = (ConfigReloader *)v;
+  char buf[64];
+
+  while (read(hangup_pipe[0], buf, sizeof buf) > 0)
+    ;
+  reloader->reload();
+  return ISC_R_SUCCESS;
+}
+
+/* Read the configuration file into a new configuration.   If that works,
+ * move the leases over to it and retire the old one; otherwise, put the
+ * old one back.
+ */
+void ConfigReloader::reload()
+{
+  struct server_config *old;
+  u_int64_t start = cur_time;
+  unsigned dropped;
+
+  log_info("Reloading configuration from %s", path);
+  old = server_config_detach();
+  if (read_server_config(path) != ISC_R_SUCCESS)
+    {
+      log_error("Keeping the configuration already loaded.");
+      server_config_free(server_config_detach());
+      server_config_attach(old);
+      return;
+    }
+  finish_server_config();
+
+  dropped = v4_lease_migrate(old->v4_subnets);
+  dropped += v6_lease_migrate(old->v6_subnets);
+  dropped += pd_lease_migrate(old->v6_subnets);
+  if (dropped)
+    log_info("Dropped %u lease%s on addresses that are no longer "
+	     "configured.", dropped, dropped == 1 ? "" : "s");
+  config_generation++;
+
+  if (ping_check)
+    ping_check->set_timeout(ping_timeout);
+  else if (ping_timeout && v4_subnets)
+    ping_check = new PingCheck(ping_timeout);
+
+  old->retired = cur_time;
+  old->next = retired;
+  retired = old;
+  addTimeout(cur_time + NANO_SECONDS(CONFIG_GRACE_PERIOD), 0);
+
+  fetch_time();
+  log_info("Configuration reloaded in %llu ms.",
+	   (unsigned long long)(cur_time - start) / 1000000);
+}
+
+/* Free the configurations whose grace period is up.   Each one has its
+ * own timeout, so there's nothing to reschedule.
+ */
+void ConfigReloader::event(const char *evname, int selector, int status)
+{
+  struct server_config **cp, *config;
+
+  for (cp = &retired; *cp; cp = &(*cp)->next)
+    if ((*cp)->retired + NANO_SECONDS(CONFIG_GRACE_PERIOD) <= cur_time)
+      break;
+  while ((config = *cp))
+    {
+      *cp = config->next;
+      server_config_free(config);
+    }
+}
+
+/* Local Variables:  */
+/* mode:C++ */
+/* c-file-style:"gnu" */
+/* end: */
@@ -0,0 +1,70 @@
+/* reload.h
+ *
+ * Definitions for reloading the server configuration on SIGHUP.
+ */
+
+/* Copyright (c) 2009 Nominum, Inc.   All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Nominum nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NOMINUM AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL NOMINUM OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef DHCPP_RELOAD_H
+#define DHCPP_RELOAD_H
+
+#include "dhc++/timeout.h"
+
+/* Rereads the configuration file when the server gets a SIGHUP.   The
+ * signal handler only writes to a pipe; the reload itself happens when
+ * the dispatcher sees the pipe become readable, between packets, so a
+ * packet is never answered with half of one configuration and half of
+ * another.   Packets that arrive while the file is being read wait in
+ * the socket buffers.   The timeout frees retired configurations once
+ * their grace period is up.
+ */
+class ConfigReloader: public Timeout
+{
+public:
+  ConfigReloader(const char *path);
+  ~ConfigReloader();
+  void event(const char *evname, int selector, int status);
+
+private:
+  static void hangup(int sig);
+  static int readfd(void *v);
+  static isc_result_t readable(void *v);
+  void reload(void);
+
+  const char *path;
+  struct server_config *retired;		/* Newest first. */
+};
+
+#endif
+
+/* Local Variables:  */
+/* mode:c++ */
+/* c-file-style:"gnu" */
+/* end: */
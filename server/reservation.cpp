@@ -0,0 +1,361 @@
+/* reservation.cpp
+ *
+ * Static host reservations, kept in a memory-mapped file.
+ */
+
+/* Copyright (c) 2009 Nominum, Inc.   All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Nominum nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NOMINUM AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL NOMINUM OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef lint
+static char ocopyright[] __attribute__((unused)) =
+  "$Id: reservation.cpp,v 1.1 2009/10/09 17:40:12 mellon Exp $ Copyright (c) 2009 Nominum, Inc.  All rights reserved.\n";
+#endif /* not lint */
+
+#include "dhcpd.h"
+#include "server/reservation.h"
+
+#include <errno.h>
+#include <sys/mman.h>
+
+struct reservation_db *reservations;
+
+/* Records accumulated for writing to a reservation file. */
+struct reservation_builder {
+  u_int8_t *records;
+  u_int32_t len, max;
+  u_int32_t *offsets;		 /* Offset of each record within records. */
+  u_int32_t count, max_count;
+};
+
+/* FNV-1a, over the key type and the key. */
+static u_int32_t reservation_hash(int key_type,
+				  const u_int8_t *key, unsigned key_len)
+{
+  u_int32_t hash = 2166136261U;
+  unsigned i;
+
+  hash = (hash ^ (u_int8_t)key_type) * 16777619U;
+  for (i = 0; i < key_len; i++)
+    hash = (hash ^ key[i]) * 16777619U;
+  return hash;
+}
+
+static unsigned record_size(const struct reservation *r)
+{
+  return (sizeof *r + r->key_len + r->address_len + r->options_len + 3) & ~3;
+}
+
+/* Map a compiled reservation file and check that it's sane.   The
+ * records themselves are checked as they're looked up.
+ */
+struct reservation_db *reservation_db_open(const char *path)
+{
+  struct reservation_db *db;
+  const struct reservation_file_header *header;
+  struct stat st;
+  void *map;
+  int fd;
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0)
+    {
+      log_error("Can't open %s: %m", path);
+      return 0;
+    }
+  if (fstat(fd, &st) < 0)
+    {
+      log_error("Can't stat %s: %m", path);
+      close(fd);
+      return 0;
+    }
+  if ((size_t)st.st_size < sizeof *header)
+    {
+      log_error("%s: too short to be a reservation file", path);
+      close(fd);
+      return 0;
+    }
+  map = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    {
+      log_error("Can't map %s: %m", path);
+      return 0;
+    }
+
+  header = (const struct reservation_file_header *)map;
+  if (header->magic != RESERVATION_MAGIC ||
+      header->version != RESERVATION_VERSION ||
+      header->size != (u_int32_t)st.st_size ||
+      !header->table_size ||
+      (header->table_size & (header->table_size - 1)) ||
+      header->count >= header->table_size ||
+      header->table_offset < sizeof *header ||
+      header->table_offset % sizeof (struct reservation_slot) ||
+      header->table_offset > header->size ||
+      ((header->size - header->table_offset) /
+       sizeof (struct reservation_slot)) < header->table_size)
+    {
+      log_error("%s: not a valid reservation file", path);
+      munmap(map, st.st_size);
+      return 0;
+    }
+
+  /* Lookups hit the file at random. */
+  madvise(map, st.st_size, MADV_RANDOM);
+
+  db = (struct reservation_db *)safemalloc(sizeof *db);
+  db->map = map;
+  db->size = st.st_size;
+  db->header = header;
+  db->slots = (const struct reservation_slot *)
+    ((const u_int8_t *)db->map + header->table_offset);
+  log_info("Loaded %u reservations from %s", header->count, path);
+  return db;
+}
+
+void reservation_db_close(struct reservation_db *db)
+{
+  if (!db)
+    return;
+  munmap(db->map, db->size);
+  free(db);
+}
+
+/* Find the reservation for a key, if there is one.   The table is never
+ * more than half full, so the probe always reaches an empty slot.
+ */
+const struct reservation *reservation_find(struct reservation_db *db,
+					   int key_type, const u_int8_t *key,
+					   unsigned key_len)
+{
+  const struct reservation_slot *slot;
+  const struct reservation *r;
+  u_int32_t hash, mask, i;
+
+  if (!db)
+    return 0;
+  hash = reservation_hash(key_type, key, key_len);
+  mask = db->header->table_size - 1;
+  for (i = hash & mask; ; i = (i + 1) & mask)
+    {
+      slot = &db->slots[i];
+      if (!slot->offset)
+	return 0;
+      if (slot->hash != hash)
+	continue;
+      if (slot->offset % 4 || slot->offset > db->size - sizeof *r)
+	break;
+      r = (const struct reservation *)((const u_int8_t *)db->map +
+				       slot->offset);
+      if (slot->offset + record_size(r) > db->size)
+	break;
+      if (r->key_type == key_type && r->key_len == key_len &&
+	  !memcmp(RESERVATION_KEY(r), key, key_len))
+	return r;
+    }
+  log_error("reservation file is corrupt at slot %u", i);
+  return 0;
+}
+
+struct reservation_builder *reservation_builder_create()
+{
+  return (struct reservation_builder *)
+    safemalloc(sizeof (struct reservation_builder));
+}
+
+isc_result_t reservation_builder_add(struct reservation_builder *builder,
+				     int key_type, const u_int8_t *key,
+				     unsigned key_len,
+				     const u_int8_t *address,
+				     unsigned address_len,
+				     const u_int8_t *options,
+				     unsigned options_len)
+{
+  struct reservation r;
+  unsigned size;
+  u_int8_t *p;
+
+  if (!key_len || key_len > 255 ||
+      (address_len != 0 && address_len != 4 && address_len != 16) ||
+      options_len > 65535)
+    return ISC_R_INVALIDARG;
+
+  memset(&r, 0, sizeof r);
+  r.key_type = key_type;
+  r.key_len = key_len;
+  r.address_len = address_len;
+  r.options_len = options_len;
+  size = record_size(&r);
+
+  if (builder->len + size > builder->max)
+    {
+      builder->max = builder->max ? builder->max * 2 : 65536;
+      while (builder->len + size > builder->max)
+	builder->max *= 2;
+      p = (u_int8_t *)safemalloc(builder->max);
+      if (builder->len)
+	memcpy(p, builder->records, builder->len);
+      free(builder->records);
+      builder->records = p;
+    }
+  if (builder->count == builder->max_count)
+    {
+      u_int32_t *offsets;
+
+      builder->max_count = builder->max_count ? builder->max_count * 2 : 1024;
+      offsets = (u_int32_t *)safemalloc(builder->max_count *
+					sizeof *offsets);
+      if (builder->count)
+	memcpy(offsets, builder->offsets, builder->count * sizeof *offsets);
+      free(builder->offsets);
+      builder->offsets = offsets;
+    }
+
+  /* safemalloc zeroes the buffer, so the padding is already zero. */
+  p = builder->records + builder->len;
+  memcpy(p, &r, sizeof r);
+  p += sizeof r;
+  memcpy(p, key, key_len);
+  p += key_len;
+  if (address_len)
+    memcpy(p, address, address_len);
+  p += address_len;
+  if (options_len)
+    memcpy(p, options, options_len);
+
+  builder->offsets[builder->count++] = builder->len;
+  builder->len += size;
+  return ISC_R_SUCCESS;
+}
+
+/* Hash the records and write out the file.   The file is written under a
+ * temporary name and renamed into place, so a server that has the old one
+ * mapped keeps a consistent copy.
+ */
+isc_result_t reservation_builder_write(struct reservation_builder *builder,
+				       const char *path)
+{
+  struct reservation_file_header header;
+  struct reservation_slot *slots;
+  const struct reservation *r, *other;
+  u_int32_t base, hash, mask, i, j;
+  char tmp[PATH_MAX];
+  FILE *f;
+  isc_result_t status = ISC_R_SUCCESS;
+
+  memset(&header, 0, sizeof header);
+  header.magic = RESERVATION_MAGIC;
+  header.version = RESERVATION_VERSION;
+  header.count = builder->count;
+  for (header.table_size = 16;
+       header.table_size < builder->count * 2; header.table_size *= 2)
+    ;
+  header.table_offset = sizeof header;
+  base = header.table_offset + header.table_size * sizeof *slots;
+  if ((u_int64_t)base + builder->len > 0xffffffffULL)
+    {
+      log_error("%s: too many reservations", path);
+      return ISC_R_NOSPACE;
+    }
+  header.size = base + builder->len;
+
+  slots = (struct reservation_slot *)
+    safemalloc(header.table_size * sizeof *slots);
+  mask = header.table_size - 1;
+  for (i = 0; i < builder->count; i++)
+    {
+      r = (const struct reservation *)(builder->records + builder->offsets[i]);
+      hash = reservation_hash(r->key_type, RESERVATION_KEY(r), r->key_len);
+      for (j = hash & mask; slots[j].offset; j = (j + 1) & mask)
+	{
+	  if (slots[j].hash != hash)
+	    continue;
+	  other = (const struct reservation *)
+	    (builder->records + slots[j].offset - base);
+	  if (other->key_type == r->key_type && other->key_len == r->key_len &&
+	      !memcmp(RESERVATION_KEY(other), RESERVATION_KEY(r), r->key_len))
+	    {
+	      log_error("duplicate reservation for %s",
+			print_hex_1(r->key_len, RESERVATION_KEY(r), 60));
+	      status = ISC_R_EXISTS;
+	      break;
+	    }
+	}
+      slots[j].hash = hash;
+      slots[j].offset = base + builder->offsets[i];
+    }
+  if (status != ISC_R_SUCCESS)
+    {
+      free(slots);
+      return status;
+    }
+
+  snprintf(tmp, sizeof tmp, "%s.tmp", path);
+  f = fopen(tmp, "w");
+  if (!f)
+    {
+      log_error("Can't create %s: %m", tmp);
+      free(slots);
+      return ISC_R_NOPERM;
+    }
+  if (fwrite(&header, sizeof header, 1, f) != 1 ||
+      fwrite(slots, sizeof *slots, header.table_size, f) != header.table_size ||
+      (builder->len &&
+       fwrite(builder->records, builder->len, 1, f) != 1))
+    status = ISC_R_NOSPACE;
+  if (fclose(f) != 0)
+    status = ISC_R_NOSPACE;
+  free(slots);
+  if (status != ISC_R_SUCCESS)
+    {
+      log_error("Can't write %s: %m", tmp);
+      unlink(tmp);
+      return status;
+    }
+  if (rename(tmp, path) < 0)
+    {
+      log_error("Can't rename %s to %s: %m", tmp, path);
+      unlink(tmp);
+      return ISC_R_NOPERM;
+    }
+  log_info("Wrote %u reservations to %s", builder->count, path);
+  return ISC_R_SUCCESS;
+}
+
+void reservation_builder_free(struct reservation_builder *builder)
+{
+  free(builder->records);
+  free(builder->offsets);
+  free(builder);
+}
+
+/* Local Variables:  */
+/* mode:C++ */
+/* c-file-style:"gnu" */
+/* end: */
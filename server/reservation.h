@@ -0,0 +1,122 @@
+/* reservation.h
+ *
+ * Definitions for the static host reservation store.
+ */
+
+/* Copyright (c) 2009 Nominum, Inc.   All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Nominum nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NOMINUM AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL NOMINUM OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef DHCPP_RESERVATION_H
+#define DHCPP_RESERVATION_H
+
+/* Host reservations are compiled from a text file into a packed file
+ * that the server maps read-only, so that a large number of them costs
+ * neither memory nor startup time, and so that several server processes
+ * share a single copy in the page cache.   The file is a header, followed
+ * by an open-addressed hash table of record offsets, followed by the
+ * records.   Each record holds the key, the reserved address, and any
+ * option overrides already encoded in wire format, so that the reply
+ * code can copy them straight into the packet.   Everything is in host
+ * byte order; the file isn't meant to be moved between machines.
+ */
+
+#define RESERVATION_MAGIC	0x44485253		/* "DHRS" */
+#define RESERVATION_VERSION	1
+
+/* Kinds of key.   Hardware keys are the htype followed by chaddr, and
+ * are used by the DHCPv4 server; DUID keys are used by the DHCPv6 server.
+ * The address and options in a record are for the corresponding protocol.
+ */
+#define RESERVATION_HW		1
+#define RESERVATION_DUID	2
+
+struct reservation_file_header {
+  u_int32_t magic;
+  u_int32_t version;
+  u_int32_t count;			   /* Number of records. */
+  u_int32_t table_size;	    /* Number of hash slots; a power of two. */
+  u_int32_t table_offset;
+  u_int32_t size;				/* Size of the file. */
+};
+
+struct reservation_slot {
+  u_int32_t hash;
+  u_int32_t offset;		 /* Offset of the record; zero if empty. */
+};
+
+/* A record is this header followed by the key, the address and the
+ * options, and is padded out to a multiple of four bytes.
+ */
+struct reservation {
+  u_int8_t key_type;
+  u_int8_t key_len;
+  u_int8_t address_len;			   /* 0, 4 or 16. */
+  u_int8_t pad;
+  u_int16_t options_len;
+  u_int16_t pad2;
+};
+
+#define RESERVATION_KEY(r)	((const u_int8_t *)((r) + 1))
+#define RESERVATION_ADDRESS(r)	(RESERVATION_KEY(r) + (r)->key_len)
+#define RESERVATION_OPTIONS(r)	(RESERVATION_ADDRESS(r) + (r)->address_len)
+
+struct reservation_db {
+  void *map;				/* As mmap() returned it. */
+  size_t size;
+  const struct reservation_file_header *header;
+  const struct reservation_slot *slots;
+};
+
+struct reservation_builder;
+
+extern struct reservation_db *reservations;
+
+struct reservation_db *reservation_db_open(const char *path);
+void reservation_db_close(struct reservation_db *db);
+const struct reservation *reservation_find(struct reservation_db *db,
+					   int key_type, const u_int8_t *key,
+					   unsigned key_len);
+
+struct reservation_builder *reservation_builder_create(void);
+isc_result_t reservation_builder_add(struct reservation_builder *builder,
+				     int key_type, const u_int8_t *key,
+				     unsigned key_len,
+				     const u_int8_t *address,
+				     unsigned address_len,
+				     const u_int8_t *options,
+				     unsigned options_len);
+isc_result_t reservation_builder_write(struct reservation_builder *builder,
+				       const char *path);
+void reservation_builder_free(struct reservation_builder *builder);
+
+#endif
+
+/* Local Variables:  */
+/* mode:c++ */
+/* c-file-style:"gnu" */
+/* end: */
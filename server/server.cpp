@@ -45,6 +45,15 @@ static char ocopyright[] __attribute__((unused)) =
 #include "dhcpd.h"
 #include "version.h"
 #include "server/v6server.h"
+#include "server/v4server.h"
+#include "server/config.h"
+#include "server/reaper.h"
+#include "server/pingcheck.h"
+#include "server/reload.h"
+#include "server/handoff.h"
+#include "server/leasesync.h"
+#include "server/leasequery.h"
+#include "server/reconfigure.h"
 
 static char copyright[] = "Copyright 2005-2006 Nominum, Inc.";
 static char arr[] = "All rights reserved.";
@@ -55,6 +64,7 @@ static char url[] = "For info, please visit http://www.nominum.com/";
 
 u_int16_t local_port_dhcpv6 = 0;
 u_int16_t remote_port_dhcpv6 = 0;
+u_int16_t listen_port_dhcpv6 = 0;
 
 static void usage(void);
 
@@ -67,6 +77,19 @@ main(int argc, char **argv)
   unsigned seed;
   int unicast_only = 0;
   duid_t *server_duid;
+  const char *config_file = 0;
+  const char *reservation_source = 0;
+  const char *reservation_file = 0;
+  const char *handoff_path = 0;
+  ServerHandoff *handoff = 0;
+  u_int16_t sync_port = 0;
+  struct in_addr sync_primary;
+  u_int16_t leasequery_port = 0;
+  const char *lease_table_path = 0;
+  u_int32_t lease_table_size = 0;
+  const char *campaign_file = 0;
+  int v4fd = -1, v6fd = -1;
+  isc_result_t status;
 
 
   /* Make sure we have stdin, stdout and stderr. */
@@ -98,6 +121,59 @@ main(int argc, char **argv)
 	{
 	  unicast_only = 1;
 	}
+      else if (!strcmp (argv [i], "-cf"))
+	{
+	  if (++i == argc)
+	    usage();
+	  config_file = argv [i];
+	}
+      else if (!strcmp (argv [i], "-compile-reservations"))
+	{
+	  if (i + 2 >= argc)
+	    usage();
+	  reservation_source = argv [++i];
+	  reservation_file = argv [++i];
+	}
+      else if (!strcmp (argv [i], "-handoff"))
+	{
+	  if (++i == argc)
+	    usage();
+	  handoff_path = argv [i];
+	}
+      else if (!strcmp (argv [i], "-leasequery"))
+	{
+	  if (++i == argc)
+	    usage();
+	  leasequery_port = htons (atoi (argv [i]));
+	}
+      else if (!strcmp (argv [i], "-lease-table"))
+	{
+	  if (i + 2 >= argc)
+	    usage();
+	  lease_table_path = argv [i + 1];
+	  lease_table_size = strtoul (argv [i + 2], 0, 10);
+	  i += 2;
+	}
+      else if (!strcmp (argv [i], "-reconfigure"))
+	{
+	  if (++i == argc)
+	    usage();
+	  campaign_file = argv [i];
+	}
+      else if (!strcmp (argv [i], "-sync-listen"))
+	{
+	  if (++i == argc)
+	    usage();
+	  sync_primary.s_addr = INADDR_ANY;
+	  sync_port = htons (atoi (argv [i]));
+	}
+      else if (!strcmp (argv [i], "-sync-from"))
+	{
+	  if (i + 2 >= argc || !inet_aton (argv [i + 1], &sync_primary))
+	    usage();
+	  sync_port = htons (atoi (argv [i + 2]));
+	  i += 2;
+	}
       else if (!strcmp (argv [i], "--version"))
 	{
 	  log_info ("nom-dhcp-dummy-%s", DHCP_VERSION);
@@ -148,15 +224,46 @@ main(int argc, char **argv)
     }
 
   remote_port_dhcpv6 = htons(ntohs(local_port_dhcpv6) - 1);
+  listen_port_dhcpv6 = local_port_dhcpv6;
   
-  local_port = 68; remote_port = 67;
-
   /* Get the current time... */
   fetch_time();
 
   /* Set up the initial dhcp option universe. */
   initialize_common_option_spaces ();
 
+  /* Compiling a reservation file is all we do if we're asked to. */
+  if (reservation_source)
+    exit (compile_reservations(reservation_source,
+			       reservation_file) == ISC_R_SUCCESS ? 0 : 1);
+
+  /* Read the configuration file, if there is one.   It's only an error
+   * for it not to exist if it was named on the command line.
+   */
+  if (config_file || access(_PATH_DHCP_SERVER_CONF, R_OK) == 0)
+    {
+      if (!config_file)
+	config_file = _PATH_DHCP_SERVER_CONF;
+      if (read_server_config(config_file) != ISC_R_SUCCESS)
+	log_fatal("Can't load configuration from %s", config_file);
+    }
+  finish_server_config();
+
+  /* We only do DHCPv4 if there's something to hand out. */
+  if (v4_subnets)
+    {
+      ent = getservbyname ("dhcps", "udp");
+      if (!ent || !ent->s_port)
+	local_port = htons (67);
+      else
+	local_port = ent->s_port;
+#ifndef __CYGWIN32__
+      endservent ();
+#endif
+      remote_port = htons (ntohs (local_port) + 1);
+      listen_port = local_port;
+    }
+
   /* Generate a server DUID.   For now, generate from scratch every
    * time since we don't need it to be persistent - maybe when the
    * client gets smarter we will want to make it persistent, though.
@@ -205,31 +312,150 @@ main(int argc, char **argv)
     }
   srandom (seed + cur_time);
 
-  /* Open the network socket(s). */
-  dhcpv6_socket_setup();
+  /* Publish our bindings for other programs to look up.   The table is
+   * made first, so that leases taken over below go in it, but readers
+   * don't see it until they have.
+   */
+  if (lease_table_path)
+    {
+      status = lease_shm_create(&lease_shm, lease_table_path,
+				lease_table_size);
+      if (status != ISC_R_SUCCESS)
+	log_fatal("Can't publish bindings in %s: %s",
+		  lease_table_path, isc_result_totext(status));
+    }
 
-  /* If we haven't been asked to only listen for unicast packets,
-   * bind to both dhcp multicast groups.
+  /* If there's a server running with the same handoff path, take over
+   * its sockets and leases.
    */
-  if (!unicast_only)
+  if (handoff_path)
     {
-      for (ip = interfaces; ip; ip = ip->next)
+      handoff = new ServerHandoff(handoff_path);
+      status = handoff->takeover(&v4fd, &v6fd);
+      if (status != ISC_R_SUCCESS && status != ISC_R_NOTFOUND)
+	log_fatal("Can't take over from the server on %s: %s",
+		  handoff_path, isc_result_totext(status));
+    }
+
+  if (lease_shm)
+    {
+      if (lease_shm_install(lease_shm) != ISC_R_SUCCESS)
+	log_fatal("Can't publish bindings in %s", lease_table_path);
+      log_info("Publishing up to %u bindings in %s.",
+	       lease_table_size, lease_table_path);
+    }
+
+  /* Open the network socket(s).   A socket we were handed is already in
+   * the multicast groups.
+   */
+  if (v6fd >= 0)
+    dhcpv6_socket_adopt(v6fd);
+  else
+    {
+      dhcpv6_socket_setup();
+
+      /* If we haven't been asked to only listen for unicast packets,
+       * bind to both dhcp multicast groups.
+       */
+      if (!unicast_only)
 	{
-	  if (ip->requested && ip->v6configured)
+	  for (ip = interfaces; ip; ip = ip->next)
 	    {
-	      dhcpv6_multicast_relay_join(ip);
-	      dhcpv6_multicast_server_join(ip);
+	      if (ip->requested && ip->v6configured)
+		{
+		  dhcpv6_multicast_relay_join(ip);
+		  dhcpv6_multicast_server_join(ip);
+		}
 	    }
 	}
     }
 
+  if (v4_subnets)
+    {
+      if (v4fd >= 0)
+	dhcpv4_socket_adopt(v4fd);
+      else
+	dhcpv4_socket_setup();
+    }
+  else if (v4fd >= 0)
+    close(v4fd);
+
+#if defined (NEED_LPF)
+  /* Have the kernel drop the messages the server only throws away:
+   * those that servers send, and BOOTP requests, which it doesn't
+   * answer.   A socket we were handed gets our filter in place of the
+   * old server's.
+   */
+  {
+    struct dhcpv6_udp_filter v6_filter;
+    struct dhcpv4_udp_filter v4_filter;
+
+    v6_filter.types = (1 << DHCPV6_SOLICIT | 1 << DHCPV6_REQUEST |
+		       1 << DHCPV6_CONFIRM | 1 << DHCPV6_RENEW |
+		       1 << DHCPV6_REBIND | 1 << DHCPV6_RELEASE |
+		       1 << DHCPV6_INFORMATION_REQUEST |
+		       1 << DHCPV6_RELAY_FORWARD);
+    v6_filter.max_hops = 256;
+    lpf_udp_filter_v6(dhcpv6_socket_fd(), &v6_filter);
+
+    memset(&v4_filter, 0, sizeof v4_filter);
+    v4_filter.requests_only = 1;
+    v4_filter.dhcp_only = 1;
+    v4_filter.min_length = DHCP_FIXED_NON_UDP + 4;
+    v4_filter.max_hops = 256;
+    if (v4_subnets)
+      lpf_udp_filter_v4(dhcpv4_socket_fd(), &v4_filter);
+  }
+#endif
+
   /* Set up listeners on all the interfaces we're covering. */
   for (ip = interfaces; ip; ip = ip->next)
     {
       if (ip->requested)
-	ip->v6listener = new DHCPv6Server(ip, server_duid);
+	{
+	  ip->max_v6listeners = 1;
+	  ip->v6listeners = (DHCPv6Listener **)
+	    safemalloc(ip->max_v6listeners * sizeof (DHCPv6Listener *));
+	  ip->v6listeners[ip->num_v6listeners++] =
+	    new DHCPv6Server(ip, server_duid);
+	  if (v4_subnets)
+	    ip->v4listener = new DHCPv4Server(ip, server_identifier);
+	}
     }			
 
+  if (v4_subnets && ping_timeout)
+    ping_check = new PingCheck(ping_timeout);
+
+  /* Expired leases and delegations are freed in the background.   A
+   * reload can add subnets, so there's a reaper if there's a file.
+   */
+  if (v4_subnets || v6_subnets || config_file)
+    new LeaseReaper();
+
+  /* A SIGHUP rereads the configuration file. */
+  if (config_file)
+    new ConfigReloader(config_file);
+
+  /* Keep a standby's leases in step with ours, or be a standby. */
+  if (sync_port && sync_primary.s_addr == INADDR_ANY)
+    lease_sync = new LeaseSync(sync_port);
+  else if (sync_port)
+    lease_sync = new LeaseSync(sync_primary, sync_port);
+
+  /* Answer bulk leasequeries over TCP. */
+  if (leasequery_port)
+    bulk_leasequery = new BulkLeasequery(leasequery_port, server_duid);
+
+  /* A SIGUSR1 starts sending Reconfigures to the clients the campaign
+   * file picks.
+   */
+  if (campaign_file)
+    reconfigurer = new Reconfigurer(campaign_file, server_duid);
+
+  /* Be ready to hand off to whatever replaces us. */
+  if (handoff)
+    handoff->listen();
+
   /* Start dispatching packets and timeouts... */
   dispatch();
 
@@ -245,7 +471,12 @@ static void usage()
   log_info ("%s", arr);
   log_info ("%s", url);
 
-  log_fatal("Usage: dhcp-server [-p <port>] [-u] [<interface> ...]");
+  log_fatal("Usage: dhcp-server [-p <port>] [-u] [-cf <config-file>] "
+	    "[-handoff <socket>] [-leasequery <port>]\n"
+	    "       [-sync-listen <port> | -sync-from <primary> <port>] "
+	    "[-lease-table <file> <max-bindings>]\n"
+	    "       [-reconfigure <campaign-file>] [<interface> ...]\n"
+	    "       dhcp-server -compile-reservations <source> <output>");
 }
 
 /* Local Variables:  */
@@ -0,0 +1,705 @@
+/* v4pool.cpp
+ *
+ * DHCPv4 subnets, address pools and leases.
+ */
+
+/* Copyright (c) 2009 Nominum, Inc.   All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Nominum nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NOMINUM AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL NOMINUM OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef lint
+static char ocopyright[] __attribute__((unused)) =
+  "$Id: v4pool.cpp,v 1.1 2009/10/02 18:11:40 mellon Exp $ Copyright (c) 2009 Nominum, Inc.  All rights reserved.\n";
+#endif /* not lint */
+
+#include "dhcpd.h"
+#include "server/v4pool.h"
+#include "server/classify.h"
+
+typedef struct hash_table v4_lease_hash_t;
+HASH_FUNCTIONS_DECL(v4_lease, const u_int8_t *,
+		    struct v4_lease, v4_lease_hash_t)
+HASH_FUNCTIONS(v4_lease, const u_int8_t *, struct v4_lease, v4_lease_hash_t)
+
+struct v4_subnet *v4_subnets;
+struct ptrie *v4_subnet_index;
+struct option_state *v4_nak_options;
+
+/* Leases that are bound to a client, indexed by client identifier.
+ * The table has a bucket for every address in the pools; see
+ * v4_client_index_rebuild().
+ */
+static v4_lease_hash_t *client_leases;
+static v4_lease_hash_t *resized_client_leases;
+
+/* The most buckets the client index gets, however big the pools are. */
+#define V4_CLIENT_INDEX_MAX	(1 << 24)
+
+/* Every lease that isn't free, in a binary heap ordered by expiry time,
+ * so that the reaper only ever looks at the leases that are due.   The
+ * heap is 1-based, so that a lease's expiry_index can be 0 when it isn't
+ * in the heap.
+ */
+static struct v4_lease **expiry_heap;
+static u_int32_t expiry_count, expiry_max;
+
+#define BITMAP_WORD_BITS	64
+#define BITMAP_FULL		(~(u_int64_t)0)
+
+
+struct v4_subnet *v4_subnet_create(struct in_addr network, int prefixlen)
+{
+  struct v4_subnet *subnet;
+  u_int32_t mask;
+
+  if (prefixlen < 0 || prefixlen > 32)
+    return 0;
+  mask = prefixlen ? ~(u_int32_t)0 << (32 - prefixlen) : 0;
+
+  subnet = (struct v4_subnet *)safemalloc(sizeof *subnet);
+  memset(subnet, 0, sizeof *subnet);
+  subnet->netmask.s_addr = htonl(mask);
+  subnet->network.s_addr = network.s_addr & subnet->netmask.s_addr;
+  subnet->prefixlen = prefixlen;
+  subnet->lease_time = 3600;
+  subnet->options = new_option_state();
+
+  subnet->next = v4_subnets;
+  v4_subnets = subnet;
+  return subnet;
+}
+
+/* Add a range of addresses to a subnet.   The addresses are all marked
+ * free; bits in the last bitmap word that don't correspond to an address
+ * are marked in use so that the allocator never has to check for them.
+ */
+isc_result_t v4_pool_create(struct v4_subnet *subnet,
+			    struct in_addr low, struct in_addr high,
+			    u_int64_t classes)
+{
+  struct v4_pool *pool;
+  u_int32_t i;
+
+  if (!v4_subnet_contains(subnet, low) || !v4_subnet_contains(subnet, high) ||
+      ntohl(low.s_addr) > ntohl(high.s_addr))
+    return ISC_R_INVALIDARG;
+
+  pool = (struct v4_pool *)safemalloc(sizeof *pool);
+  memset(pool, 0, sizeof *pool);
+  pool->subnet = subnet;
+  pool->classes = classes;
+  pool->low = ntohl(low.s_addr);
+  pool->high = ntohl(high.s_addr);
+  pool->size = pool->high - pool->low + 1;
+  pool->free_count = pool->size;
+  pool->nwords = (pool->size + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS;
+
+  pool->bitmap = (u_int64_t *)safemalloc(pool->nwords * sizeof (u_int64_t));
+  memset(pool->bitmap, 0, pool->nwords * sizeof (u_int64_t));
+  if (pool->size % BITMAP_WORD_BITS)
+    pool->bitmap[pool->nwords - 1] =
+      BITMAP_FULL << (pool->size % BITMAP_WORD_BITS);
+
+  pool->leases = (struct v4_lease *)safemalloc(pool->size *
+					       sizeof (struct v4_lease));
+  memset(pool->leases, 0, pool->size * sizeof (struct v4_lease));
+  for (i = 0; i < pool->size; i++)
+    {
+      pool->leases[i].pool = pool;
+      pool->leases[i].address.s_addr = htonl(pool->low + i);
+    }
+
+  pool->next = subnet->pools;
+  subnet->pools = pool;
+  return ISC_R_SUCCESS;
+}
+
+static void add_option(struct option_state *options, unsigned code,
+		       u_int8_t *data, unsigned len)
+{
+  struct option_cache *oc;
+
+  oc = make_const_option_cache((struct buffer **)0, data, len,
+			       find_option(&dhcp_option_space, code));
+  save_option(&dhcp_option_space, options, oc);
+}
+
+static void add_ulong_option(struct option_state *options,
+			     unsigned code, u_int32_t value)
+{
+  u_int8_t buf[4];
+
+  putULong(buf, value);
+  add_option(options, code, buf, sizeof buf);
+}
+
+/* Compute the option states the server actually sends.   Each is a layer
+ * on top of the options configured on the subnet holding just the options
+ * that depend on the message type, so the subnet's options aren't copied
+ * and the server's own options take precedence over configured ones.
+ * This has to be called again if the subnet's configuration changes.
+ */
+void v4_subnet_finish(struct v4_subnet *subnet, struct in_addr server_id)
+{
+  struct option_state *states[3];
+  u_int8_t type;
+  int i;
+
+  if (!subnet->renewal_time)
+    subnet->renewal_time = subnet->lease_time / 2;
+  if (!subnet->rebinding_time)
+    subnet->rebinding_time = (subnet->lease_time / 8) * 7;
+
+  if (!lookup_option(&dhcp_option_space, subnet->options, DHO_SUBNET_MASK))
+    add_option(subnet->options, DHO_SUBNET_MASK,
+	       (u_int8_t *)&subnet->netmask, 4);
+
+  states[0] = subnet->offer_options =
+    new_layered_option_state(subnet->options);
+  states[1] = subnet->ack_options =
+    new_layered_option_state(subnet->options);
+  states[2] = subnet->inform_options =
+    new_layered_option_state(subnet->options);
+
+  for (i = 0; i < 3; i++)
+    {
+      type = i == 0 ? DHCPOFFER : DHCPACK;
+      add_option(states[i], DHO_DHCP_MESSAGE_TYPE, &type, 1);
+      add_option(states[i], DHO_DHCP_SERVER_IDENTIFIER,
+		 (u_int8_t *)&server_id, 4);
+
+      /* A DHCPACK in response to a DHCPINFORM must not carry lease
+       * times (RFC2131 section 4.3.5).
+       */
+      if (states[i] == subnet->inform_options)
+	continue;
+      add_ulong_option(states[i], DHO_DHCP_LEASE_TIME, subnet->lease_time);
+      add_ulong_option(states[i], DHO_DHCP_RENEWAL_TIME,
+		       subnet->renewal_time);
+      add_ulong_option(states[i], DHO_DHCP_REBINDING_TIME,
+		       subnet->rebinding_time);
+    }
+}
+
+/* Clients in one or more classes get the classes' options layered over
+ * the subnet's options for the message.   There are only as many of these
+ * as there are combinations of classes that clients actually turn out to
+ * be in, so each is built the first time it's needed and then kept.
+ */
+struct option_state *v4_subnet_class_options(struct v4_subnet *subnet,
+					     struct option_state *base,
+					     u_int64_t classes)
+{
+  struct v4_class_options *co;
+
+  if (!classes)
+    return base;
+  for (co = subnet->class_options; co; co = co->next)
+    if (co->base == base && co->classes == classes)
+      return co->options;
+
+  co = (struct v4_class_options *)safemalloc(sizeof *co);
+  co->base = base;
+  co->classes = classes;
+  co->options = new_layered_option_state(base);
+  classify_add_options(co->options, classes, 0);
+  co->next = subnet->class_options;
+  subnet->class_options = co;
+  return co->options;
+}
+
+/* The options in a DHCPNAK don't depend on the subnet. */
+void v4_nak_options_setup(struct in_addr server_id)
+{
+  u_int8_t type = DHCPNAK;
+
+  v4_nak_options = new_option_state();
+  add_option(v4_nak_options, DHO_DHCP_MESSAGE_TYPE, &type, 1);
+  add_option(v4_nak_options, DHO_DHCP_SERVER_IDENTIFIER,
+	     (u_int8_t *)&server_id, 4);
+}
+
+int v4_subnet_contains(struct v4_subnet *subnet, struct in_addr addr)
+{
+  return (addr.s_addr & subnet->netmask.s_addr) == subnet->network.s_addr;
+}
+
+/* Find the narrowest subnet containing the specified address.   This is
+ * done for every relayed packet, so it's a trie lookup rather than a walk
+ * of the subnet list.
+ */
+struct v4_subnet *v4_subnet_find(struct in_addr addr)
+{
+  return (struct v4_subnet *)ptrie_lookup(v4_subnet_index,
+					  (unsigned char *)&addr);
+}
+
+/* Build a new subnet index from the subnet list and swap it in.   This is
+ * done whenever the configuration is loaded, never while answering a
+ * packet.
+ */
+void v4_subnet_index_rebuild()
+{
+  struct ptrie *nouveau;
+  struct v4_subnet *subnet;
+
+  nouveau = ptrie_create(32);
+  for (subnet = v4_subnets; subnet; subnet = subnet->next)
+    {
+      if (ptrie_insert(nouveau, (unsigned char *)&subnet->network,
+		       subnet->prefixlen, subnet) == ISC_R_EXISTS)
+	log_error("subnet %s/%d is declared more than once.",
+		  inet_ntoa(subnet->network), subnet->prefixlen);
+    }
+  ptrie_free(ptrie_publish(&v4_subnet_index, nouveau));
+}
+
+static void rehash_client(const u_int8_t *id, unsigned len,
+			  struct v4_lease *lease)
+{
+  v4_lease_hash_add(resized_client_leases, id, len, lease);
+}
+
+/* Size the index of leases by client identifier to the pools, so that
+ * chains stay short however many clients there are.   An address has at
+ * most one client, so there's a bucket per address.   This is done
+ * whenever the configuration is loaded; leases in the configuration being
+ * replaced move to the new index until they're migrated.
+ */
+void v4_client_index_rebuild()
+{
+  struct v4_subnet *subnet;
+  struct v4_pool *pool;
+  u_int64_t size = 0;
+
+  for (subnet = v4_subnets; subnet; subnet = subnet->next)
+    for (pool = subnet->pools; pool; pool = pool->next)
+      size += pool->size;
+  if (size < DEFAULT_HASH_SIZE)
+    size = DEFAULT_HASH_SIZE;
+  if (size > V4_CLIENT_INDEX_MAX)
+    size = V4_CLIENT_INDEX_MAX;
+  if (client_leases && client_leases->hash_count == size)
+    return;
+
+  if (!new_hash_sized(&resized_client_leases, size))
+    log_fatal("No memory for an index of %llu clients",
+	      (unsigned long long)size);
+  if (client_leases)
+    {
+      v4_lease_hash_foreach(client_leases, rehash_client);
+      free_hash_table(&client_leases);
+    }
+  client_leases = resized_client_leases;
+  resized_client_leases = 0;
+}
+
+static inline void bitmap_set(struct v4_pool *pool, u_int32_t offset)
+{
+  pool->bitmap[offset / BITMAP_WORD_BITS] |=
+    (u_int64_t)1 << (offset % BITMAP_WORD_BITS);
+}
+
+static inline void bitmap_clear(struct v4_pool *pool, u_int32_t offset)
+{
+  pool->bitmap[offset / BITMAP_WORD_BITS] &=
+    ~((u_int64_t)1 << (offset % BITMAP_WORD_BITS));
+}
+
+/* Scan the bitmap a word at a time, starting at the hint, for a word
+ * that has a clear bit in it.   Returns the offset of the address in the
+ * pool, or -1 if the pool is full.
+ */
+static int64_t bitmap_find_free(struct v4_pool *pool)
+{
+  u_int32_t i, n;
+  u_int64_t word;
+
+  i = pool->hint;
+  for (n = 0; n < pool->nwords; n++)
+    {
+      word = pool->bitmap[i];
+      if (word != BITMAP_FULL)
+	{
+	  pool->hint = i;
+	  return (int64_t)i * BITMAP_WORD_BITS + __builtin_ctzll(~word);
+	}
+      if (++i == pool->nwords)
+	i = 0;
+    }
+  return -1;
+}
+
+/* A pool that is restricted to some classes only serves clients that are
+ * in at least one of them.
+ */
+int v4_pool_permits(struct v4_pool *pool, u_int64_t classes)
+{
+  return !pool->classes || (pool->classes & classes);
+}
+
+/* Allocate a free address from one of the subnet's pools.   The lease
+ * comes back in the V4_LEASE_OFFERED state; the caller fills in the rest.
+ * If the pools are dry, reap a batch of expired leases before giving up,
+ * in case the reaper hasn't caught up with them yet.
+ */
+struct v4_lease *v4_pool_allocate(struct v4_subnet *subnet, u_int64_t classes)
+{
+  struct v4_pool *pool;
+  struct v4_lease *lease;
+  int64_t offset;
+  int reaped = 0;
+
+ again:
+  for (pool = subnet->pools; pool; pool = pool->next)
+    {
+      if (!v4_pool_permits(pool, classes) || !pool->free_count)
+	continue;
+      offset = bitmap_find_free(pool);
+      if (offset < 0)
+	continue;
+      lease = &pool->leases[offset];
+      bitmap_set(pool, offset);
+      pool->free_count--;
+      lease->state = V4_LEASE_OFFERED;
+      return lease;
+    }
+  if (!reaped++ && v4_lease_reap(cur_time, V4_REAP_BATCH))
+    goto again;
+  return 0;
+}
+
+struct v4_lease *v4_lease_find_address(struct v4_subnet *subnet,
+				       struct in_addr addr)
+{
+  struct v4_pool *pool;
+  u_int32_t a = ntohl(addr.s_addr);
+
+  for (pool = subnet->pools; pool; pool = pool->next)
+    {
+      if (a >= pool->low && a <= pool->high)
+	return &pool->leases[a - pool->low];
+    }
+  return 0;
+}
+
+/* Claim a specific address, e.g., one the client asked for. */
+isc_result_t v4_lease_claim(struct v4_lease *lease)
+{
+  if (lease->state != V4_LEASE_FREE)
+    {
+      if (lease->expiry > cur_time)
+	return ISC_R_ADDRINUSE;
+      v4_lease_free(lease);
+    }
+  bitmap_set(lease->pool, lease - lease->pool->leases);
+  lease->pool->free_count--;
+  lease->state = V4_LEASE_OFFERED;
+  return ISC_R_SUCCESS;
+}
+
+/* Return a lease to its pool.   If it's below the scan hint, move the hint
+ * back so that allocation stays first-fit.
+ */
+void v4_lease_free(struct v4_lease *lease)
+{
+  struct v4_pool *pool = lease->pool;
+  u_int32_t offset = lease - pool->leases;
+
+  if (lease->state == V4_LEASE_FREE)
+    return;
+  v4_lease_clear_client(lease);
+  bitmap_clear(pool, offset);
+  pool->free_count++;
+  if (offset / BITMAP_WORD_BITS < pool->hint)
+    pool->hint = offset / BITMAP_WORD_BITS;
+  lease->state = V4_LEASE_FREE;
+  v4_lease_set_expiry(lease, 0);
+}
+
+static inline void expiry_place(u_int32_t ix, struct v4_lease *lease)
+{
+  expiry_heap[ix] = lease;
+  lease->expiry_index = ix;
+}
+
+static void expiry_sift_up(u_int32_t ix)
+{
+  struct v4_lease *lease = expiry_heap[ix];
+
+  while (ix > 1 && expiry_heap[ix / 2]->expiry > lease->expiry)
+    {
+      expiry_place(ix, expiry_heap[ix / 2]);
+      ix /= 2;
+    }
+  expiry_place(ix, lease);
+}
+
+static void expiry_sift_down(u_int32_t ix)
+{
+  struct v4_lease *lease = expiry_heap[ix];
+  u_int32_t child;
+
+  while ((child = ix * 2) <= expiry_count)
+    {
+      if (child < expiry_count &&
+	  expiry_heap[child + 1]->expiry < expiry_heap[child]->expiry)
+	child++;
+      if (expiry_heap[child]->expiry >= lease->expiry)
+	break;
+      expiry_place(ix, expiry_heap[child]);
+      ix = child;
+    }
+  expiry_place(ix, lease);
+}
+
+/* Bring the published copy of a lease up to date, if the bindings are
+ * being published.   Only bindings are; an offer isn't a binding yet.
+ */
+static void v4_lease_publish(struct v4_lease *lease)
+{
+  struct lease_shm_record rec;
+
+  if (!lease_shm)
+    return;
+  if (lease->state != V4_LEASE_BOUND)
+    {
+      lease_shm_remove(lease_shm, LEASE_SHM_V4,
+		       (const u_int8_t *)&lease->address);
+      return;
+    }
+
+  memset(&rec, 0, sizeof rec);
+  rec.kind = LEASE_SHM_V4;
+  rec.prefixlen = 32;
+  rec.expiry = lease->expiry / NANO_SECONDS(1);
+  memcpy(rec.address, &lease->address, 4);
+  rec.id_len = (lease->client_id_len < sizeof rec.id
+		? lease->client_id_len : sizeof rec.id);
+  memcpy(rec.id, lease->client_id, rec.id_len);
+
+  /* A client identifier made from an Ethernet address, or the hardware
+   * type and address a client without one is known by.
+   */
+  if (lease->client_id_len == 7 && lease->client_id[0] == HTYPE_ETHER)
+    {
+      memcpy(rec.hw, &lease->client_id[1], sizeof rec.hw);
+      rec.has_hw = 1;
+    }
+  lease_shm_put(lease_shm, &rec);
+}
+
+/* Change when a lease runs out, keeping the expiry heap in order.   An
+ * expiry time of zero takes the lease out of the heap.
+ */
+void v4_lease_set_expiry(struct v4_lease *lease, u_int64_t when)
+{
+  struct v4_lease **nh, *moved;
+  u_int32_t ix = lease->expiry_index;
+
+  lease->expiry = when;
+  v4_lease_publish(lease);
+  if (!when)
+    {
+      if (!ix)
+	return;
+      lease->expiry_index = 0;
+      if (ix == expiry_count--)
+	return;
+      moved = expiry_heap[expiry_count + 1];
+      expiry_place(ix, moved);
+      expiry_sift_up(ix);
+      expiry_sift_down(moved->expiry_index);
+      return;
+    }
+
+  if (!ix)
+    {
+      if (expiry_count + 1 >= expiry_max)
+	{
+	  expiry_max = expiry_max ? expiry_max * 2 : 1024;
+	  nh = (struct v4_lease **)safemalloc(expiry_max * sizeof *nh);
+	  if (expiry_heap)
+	    {
+	      memcpy(nh, expiry_heap, (expiry_count + 1) * sizeof *nh);
+	      free(expiry_heap);
+	    }
+	  expiry_heap = nh;
+	}
+      ix = ++expiry_count;
+      expiry_heap[ix] = lease;
+    }
+  expiry_sift_up(ix);
+  expiry_sift_down(lease->expiry_index);
+}
+
+/* Free up to max leases that have run out by now, earliest first.   Returns
+ * the number freed.
+ */
+unsigned v4_lease_reap(u_int64_t now, unsigned max)
+{
+  struct v4_lease *lease;
+  unsigned n;
+
+  for (n = 0; n < max && expiry_count; n++)
+    {
+      lease = expiry_heap[1];
+      if (lease->expiry > now)
+	break;
+      v4_lease_free(lease);
+    }
+  return n;
+}
+
+/* When the next lease runs out, or 0 if none will. */
+u_int64_t v4_lease_next_expiry()
+{
+  return expiry_count ? expiry_heap[1]->expiry : 0;
+}
+
+struct v4_lease *v4_lease_find_client(const u_int8_t *id, unsigned len)
+{
+  struct v4_lease *lease;
+
+  if (!client_leases || !len)
+    return 0;
+  if (!v4_lease_hash_lookup(&lease, client_leases, id, len))
+    return 0;
+  return lease;
+}
+
+void v4_lease_set_client(struct v4_lease *lease,
+			 const u_int8_t *id, unsigned len)
+{
+  if (lease->client_id_len == len && !memcmp(lease->client_id, id, len))
+    return;
+  v4_lease_clear_client(lease);
+
+  if (!client_leases)
+    v4_lease_new_hash(&client_leases, 0);
+  if (len > sizeof lease->client_id_buf)
+    lease->client_id = (u_int8_t *)safemalloc(len);
+  else
+    lease->client_id = lease->client_id_buf;
+  memcpy(lease->client_id, id, len);
+  lease->client_id_len = len;
+
+  /* The hash table holds on to the name pointer, which is why the lease
+   * keeps its own copy of the identifier.
+   */
+  v4_lease_hash_add(client_leases, lease->client_id, len, lease);
+  v4_lease_publish(lease);
+}
+
+void v4_lease_clear_client(struct v4_lease *lease)
+{
+  if (!lease->client_id_len)
+    return;
+  v4_lease_hash_delete(client_leases, lease->client_id,
+		       lease->client_id_len);
+  if (lease->client_id != lease->client_id_buf)
+    free(lease->client_id);
+  lease->client_id = 0;
+  lease->client_id_len = 0;
+}
+
+/* Move the leases in subnets that are being replaced by a new
+ * configuration to the same addresses in the current subnets.   A lease
+ * on an address that isn't in a pool any more is dropped.   Returns the
+ * number dropped.
+ */
+unsigned v4_lease_migrate(struct v4_subnet *old)
+{
+  struct v4_subnet *subnet;
+  struct v4_pool *pool;
+  struct v4_lease *ol, *lease;
+  enum v4_lease_state state;
+  u_int64_t expiry;
+  u_int8_t id[256];
+  unsigned len, dropped = 0;
+  u_int32_t i;
+
+  for (; old; old = old->next)
+    for (pool = old->pools; pool; pool = pool->next)
+      for (i = 0; i < pool->size; i++)
+	{
+	  ol = &pool->leases[i];
+	  if (ol->state == V4_LEASE_FREE)
+	    continue;
+	  state = ol->state;
+	  expiry = ol->expiry;
+	  len = ol->client_id_len < sizeof id ? ol->client_id_len : 0;
+	  memcpy(id, ol->client_id, len);
+	  v4_lease_free(ol);
+
+	  subnet = v4_subnet_find(ol->address);
+	  lease = subnet ? v4_lease_find_address(subnet, ol->address) : 0;
+	  if (!lease || v4_lease_claim(lease) != ISC_R_SUCCESS)
+	    {
+	      dropped++;
+	      continue;
+	    }
+	  lease->state = state;
+	  v4_lease_set_expiry(lease, expiry);
+	  if (len)
+	    v4_lease_set_client(lease, id, len);
+	}
+  return dropped;
+}
+
+/* Free subnets that are no longer in use, which must have no leases left
+ * in them.   Option states can share option caches, so they aren't freed.
+ */
+void v4_subnets_free(struct v4_subnet *subnets)
+{
+  struct v4_subnet *subnet;
+  struct v4_pool *pool;
+  struct v4_class_options *co;
+
+  while ((subnet = subnets))
+    {
+      subnets = subnet->next;
+      while ((pool = subnet->pools))
+	{
+	  subnet->pools = pool->next;
+	  free(pool->bitmap);
+	  free(pool->leases);
+	  free(pool);
+	}
+      while ((co = subnet->class_options))
+	{
+	  subnet->class_options = co->next;
+	  free(co);
+	}
+      free(subnet);
+    }
+}
+
+/* Local Variables:  */
+/* mode:C++ */
+/* c-file-style:"gnu" */
+/* end: */
@@ -0,0 +1,163 @@
+/* v4pool.h
+ *
+ * Definitions for DHCPv4 subnets, address pools and leases.
+ */
+
+/* Copyright (c) 2009 Nominum, Inc.   All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Nominum nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NOMINUM AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL NOMINUM OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef DHCPP_V4POOL_H
+#define DHCPP_V4POOL_H
+
+/* States a lease can be in.   A lease that isn't V4_LEASE_FREE has its
+ * bit set in the pool's allocation bitmap.
+ */
+enum v4_lease_state {
+  V4_LEASE_FREE,
+  V4_LEASE_OFFERED,
+  V4_LEASE_BOUND,
+  V4_LEASE_ABANDONED
+};
+
+/* Client identifiers up to this length are stored in the lease itself;
+ * longer ones (which are rare) are allocated separately.
+ */
+#define V4_LEASE_INLINE_ID	20
+
+/* How long an offered address is held for the client, in seconds. */
+#define V4_OFFER_HOLD_TIME	60
+
+/* The most expired leases freed at a time, so that a lot of leases
+ * running out at once doesn't hold up answering packets.
+ */
+#define V4_REAP_BATCH		256
+
+struct v4_lease {
+  struct v4_pool *pool;			     /* Pool this address is in. */
+  struct in_addr address;				/* The address. */
+  enum v4_lease_state state;
+  u_int64_t expiry;		 /* When the offer or binding runs out (ns). */
+  u_int32_t expiry_index;			 /* Place in expiry heap. */
+  u_int8_t *client_id;	 /* Client identifier, or htype+chaddr if none. */
+  unsigned client_id_len;
+  u_int8_t client_id_buf[V4_LEASE_INLINE_ID];
+};
+
+/* A contiguous range of addresses.   There is one bit per address in
+ * bitmap, and one lease structure per address in leases, so finding a
+ * free address is a scan for a word that isn't all ones, and going from
+ * an address to its lease is a subtraction.
+ */
+struct v4_pool {
+  struct v4_pool *next;
+  struct v4_subnet *subnet;
+  u_int64_t classes;	   /* Classes the pool is restricted to, or 0. */
+  u_int32_t low, high;		   /* First and last address, host order. */
+  u_int32_t size;				/* high - low + 1. */
+  u_int32_t free_count;
+  u_int32_t nwords;			   /* Number of words in bitmap. */
+  u_int32_t hint;		/* Word at which to start the next scan. */
+  u_int64_t *bitmap;
+  struct v4_lease *leases;
+};
+
+/* Options for clients in a particular set of classes; see
+ * v4_subnet_class_options().
+ */
+struct v4_class_options {
+  struct v4_class_options *next;
+  struct option_state *base;	      /* The subnet options underneath. */
+  u_int64_t classes;
+  struct option_state *options;
+};
+
+struct v4_subnet {
+  struct v4_subnet *next;
+  struct in_addr network;
+  struct in_addr netmask;
+  int prefixlen;
+  struct v4_pool *pools;
+  u_int32_t lease_time;				   /* In seconds. */
+  u_int32_t renewal_time;
+  u_int32_t rebinding_time;
+
+  /* Options configured for the subnet. */
+  struct option_state *options;
+
+  /* The per-message-type options the server sends, layered on top of
+   * the configured options by v4_subnet_finish() so that constructing a
+   * reply doesn't have to allocate anything.
+   */
+  struct option_state *offer_options;
+  struct option_state *ack_options;
+  struct option_state *inform_options;
+  struct v4_class_options *class_options;
+};
+
+extern struct v4_subnet *v4_subnets;
+extern struct ptrie *v4_subnet_index;
+extern struct option_state *v4_nak_options;
+
+struct v4_subnet *v4_subnet_create(struct in_addr network, int prefixlen);
+isc_result_t v4_pool_create(struct v4_subnet *subnet,
+			    struct in_addr low, struct in_addr high,
+			    u_int64_t classes);
+void v4_subnet_finish(struct v4_subnet *subnet, struct in_addr server_id);
+struct option_state *v4_subnet_class_options(struct v4_subnet *subnet,
+					     struct option_state *base,
+					     u_int64_t classes);
+void v4_nak_options_setup(struct in_addr server_id);
+struct v4_subnet *v4_subnet_find(struct in_addr addr);
+void v4_subnet_index_rebuild(void);
+void v4_client_index_rebuild(void);
+int v4_subnet_contains(struct v4_subnet *subnet, struct in_addr addr);
+
+int v4_pool_permits(struct v4_pool *pool, u_int64_t classes);
+struct v4_lease *v4_pool_allocate(struct v4_subnet *subnet, u_int64_t classes);
+struct v4_lease *v4_lease_find_address(struct v4_subnet *subnet,
+				       struct in_addr addr);
+isc_result_t v4_lease_claim(struct v4_lease *lease);
+void v4_lease_free(struct v4_lease *lease);
+void v4_lease_set_expiry(struct v4_lease *lease, u_int64_t when);
+unsigned v4_lease_reap(u_int64_t now, unsigned max);
+u_int64_t v4_lease_next_expiry(void);
+
+struct v4_lease *v4_lease_find_client(const u_int8_t *id, unsigned len);
+void v4_lease_set_client(struct v4_lease *lease,
+			 const u_int8_t *id, unsigned len);
+void v4_lease_clear_client(struct v4_lease *lease);
+
+unsigned v4_lease_migrate(struct v4_subnet *old);
+void v4_subnets_free(struct v4_subnet *subnets);
+
+#endif
+
+/* Local Variables:  */
+/* mode:c++ */
+/* c-file-style:"gnu" */
+/* end: */
@@ -0,0 +1,796 @@
+/* v4server.cpp
+ *
+ * DHCPv4 server.   Hands out addresses from the pools configured on each
+ * subnet, and answers relayed requests via the relay agent.
+ */
+
+/* Copyright (c) 2009 Nominum, Inc.   All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Nominum nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NOMINUM AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL NOMINUM OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef lint
+static char ocopyright[] __attribute__((unused)) =
+  "$Id: v4server.cpp,v 1.1 2009/10/02 18:11:40 mellon Exp $ Copyright (c) 2009 Nominum, Inc.  All rights reserved.\n";
+#endif /* not lint */
+
+#include "dhcpd.h"
+#include "server/v4server.h"
+#include "server/reservation.h"
+#include "server/classify.h"
+#include "server/pingcheck.h"
+#include "server/config.h"
+#include "server/leasesync.h"
+
+/* The most addresses we'll try to offer in answer to one DHCPDISCOVER if
+ * the ping check keeps finding them in use.
+ */
+#define PING_MAX_TRIES		3
+
+/* A DHCPDISCOVER whose answer is waiting on a ping check.   The packet
+ * the listener gave us is in a receive buffer that will be reused, so we
+ * keep a copy of it.
+ */
+struct v4_ping_offer {
+  DHCPv4Server *server;
+  struct packet *packet;
+  struct v4_subnet *subnet;
+  unsigned generation;		    /* Of the configuration subnet is in. */
+  u_int64_t classes;
+  const struct reservation *rsv;
+  unsigned tries;
+  u_int8_t idbuf[sizeof ((struct dhcp_packet *)0)->chaddr + 1];
+};
+
+/* Find the raw relay agent information option in a packet.   The relay
+ * agent always appends it to the main option buffer, so there's no need
+ * to look in overloaded sname or file fields.
+ */
+static const unsigned char *find_agent_options(struct packet *packet,
+					       unsigned *lenp)
+{
+  const unsigned char *op = packet->raw->options;
+  unsigned len, ix;
+
+  if (packet->packet_length < DHCP_FIXED_NON_UDP + 4 ||
+      memcmp(op, DHCP_OPTIONS_COOKIE, 4))
+    return 0;
+  len = packet->packet_length - DHCP_FIXED_NON_UDP;
+
+  for (ix = 4; ix < len && op[ix] != DHO_END; )
+    {
+      if (op[ix] == DHO_PAD)
+	{
+	  ix++;
+	  continue;
+	}
+      if (ix + 2 > len || ix + 2 + op[ix + 1] > len)
+	return 0;
+      if (op[ix] == DHO_DHCP_AGENT_OPTIONS)
+	{
+	  *lenp = op[ix + 1];
+	  return &op[ix + 2];
+	}
+      ix += 2 + op[ix + 1];
+    }
+  return 0;
+}
+
+DHCPv4Server::DHCPv4Server(struct interface_info *ip, struct in_addr server_id)
+{
+  interface = ip;
+  server_identifier = server_id;
+  configure();
+}
+
+/* Figure out which subnet, if any, the interface is directly attached
+ * to; that's where we allocate for clients that aren't relayed.
+ */
+void DHCPv4Server::configure()
+{
+  int i;
+
+  generation = config_generation;
+  local_subnet = 0;
+  for (i = 0; i < interface->ipv4_addr_count && !local_subnet; i++)
+    local_subnet = v4_subnet_find(interface->ipv4s[i]);
+  if (!local_subnet)
+    log_info("%s: no subnet declared for this interface; only relayed "
+	     "DHCPv4 requests will be answered.", interface->name);
+}
+
+/* Free a packet we're done with and the options parsed from it.   Its
+ * raw contents are the listener's receive buffer unless we copied them.
+ */
+static void free_packet(struct packet *packet)
+{
+  option_state_dereference(&packet->options);
+  free(packet);
+}
+
+/* Pick up a configuration that was reloaded since the last packet.   The
+ * packet is ours to free once it's been handled; a ping check that needs
+ * it keeps its own copy.
+ */
+void DHCPv4Server::dhcp(struct packet *packet)
+{
+  if (!lease_sync_standby)
+    {
+      if (generation != config_generation)
+	{
+	  server_identifier = ::server_identifier;
+	  configure();
+	}
+      DHCPv4Listener::dhcp(packet);
+    }
+  free_packet(packet);
+}
+
+/* We don't answer BOOTP clients. */
+void DHCPv4Server::bootp(struct packet *packet)
+{
+  free_packet(packet);
+}
+
+/* Relayed packets come from the subnet giaddr is on.   Clients that are
+ * renewing unicast from their own address; everything else is on the
+ * subnet we're attached to.
+ */
+struct v4_subnet *DHCPv4Server::select_subnet(struct packet *packet)
+{
+  if (packet->raw->giaddr.s_addr)
+    return v4_subnet_find(packet->raw->giaddr);
+  if (packet->raw->ciaddr.s_addr &&
+      !(local_subnet && v4_subnet_contains(local_subnet,
+					   packet->raw->ciaddr)))
+    return v4_subnet_find(packet->raw->ciaddr);
+  return local_subnet;
+}
+
+/* Use the client identifier option if the client sent one; otherwise
+ * identify the client by its hardware type and address.
+ */
+const u_int8_t *DHCPv4Server::client_identifier(struct packet *packet,
+						u_int8_t *buf, unsigned *len)
+{
+  struct option_cache *oc;
+
+  oc = lookup_option(&dhcp_option_space, packet->options,
+		     DHO_DHCP_CLIENT_IDENTIFIER);
+  if (oc && oc->data.len)
+    {
+      *len = oc->data.len;
+      return oc->data.data;
+    }
+  buf[0] = packet->raw->htype;
+  memcpy(&buf[1], packet->raw->chaddr, packet->raw->hlen);
+  *len = packet->raw->hlen + 1;
+  return buf;
+}
+
+int DHCPv4Server::requested_address(struct packet *packet,
+				    struct in_addr *addr)
+{
+  struct option_cache *oc;
+
+  oc = lookup_option(&dhcp_option_space, packet->options,
+		     DHO_DHCP_REQUESTED_ADDRESS);
+  if (oc && oc->data.len == 4)
+    {
+      memcpy(addr, oc->data.data, 4);
+      return 1;
+    }
+  return 0;
+}
+
+/* Look up the client's reservation by its hardware address. */
+const struct reservation *DHCPv4Server::find_reservation(struct packet *packet)
+{
+  u_int8_t key[sizeof packet->raw->chaddr + 1];
+
+  if (!reservations || packet->raw->hlen > sizeof packet->raw->chaddr)
+    return 0;
+  key[0] = packet->raw->htype;
+  memcpy(&key[1], packet->raw->chaddr, packet->raw->hlen);
+  return reservation_find(reservations, RESERVATION_HW,
+			  key, packet->raw->hlen + 1);
+}
+
+/* Get the address reserved for the client, if there is one and it's on
+ * the subnet the client is on.
+ */
+int DHCPv4Server::reserved_address(struct packet *packet,
+				   struct v4_subnet *subnet,
+				   const struct reservation *rsv,
+				   struct in_addr *addr)
+{
+  if (!rsv || rsv->address_len != 4)
+    return 0;
+  memcpy(addr, RESERVATION_ADDRESS(rsv), 4);
+  if (v4_subnet_contains(subnet, *addr))
+    return 1;
+  log_info("%s: reserved address %s is not on subnet %s/%d",
+	   print_hw_addr(packet->raw->htype, packet->raw->hlen,
+			 packet->raw->chaddr), inet_ntoa(*addr),
+	   inet_ntoa(subnet->network), subnet->prefixlen);
+  return 0;
+}
+
+/* Take an address somebody else turns out to be using out of circulation
+ * for a lease time.
+ */
+static void abandon_lease(struct v4_lease *lease)
+{
+  v4_lease_clear_client(lease);
+  lease->state = V4_LEASE_ABANDONED;
+  v4_lease_set_expiry(lease, cur_time +
+		      NANO_SECONDS(lease->pool->subnet->lease_time));
+  lease_sync_v4(lease);
+}
+
+/* DHCP client broadcasts this to find one or more DHCP servers.   Offer
+ * it the address it already has if there is one, then the address it asked
+ * for if that's free, and otherwise the first free address in a pool its
+ * classes allow it to use.   If ping checks are on, an address that wasn't
+ * the client's already isn't offered until a ping to it goes unanswered.
+ */
+void DHCPv4Server::discover(struct packet *packet)
+{
+  struct v4_subnet *subnet;
+  struct v4_lease *lease, *rl;
+  struct in_addr requested, fixed;
+  const struct reservation *rsv;
+  u_int8_t idbuf[sizeof packet->raw->chaddr + 1];
+  const u_int8_t *id;
+  unsigned idlen;
+  u_int64_t classes;
+  int fresh = 0;
+
+  subnet = select_subnet(packet);
+  if (!subnet)
+    {
+      log_info("DHCPDISCOVER from %s via %s: no subnet for client",
+	       print_hw_addr(packet->raw->htype, packet->raw->hlen,
+			     packet->raw->chaddr), interface->name);
+      return;
+    }
+  id = client_identifier(packet, idbuf, &idlen);
+  rsv = find_reservation(packet);
+  classes = classify_v4(classifier, packet);
+
+  lease = v4_lease_find_client(id, idlen);
+  if (lease && (lease->pool->subnet != subnet ||
+		!v4_pool_permits(lease->pool, classes)))
+    {
+      /* The client has moved, or is no longer in a class the address's
+       * pool is restricted to; its old address is no use to it.
+       */
+      v4_lease_free(lease);
+      lease_sync_v4(lease);
+      lease = 0;
+    }
+
+  /* A client with a reserved address gets that and nothing else.   If
+   * the address is in a pool we have to take it out of circulation, but
+   * otherwise there's no lease to keep track of.
+   */
+  if (reserved_address(packet, subnet, rsv, &fixed))
+    {
+      if (lease && lease->address.s_addr != fixed.s_addr)
+	{
+	  v4_lease_free(lease);
+	  lease_sync_v4(lease);
+	  lease = 0;
+	}
+      if (!lease && (rl = v4_lease_find_address(subnet, fixed)))
+	{
+	  if (v4_lease_claim(rl) != ISC_R_SUCCESS)
+	    {
+	      log_error("DHCPDISCOVER from %s via %s: reserved address %s "
+			"is leased to another client",
+			print_hw_addr(packet->raw->htype, packet->raw->hlen,
+				      packet->raw->chaddr), interface->name,
+			inet_ntoa(fixed));
+	      return;
+	    }
+	  lease = rl;
+	}
+      if (!lease)
+	{
+	  send_reply(packet, &fixed,
+		     v4_subnet_class_options(subnet, subnet->offer_options,
+					     classes), rsv, "DHCPOFFER");
+	  return;
+	}
+    }
+
+  if (!lease && requested_address(packet, &requested) &&
+      v4_subnet_contains(subnet, requested))
+    {
+      rl = v4_lease_find_address(subnet, requested);
+      if (rl && v4_pool_permits(rl->pool, classes) &&
+	  v4_lease_claim(rl) == ISC_R_SUCCESS)
+	lease = rl;
+      fresh = lease != 0;
+    }
+
+  if (!lease && (lease = v4_pool_allocate(subnet, classes)))
+    fresh = 1;
+  if (!lease)
+    {
+      log_error("DHCPDISCOVER from %s via %s: no free leases",
+		print_hw_addr(packet->raw->htype, packet->raw->hlen,
+			      packet->raw->chaddr), interface->name);
+      return;
+    }
+
+  /* Don't shorten an existing binding just because the client rebooted. */
+  if (lease->state != V4_LEASE_BOUND || lease->expiry <= cur_time)
+    {
+      lease->state = V4_LEASE_OFFERED;
+      v4_lease_set_expiry(lease, cur_time + NANO_SECONDS(V4_OFFER_HOLD_TIME));
+    }
+  v4_lease_set_client(lease, id, idlen);
+
+  /* A client that retransmits while we're still checking its address
+   * waits for the same answer.
+   */
+  if (ping_check && ping_timeout &&
+      (fresh || ping_check->pending(lease->address)))
+    {
+      offer_after_ping(packet, subnet, lease, classes, rsv);
+      return;
+    }
+
+  send_reply(packet, &lease->address,
+	     v4_subnet_class_options(subnet, subnet->offer_options, classes),
+	     rsv, "DHCPOFFER");
+}
+
+/* Ping the address we're about to offer, and send the offer when the
+ * ping times out.   If we can't send a ping, just send the offer.
+ */
+void DHCPv4Server::offer_after_ping(struct packet *packet,
+				    struct v4_subnet *subnet,
+				    struct v4_lease *lease, u_int64_t classes,
+				    const struct reservation *rsv)
+{
+  struct v4_ping_offer *po;
+  struct dhcp_packet *raw;
+
+  po = (struct v4_ping_offer *)safemalloc(sizeof *po);
+  raw = (struct dhcp_packet *)safemalloc(packet->packet_length > sizeof *raw
+					 ? packet->packet_length
+					 : sizeof *raw);
+  memcpy(raw, packet->raw, packet->packet_length);
+  po->server = this;
+  po->packet = (struct packet *)safemalloc(sizeof *po->packet);
+  *po->packet = *packet;
+  po->packet->raw = raw;
+  packet->options = 0;
+  po->subnet = subnet;
+  po->generation = config_generation;
+  po->classes = classes;
+  po->rsv = rsv;
+
+  if (!ping_check->probe(lease->address, ping_done, po))
+    ping_done(po, lease->address, 0);
+}
+
+/* The ping check for an address we want to offer is done.   If nobody
+ * answered, and the address is still being held for the client, send
+ * the offer.   If somebody did, abandon the address and try another.
+ */
+void DHCPv4Server::ping_done(void *arg, struct in_addr addr, int answered)
+{
+  struct v4_ping_offer *po = (struct v4_ping_offer *)arg;
+  DHCPv4Server *server = po->server;
+  struct packet *packet = po->packet;
+  struct v4_lease *lease;
+  const u_int8_t *id;
+  unsigned idlen;
+
+  /* If the configuration was reloaded while we waited, the lease moved
+   * to the new one; the old one is kept around until we're done.
+   */
+  if (po->generation != config_generation)
+    {
+      po->subnet = v4_subnet_find(po->subnet->network);
+      po->generation = config_generation;
+      po->rsv = server->find_reservation(packet);
+      po->classes = classify_v4(classifier, packet);
+    }
+
+  id = server->client_identifier(packet, po->idbuf, &idlen);
+  for (;;)
+    {
+      /* The offer may have been given up on while we waited. */
+      lease = po->subnet ? v4_lease_find_address(po->subnet, addr) : 0;
+      if (!lease || lease->state != V4_LEASE_OFFERED ||
+	  lease->client_id_len != idlen || memcmp(lease->client_id, id, idlen))
+	break;
+
+      if (!answered)
+	{
+	  server->send_reply(packet, &addr,
+			     v4_subnet_class_options(po->subnet,
+						     po->subnet->offer_options,
+						     po->classes),
+			     po->rsv, "DHCPOFFER");
+	  break;
+	}
+
+      log_error("DHCPDISCOVER from %s via %s: %s answered a ping; "
+		"abandoning it",
+		print_hw_addr(packet->raw->htype, packet->raw->hlen,
+			      packet->raw->chaddr), server->interface->name,
+		inet_ntoa(addr));
+      abandon_lease(lease);
+      if (++po->tries == PING_MAX_TRIES ||
+	  !(lease = v4_pool_allocate(po->subnet, po->classes)))
+	{
+	  log_error("DHCPDISCOVER from %s via %s: no free leases",
+		    print_hw_addr(packet->raw->htype, packet->raw->hlen,
+				  packet->raw->chaddr), server->interface->name);
+	  break;
+	}
+      v4_lease_set_expiry(lease, cur_time + NANO_SECONDS(V4_OFFER_HOLD_TIME));
+      v4_lease_set_client(lease, id, idlen);
+      if (ping_check->probe(lease->address, ping_done, po))
+	return;
+      addr = lease->address;
+      answered = 0;
+    }
+
+  free(packet->raw);
+  free_packet(packet);
+  free(po);
+}
+
+/* The client is either selecting one of the offers it got, renewing or
+ * rebinding, or checking an address it remembered across a reboot.
+ */
+void DHCPv4Server::request(struct packet *packet)
+{
+  struct v4_subnet *subnet;
+  struct v4_lease *lease, *rl;
+  struct option_cache *oc;
+  struct in_addr requested, fixed;
+  const struct reservation *rsv;
+  u_int8_t idbuf[sizeof packet->raw->chaddr + 1];
+  const u_int8_t *id;
+  unsigned idlen;
+  u_int64_t classes;
+
+  id = client_identifier(packet, idbuf, &idlen);
+  lease = v4_lease_find_client(id, idlen);
+
+  /* If the client picked some other server's offer, we can put the
+   * address we offered back in the pool.
+   */
+  oc = lookup_option(&dhcp_option_space, packet->options,
+		     DHO_DHCP_SERVER_IDENTIFIER);
+  if (oc && (oc->data.len != 4 ||
+	     memcmp(oc->data.data, &server_identifier, 4)))
+    {
+      if (lease && lease->state == V4_LEASE_OFFERED)
+	v4_lease_free(lease);
+      return;
+    }
+
+  if (!requested_address(packet, &requested))
+    requested = packet->raw->ciaddr;
+  if (!requested.s_addr)
+    {
+      log_info("DHCPREQUEST from %s via %s: no address requested",
+	       print_hw_addr(packet->raw->htype, packet->raw->hlen,
+			     packet->raw->chaddr), interface->name);
+      return;
+    }
+
+  subnet = select_subnet(packet);
+  if (!subnet || !v4_subnet_contains(subnet, requested))
+    {
+      send_reply(packet, 0, v4_nak_options, 0, "DHCPNAK");
+      return;
+    }
+
+  classes = classify_v4(classifier, packet);
+
+  /* A client with a reservation can only have the reserved address. */
+  rsv = find_reservation(packet);
+  if (reserved_address(packet, subnet, rsv, &fixed))
+    {
+      if (requested.s_addr != fixed.s_addr)
+	{
+	  send_reply(packet, 0, v4_nak_options, 0, "DHCPNAK");
+	  return;
+	}
+      if (!v4_lease_find_address(subnet, fixed))
+	{
+	  if (lease)
+	    {
+	      v4_lease_free(lease);
+	      lease_sync_v4(lease);
+	    }
+	  send_reply(packet, &fixed,
+		     v4_subnet_class_options(subnet, subnet->ack_options,
+					     classes), rsv, "DHCPACK");
+	  return;
+	}
+    }
+
+  if (!lease || lease->address.s_addr != requested.s_addr)
+    {
+      rl = v4_lease_find_address(subnet, requested);
+      if (!rl || !v4_pool_permits(rl->pool, classes) ||
+	  v4_lease_claim(rl) != ISC_R_SUCCESS)
+	{
+	  send_reply(packet, 0, v4_nak_options, 0, "DHCPNAK");
+	  return;
+	}
+      if (lease)
+	{
+	  v4_lease_free(lease);
+	  lease_sync_v4(lease);
+	}
+      lease = rl;
+    }
+
+  lease->state = V4_LEASE_BOUND;
+  v4_lease_set_expiry(lease, cur_time + NANO_SECONDS(subnet->lease_time));
+  v4_lease_set_client(lease, id, idlen);
+  lease_sync_v4(lease);
+
+  send_reply(packet, &lease->address,
+	     v4_subnet_class_options(subnet, subnet->ack_options, classes),
+	     rsv, "DHCPACK");
+}
+
+/* The client found someone else using the address we gave it.   Take the
+ * address out of circulation for a lease time.
+ */
+void DHCPv4Server::decline(struct packet *packet)
+{
+  struct v4_lease *lease;
+  struct in_addr requested;
+  u_int8_t idbuf[sizeof packet->raw->chaddr + 1];
+  const u_int8_t *id;
+  unsigned idlen;
+
+  id = client_identifier(packet, idbuf, &idlen);
+  lease = v4_lease_find_client(id, idlen);
+  if (!lease || !requested_address(packet, &requested) ||
+      lease->address.s_addr != requested.s_addr)
+    return;
+
+  log_error("DHCPDECLINE from %s via %s: abandoning %s",
+	    print_hw_addr(packet->raw->htype, packet->raw->hlen,
+			  packet->raw->chaddr), interface->name,
+	    inet_ntoa(lease->address));
+  abandon_lease(lease);
+}
+
+void DHCPv4Server::release(struct packet *packet)
+{
+  struct v4_lease *lease;
+  u_int8_t idbuf[sizeof packet->raw->chaddr + 1];
+  const u_int8_t *id;
+  unsigned idlen;
+
+  id = client_identifier(packet, idbuf, &idlen);
+  lease = v4_lease_find_client(id, idlen);
+  if (lease && lease->address.s_addr == packet->raw->ciaddr.s_addr)
+    {
+      v4_lease_free(lease);
+      lease_sync_v4(lease);
+    }
+}
+
+/* The client already has an address and just wants the other
+ * parameters for its subnet.
+ */
+void DHCPv4Server::inform(struct packet *packet)
+{
+  struct v4_subnet *subnet;
+
+  subnet = select_subnet(packet);
+  if (!subnet)
+    {
+      log_info("DHCPINFORM from %s via %s: no subnet for client",
+	       inet_ntoa(packet->raw->ciaddr), interface->name);
+      return;
+    }
+  send_reply(packet, 0,
+	     v4_subnet_class_options(subnet, subnet->inform_options,
+				     classify_v4(classifier, packet)),
+	     find_reservation(packet), "DHCPACK");
+}
+
+/* Remove any options the reservation overrides from the options cons_options
+ * stored, so that they can be replaced.   Returns the new length.
+ */
+static unsigned strip_overridden(unsigned char *op, unsigned len,
+				 const struct reservation *rsv)
+{
+  const u_int8_t *ro = RESERVATION_OPTIONS(rsv);
+  u_int8_t codes[256 / 8];
+  unsigned ix, out, olen;
+
+  memset(codes, 0, sizeof codes);
+  for (ix = 0; ix + 2 <= rsv->options_len; ix += 2 + ro[ix + 1])
+    codes[ro[ix] / 8] |= 1 << (ro[ix] % 8);
+
+  for (ix = out = 4; ix < len; ix += olen)
+    {
+      olen = op[ix] == DHO_PAD ? 1 : 2 + op[ix + 1];
+      if (op[ix] != DHO_PAD && (codes[op[ix] / 8] & (1 << (op[ix] % 8))))
+	continue;
+      memmove(&op[out], &op[ix], olen);
+      out += olen;
+    }
+  return out;
+}
+
+/* Put together a reply to the packet and send it.   The options come
+ * straight from one of the precomputed option states; the only thing we
+ * copy from the request, other than the fixed fields, is the relay agent
+ * information option, which RFC3046 requires us to echo back.   If the
+ * client has a reservation with options in it, those are already in wire
+ * format and go in as they are, replacing any the subnet supplied.
+ */
+void DHCPv4Server::send_reply(struct packet *packet,
+			      const struct in_addr *yiaddr,
+			      struct option_state *options,
+			      const struct reservation *rsv, const char *name)
+{
+  struct dhcp_packet raw;
+  struct sockaddr_in to;
+  struct option_cache *oc;
+  struct data_string prl;
+  const unsigned char *agent;
+  unsigned agentlen, ix, limit;
+  int mms = 0;
+  int length;
+  int nak = options == v4_nak_options;
+
+  memset(&raw, 0, sizeof raw);
+  raw.op = BOOTREPLY;
+  raw.htype = packet->raw->htype;
+  raw.hlen = packet->raw->hlen;
+  raw.xid = packet->raw->xid;
+  raw.flags = packet->raw->flags;
+  raw.giaddr = packet->raw->giaddr;
+  memcpy(raw.chaddr, packet->raw->chaddr, sizeof raw.chaddr);
+  if (!nak)
+    raw.ciaddr = packet->raw->ciaddr;
+  if (yiaddr)
+    raw.yiaddr = *yiaddr;
+
+  oc = lookup_option(&dhcp_option_space, packet->options,
+		     DHO_DHCP_MAX_MESSAGE_SIZE);
+  if (oc && oc->data.len == 2)
+    {
+      mms = getUShort(oc->data.data);
+      if (mms < 576)
+	mms = 576;
+      if (mms > DHCP_MTU_MAX)
+	mms = DHCP_MTU_MAX;
+    }
+  limit = (mms ? mms : 576) - DHCP_UDP_OVERHEAD - DHCP_FIXED_NON_UDP;
+
+  memset(&prl, 0, sizeof prl);
+  oc = lookup_option(&dhcp_option_space, packet->options,
+		     DHO_DHCP_PARAMETER_REQUEST_LIST);
+  if (oc)
+    prl = oc->data;
+
+  length = cons_options(&raw, mms, options, 0, 0, 0,
+			prl.len ? &prl : (struct data_string *)0, 0);
+  if (!length)
+    {
+      log_error("%s for %s: can't store options", name,
+		print_hw_addr(packet->raw->htype, packet->raw->hlen,
+			      packet->raw->chaddr));
+      return;
+    }
+  ix = length - DHCP_FIXED_NON_UDP;
+  if (ix && raw.options[ix - 1] == DHO_END)
+    ix--;
+
+  /* Splice in the reservation's options. */
+  if (rsv && rsv->options_len && !nak)
+    {
+      if (ix + rsv->options_len + 1 <= limit)
+	{
+	  ix = strip_overridden(raw.options, ix, rsv);
+	  memcpy(&raw.options[ix], RESERVATION_OPTIONS(rsv), rsv->options_len);
+	  ix += rsv->options_len;
+	}
+      else
+	log_error("%s for %s: no room for reserved options", name,
+		  print_hw_addr(packet->raw->htype, packet->raw->hlen,
+				packet->raw->chaddr));
+    }
+
+  /* Splice the relay agent information option in ahead of the END
+   * option, if the client's packet had one and it fits.
+   */
+  if (packet->raw->giaddr.s_addr &&
+      (agent = find_agent_options(packet, &agentlen)) &&
+      ix + agentlen + 3 <= limit)
+    {
+      raw.options[ix++] = DHO_DHCP_AGENT_OPTIONS;
+      raw.options[ix++] = agentlen;
+      memcpy(&raw.options[ix], agent, agentlen);
+      ix += agentlen;
+    }
+  raw.options[ix++] = DHO_END;
+  length = DHCP_FIXED_NON_UDP + ix;
+
+  if (length < BOOTP_MIN_LEN)
+    length = BOOTP_MIN_LEN;
+
+  /* Relayed replies go back to the relay agent on the server port.   A
+   * client that knows its address gets a unicast, unless we're telling it
+   * it's wrong.   Anybody else gets a broadcast, since we can't unicast to
+   * an address the client hasn't configured yet without ARP.
+   */
+  memset(&to, 0, sizeof to);
+  to.sin_family = AF_INET;
+#ifdef HAVE_SA_LEN
+  to.sin_len = sizeof to;
+#endif
+  if (packet->raw->giaddr.s_addr)
+    {
+      to.sin_addr = packet->raw->giaddr;
+      to.sin_port = local_port;
+      if (nak)
+	raw.flags |= htons(BOOTP_BROADCAST);
+    }
+  else if (!nak && packet->raw->ciaddr.s_addr)
+    {
+      to.sin_addr = packet->raw->ciaddr;
+      to.sin_port = remote_port;
+    }
+  else
+    {
+      to.sin_addr.s_addr = htonl(INADDR_BROADCAST);
+      to.sin_port = remote_port;
+    }
+
+  log_debug("%s on %s to %s (%s)", name,
+	    yiaddr ? inet_ntoa(*yiaddr) : "-",
+	    print_hw_addr(packet->raw->htype, packet->raw->hlen,
+			  packet->raw->chaddr), interface->name);
+
+  send_packet(interface, &raw, length, (struct sockaddr *)&to);
+}
+
+/* Local Variables:  */
+/* mode:C++ */
+/* c-file-style:"gnu" */
+/* end: */
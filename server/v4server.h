@@ -0,0 +1,82 @@
+/* v4server.h
+ *
+ * Definitions for the DHCPv4Server class.
+ */
+
+/* Copyright (c) 2009 Nominum, Inc.   All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Nominum nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NOMINUM AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL NOMINUM OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef DHCPP_V4SERVER_H
+#define DHCPP_V4SERVER_H
+
+#include "dhc++/v4listener.h"
+#include "server/v4pool.h"
+
+class DHCPv4Server: public DHCPv4Listener
+{
+public:
+  DHCPv4Server(struct interface_info *ip, struct in_addr server_id);
+
+protected:
+  void dhcp(struct packet *packet);
+  void bootp(struct packet *packet);
+  void discover(struct packet *packet);
+  void request(struct packet *packet);
+  void decline(struct packet *packet);
+  void release(struct packet *packet);
+  void inform(struct packet *packet);
+
+private:
+  struct interface_info *interface;
+  struct in_addr server_identifier;
+  struct v4_subnet *local_subnet;    /* Subnet the interface is attached to. */
+  unsigned generation;		   /* Of the configuration cached here. */
+
+  void configure(void);
+  struct v4_subnet *select_subnet(struct packet *packet);
+  const u_int8_t *client_identifier(struct packet *packet,
+				    u_int8_t *buf, unsigned *len);
+  int requested_address(struct packet *packet, struct in_addr *addr);
+  const struct reservation *find_reservation(struct packet *packet);
+  int reserved_address(struct packet *packet, struct v4_subnet *subnet,
+		       const struct reservation *rsv, struct in_addr *addr);
+  void send_reply(struct packet *packet, const struct in_addr *yiaddr,
+		  struct option_state *options,
+		  const struct reservation *rsv, const char *name);
+  void offer_after_ping(struct packet *packet, struct v4_subnet *subnet,
+			struct v4_lease *lease, u_int64_t classes,
+			const struct reservation *rsv);
+  static void ping_done(void *arg, struct in_addr addr, int answered);
+};
+
+#endif
+
+/* Local Variables:  */
+/* mode:c++ */
+/* c-file-style:"gnu" */
+/* end: */
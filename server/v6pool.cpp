@@ -0,0 +1,757 @@
+/* v6pool.cpp
+ *
+ * DHCPv6 subnets.
+ */
+
+/* Copyright (c) 2009 Nominum, Inc.   All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Nominum nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NOMINUM AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL NOMINUM OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef lint
+static char ocopyright[] __attribute__((unused)) =
+  "$Id: v6pool.cpp,v 1.1 2009/10/09 17:40:12 mellon Exp $ Copyright (c) 2009 Nominum, Inc.  All rights reserved.\n";
+#endif /* not lint */
+
+#include "dhcpd.h"
+#include "server/v6pool.h"
+#include "server/pdpool.h"
+
+typedef struct hash_table v6_lease_hash_t;
+HASH_FUNCTIONS_DECL(v6_lease, const u_int8_t *,
+		    struct v6_lease, v6_lease_hash_t)
+HASH_FUNCTIONS(v6_lease, const u_int8_t *, struct v6_lease, v6_lease_hash_t)
+
+typedef struct hash_table v6_relay_id_hash_t;
+HASH_FUNCTIONS_DECL(v6_relay_id, const u_int8_t *,
+		    struct v6_relay_id, v6_relay_id_hash_t)
+HASH_FUNCTIONS(v6_relay_id, const u_int8_t *,
+	       struct v6_relay_id, v6_relay_id_hash_t)
+
+struct v6_subnet *v6_subnets;
+struct ptrie *v6_subnet_index;
+
+/* The key for hashed pools.   Servers that are to agree on assignments
+ * need to be configured with the same one.
+ */
+u_int8_t v6_hash_key[16];
+
+/* Leased addresses, indexed by address and by DUID and IAID. */
+static v6_lease_hash_t *leased_addresses;
+static v6_lease_hash_t *client_addresses;
+
+/* Relay identifiers leases refer to, by identifier. */
+static v6_relay_id_hash_t *relay_ids;
+
+/* Cursors on lease lists. */
+static struct v6_lease_cursor *lease_cursors;
+
+struct v6_subnet *v6_subnet_create(const struct in6_addr *prefix,
+				   int prefixlen)
+{
+  struct v6_subnet *subnet;
+  int i;
+
+  if (prefixlen < 0 || prefixlen > 128)
+    return 0;
+
+  subnet = (struct v6_subnet *)safemalloc(sizeof *subnet);
+  memset(subnet, 0, sizeof *subnet);
+
+  /* Keep only the network bits of the prefix. */
+  for (i = 0; i < 16; i++)
+    {
+      if (prefixlen >= (i + 1) * 8)
+	subnet->prefix.s6_addr[i] = prefix->s6_addr[i];
+      else if (prefixlen > i * 8)
+	subnet->prefix.s6_addr[i] = (prefix->s6_addr[i] &
+				     (0xff00 >> (prefixlen - i * 8)));
+    }
+  subnet->prefixlen = prefixlen;
+  subnet->options = new_option_state();
+  subnet->lifetime = 3600;
+  subnet->pd_lifetime = 3600;
+
+  subnet->next = v6_subnets;
+  v6_subnets = subnet;
+  return subnet;
+}
+
+/* Find the narrowest subnet containing the specified address, e.g., the
+ * link address from a Relay-Forward message.
+ */
+struct v6_subnet *v6_subnet_find(const struct in6_addr *addr)
+{
+  return (struct v6_subnet *)ptrie_lookup(v6_subnet_index, addr->s6_addr);
+}
+
+/* Build a new subnet index from the subnet list and swap it in. */
+void v6_subnet_index_rebuild()
+{
+  struct ptrie *nouveau;
+  struct v6_subnet *subnet;
+  char buf[128];
+
+  nouveau = ptrie_create(128);
+  for (subnet = v6_subnets; subnet; subnet = subnet->next)
+    {
+      if (ptrie_insert(nouveau, subnet->prefix.s6_addr,
+		       subnet->prefixlen, subnet) == ISC_R_EXISTS)
+	log_error("subnet6 %s/%d is declared more than once.",
+		  inet_ntop(AF_INET6, &subnet->prefix, buf, sizeof buf),
+		  subnet->prefixlen);
+    }
+  ptrie_free(ptrie_publish(&v6_subnet_index, nouveau));
+}
+
+static int v6_subnet_contains(struct v6_subnet *subnet,
+			      const struct in6_addr *addr)
+{
+  int i;
+
+  for (i = 0; i < subnet->prefixlen; i++)
+    if ((addr->s6_addr[i / 8] ^ subnet->prefix.s6_addr[i / 8]) &
+	(0x80 >> (i % 8)))
+      return 0;
+  return 1;
+}
+
+static inline u_int64_t low64(const struct in6_addr *addr)
+{
+  return ((u_int64_t)getULong(&addr->s6_addr[8]) << 32 |
+	  getULong(&addr->s6_addr[12]));
+}
+
+isc_result_t v6_pool_create(struct v6_subnet *subnet,
+			    const struct in6_addr *low,
+			    const struct in6_addr *high,
+			    enum v6_alloc_mode mode)
+{
+  struct v6_pool *pool;
+
+  if (!v6_subnet_contains(subnet, low) || !v6_subnet_contains(subnet, high) ||
+      memcmp(low, high, 8) || low64(low) > low64(high))
+    return ISC_R_INVALIDARG;
+
+  pool = (struct v6_pool *)safemalloc(sizeof *pool);
+  memset(pool, 0, sizeof *pool);
+  pool->subnet = subnet;
+  pool->low = *low;
+  pool->size = low64(high) - low64(low) + 1;
+  if (!pool->size)
+    pool->size--;		/* A whole /64; close enough. */
+  pool->mode = mode;
+
+  pool->next = subnet->pools;
+  subnet->pools = pool;
+  return ISC_R_SUCCESS;
+}
+
+/* The slot in a pool's taken table where the search for an offset
+ * starts.   The multiply spreads out runs of consecutive offsets, which
+ * sequential pools hand out.
+ */
+static inline u_int64_t v6_pool_slot(struct v6_pool *pool, u_int64_t offset)
+{
+  return (offset * 0x9e3779b97f4a7c15ULL) >> (64 - pool->taken_bits);
+}
+
+/* Return nonzero if the address at an offset in a pool is leased. */
+static int v6_pool_taken(struct v6_pool *pool, u_int64_t offset)
+{
+  u_int64_t mask, i;
+
+  if (!pool->taken)
+    return 0;
+  mask = ((u_int64_t)1 << pool->taken_bits) - 1;
+  for (i = v6_pool_slot(pool, offset); pool->taken[i]; i = (i + 1) & mask)
+    if (pool->taken[i] == offset + 1)
+      return 1;
+  return 0;
+}
+
+static void v6_pool_take(struct v6_pool *pool, u_int64_t offset)
+{
+  u_int64_t *old = pool->taken, mask, i, n;
+
+  /* Keep the table at most half full, doubling it as the pool fills. */
+  if (!old || (pool->used + 1) * 2 > (u_int64_t)1 << pool->taken_bits)
+    {
+      n = old ? (u_int64_t)1 << pool->taken_bits : 0;
+      pool->taken_bits = old ? pool->taken_bits + 1 : 6;
+      pool->taken = (u_int64_t *)safemalloc(sizeof *pool->taken
+					    << pool->taken_bits);
+      memset(pool->taken, 0, sizeof *pool->taken << pool->taken_bits);
+      mask = ((u_int64_t)1 << pool->taken_bits) - 1;
+      for (; n--; )
+	if (old[n])
+	  {
+	    for (i = v6_pool_slot(pool, old[n] - 1); pool->taken[i];
+		 i = (i + 1) & mask)
+	      ;
+	    pool->taken[i] = old[n];
+	  }
+      free(old);
+    }
+
+  mask = ((u_int64_t)1 << pool->taken_bits) - 1;
+  for (i = v6_pool_slot(pool, offset); pool->taken[i]; i = (i + 1) & mask)
+    ;
+  pool->taken[i] = offset + 1;
+}
+
+/* Take an offset out of a pool's taken table.   Entries after it in the
+ * same run move back to fill the hole where they can, so that lookups
+ * never stop short of them.
+ */
+static void v6_pool_release(struct v6_pool *pool, u_int64_t offset)
+{
+  u_int64_t mask = ((u_int64_t)1 << pool->taken_bits) - 1, i, j, home;
+
+  for (i = v6_pool_slot(pool, offset); pool->taken[i] != offset + 1;
+       i = (i + 1) & mask)
+    if (!pool->taken[i])
+      return;
+  pool->taken[i] = 0;
+  for (j = (i + 1) & mask; pool->taken[j]; j = (j + 1) & mask)
+    {
+      /* An entry can move to the hole if the hole is no further along
+	 than the entry from the slot it hashes to. */
+      home = v6_pool_slot(pool, pool->taken[j] - 1);
+      if (((j - home) & mask) >= ((j - i) & mask))
+	{
+	  pool->taken[i] = pool->taken[j];
+	  pool->taken[j] = 0;
+	  i = j;
+	}
+    }
+}
+
+static void v6_pool_address(struct v6_pool *pool, u_int64_t offset,
+			    struct in6_addr *addr)
+{
+  u_int64_t n = low64(&pool->low) + offset;
+
+  *addr = pool->low;
+  putULong(&addr->s6_addr[8], (u_int32_t)(n >> 32));
+  putULong(&addr->s6_addr[12], (u_int32_t)n);
+}
+
+#define ROTL64(x, b)	(((x) << (b)) | ((x) >> (64 - (b))))
+#define SIPROUND							\
+  do {									\
+    v0 += v1; v1 = ROTL64(v1, 13); v1 ^= v0; v0 = ROTL64(v0, 32);	\
+    v2 += v3; v3 = ROTL64(v3, 16); v3 ^= v2;				\
+    v0 += v3; v3 = ROTL64(v3, 21); v3 ^= v0;				\
+    v2 += v1; v1 = ROTL64(v1, 17); v1 ^= v2; v2 = ROTL64(v2, 32);	\
+  } while (0)
+
+static inline u_int64_t get_le64(const u_int8_t *p)
+{
+  u_int64_t n = 0;
+  int i;
+
+  for (i = 7; i >= 0; i--)
+    n = n << 8 | p[i];
+  return n;
+}
+
+/* SipHash-2-4, which is fast on short inputs and, given a secret key,
+ * can't be steered by clients choosing DUIDs that collide.
+ */
+static u_int64_t siphash24(const u_int8_t *key,
+			   const u_int8_t *data, unsigned len)
+{
+  u_int64_t k0 = get_le64(key), k1 = get_le64(key + 8);
+  u_int64_t v0 = k0 ^ 0x736f6d6570736575ULL;
+  u_int64_t v1 = k1 ^ 0x646f72616e646f6dULL;
+  u_int64_t v2 = k0 ^ 0x6c7967656e657261ULL;
+  u_int64_t v3 = k1 ^ 0x7465646279746573ULL;
+  u_int64_t b = (u_int64_t)len << 56, m;
+  unsigned i;
+
+  for (i = 0; i + 8 <= len; i += 8)
+    {
+      m = get_le64(data + i);
+      v3 ^= m;
+      SIPROUND;
+      SIPROUND;
+      v0 ^= m;
+    }
+  for (; i < len; i++)
+    b |= (u_int64_t)data[i] << (8 * (i % 8));
+  v3 ^= b;
+  SIPROUND;
+  SIPROUND;
+  v0 ^= b;
+  v2 ^= 0xff;
+  SIPROUND;
+  SIPROUND;
+  SIPROUND;
+  SIPROUND;
+  return v0 ^ v1 ^ v2 ^ v3;
+}
+
+/* Where a client's search for an address in a hashed pool starts: the
+ * hash of its DUID and IAID, which come in the key, and of the link.
+ */
+static u_int64_t v6_pool_hash(struct v6_pool *pool,
+			      const u_int8_t *key, unsigned len)
+{
+  u_int8_t buf[256];
+
+  if (len > sizeof buf - 17)
+    len = sizeof buf - 17;
+  memcpy(buf, key, len);
+  memcpy(&buf[len], &pool->subnet->prefix, 16);
+  buf[len + 16] = pool->subnet->prefixlen;
+  return siphash24(v6_hash_key, buf, len + 17) % pool->size;
+}
+
+static struct v6_lease *v6_lease_create(struct v6_pool *pool,
+					const struct in6_addr *addr,
+					const u_int8_t *key, unsigned len)
+{
+  struct v6_lease *lease;
+
+  lease = (struct v6_lease *)safemalloc(sizeof *lease);
+  memset(lease, 0, sizeof *lease);
+  lease->pool = pool;
+  lease->address = *addr;
+  lease->key = (u_int8_t *)safemalloc(len);
+  memcpy(lease->key, key, len);
+  lease->key_len = len;
+  v6_pool_take(pool, low64(addr) - low64(&pool->low));
+  pool->used++;
+
+  /* The hash tables keep the name pointers, which is why the lease has
+   * its own copies.
+   */
+  v6_lease_hash_add(leased_addresses, lease->address.s6_addr, 16, lease);
+  v6_lease_hash_add(client_addresses, lease->key, len, lease);
+  return lease;
+}
+
+/* Lease an address to a client from one of the subnet's pools.   The
+ * lease is on no list until the caller extends it.
+ */
+struct v6_lease *v6_lease_allocate(struct v6_subnet *subnet,
+				   const u_int8_t *key, unsigned len)
+{
+  struct v6_pool *pool;
+  struct in6_addr addr;
+  u_int64_t offset, n;
+
+  if (!leased_addresses)
+    {
+      v6_lease_new_hash(&leased_addresses, 0);
+      v6_lease_new_hash(&client_addresses, 0);
+    }
+
+  for (pool = subnet->pools; pool; pool = pool->next)
+    {
+      if (pool->used >= pool->size)
+	continue;
+      offset = (pool->mode == V6_ALLOC_HASH
+		? v6_pool_hash(pool, key, len) : pool->cursor);
+      for (n = 0; n < pool->size; n++)
+	{
+	  if (!v6_pool_taken(pool, offset))
+	    {
+	      v6_pool_address(pool, offset, &addr);
+	      pool->allocations++;
+	      pool->probes += n + 1;
+	      if (n)
+		pool->collisions++;
+	      if (pool->mode == V6_ALLOC_SEQUENTIAL)
+		pool->cursor = offset + 1 == pool->size ? 0 : offset + 1;
+	      return v6_lease_create(pool, &addr, key, len);
+	    }
+	  if (++offset == pool->size)
+	    offset = 0;
+	}
+    }
+  return 0;
+}
+
+struct v6_lease *v6_lease_find_client(const u_int8_t *key, unsigned len)
+{
+  struct v6_lease *lease;
+
+  if (!client_addresses || !len)
+    return 0;
+  if (!v6_lease_hash_lookup(&lease, client_addresses, key, len))
+    return 0;
+  return lease;
+}
+
+struct v6_lease *v6_lease_find_address(const struct in6_addr *addr)
+{
+  struct v6_lease *lease;
+
+  if (!leased_addresses)
+    return 0;
+  if (!v6_lease_hash_lookup(&lease, leased_addresses, addr->s6_addr, 16))
+    return 0;
+  return lease;
+}
+
+static void v6_lease_list_remove(struct v6_lease *lease)
+{
+  struct v6_lease_list *list = lease->list;
+  struct v6_lease_cursor *cursor;
+
+  if (!list)
+    return;
+  for (cursor = lease_cursors; cursor; cursor = cursor->next)
+    if (cursor->lease == lease)
+      cursor->lease = lease->next;
+  if (lease->prev)
+    lease->prev->next = lease->next;
+  else
+    list->head = lease->next;
+  if (lease->next)
+    lease->next->prev = lease->prev;
+  else
+    list->tail = lease->prev;
+  lease->prev = lease->next = 0;
+  lease->list = 0;
+}
+
+/* Bring the published copy of a lease up to date, if the bindings are
+ * being published.   A lease is a binding while it's on a bound list.
+ */
+static void v6_lease_publish(struct v6_lease *lease)
+{
+  struct lease_shm_record rec;
+  unsigned len;
+
+  if (!lease_shm)
+    return;
+  if (!lease->list || lease->list != &lease->pool->bound)
+    {
+      lease_shm_remove(lease_shm, LEASE_SHM_V6, lease->address.s6_addr);
+      return;
+    }
+
+  memset(&rec, 0, sizeof rec);
+  rec.kind = LEASE_SHM_V6;
+  rec.prefixlen = 128;
+  rec.expiry = lease->expiry / NANO_SECONDS(1);
+  memcpy(rec.address, &lease->address, 16);
+
+  /* The key is the DUID followed by the IAID. */
+  len = lease->key_len > 4 ? lease->key_len - 4 : 0;
+  if (len)
+    rec.iaid = getULong(&lease->key[len]);
+  rec.id_len = len < sizeof rec.id ? len : sizeof rec.id;
+  memcpy(rec.id, lease->key, rec.id_len);
+  rec.has_hw = lease_shm_duid_hw(rec.hw, lease->key, len);
+  lease_shm_put(lease_shm, &rec);
+}
+
+/* Extend an offer, or a binding for the subnet's lifetime, and move the
+ * lease to the end of the corresponding list.
+ */
+void v6_lease_extend(struct v6_lease *lease, int bound)
+{
+  struct v6_pool *pool = lease->pool;
+  struct v6_lease_list *list = bound ? &pool->bound : &pool->offered;
+
+  v6_lease_list_remove(lease);
+  lease->expiry = cur_time + NANO_SECONDS(bound ? pool->subnet->lifetime
+					  : V6_OFFER_HOLD_TIME);
+  lease->list = list;
+  lease->prev = list->tail;
+  if (list->tail)
+    list->tail->next = lease;
+  else
+    list->head = lease;
+  list->tail = lease;
+  v6_lease_publish(lease);
+}
+
+void v6_lease_free(struct v6_lease *lease)
+{
+  v6_lease_list_remove(lease);
+  v6_lease_publish(lease);
+  v6_lease_hash_delete(leased_addresses, lease->address.s6_addr, 16);
+  v6_lease_hash_delete(client_addresses, lease->key, lease->key_len);
+  v6_pool_release(lease->pool,
+		  low64(&lease->address) - low64(&lease->pool->low));
+  lease->pool->used--;
+  if (lease->relay)
+    v6_relay_id_put(lease->relay);
+  free(lease->key);
+  free(lease);
+}
+
+/* Free up to max leases that have run out by now.   Returns the number
+ * freed.
+ */
+unsigned v6_lease_reap(u_int64_t now, unsigned max)
+{
+  struct v6_subnet *subnet;
+  struct v6_pool *pool;
+  unsigned n = 0;
+
+  for (subnet = v6_subnets; subnet; subnet = subnet->next)
+    for (pool = subnet->pools; pool; pool = pool->next)
+      {
+	while (n < max && pool->offered.head &&
+	       pool->offered.head->expiry <= now)
+	  {
+	    v6_lease_free(pool->offered.head);
+	    n++;
+	  }
+	while (n < max && pool->bound.head && pool->bound.head->expiry <= now)
+	  {
+	    v6_lease_free(pool->bound.head);
+	    n++;
+	  }
+      }
+  return n;
+}
+
+/* Find the pool in a subnet that an address is in. */
+static struct v6_pool *v6_pool_find(struct v6_subnet *subnet,
+				    const struct in6_addr *addr)
+{
+  struct v6_pool *pool;
+
+  for (pool = subnet->pools; pool; pool = pool->next)
+    if (!memcmp(addr, &pool->low, 8) &&
+	low64(addr) - low64(&pool->low) < pool->size)
+      return pool;
+  return 0;
+}
+
+/* Put a lease on a list in expiry order.   Leases that were on the same
+ * list before arrive in order, so this rarely looks past the tail.
+ */
+static void v6_lease_list_insert(struct v6_lease_list *list,
+				 struct v6_lease *lease)
+{
+  struct v6_lease *after;
+
+  for (after = list->tail; after && after->expiry > lease->expiry;
+       after = after->prev)
+    ;
+  lease->list = list;
+  lease->prev = after;
+  lease->next = after ? after->next : list->head;
+  if (lease->next)
+    lease->next->prev = lease;
+  else
+    list->tail = lease;
+  if (after)
+    after->next = lease;
+  else
+    list->head = lease;
+  v6_lease_publish(lease);
+}
+
+/* Move the leases in subnets that are being replaced by a new
+ * configuration to whichever current pool has their addresses.   A lease
+ * on an address that isn't in a pool any more is dropped.   Returns the
+ * number dropped.
+ */
+unsigned v6_lease_migrate(struct v6_subnet *old)
+{
+  struct v6_pool *pool, *np;
+  struct v6_subnet *subnet;
+  struct v6_lease *lease;
+  struct v6_lease_list *list;
+  unsigned dropped = 0;
+  int bound;
+
+  for (; old; old = old->next)
+    for (pool = old->pools; pool; pool = pool->next)
+      for (bound = 0; bound < 2; bound++)
+	{
+	  list = bound ? &pool->bound : &pool->offered;
+	  while ((lease = list->head))
+	    {
+	      subnet = v6_subnet_find(&lease->address);
+	      np = subnet ? v6_pool_find(subnet, &lease->address) : 0;
+	      if (!np)
+		{
+		  v6_lease_free(lease);
+		  dropped++;
+		  continue;
+		}
+	      v6_lease_list_remove(lease);
+	      v6_pool_release(pool, low64(&lease->address) - low64(&pool->low));
+	      pool->used--;
+	      lease->pool = np;
+	      v6_pool_take(np, low64(&lease->address) - low64(&np->low));
+	      np->used++;
+	      v6_lease_list_insert(bound ? &np->bound : &np->offered, lease);
+	    }
+	}
+  return dropped;
+}
+
+/* Recreate a lease another process had, e.g., one that handed its state
+ * over to this one.   Leases restored in the order they were on their
+ * lists go on the ends of the new ones.   Returns 0 if the address isn't
+ * in a pool, or is leased already.
+ */
+struct v6_lease *v6_lease_restore(const struct in6_addr *addr,
+				  const u_int8_t *key, unsigned len,
+				  u_int64_t expiry, int bound)
+{
+  struct v6_subnet *subnet;
+  struct v6_pool *pool;
+  struct v6_lease *lease;
+
+  if (!leased_addresses)
+    {
+      v6_lease_new_hash(&leased_addresses, 0);
+      v6_lease_new_hash(&client_addresses, 0);
+    }
+
+  subnet = v6_subnet_find(addr);
+  pool = subnet ? v6_pool_find(subnet, addr) : 0;
+  if (!pool || v6_lease_hash_lookup(&lease, leased_addresses,
+				    addr->s6_addr, 16))
+    return 0;
+  lease = v6_lease_create(pool, addr, key, len);
+  lease->expiry = expiry;
+  v6_lease_list_insert(bound ? &pool->bound : &pool->offered, lease);
+  return lease;
+}
+
+/* Record the relay agent a client's messages came through, or that they
+ * came through none if len is 0.
+ */
+void v6_lease_set_relay(struct v6_lease *lease,
+			const u_int8_t *id, unsigned len)
+{
+  if (lease->relay && lease->relay->len == len &&
+      !memcmp(lease->relay->id, id, len))
+    return;
+  if (lease->relay)
+    v6_relay_id_put(lease->relay);
+  lease->relay = len ? v6_relay_id_get(id, len) : 0;
+}
+
+/* Find a relay identifier, or make one, and take a reference to it. */
+struct v6_relay_id *v6_relay_id_get(const u_int8_t *id, unsigned len)
+{
+  struct v6_relay_id *relay;
+
+  if (!relay_ids)
+    v6_relay_id_new_hash(&relay_ids, 0);
+  if (!v6_relay_id_hash_lookup(&relay, relay_ids, id, len))
+    {
+      relay = (struct v6_relay_id *)safemalloc(sizeof *relay + len);
+      relay->refs = 0;
+      relay->len = len;
+      memcpy(relay->id, id, len);
+      v6_relay_id_hash_add(relay_ids, relay->id, len, relay);
+    }
+  relay->refs++;
+  return relay;
+}
+
+void v6_relay_id_put(struct v6_relay_id *relay)
+{
+  if (--relay->refs)
+    return;
+  v6_relay_id_hash_delete(relay_ids, relay->id, relay->len);
+  free(relay);
+}
+
+/* Start a cursor at a lease, or at the end of a list if lease is 0. */
+void v6_lease_cursor_attach(struct v6_lease_cursor *cursor,
+			    struct v6_lease *lease)
+{
+  cursor->lease = lease;
+  cursor->next = lease_cursors;
+  lease_cursors = cursor;
+}
+
+void v6_lease_cursor_detach(struct v6_lease_cursor *cursor)
+{
+  struct v6_lease_cursor **cp;
+
+  for (cp = &lease_cursors; *cp; cp = &(*cp)->next)
+    if (*cp == cursor)
+      {
+	*cp = cursor->next;
+	break;
+      }
+  cursor->next = 0;
+  cursor->lease = 0;
+}
+
+/* Free subnets that are no longer in use, which must have no leases or
+ * delegations left in them.   Option states can share option caches, so
+ * they aren't freed.
+ */
+void v6_subnets_free(struct v6_subnet *subnets)
+{
+  struct v6_subnet *subnet;
+  struct v6_pool *pool;
+
+  while ((subnet = subnets))
+    {
+      subnets = subnet->next;
+      while ((pool = subnet->pools))
+	{
+	  subnet->pools = pool->next;
+	  free(pool->taken);
+	  free(pool);
+	}
+      pd_pools_free(subnet->pd_pools);
+      free(subnet);
+    }
+}
+
+/* When the next lease runs out, or 0 if none will. */
+u_int64_t v6_lease_next_expiry()
+{
+  struct v6_subnet *subnet;
+  struct v6_pool *pool;
+  u_int64_t next = 0;
+
+  for (subnet = v6_subnets; subnet; subnet = subnet->next)
+    for (pool = subnet->pools; pool; pool = pool->next)
+      {
+	if (pool->offered.head &&
+	    (!next || pool->offered.head->expiry < next))
+	  next = pool->offered.head->expiry;
+	if (pool->bound.head && (!next || pool->bound.head->expiry < next))
+	  next = pool->bound.head->expiry;
+      }
+  return next;
+}
+
+/* Local Variables:  */
+/* mode:C++ */
+/* c-file-style:"gnu" */
+/* end: */
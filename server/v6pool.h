@@ -0,0 +1,169 @@
+/* v6pool.h
+ *
+ * Definitions for DHCPv6 subnets.
+ */
+
+/* Copyright (c) 2009 Nominum, Inc.   All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Nominum nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NOMINUM AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL NOMINUM OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef DHCPP_V6POOL_H
+#define DHCPP_V6POOL_H
+
+/* How long an address offered in an Advertise is held for the client, in
+ * seconds.
+ */
+#define V6_OFFER_HOLD_TIME	60
+
+/* How a pool picks an address for a client.   A sequential pool hands
+ * out the next free address.   A hashed pool starts looking at an address
+ * chosen by a keyed hash of the client's DUID, IAID and link, so servers
+ * with the same key and pools agree on where a client goes without
+ * talking to each other, and a client that comes back finds its address
+ * on the first probe.   Either way, taken addresses are skipped by linear
+ * probing.
+ */
+enum v6_alloc_mode {
+  V6_ALLOC_SEQUENTIAL,
+  V6_ALLOC_HASH
+};
+
+/* Leases are kept on an offer list and a binding list per pool, in the
+ * order they were last extended, which is also expiry order.
+ */
+struct v6_lease_list {
+  struct v6_lease *head, *tail;
+};
+
+/* The DUID of the relay agent a client's messages came through, from
+ * the Relay-Id option the relay added, kept so that bulk leasequery can
+ * find everything behind a relay.   Leases behind the same relay share
+ * one.
+ */
+struct v6_relay_id {
+  unsigned refs;
+  unsigned len;
+  u_int8_t id[1];
+};
+
+struct v6_lease {
+  struct v6_lease *prev, *next;
+  struct v6_lease_list *list;		   /* List the lease is on. */
+  struct v6_pool *pool;
+  struct in6_addr address;
+  u_int64_t expiry;					     /* ns. */
+  u_int8_t *key;		   /* Client's DUID followed by IAID. */
+  unsigned key_len;
+  struct v6_relay_id *relay;			   /* Or 0 if none. */
+};
+
+/* A place on a lease list that stays good while leases come and go, for
+ * a walk that's spread over many trips through the dispatcher.   When the
+ * lease the cursor is on is taken off its list, the cursor moves on to
+ * the next one.
+ */
+struct v6_lease_cursor {
+  struct v6_lease_cursor *next;
+  struct v6_lease *lease;		/* The next lease to visit. */
+};
+
+/* A range of addresses that differ only in the low 64 bits. */
+struct v6_pool {
+  struct v6_pool *next;
+  struct v6_subnet *subnet;
+  struct in6_addr low;
+  u_int64_t size;				/* Number of addresses. */
+  u_int64_t used;
+  u_int64_t cursor;	     /* Where a sequential pool looks next. */
+  enum v6_alloc_mode mode;
+  struct v6_lease_list offered, bound;
+
+  /* The offsets of the leased addresses, in an open-addressed table
+   * that's kept no more than half full, so that probing for a free
+   * address doesn't touch the leases.   A slot holds an offset plus one,
+   * or 0 if it's empty.
+   */
+  u_int64_t *taken;
+  unsigned taken_bits;		/* The table has 2^taken_bits slots. */
+
+  /* Allocation statistics. */
+  u_int64_t allocations;
+  u_int64_t collisions;		/* Allocations whose first probe failed. */
+  u_int64_t probes;
+};
+
+struct v6_subnet {
+  struct v6_subnet *next;
+  struct in6_addr prefix;
+  int prefixlen;
+  struct option_state *options;	     /* Options configured for the subnet. */
+  struct v6_pool *pools;
+  u_int32_t lifetime;		     /* Of an address, in seconds. */
+  struct pd_pool *pd_pools;	      /* Prefixes to delegate on the link. */
+  u_int32_t pd_lifetime;		/* Of a delegation, in seconds. */
+};
+
+extern struct v6_subnet *v6_subnets;
+extern struct ptrie *v6_subnet_index;
+extern u_int8_t v6_hash_key[16];
+
+struct v6_subnet *v6_subnet_create(const struct in6_addr *prefix,
+				   int prefixlen);
+struct v6_subnet *v6_subnet_find(const struct in6_addr *addr);
+void v6_subnet_index_rebuild(void);
+
+isc_result_t v6_pool_create(struct v6_subnet *subnet,
+			    const struct in6_addr *low,
+			    const struct in6_addr *high,
+			    enum v6_alloc_mode mode);
+struct v6_lease *v6_lease_allocate(struct v6_subnet *subnet,
+				   const u_int8_t *key, unsigned len);
+struct v6_lease *v6_lease_find_client(const u_int8_t *key, unsigned len);
+struct v6_lease *v6_lease_find_address(const struct in6_addr *addr);
+void v6_lease_extend(struct v6_lease *lease, int bound);
+void v6_lease_free(struct v6_lease *lease);
+unsigned v6_lease_reap(u_int64_t now, unsigned max);
+u_int64_t v6_lease_next_expiry(void);
+unsigned v6_lease_migrate(struct v6_subnet *old);
+struct v6_lease *v6_lease_restore(const struct in6_addr *addr,
+				  const u_int8_t *key, unsigned len,
+				  u_int64_t expiry, int bound);
+void v6_lease_set_relay(struct v6_lease *lease,
+			const u_int8_t *id, unsigned len);
+struct v6_relay_id *v6_relay_id_get(const u_int8_t *id, unsigned len);
+void v6_relay_id_put(struct v6_relay_id *relay);
+void v6_lease_cursor_attach(struct v6_lease_cursor *cursor,
+			    struct v6_lease *lease);
+void v6_lease_cursor_detach(struct v6_lease_cursor *cursor);
+void v6_subnets_free(struct v6_subnet *subnets);
+
+#endif
+
+/* Local Variables:  */
+/* mode:c++ */
+/* c-file-style:"gnu" */
+/* end: */
@@ -39,6 +39,12 @@ static char ocopyright[] __attribute__((unused)) =
 
 #include "dhcpd.h"
 #include "server/v6server.h"
+#include "server/reservation.h"
+#include "server/classify.h"
+#include "server/pdpool.h"
+#include "server/config.h"
+#include "server/leasesync.h"
+#include "server/reconfigure.h"
 
 /* Existing client contexts... */
 struct dhcpv6_client_context *DHCPv6Server::client_contexts;
@@ -54,49 +60,299 @@ DHCPv6Server::DHCPv6Server(struct interface_info *ip, duid_t *duid)
 {
   interface = ip;
   server_duid = duid;
+  configure();
+}
+
+/* Clients that aren't relayed are on whatever subnet one of the
+ * interface's global addresses is on.
+ */
+void DHCPv6Server::configure()
+{
+  int i;
+
+  generation = config_generation;
+  local_subnet = 0;
+  for (i = 0; i < interface->ipv6_addr_count && !local_subnet; i++)
+    {
+      if (!IN6_IS_ADDR_LINKLOCAL(&interface->ipv6s[i]))
+	local_subnet = v6_subnet_find(&interface->ipv6s[i]);
+    }
+}
+
+/* The server is the only listener on its interfaces, so every message
+ * is ours.
+ */
+bool DHCPv6Server::mine(struct dhcpv6_response *rsp)
+{
+  return true;
 }
 
 /* Below are the set of virtual functions for the DHCPv6Listener
  * object that we actually implement - those that a server needs to
  * implement.  Because the client we're testing doesn't currently
- * do release or decline, the server doesn't have hooks for them
- * either.
+ * do decline, the server doesn't have a hook for it either; Release
+ * is only handled so that delegated prefixes can be given back.
  */
 
-void DHCPv6Server::information_request(struct sockaddr_in6 *from,
-				       unsigned char *contents, ssize_t length)
+void DHCPv6Server::information_request(dhcpv6_response *response,
+				       struct sockaddr_in6 *from,
+				       const unsigned char *contents,
+				       unsigned length)
 {
-  confreq(from, contents, length, "DHCP Information Request");
+  confreq(response, from, "DHCP Information Request");
 }
 
-void DHCPv6Server::solicit(struct sockaddr_in6 *from,
-			   unsigned char *contents, ssize_t length)
+void DHCPv6Server::solicit(dhcpv6_response *response,
+			   struct sockaddr_in6 *from,
+			   const unsigned char *contents, unsigned length)
 {
-  confreq(from, contents, length, "DHCP Solicit");
+  confreq(response, from, "DHCP Solicit");
 }
 
-void DHCPv6Server::request(struct sockaddr_in6 *from,
-			   unsigned char *contents, ssize_t length)
+void DHCPv6Server::request(dhcpv6_response *response,
+			   struct sockaddr_in6 *from,
+			   const unsigned char *contents, unsigned length)
 {
-  confreq(from, contents, length, "DHCP Request");
+  confreq(response, from, "DHCP Request");
 }
 
-void DHCPv6Server::renew(struct sockaddr_in6 *from,
-			   unsigned char *contents, ssize_t length)
+void DHCPv6Server::renew(dhcpv6_response *response,
+			 struct sockaddr_in6 *from,
+			 const unsigned char *contents, unsigned length)
 {
-  confreq(from, contents, length, "DHCP Renew");
+  confreq(response, from, "DHCP Renew");
 }
 
-void DHCPv6Server::rebind(struct sockaddr_in6 *from,
-			   unsigned char *contents, ssize_t length)
+void DHCPv6Server::rebind(dhcpv6_response *response,
+			  struct sockaddr_in6 *from,
+			  const unsigned char *contents, unsigned length)
 {
-  confreq(from, contents, length, "DHCP Rebind");
+  confreq(response, from, "DHCP Rebind");
+}
+
+void DHCPv6Server::confirm(dhcpv6_response *response,
+			   struct sockaddr_in6 *from,
+			   const unsigned char *contents, unsigned length)
+{
+  confreq(response, from, "DHCP Confirm");
+}
+
+void DHCPv6Server::release(dhcpv6_response *response,
+			   struct sockaddr_in6 *from,
+			   const unsigned char *contents, unsigned length)
+{
+  confreq(response, from, "DHCP Release");
+}
+
+/* Figure out which subnet a message came from.   If it was relayed, the
+ * link-address of the relay agent closest to the client says which link
+ * the client is on; a relay agent that couldn't tell sets it to zero, in
+ * which case the next relay agent out gets to say.   If it wasn't relayed,
+ * the client is on the link the message arrived on.
+ */
+struct v6_subnet *DHCPv6Server::select_subnet(struct dhcpv6_response *msg)
+{
+  struct dhcpv6_response *relay;
+
+  for (relay = msg->outer; relay; relay = relay->outer)
+    {
+      if (!IN6_IS_ADDR_UNSPECIFIED(&relay->link_address))
+	return v6_subnet_find(&relay->link_address);
+    }
+  if (msg->outer)
+    return 0;
+  if (generation != config_generation)
+    configure();
+  return local_subnet;
+}
+
+/* Leases and delegations are keyed on the client's DUID followed by the
+ * IAID.   Returns the length of the key, or 0 if it doesn't fit.
+ */
+static unsigned ia_key(u_int8_t *key, unsigned max,
+		       const struct data_string *duid, struct ia *ia)
+{
+  if (duid->len + 4 > max)
+    return 0;
+  memcpy(key, duid->data, duid->len);
+  putULong(&key[duid->len], ia->id);
+  return duid->len + 4;
+}
+
+/* The Relay-Id option the relay agent nearest the client added, if it
+ * added one.
+ */
+static const u_int8_t *relay_id(struct dhcpv6_response *msg, unsigned *len)
+{
+  struct option_cache *oc;
+
+  *len = 0;
+  if (!msg->outer ||
+      !(oc = lookup_option(&dhcpv6_option_space, msg->outer->options,
+			   DHCPV6_RELAY_ID)))
+    return 0;
+  *len = oc->data.len;
+  return oc->data.data;
+}
+
+/* Lease an address for an IA_NA from the subnet's pools.   A client that
+ * already has one gets the same one back.
+ */
+void DHCPv6Server::assign_address(struct dhcpv6_response *msg,
+				  struct ia *ia, struct v6_subnet *subnet,
+				  const struct data_string *duid)
+{
+  u_int8_t key[132];			/* Longest DUID, plus the IAID. */
+  unsigned keylen, idlen;
+  struct v6_lease *lease;
+  struct ia_addr *addr;
+  const u_int8_t *id;
+
+  ia->addresses = 0;
+  if (!(keylen = ia_key(key, sizeof key, duid, ia)))
+    return;
+
+  lease = v6_lease_find_client(key, keylen);
+  if (lease && (lease->pool->subnet != subnet ||
+		msg->message_type == DHCPV6_RELEASE))
+    {
+      lease_sync_v6(lease, 1);
+      v6_lease_free(lease);
+      lease = 0;
+    }
+  if (msg->message_type == DHCPV6_RELEASE)
+    return;
+
+  if (!lease)
+    lease = v6_lease_allocate(subnet, key, keylen);
+  if (!lease)
+    {
+      log_info("IA_NA %x: no addresses available.", ia->id);
+      return;
+    }
+  v6_lease_extend(lease, msg->message_type != DHCPV6_SOLICIT);
+  if (msg->message_type != DHCPV6_SOLICIT)
+    {
+      id = relay_id(msg, &idlen);
+      v6_lease_set_relay(lease, id, idlen);
+      lease_sync_v6(lease, 0);
+    }
+
+  addr = (struct ia_addr *)safemalloc(sizeof *addr);
+  memcpy(addr->address.iabuf, &lease->address, 16);
+  addr->address.len = 16;
+  addr->preferred = cur_time + subnet->lifetime;
+  addr->valid = cur_time + subnet->lifetime;
+  addr->ia = ia;
+  ia->addresses = addr;
+  ia->t1 = subnet->lifetime / 2;
+  ia->t2 = subnet->lifetime / 5 * 4;
+}
+
+/* Delegate a prefix for an IA_PD.   A client that already has one gets
+ * the same one back; otherwise it gets the prefix it asked for if that's
+ * free, or a new one of the length it hinted at.   A Solicit only gets
+ * the prefix held for it for a little while; asking for it commits it.
+ */
+void DHCPv6Server::delegate_prefix(struct dhcpv6_response *msg,
+				   struct ia *ia, struct v6_subnet *subnet,
+				   const struct data_string *duid)
+{
+  u_int8_t key[132];			/* Longest DUID, plus the IAID. */
+  unsigned keylen, idlen;
+  struct ia_addr *hint = ia->addresses, *addr;
+  struct pd_lease *lease;
+  struct in6_addr prefix;
+  const u_int8_t *id;
+
+  ia->addresses = 0;
+  if (!subnet || !(keylen = ia_key(key, sizeof key, duid, ia)))
+    return;
+
+  lease = pd_lease_find(key, keylen);
+  if (lease && (lease->pool->subnet != subnet ||
+		msg->message_type == DHCPV6_RELEASE))
+    {
+      lease_sync_pd(lease, 1);
+      pd_lease_free(lease);
+      lease = 0;
+    }
+  if (msg->message_type == DHCPV6_RELEASE)
+    return;
+
+  if (!lease && hint)
+    {
+      memcpy(&prefix, hint->address.iabuf, 16);
+      if (!IN6_IS_ADDR_UNSPECIFIED(&prefix))
+	lease = pd_lease_claim(subnet, &prefix, hint->prefixlen, key, keylen);
+    }
+  if (!lease)
+    lease = pd_lease_allocate(subnet, hint ? hint->prefixlen : 0,
+			      key, keylen);
+  if (!lease)
+    {
+      log_info("IA_PD %x: no prefixes available.", ia->id);
+      return;
+    }
+  pd_lease_extend(lease, msg->message_type != DHCPV6_SOLICIT);
+  if (msg->message_type != DHCPV6_SOLICIT)
+    {
+      id = relay_id(msg, &idlen);
+      pd_lease_set_relay(lease, id, idlen);
+      lease_sync_pd(lease, 0);
+    }
+
+  addr = (struct ia_addr *)safemalloc(sizeof *addr);
+  memcpy(addr->address.iabuf, &lease->node->prefix, 16);
+  addr->address.len = 16;
+  addr->prefixlen = lease->node->prefixlen;
+  addr->preferred = cur_time + subnet->pd_lifetime;
+  addr->valid = cur_time + subnet->pd_lifetime;
+  addr->ia = ia;
+  ia->addresses = addr;
+  ia->t1 = subnet->pd_lifetime / 2;
+  ia->t2 = subnet->pd_lifetime / 5 * 4;
 }
 
-void DHCPv6Server::confirm(struct sockaddr_in6 *from,
-			   unsigned char *contents, ssize_t length)
+/* Wrap a reply in a Relay-Reply message for each relay agent the request
+ * came through, innermost first, so that the result can be sent to the
+ * relay agent that sent us the request.   Each Relay-Reply carries the
+ * same hop count, link-address and peer-address as the corresponding
+ * Relay-Forward, and echoes its Interface-Id option if it had one.
+ */
+void DHCPv6Server::relay_wrap(struct data_string *packet,
+			      struct dhcpv6_response *msg)
 {
-  confreq(from, contents, length, "DHCP Confirm");
+  struct dhcpv6_response *relay;
+  struct option_state *relay_options;
+  struct option_cache *oc;
+  struct data_string wrapped;
+
+  for (relay = msg->outer; relay; relay = relay->outer)
+    {
+      relay_options = new_option_state();
+      oc = lookup_option(&dhcpv6_option_space, relay->options,
+			 DHCPV6_INTERFACE_IDENTIFIER);
+      if (oc)
+	save_option(&dhcpv6_option_space, relay_options, oc);
+      oc = make_const_option_cache((struct buffer **)0,
+				   packet->data, packet->len,
+				   find_option(&dhcpv6_option_space,
+					       DHCPV6_RELAY_MESSAGE));
+      save_option(&dhcpv6_option_space, relay_options, oc);
+
+      memset(&wrapped, 0, sizeof wrapped);
+      wrapped.buffer = buffer_allocate(packet->len + 100);
+      wrapped.data = wrapped.buffer->data;
+      wrapped.buffer->data[0] = DHCPV6_RELAY_REPLY;
+      wrapped.buffer->data[1] = relay->hop_count;
+      memcpy(&wrapped.buffer->data[2], &relay->link_address, 16);
+      memcpy(&wrapped.buffer->data[18], &relay->peer_address, 16);
+      wrapped.len = 34;
+      if (!option_space_encapsulate(&wrapped, relay_options, &dhcpv6))
+	log_fatal("couldn't encapsulate relay reply");
+      *packet = wrapped;
+    }
 }
 
 /* Handle a configuration request from a client.   This actually handles
@@ -104,34 +360,52 @@ void DHCPv6Server::confirm(struct sockaddr_in6 *from,
  * extremely limited way.
  */
 
-void DHCPv6Server::confreq(struct sockaddr_in6 *from,
-			   unsigned char *inpacket,
-			   ssize_t len, const char *name)
+void DHCPv6Server::confreq(struct dhcpv6_response *msg,
+			   struct sockaddr_in6 *from, const char *name)
 {
   struct option_cache *oc;
-  struct option_cache *ias = 0;
+  struct option_cache *ias = 0, *pds = 0;
   struct data_string packet;
   ssize_t result;
   struct sockaddr_in6 dest;
   char msgbuf[128];
-  char addrbuf[128];
+  char addrbuf[INET6_ADDRSTRLEN];
   struct ia *ia;
-  struct dhcpv6_response *msg;
   struct dhcpv6_client_context *ctx;
+  struct v6_subnet *subnet;
+  const struct reservation *rsv;
+  const u_int8_t *ro;
+  unsigned ix;
   int i;
   const char *respname;
-  struct option_state *send_options = new_option_state();
+  struct option_state *send_options;
   unsigned char *s;
+  struct data_string *client_duid;
+  struct reconfigure_client *rc;
+  u_int64_t classes;
+
+  /* A standby leaves the clients to the primary. */
+  if (lease_sync_standby)
+    return;
 
   /* Make the message to log. */
   inet_ntop(AF_INET6, &from->sin6_addr, addrbuf, sizeof addrbuf);
   snprintf(msgbuf, sizeof msgbuf, "%s from %s/%d on %s",
 	   name, addrbuf, ntohs(from->sin6_port), interface->name);
 
-  /* Decode the response.    If it's bogus, drop it right away. */
-  msg = decode_dhcpv6_packet((unsigned char *)inpacket, len, name);
-  if (!msg)
-    return;
+  /* If subnets have been configured, we only answer clients on them. */
+  subnet = select_subnet(msg);
+  if (!subnet && v6_subnets)
+    {
+      log_info("%s: no subnet for this link.", msgbuf);
+      return;
+    }
+
+  /* The reply's options are a layer on top of the subnet's, so that we
+   * don't have to copy the subnet's options for every reply.
+   */
+  send_options = subnet ? new_layered_option_state(subnet->options)
+    : new_option_state();
 
   /* Get the DUID option. */
   oc = lookup_option(&dhcpv6_option_space, msg->options, DHCPV6_DUID);
@@ -143,6 +417,35 @@ void DHCPv6Server::confreq(struct sockaddr_in6 *from,
 
   /* Copy the client's DUID into the response. */
   save_option(&dhcpv6_option_space, send_options, oc);
+  client_duid = &oc->data;
+
+  /* Hearing from a client that was sent a Reconfigure is its answer. */
+  if (reconfigurer &&
+      (msg->message_type == DHCPV6_RENEW ||
+       msg->message_type == DHCPV6_REBIND ||
+       msg->message_type == DHCPV6_REQUEST ||
+       msg->message_type == DHCPV6_INFORMATION_REQUEST))
+    reconfigurer->heard(client_duid);
+
+  rsv = reservation_find(reservations, RESERVATION_DUID,
+			 oc->data.data, oc->data.len);
+
+  /* Options from a reservation go in the packet as they are, so mask any
+   * the subnet would have supplied.
+   */
+  if (rsv)
+    {
+      ro = RESERVATION_OPTIONS(rsv);
+      for (ix = 0; ix + 4 <= rsv->options_len;
+	   ix += 4 + getUShort(&ro[ix + 2]))
+	delete_option(&dhcpv6_option_space, send_options, getUShort(&ro[ix]));
+    }
+
+  /* Then the options for the client's classes, which take precedence
+   * over the subnet's but not over a reservation's.
+   */
+  classes = classify_v6(classifier, msg);
+  classify_add_options(send_options, classes, 1);
 
   /* See if there's a client context for this message; if there isn't,
    * make one.
@@ -166,7 +469,7 @@ void DHCPv6Server::confreq(struct sockaddr_in6 *from,
   /* If there are no IAs, this had better be an Information Request
    * message.
    */
-  if (!msg->ias && inpacket[0] != DHCPV6_INFORMATION_REQUEST)
+  if (!msg->ias && msg->message_type != DHCPV6_INFORMATION_REQUEST)
     {
       log_info("%s: we weren't asked to configure anything.", msgbuf);
       return;
@@ -174,7 +477,8 @@ void DHCPv6Server::confreq(struct sockaddr_in6 *from,
 	
   /* Very simple configuration - give it two IP addresses.   One will be
    * valid and preferred; the other will be deprecated, meaning valid but
-   * not preferred.
+   * not preferred.   The addresses are on the client's subnet if we have
+   * one for it.
    */
   i = 0;
   for (ia = msg->ias; ia; ia = ia->next)
@@ -182,19 +486,48 @@ void DHCPv6Server::confreq(struct sockaddr_in6 *from,
       struct ia_addr *addr;
       int j;
 
+      if (ia->type == DHCPV6_IA_PD)
+	{
+	  delegate_prefix(msg, ia, subnet, &oc->data);
+	  continue;
+	}
+      if (subnet && subnet->pools && !(rsv && rsv->address_len == 16))
+	{
+	  assign_address(msg, ia, subnet, &oc->data);
+	  continue;
+	}
       ia->addresses = 0;
+      if (msg->message_type == DHCPV6_RELEASE)
+	continue;
+
+      /* A client with a reserved address just gets that. */
+      if (rsv && rsv->address_len == 16)
+	{
+	  addr = (struct ia_addr *)
+	    safemalloc(sizeof *ia->addresses);
+	  memcpy(addr->address.iabuf, RESERVATION_ADDRESS(rsv), 16);
+	  addr->preferred = cur_time + 100;
+	  addr->valid = cur_time + 100;
+	  ia->addresses = addr;
+	  continue;
+	}
       for (j = 2; j < 4; j++)
 	{
 	  addr = (struct ia_addr *)
 	    safemalloc(sizeof *ia->addresses);
-	  addr->address.iabuf[0] = 0x20;
-	  addr->address.iabuf[1] = 0x01;
-	  addr->address.iabuf[2] = 0x04;
-	  addr->address.iabuf[3] = 0xf8;
-	  addr->address.iabuf[4] = 0x03;
-	  addr->address.iabuf[5] = 0xba;
-	  addr->address.iabuf[6] = j;
-	  addr->address.iabuf[7] = 0x30;
+	  if (subnet)
+	    memcpy(addr->address.iabuf, &subnet->prefix, 8);
+	  else
+	    {
+	      addr->address.iabuf[0] = 0x20;
+	      addr->address.iabuf[1] = 0x01;
+	      addr->address.iabuf[2] = 0x04;
+	      addr->address.iabuf[3] = 0xf8;
+	      addr->address.iabuf[4] = 0x03;
+	      addr->address.iabuf[5] = 0xba;
+	      addr->address.iabuf[6] = j;
+	      addr->address.iabuf[7] = 0x30;
+	    }
 	  addr->address.iabuf[8] = 0x48;
 	  addr->address.iabuf[9] = 0xff;
 	  addr->address.iabuf[10] = 0xfe;
@@ -217,6 +550,7 @@ void DHCPv6Server::confreq(struct sockaddr_in6 *from,
 	  addr->next = ia->addresses;
 	  ia->addresses = addr;
 	}
+      i++;
     }
 
   /* Make IA options... */
@@ -225,16 +559,27 @@ void DHCPv6Server::confreq(struct sockaddr_in6 *from,
       oc = (struct option_cache *)safemalloc(sizeof *oc);
       memset(oc, 0, sizeof *oc);
       make_ia_option(&oc->data, ia, 0);
-      oc->option = find_option(&dhcpv6_option_space, DHCPV6_IA_NA);
 
-      /* Make a linked list of IA options, and when we've made the
-       * last IA option, stash it in client->send_options.
+      /* Make a linked list of IA options of each type, and when we've
+       * made the last IA option, stash them in client->send_options.
        */
-      oc->next = ias;
-      ias = oc;
+      if (ia->type == DHCPV6_IA_PD)
+	{
+	  oc->option = find_option(&dhcpv6_option_space, DHCPV6_IA_PD);
+	  oc->next = pds;
+	  pds = oc;
+	}
+      else
+	{
+	  oc->option = find_option(&dhcpv6_option_space, DHCPV6_IA_NA);
+	  oc->next = ias;
+	  ias = oc;
+	}
     }
   if (ias)
     save_option(&dhcpv6_option_space, send_options, ias);
+  if (pds)
+    save_option(&dhcpv6_option_space, send_options, pds);
 
   /* Make the server DUID option. */
   oc = (struct option_cache *)safemalloc(sizeof *oc);
@@ -245,36 +590,50 @@ void DHCPv6Server::confreq(struct sockaddr_in6 *from,
   oc->data.len = server_duid->len;
   save_option(&dhcpv6_option_space, send_options, oc);
 
-  /* Make a DNS server option. */
-  oc = (struct option_cache *)safemalloc(sizeof *oc);
-  memset(oc, 0, sizeof *oc);
-  oc->option = find_option(&dhcpv6_option_space,
-			   DHCPV6_DOMAIN_NAME_SERVERS);
-  oc->data.data = s = (unsigned char *)safemalloc(16);
-  oc->data.len = 16;
-  s[0] = 0x20;
-  s[1] = 0x01;
-  s[2] = 0x04;
-  s[3] = 0xf8;
-  s[4] = 0x03;
-  s[5] = 0xba;
-  s[6] = 0x02;
-  s[7] = 0x30;
-  s[8] = 0x48;
-  s[9] = 0xff;
-  s[10] = 0xfe;
-  s[11] = 0x41;
-  putUShort(&s[12], 65534);
+  /* Without a subnet, there's nothing configured to send, so make up a
+   * DNS server option.
+   */
+  if (!subnet)
+    {
+      oc = (struct option_cache *)safemalloc(sizeof *oc);
+      memset(oc, 0, sizeof *oc);
+      oc->option = find_option(&dhcpv6_option_space,
+			       DHCPV6_DOMAIN_NAME_SERVERS);
+      oc->data.data = s = (unsigned char *)safemalloc(16);
+      oc->data.len = 16;
+      s[0] = 0x20;
+      s[1] = 0x01;
+      s[2] = 0x04;
+      s[3] = 0xf8;
+      s[4] = 0x03;
+      s[5] = 0xba;
+      s[6] = 0x02;
+      s[7] = 0x30;
+      s[8] = 0x48;
+      s[9] = 0xff;
+      s[10] = 0xfe;
+      s[11] = 0x41;
+      putUShort(&s[12], 65534);
 	
-  save_option(&dhcpv6_option_space, send_options, oc);
+      save_option(&dhcpv6_option_space, send_options, oc);
+    }
 
+  /* Replies to relayed messages go back to the relay agent that sent
+   * them to us, on the server port.
+   */
   dest.sin6_family = AF_INET6;
-  dest.sin6_port = remote_port_dhcpv6;
+  dest.sin6_port = msg->outer ? local_port_dhcpv6 : remote_port_dhcpv6;
 #ifdef HAVE_SA_LEN
   dest.sin6_len = sizeof dest;
 #endif
   memcpy(&dest.sin6_addr, &from->sin6_addr, 16);
 
+  /* A client that will take Reconfigures is remembered, so that it can
+   * be sent them.
+   */
+  rc = reconfigurer ? reconfigurer->reply(msg, interface, &dest, client_duid,
+					  subnet, classes) : 0;
+
   /* Start out with a 200 byte buffer; the option encapsulation code
    * will expand it as needed.
    */
@@ -291,7 +650,7 @@ void DHCPv6Server::confreq(struct sockaddr_in6 *from,
    * number, and then overwrite the MSB with the type code.
    */
   putULong(packet.buffer->data, msg->xid);
-  if (inpacket[0] == DHCPV6_SOLICIT)
+  if (msg->message_type == DHCPV6_SOLICIT)
     {
       respname = "DHCP Advertise";
       packet.buffer->data[0] = DHCPV6_ADVERTISE;
@@ -311,6 +670,18 @@ void DHCPv6Server::confreq(struct sockaddr_in6 *from,
       log_fatal ("%s: couldn't encapsulate", msgbuf);
     }
 
+  /* The reservation's options are already in wire format. */
+  if (rsv && rsv->options_len)
+    {
+      data_string_need(&packet, rsv->options_len);
+      memcpy(&packet.buffer->data[packet.len],
+	     RESERVATION_OPTIONS(rsv), rsv->options_len);
+      packet.len += rsv->options_len;
+    }
+  if (rc)
+    reconfigurer->add_options(&packet, rc);
+  relay_wrap(&packet, msg);
+
   inet_ntop(AF_INET6, &dest.sin6_addr, addrbuf, sizeof addrbuf);
   log_info("%s: sending %s to %s port %d",
 	   msgbuf, respname, addrbuf, ntohs(dest.sin6_port));
@@ -35,33 +35,48 @@
 #define DHCPP_V6SERVER_H
 
 #include "dhc++/v6listener.h"
+#include "server/v6pool.h"
 
 class DHCPv6Server: public DHCPv6Listener
 {
 public:
   DHCPv6Server(struct interface_info *ip, duid_t *duid);
+  bool mine(struct dhcpv6_response *rsp);
 
 protected:
-  void information_request(struct sockaddr_in6 *from,
-			   unsigned char *contents, ssize_t length);
-  void solicit(struct sockaddr_in6 *from,
-	       unsigned char *contents, ssize_t length);
-  void request(struct sockaddr_in6 *from,
-	       unsigned char *contents, ssize_t length);
-  void renew(struct sockaddr_in6 *from,
-	     unsigned char *contents, ssize_t length);
-  void rebind(struct sockaddr_in6 *from,
-	      unsigned char *contents, ssize_t length);
-  void confirm(struct sockaddr_in6 *from,
-	       unsigned char *contents, ssize_t length);
+  void information_request(dhcpv6_response *response,
+			   struct sockaddr_in6 *from,
+			   const unsigned char *contents, unsigned length);
+  void solicit(dhcpv6_response *response, struct sockaddr_in6 *from,
+	       const unsigned char *contents, unsigned length);
+  void request(dhcpv6_response *response, struct sockaddr_in6 *from,
+	       const unsigned char *contents, unsigned length);
+  void renew(dhcpv6_response *response, struct sockaddr_in6 *from,
+	     const unsigned char *contents, unsigned length);
+  void rebind(dhcpv6_response *response, struct sockaddr_in6 *from,
+	      const unsigned char *contents, unsigned length);
+  void confirm(dhcpv6_response *response, struct sockaddr_in6 *from,
+	       const unsigned char *contents, unsigned length);
+  void release(dhcpv6_response *response, struct sockaddr_in6 *from,
+	       const unsigned char *contents, unsigned length);
 private:
   static struct dhcpv6_client_context *client_contexts;
   struct interface_info *interface;
   duid_t *server_duid;
+  struct v6_subnet *local_subnet;    /* Subnet the interface is attached to. */
+  unsigned generation;		   /* Of the configuration cached here. */
 
-  void confreq(struct sockaddr_in6 *from,
-	       unsigned char *inpacket,
-	       ssize_t len, const char *name);
+  void configure(void);
+  struct v6_subnet *select_subnet(struct dhcpv6_response *msg);
+  void confreq(struct dhcpv6_response *msg, struct sockaddr_in6 *from,
+	       const char *name);
+  void relay_wrap(struct data_string *packet, struct dhcpv6_response *msg);
+  void assign_address(struct dhcpv6_response *msg, struct ia *ia,
+		      struct v6_subnet *subnet,
+		      const struct data_string *duid);
+  void delegate_prefix(struct dhcpv6_response *msg, struct ia *ia,
+		       struct v6_subnet *subnet,
+		       const struct data_string *duid);
 };
 
 #endif
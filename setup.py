@@ -18,6 +18,7 @@ setup(name="dhcp", version="0.1",
                               "common/hash.cpp",
                               "common/ifaddrs.cpp",
                               "common/inet.cpp",
+                              "common/leaseshm.cpp",
                               "common/bpf.cpp",
                               "common/lpf.cpp",
                               "common/options.cpp",
@@ -37,6 +38,7 @@ setup(name="dhcp", version="0.1",
                               "python/pyv6client.cpp",
                               "python/pyv4client.cpp",
                               "python/pyoptions.cpp",
+                              "python/pyleases.cpp",
                               "python/pymod.cpp"],
                              include_dirs=include_dirs,
 			     extra_compile_args=["-g", "-O0"])])